@@ -0,0 +1,748 @@
+// syscall, mmap and the io_uring structures
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "headers/async_io.h"
+#include "headers/trace.h"
+
+// the kernel headers have io_uring with opening, sizing and closing files (Linux 5.6) and the
+// system calls to reach it
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register) && \
+    defined(IORING_FEAT_CUR_PERSONALITY)
+#define JPG_HAVE_IO_URING 1
+#endif
+
+// states of a request
+#define IO_FREE 0
+#define IO_QUEUED 1 // waiting for a worker thread
+#define IO_RUNNING 2 // with a worker thread or the kernel
+#define IO_DONE 3
+
+// steps of a request on io_uring, each one an entry of the ring
+#define IO_STEP_OPEN 0
+#define IO_STEP_STAT 1 // reads only
+#define IO_STEP_DATA 2 // as many reads or writes as it takes
+#define IO_STEP_CLOSE 3
+#define IO_STEP_DONE 4
+
+typedef struct _io_request{
+	int state;
+	int kind;
+	int tag;
+	const char *filename;
+	int fd;
+	unsigned char *data;
+	size_t size;
+	size_t done; // bytes read or written so far
+	int error;
+	unsigned long order; // when it was started, the oldest finished request is collected first
+
+	// io_uring: the step in the ring, and what the kernel fills in or reads after submission
+	int step;
+	struct iovec iov; // the part still to be read or written
+#ifdef JPG_HAVE_IO_URING
+	struct statx st;
+#endif
+} IoRequest;
+
+typedef struct _async_io{
+	int backend;
+	int depth;
+	IoRequest *requests;
+	unsigned long started;
+
+	// threads: one per request, sharing a lock
+	pthread_t *threads;
+	int num_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	pthread_cond_t finished;
+	int shutdown;
+
+	// io_uring: the submission and completion rings shared with the kernel
+	int ring_fd;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	void *sqes;
+	size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	void *cqes;
+} async_io;
+
+// opens the file of a request and allocates the buffer of a read, returns 0 (with error set) if it can't
+int open_request(IoRequest *r);
+
+// reads or writes the whole of a request with blocking calls, on a worker thread
+void run_request(IoRequest *r);
+
+// closes the file of a finished request, a write that failed leaves no file behind
+void finish_request(IoRequest *r);
+
+// returns a free request, or NULL if depth are in flight
+IoRequest *free_request(AsyncIo io);
+
+// returns the oldest finished request, or NULL
+IoRequest *finished_request(AsyncIo io);
+
+// starts a request (the lock is held with threads)
+int start_request(AsyncIo io, int kind, const char *filename, unsigned char *data, size_t size, int tag);
+
+// main loop of the worker threads
+void *io_worker(void *arg);
+
+// starts the worker threads, returns 0 if none could be started
+int setup_io_threads(AsyncIo io);
+
+#ifdef JPG_HAVE_IO_URING
+
+// creates the rings, returns 0 if the kernel doesn't allow io_uring
+int setup_io_uring(AsyncIo io);
+
+// 1 if the kernel has every operation a request goes through
+int uring_has_operations(AsyncIo io);
+
+// queues the step of a request (the rest of the data for a read or write) and submits it
+int submit_uring(AsyncIo io, IoRequest *r);
+
+// takes the result of the step of a request
+void complete_step(IoRequest *r, int res);
+
+// submits the next step of a request, or finishes it once it is closed
+void next_step(AsyncIo io, IoRequest *r);
+
+// takes the completions the kernel has posted, waiting for one if wait is 1
+void reap_uring(AsyncIo io, int wait);
+
+void destroy_io_uring(AsyncIo io);
+
+#endif
+
+/* ==================================== Function definitions ===================================== */
+
+AsyncIo create_async_io(int backend, int depth)
+{
+	AsyncIo io = NULL;
+	int ok = 0;
+
+	if (depth <= 0){
+		return NULL;
+	}
+
+	io = calloc(1, sizeof(async_io));
+
+	if (io == NULL){
+		return NULL;
+	}
+
+	io->depth = depth;
+	io->ring_fd = -1;
+	io->requests = calloc(depth, sizeof(IoRequest));
+
+	if (io->requests != NULL){
+#ifdef JPG_HAVE_IO_URING
+		if (backend != JPG_IO_THREADS){
+			ok = setup_io_uring(io);
+			io->backend = JPG_IO_URING;
+		}
+#endif
+
+		if (!ok && backend != JPG_IO_URING){
+			ok = setup_io_threads(io);
+			io->backend = JPG_IO_THREADS;
+		}
+	}
+
+	if (!ok){
+		free(io->requests);
+		free(io);
+		io = NULL;
+	}
+
+	return io;
+}
+
+int async_io_backend(AsyncIo io)
+{
+	return io->backend;
+}
+
+int async_read_file(AsyncIo io, const char *filename, int tag)
+{
+	return start_request(io, JPG_IO_READ, filename, NULL, 0, tag);
+}
+
+int async_write_file(AsyncIo io, const char *filename, unsigned char *data, size_t size, int tag)
+{
+	return start_request(io, JPG_IO_WRITE, filename, data, size, tag);
+}
+
+int async_io_pending(AsyncIo io)
+{
+	int i = 0, pending = 0;
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_lock(&io->lock);
+	}
+
+	for (i = 0; i < io->depth; i++){
+		pending += (io->requests[i].state != IO_FREE);
+	}
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_unlock(&io->lock);
+	}
+
+	return pending;
+}
+
+int async_io_wait(AsyncIo io, AsyncIoResult *result)
+{
+	IoRequest *r = NULL;
+
+	if (async_io_pending(io) == 0){
+		return 0;
+	}
+
+	trace_begin("io_wait", -1);
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_lock(&io->lock);
+
+		while ((r = finished_request(io)) == NULL){
+			pthread_cond_wait(&io->finished, &io->lock);
+		}
+	}
+
+#ifdef JPG_HAVE_IO_URING
+	else{
+		reap_uring(io, 0);
+
+		while ((r = finished_request(io)) == NULL){
+			reap_uring(io, 1);
+		}
+	}
+#endif
+
+	result->kind = r->kind;
+	result->tag = r->tag;
+	result->error = r->error;
+	result->size = r->size;
+	result->data = (r->kind == JPG_IO_READ && r->error == 0) ? r->data : NULL;
+
+	// the data of a write, or of a read that failed, isn't the caller's
+	if (result->data == NULL){
+		free(r->data);
+	}
+
+	r->data = NULL;
+	r->state = IO_FREE;
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_unlock(&io->lock);
+	}
+
+	trace_end();
+
+	return 1;
+}
+
+void destroy_async_io(AsyncIo io)
+{
+	AsyncIoResult result;
+	int i = 0;
+
+	if (io == NULL){
+		return;
+	}
+
+	while (async_io_wait(io, &result)){
+		free(result.data);
+	}
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_lock(&io->lock);
+		io->shutdown = 1;
+		pthread_cond_broadcast(&io->queued);
+		pthread_mutex_unlock(&io->lock);
+
+		for (i = 0; i < io->num_threads; i++){
+			pthread_join(io->threads[i], NULL);
+		}
+
+		pthread_mutex_destroy(&io->lock);
+		pthread_cond_destroy(&io->queued);
+		pthread_cond_destroy(&io->finished);
+		free(io->threads);
+	}
+
+#ifdef JPG_HAVE_IO_URING
+	else{
+		destroy_io_uring(io);
+	}
+#endif
+
+	free(io->requests);
+	free(io);
+}
+
+int start_request(AsyncIo io, int kind, const char *filename, unsigned char *data, size_t size, int tag)
+{
+	IoRequest *r = NULL;
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_lock(&io->lock);
+	}
+
+	r = free_request(io);
+
+	if (r != NULL){
+		memset(r, 0, sizeof(IoRequest));
+		r->kind = kind;
+		r->tag = tag;
+		r->filename = filename;
+		r->fd = -1;
+		r->data = data;
+		r->size = size;
+		r->order = io->started++;
+
+		// the worker opens the file, so a slow file system doesn't hold up the caller
+		if (io->backend == JPG_IO_THREADS){
+			r->state = IO_QUEUED;
+			pthread_cond_signal(&io->queued);
+		}
+
+#ifdef JPG_HAVE_IO_URING
+		else{
+			r->state = IO_RUNNING;
+			r->step = IO_STEP_OPEN;
+			next_step(io, r);
+		}
+#endif
+	}
+
+	if (io->backend == JPG_IO_THREADS){
+		pthread_mutex_unlock(&io->lock);
+	}
+
+	return r != NULL;
+}
+
+IoRequest *free_request(AsyncIo io)
+{
+	int i = 0;
+
+	for (i = 0; i < io->depth; i++){
+		if (io->requests[i].state == IO_FREE){
+			return &io->requests[i];
+		}
+	}
+
+	return NULL;
+}
+
+IoRequest *finished_request(AsyncIo io)
+{
+	IoRequest *r = NULL;
+	int i = 0;
+
+	for (i = 0; i < io->depth; i++){
+		if (io->requests[i].state == IO_DONE && (r == NULL || io->requests[i].order < r->order)){
+			r = &io->requests[i];
+		}
+	}
+
+	return r;
+}
+
+int open_request(IoRequest *r)
+{
+	struct stat st;
+
+	if (r->kind == JPG_IO_READ){
+		r->fd = open(r->filename, O_RDONLY);
+
+		if (r->fd >= 0 && fstat(r->fd, &st) == 0){
+			r->size = st.st_size;
+			r->data = malloc(r->size > 0 ? r->size : 1);
+			r->error = (r->data == NULL) ? ENOMEM : 0;
+		}
+
+		else{
+			r->error = errno;
+		}
+	}
+
+	else{
+		r->fd = open(r->filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		r->error = (r->fd < 0) ? errno : 0;
+	}
+
+	return r->error == 0;
+}
+
+void run_request(IoRequest *r)
+{
+	ssize_t n = 0;
+
+	trace_begin((r->kind == JPG_IO_READ) ? "io_read" : "io_write", r->tag);
+
+	if (open_request(r)){
+		while (r->done < r->size && r->error == 0){
+			if (r->kind == JPG_IO_READ){
+				n = read(r->fd, r->data + r->done, r->size - r->done);
+			}
+
+			else{
+				n = write(r->fd, r->data + r->done, r->size - r->done);
+			}
+
+			if (n < 0 && errno != EINTR){
+				r->error = errno;
+			}
+
+			// the file got shorter since it was sized
+			else if (n == 0){
+				r->error = EIO;
+			}
+
+			else if (n > 0){
+				r->done += n;
+			}
+		}
+	}
+
+	finish_request(r);
+	trace_end();
+}
+
+void finish_request(IoRequest *r)
+{
+	if (r->fd >= 0 && close(r->fd) != 0 && r->error == 0){
+		r->error = errno;
+	}
+
+	r->fd = -1;
+
+	if (r->kind == JPG_IO_WRITE && r->error != 0){
+		remove(r->filename);
+	}
+}
+
+void *io_worker(void *arg)
+{
+	AsyncIo io = arg;
+	IoRequest *r = NULL;
+	int i = 0;
+
+	trace_thread_name("io_worker");
+	pthread_mutex_lock(&io->lock);
+
+	while (!io->shutdown){
+		r = NULL;
+
+		// the oldest request waiting
+		for (i = 0; i < io->depth; i++){
+			if (io->requests[i].state == IO_QUEUED && (r == NULL || io->requests[i].order < r->order)){
+				r = &io->requests[i];
+			}
+		}
+
+		if (r == NULL){
+			pthread_cond_wait(&io->queued, &io->lock);
+			continue;
+		}
+
+		r->state = IO_RUNNING;
+		pthread_mutex_unlock(&io->lock);
+
+		run_request(r);
+
+		pthread_mutex_lock(&io->lock);
+		r->state = IO_DONE;
+		pthread_cond_broadcast(&io->finished);
+	}
+
+	pthread_mutex_unlock(&io->lock);
+
+	return NULL;
+}
+
+int setup_io_threads(AsyncIo io)
+{
+	int i = 0;
+
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->queued, NULL);
+	pthread_cond_init(&io->finished, NULL);
+
+	io->threads = malloc(sizeof(pthread_t) * io->depth);
+
+	for (i = 0; io->threads != NULL && i < io->depth; i++){
+		if (pthread_create(&io->threads[i], NULL, io_worker, io) != 0){
+			break;
+		}
+
+		io->num_threads++;
+	}
+
+	if (io->num_threads == 0){
+		pthread_mutex_destroy(&io->lock);
+		pthread_cond_destroy(&io->queued);
+		pthread_cond_destroy(&io->finished);
+		free(io->threads);
+		io->threads = NULL;
+	}
+
+	return io->num_threads > 0;
+}
+
+#ifdef JPG_HAVE_IO_URING
+
+int setup_io_uring(AsyncIo io)
+{
+	struct io_uring_params params;
+	unsigned char *sq = NULL, *cq = NULL;
+
+	memset(&params, 0, sizeof(params));
+	io->ring_fd = syscall(__NR_io_uring_setup, io->depth, &params);
+
+	// kernels without io_uring, or with it turned off (io_uring_disabled, seccomp)
+	if (io->ring_fd < 0){
+		return 0;
+	}
+
+	io->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	io->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	// newer kernels map both rings at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP){
+		io->sq_ring_size = (io->cq_ring_size > io->sq_ring_size) ? io->cq_ring_size : io->sq_ring_size;
+		io->cq_ring_size = 0;
+	}
+
+	io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQ_RING);
+	io->cq_ring = io->sq_ring;
+
+	if (io->sq_ring != MAP_FAILED && io->cq_ring_size > 0){
+		io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_CQ_RING);
+	}
+
+	io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+
+	if (io->sq_ring == MAP_FAILED || io->cq_ring == MAP_FAILED || io->sqes == MAP_FAILED){
+		destroy_io_uring(io);
+		return 0;
+	}
+
+	// kernels before 5.6 can't open, size or close files through the ring, they use the threads
+	if (!uring_has_operations(io)){
+		destroy_io_uring(io);
+		return 0;
+	}
+
+	sq = io->sq_ring;
+	cq = io->cq_ring;
+	io->sq_head = (unsigned *) (sq + params.sq_off.head);
+	io->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	io->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+	io->sq_array = (unsigned *) (sq + params.sq_off.array);
+	io->cq_head = (unsigned *) (cq + params.cq_off.head);
+	io->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	io->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+	io->cqes = cq + params.cq_off.cqes;
+
+	return 1;
+}
+
+int uring_has_operations(AsyncIo io)
+{
+	static const int operations[5] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_CLOSE};
+	struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+	int i = 0, ok = 0;
+
+	if (probe != NULL && syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0){
+		ok = 1;
+
+		for (i = 0; i < 5; i++){
+			ok &= (operations[i] <= probe->last_op && (probe->ops[operations[i]].flags & IO_URING_OP_SUPPORTED));
+		}
+	}
+
+	free(probe);
+
+	return ok;
+}
+
+int submit_uring(AsyncIo io, IoRequest *r)
+{
+	struct io_uring_sqe *sqe = NULL;
+	unsigned tail = *io->sq_tail; // only this thread writes it
+	unsigned index = tail & *io->sq_mask;
+	int submitted = 0;
+
+	// there is an entry for each request, so one is always free
+	sqe = (struct io_uring_sqe *) io->sqes + index;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = r - io->requests;
+
+	if (r->step == IO_STEP_OPEN){
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long) r->filename;
+		sqe->open_flags = (r->kind == JPG_IO_READ) ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC;
+		sqe->len = 0666; // the mode
+	}
+
+	else if (r->step == IO_STEP_STAT){
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long) r->filename;
+		sqe->len = STATX_SIZE;
+		sqe->off = (unsigned long) &r->st;
+	}
+
+	else if (r->step == IO_STEP_DATA){
+		r->iov.iov_base = r->data + r->done;
+		r->iov.iov_len = r->size - r->done;
+
+		sqe->opcode = (r->kind == JPG_IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+		sqe->fd = r->fd;
+		sqe->addr = (unsigned long) &r->iov;
+		sqe->len = 1;
+		sqe->off = r->done;
+	}
+
+	else{
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = r->fd;
+	}
+
+	io->sq_array[index] = index;
+
+	// the entry is written before the kernel can see the new tail
+	__atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	do{
+		submitted = syscall(__NR_io_uring_enter, io->ring_fd, 1, 0, 0, NULL, 0);
+	} while (submitted < 0 && errno == EINTR);
+
+	if (submitted != 1){
+		// the kernel didn't take the entry, it is taken back
+		__atomic_store_n(io->sq_tail, tail, __ATOMIC_RELEASE);
+		r->error = (submitted < 0) ? errno : EAGAIN;
+	}
+
+	return submitted == 1;
+}
+
+void complete_step(IoRequest *r, int res)
+{
+	if (r->step == IO_STEP_CLOSE){
+		r->error = (res < 0 && r->error == 0) ? -res : r->error;
+		r->fd = -1;
+		r->step = IO_STEP_DONE;
+	}
+
+	else if (res < 0){
+		r->error = -res;
+	}
+
+	else if (r->step == IO_STEP_OPEN){
+		r->fd = res;
+		r->step = (r->kind == JPG_IO_READ) ? IO_STEP_STAT : IO_STEP_DATA;
+	}
+
+	else if (r->step == IO_STEP_STAT){
+		r->size = r->st.stx_size;
+		r->data = malloc(r->size > 0 ? r->size : 1);
+		r->error = (r->data == NULL) ? ENOMEM : 0;
+		r->step = IO_STEP_DATA;
+	}
+
+	// the file got shorter since it was sized
+	else if (res == 0){
+		r->error = EIO;
+	}
+
+	else{
+		r->done += res;
+	}
+}
+
+void next_step(AsyncIo io, IoRequest *r)
+{
+	// a request that failed still closes its file, one that has all its data is closed
+	if (r->fd >= 0 && (r->error != 0 || (r->step == IO_STEP_DATA && r->done >= r->size))){
+		r->step = IO_STEP_CLOSE;
+	}
+
+	// finished, failed before its file was open, or the kernel didn't take the step (the file is closed here then)
+	if (r->step == IO_STEP_DONE || (r->error != 0 && r->fd < 0) || !submit_uring(io, r)){
+		finish_request(r);
+		r->state = IO_DONE;
+	}
+}
+
+void reap_uring(AsyncIo io, int wait)
+{
+	struct io_uring_cqe *cqe = NULL;
+	IoRequest *r = NULL;
+	unsigned head = *io->cq_head; // only this thread writes it
+	unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail && wait){
+		syscall(__NR_io_uring_enter, io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for (; head != tail; head++){
+		cqe = (struct io_uring_cqe *) io->cqes + (head & *io->cq_mask);
+		r = &io->requests[cqe->user_data];
+
+		// large files take more than one read or write
+		complete_step(r, cqe->res);
+		next_step(io, r);
+	}
+
+	__atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void destroy_io_uring(AsyncIo io)
+{
+	if (io->sqes != NULL && io->sqes != MAP_FAILED){
+		munmap(io->sqes, io->sqes_size);
+	}
+
+	if (io->cq_ring != NULL && io->cq_ring != MAP_FAILED && io->cq_ring != io->sq_ring){
+		munmap(io->cq_ring, io->cq_ring_size);
+	}
+
+	if (io->sq_ring != NULL && io->sq_ring != MAP_FAILED){
+		munmap(io->sq_ring, io->sq_ring_size);
+	}
+
+	if (io->ring_fd >= 0){
+		close(io->ring_fd);
+	}
+}
+
+#endif
@@ -4,14 +4,29 @@
 	Written by: Matthew Ta
 */
 
+// pread, fseeko and 64 bit file offsets
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
 
 #include "headers/bitmap.h"
 
 #define BMP_MAX_LEN 500
 
+// bytes of the file and info headers needed to reach the bit depth
+#define BMP_HEADER_SIZE 30
+
+// the colour table of an 8-bit image follows the info header
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_COLOURS_USED 46
+#define BMP_MAX_COLOURS 256
+
 /*
 	Helper functions
 */
@@ -19,18 +34,22 @@
 // stores the RGB values in seperate channels
 void bmp_GetColourData(BmpImage b);
 
+// stores the RGB values of a bitmap file that is in memory in seperate channels
+void bmp_DecodeColourData(BmpImage b, const Byte *buffer);
+
 // determines the size of a file
-int determineFileSize(FILE *f);
+long long determineFileSize(FILE *f);
 
 typedef struct _bitmap {
 	char filename[BMP_MAX_LEN]; // name of the bitmap file
-	int fileSize;			// size of the bitmap file
+	long long fileSize;		// size of the bitmap file
 	int offsetRGB; 			// offset to the RGB data
 	int width;              // width of the image
 	int height;             // height of the image
 	short bitDepth;	        // bit depth of the image
-	int numPixels; 			// number of pixels
+	long long numPixels; 	// number of pixels
 	int error; 		        // error code associated with reading the file
+	int grayscale;          // 1 if every pixel has R == G == B
 
 	// data for each of the colour channels
 	Byte *red;
@@ -38,117 +57,273 @@ typedef struct _bitmap {
 	Byte *blue;
 } Bitmap;
 
+// reads the fields of the bmp header
+void bmp_ReadHeader(Bitmap *b, const Byte *buffer);
+
+typedef struct _bmp_strip_reader {
+	int fd;
+	int width;
+	int height;
+	short bitDepth;         // 24 or 8, raw files are read as 24-bit
+	int raw;                // 1 for raw files: rows top down without padding
+	long long offsetRGB;    // offset to the first row in the file
+	long long rowSize;      // bytes from one row to the next
+	long long fileSize;
+	int grayscale;          // 1 if every colour in the table is grey (8-bit only)
+
+	// colour table of an 8-bit image (blue, green, red, unused)
+	Byte palette[BMP_MAX_COLOURS * 4];
+	int numColours;
+
+	// the rows of a strip as they are in the file
+	Byte *rows;
+	size_t rowsSize;
+} BmpStrips;
+
+// reads n bytes at offset, returns 1 if they were all read
+int bmp_ReadAt(int fd, Byte *buffer, size_t n, long long offset);
+
 BmpImage bmp_OpenBitmap(const char *filename)
 {
 	FILE *fp = NULL;
 	BmpImage b = NULL;
-	Byte *buffer = NULL, *data = NULL;
-	int fs = 0; // filesize local
+	Byte header[BMP_HEADER_SIZE];
 
 	// create the bitmap structure
-	b = malloc(sizeof(Bitmap));
-	b->error = BMP_SUCCESS;
+	b = calloc(1, sizeof(Bitmap));
 
 	if (b != NULL){
+		b->error = BMP_SUCCESS;
+
 		// open the bitmap
 		fp = fopen(filename, "rb");
 
 		// check if we got a handle to a file
 		if (fp != NULL){
-			fs = determineFileSize(fp);
-			buffer = malloc(sizeof(Byte) * (fs + 1));
-
-			b->fileSize = fs;
+			b->fileSize = determineFileSize(fp);
 			memset(b->filename, 0, BMP_MAX_LEN);
-			strncpy(b->filename, filename, strlen(filename));
-
-			// check if the buffer for reading has been created properly
-			if (buffer != NULL){
-				fread(buffer, sizeof(Byte), fs, fp);
-
-				// read in bmp header info
-				data = buffer + 10; // offset to RGB info
-				memcpy(&b->offsetRGB, data, sizeof(int));
-
-				data = buffer + 18; // offset to width
-				memcpy(&b->width, data, sizeof(int));
-
-				data = buffer + 22; // offset to height
-				memcpy(&b->height, data, sizeof(int));
-
-				data = buffer + 28; // # bits / pixel
-				memcpy(&b->bitDepth, data, sizeof(short));
-
-				b->numPixels = b->width * b->height;
+			strncpy(b->filename, filename, BMP_MAX_LEN - 1);
 
+			// only the header is needed here, bmp_GetColourData reads the rest
+			if (fread(header, sizeof(Byte), BMP_HEADER_SIZE, fp) == BMP_HEADER_SIZE){
+				bmp_ReadHeader(b, header);
 				bmp_GetColourData(b);
 			}
 
 			else{
 				b->error = BMP_READ_FAILED;
 			}
+
+			fclose(fp);
 		}
 
 		else{
 			b->error = BMP_FILE_DOESNT_EXIST;
 		}
+	}
 
-		fclose(fp);
+	return b;
+}
+
+BmpImage bmp_OpenBitmapFromMemory(const Byte *data, size_t size)
+{
+	BmpImage b = calloc(1, sizeof(Bitmap));
+
+	if (b != NULL){
+		b->error = BMP_SUCCESS;
+		b->fileSize = size;
+
+		if (size >= BMP_HEADER_SIZE && data[0] == 'B' && data[1] == 'M'){
+			bmp_ReadHeader(b, data);
+			bmp_DecodeColourData(b, data);
+		}
+
+		else{
+			b->error = BMP_READ_FAILED;
+		}
 	}
 
 	return b;
 }
 
+int bmp_ProbeBitmap(const char *filename, BmpInfo *info)
+{
+	FILE *fp = NULL;
+	Bitmap b;
+	Byte header[BMP_HEADER_SIZE];
+	int error = BMP_SUCCESS;
+
+	memset(info, 0, sizeof(BmpInfo));
+	fp = fopen(filename, "rb");
+
+	if (fp != NULL){
+		// only the header is read, the pixel data is never touched
+		if (fread(header, sizeof(Byte), BMP_HEADER_SIZE, fp) == BMP_HEADER_SIZE && header[0] == 'B' && header[1] == 'M'){
+			bmp_ReadHeader(&b, header);
+
+			info->width = b.width;
+			info->height = b.height;
+			info->bitDepth = b.bitDepth;
+			info->offsetRGB = b.offsetRGB;
+			info->fileSize = determineFileSize(fp);
+		}
+
+		else{
+			error = BMP_READ_FAILED;
+		}
+
+		fclose(fp);
+	}
+
+	else{
+		error = BMP_FILE_DOESNT_EXIST;
+	}
+
+	return error;
+}
+
+void bmp_ReadHeader(Bitmap *b, const Byte *buffer)
+{
+	const Byte *data = NULL;
+
+	data = buffer + 10; // offset to RGB info
+	memcpy(&b->offsetRGB, data, sizeof(int));
+
+	data = buffer + 18; // offset to width
+	memcpy(&b->width, data, sizeof(int));
+
+	data = buffer + 22; // offset to height
+	memcpy(&b->height, data, sizeof(int));
+
+	data = buffer + 28; // # bits / pixel
+	memcpy(&b->bitDepth, data, sizeof(short));
+
+	b->numPixels = (long long) b->width * b->height;
+}
+
 void bmp_GetColourData(BmpImage b)
 {
 	FILE *fp = NULL;
 	Byte *buffer = NULL;
-	int n = 0;
+	long long fs = b->fileSize;
+
+	// sizes that don't fit in memory can't be read
+	if (fs <= 0 || (size_t) fs != fs){
+		b->error = BMP_READ_FAILED;
+		return;
+	}
+
+	buffer = malloc(sizeof(Byte) * fs);
+
+	if (buffer == NULL){
+		b->error = BMP_FAILED_ALLOCATE_BUFFER;
+		return;
+	}
+
+	fp = fopen(b->filename, "rb");
+
+	// read the file into a buffer
+	if (fp == NULL || fread(buffer, sizeof(Byte), fs, fp) != (size_t) fs){
+		b->error = BMP_READ_FAILED;
+	}
+
+	else{
+		bmp_DecodeColourData(b, buffer);
+	}
+
+	if (fp != NULL){
+		fclose(fp);
+	}
+
+	free(buffer);
+}
+
+void bmp_DecodeColourData(BmpImage b, const Byte *buffer)
+{
+	const Byte *palette = NULL;
+	size_t n = 0, offset = 0, rowSize = 0;
 	int i = 0, j = 0; // index for the pixel array
-	int fs = 0, offset = 0;
-	int numPixels = 0;
+	long long fs = 0, numPixels = 0;
+	int numColours = 0, infoSize = 0, grey = 1;
 
 	numPixels = b->numPixels;
 	fs 		  = b->fileSize;
-	buffer    = malloc(sizeof(Byte) * fs);
+
+	// sizes from the header that don't fit in memory are left to fail the allocations
+	if (b->width <= 0 || b->height <= 0 || (size_t) numPixels != numPixels){
+		b->error = BMP_READ_FAILED;
+		return;
+	}
 
 	// allocate memory for each of the colour channels
 	b->red   = malloc(sizeof(Byte) * numPixels);
 	b->green = malloc(sizeof(Byte) * numPixels);
 	b->blue  = malloc(sizeof(Byte) * numPixels);
 
+	if (b->red != NULL && b->green != NULL && b->blue != NULL){
+		// rows are stored bottom up, each one padded to a multiple of 4 bytes
+		rowSize = ((size_t) b->width * (b->bitDepth / 8) + 3) & ~(size_t) 3;
 
-	if (buffer != NULL && b->red != NULL && b->green != NULL && b->blue != NULL){
-		fp = fopen(b->filename, "rb");
+		if ((b->bitDepth != 24 && b->bitDepth != 8) || b->offsetRGB < 0 || b->offsetRGB + (long long) b->height * rowSize > fs){
+			b->error = BMP_READ_FAILED;
+		}
 
-		if (fp != NULL){
-			// read the file into a buffer
-			fread(buffer, sizeof(Byte), fs, fp);
-
-			// store the pixel data RGB
-			for (i = 1; i <= b->height; i++){
-				offset = fs - (i * b->width * (b->bitDepth / 8));
-				for (j = 0; j < (b->width * 3); j += 3){ // sometimes the ordering of the rgb values is different
-					b->red[n]   = buffer[offset + j];     // r
-				 	b->green[n] = buffer[offset + j + 1]; // g
-					b->blue[n]  = buffer[offset + j + 2]; // b
-					n++;
-				}
+		// 8-bit images index a table of blue, green, red, unused entries
+		if (b->error == BMP_SUCCESS && b->bitDepth == 8){
+			memcpy(&infoSize, buffer + BMP_FILE_HEADER_SIZE, sizeof(int));
+			memcpy(&numColours, buffer + BMP_COLOURS_USED, sizeof(int));
+
+			numColours = (numColours <= 0 || numColours > BMP_MAX_COLOURS) ? BMP_MAX_COLOURS : numColours;
+			palette = buffer + BMP_FILE_HEADER_SIZE + infoSize;
+
+			if (infoSize <= 0 || BMP_FILE_HEADER_SIZE + (long long) infoSize + numColours * 4 > fs){
+				b->error = BMP_READ_FAILED;
 			}
 		}
 
-		else{
-			b->error = BMP_READ_FAILED;
+		// store the pixel data RGB, each pixel is stored as blue, green, red
+		for (i = b->height - 1; i >= 0 && b->error == BMP_SUCCESS && b->bitDepth == 24; i--){
+			offset = b->offsetRGB + (size_t) i * rowSize;
+			for (j = 0; j < (b->width * 3); j += 3){
+				b->blue[n]  = buffer[offset + j];     // b
+			 	b->green[n] = buffer[offset + j + 1]; // g
+				b->red[n]   = buffer[offset + j + 2]; // r
+				grey &= (b->red[n] == b->green[n] && b->green[n] == b->blue[n]);
+				n++;
+			}
 		}
 
-		fclose(fp);
+		for (i = b->height - 1; i >= 0 && b->error == BMP_SUCCESS && b->bitDepth == 8; i--){
+			offset = b->offsetRGB + (size_t) i * rowSize;
+			for (j = 0; j < b->width && b->error == BMP_SUCCESS; j++){
+				if (buffer[offset + j] >= numColours){
+					b->error = BMP_READ_FAILED;
+				}
+
+				else{
+					b->blue[n]  = palette[buffer[offset + j] * 4];
+					b->green[n] = palette[buffer[offset + j] * 4 + 1];
+					b->red[n]   = palette[buffer[offset + j] * 4 + 2];
+					grey &= (b->red[n] == b->green[n] && b->green[n] == b->blue[n]);
+					n++;
+				}
+			}
+		}
+
+		b->grayscale = grey;
 	}
 
 	else{
 		b->error = BMP_FAILED_ALLOCATE_BUFFER;
 	}
 
-	free(buffer);
+	// images that couldn't be read have no colour data
+	if (b->error != BMP_SUCCESS){
+		free(b->red);
+		free(b->green);
+		free(b->blue);
+		b->red = b->green = b->blue = NULL;
+	}
 }
 
 Byte *bmp_GetRed(BmpImage b)
@@ -170,12 +345,17 @@ void bmp_ShowBmpInfo(BmpImage b)
 {
 	printf("[BMP Info]:\n");
 	printf("Filename: %s\n", b->filename);
-	printf("File size: %d kb\n", b->fileSize / 1000);
+	printf("File size: %lld kb\n", b->fileSize / 1000);
 	printf("Height: %d\n", b->height);
 	printf("Width: %d\n", b->width);
 	printf("Bit depth: %d\n", b->bitDepth);
 }
 
+int bmp_IsGrayscale(BmpImage b)
+{
+	return b->grayscale;
+}
+
 int bmp_GetWidth(BmpImage b)
 {
 	return b->width;
@@ -186,7 +366,7 @@ int bmp_GetHeight(BmpImage b)
 	return b->height;
 }
 
-int bmp_GetNumPixels(BmpImage b)
+long long bmp_GetNumPixels(BmpImage b)
 {
 	return b->numPixels;
 }
@@ -212,7 +392,7 @@ void bmp_GetLastError(BmpImage b)
 	}
 }
 
-int bmp_GetFileSize(BmpImage b)
+long long bmp_GetFileSize(BmpImage b)
 {
 	return b->fileSize;
 }
@@ -231,14 +411,206 @@ void bmp_DestroyBitmap(BmpImage b)
 	free(b);
 }
 
+BmpStripReader bmp_OpenStrips(const char *filename)
+{
+	BmpStripReader r = NULL;
+	Bitmap b;
+	Byte header[BMP_HEADER_SIZE];
+	int infoSize = 0, numColours = 0, i = 0, ok = 0;
+
+	r = calloc(1, sizeof(BmpStrips));
+
+	if (r == NULL){
+		return NULL;
+	}
+
+	r->fd = open(filename, O_RDONLY);
+	r->fileSize = (r->fd >= 0) ? (long long) lseek(r->fd, 0, SEEK_END) : 0;
+
+	if (r->fd >= 0 && bmp_ReadAt(r->fd, header, BMP_HEADER_SIZE, 0) && header[0] == 'B' && header[1] == 'M'){
+		bmp_ReadHeader(&b, header);
+
+		r->width = b.width;
+		r->height = b.height;
+		r->bitDepth = b.bitDepth;
+		r->offsetRGB = b.offsetRGB;
+		r->rowSize = ((long long) b.width * (b.bitDepth / 8) + 3) & ~3LL;
+
+		// only bottom up rows of 24-bit or 8-bit pixels, all of which have to be in the file
+		ok = r->width > 0 && r->height > 0 && (r->bitDepth == 24 || r->bitDepth == 8)
+		     && r->offsetRGB >= 0 && r->offsetRGB + r->height * r->rowSize <= r->fileSize;
+	}
+
+	// 8-bit images index a table of blue, green, red, unused entries
+	if (ok && r->bitDepth == 8){
+		ok = bmp_ReadAt(r->fd, (Byte *) &infoSize, sizeof(int), BMP_FILE_HEADER_SIZE)
+		     && bmp_ReadAt(r->fd, (Byte *) &numColours, sizeof(int), BMP_COLOURS_USED);
+
+		numColours = (numColours <= 0 || numColours > BMP_MAX_COLOURS) ? BMP_MAX_COLOURS : numColours;
+		r->numColours = numColours;
+
+		ok = ok && infoSize > 0 && bmp_ReadAt(r->fd, r->palette, numColours * 4, BMP_FILE_HEADER_SIZE + (long long) infoSize);
+
+		r->grayscale = 1;
+		for (i = 0; i < numColours; i++){
+			r->grayscale &= (r->palette[i * 4] == r->palette[i * 4 + 1] && r->palette[i * 4 + 1] == r->palette[i * 4 + 2]);
+		}
+	}
+
+	if (!ok){
+		bmp_CloseStrips(r);
+		r = NULL;
+	}
+
+	return r;
+}
+
+BmpStripReader bmp_OpenRawStrips(const char *filename, int width, int height)
+{
+	BmpStripReader r = NULL;
+
+	r = calloc(1, sizeof(BmpStrips));
+
+	if (r == NULL){
+		return NULL;
+	}
+
+	r->fd = open(filename, O_RDONLY);
+	r->fileSize = (r->fd >= 0) ? (long long) lseek(r->fd, 0, SEEK_END) : 0;
+	r->width = width;
+	r->height = height;
+	r->bitDepth = 24;
+	r->raw = 1;
+	r->offsetRGB = 0;
+	r->rowSize = (long long) width * 3;
+
+	if (r->fd < 0 || width <= 0 || height <= 0 || height * r->rowSize > r->fileSize){
+		bmp_CloseStrips(r);
+		r = NULL;
+	}
+
+	return r;
+}
+
+int bmp_ReadStrip(BmpStripReader r, int first_row, int num_rows, Byte *rgb)
+{
+	const Byte *row = NULL, *entry = NULL;
+	size_t size = 0;
+	long long offset = 0;
+	int i = 0, j = 0;
+
+	if (first_row < 0 || num_rows <= 0 || first_row + (long long) num_rows > r->height){
+		return BMP_READ_FAILED;
+	}
+
+	// raw rows are already R, G, B from the top down
+	if (r->raw){
+		return bmp_ReadAt(r->fd, rgb, (size_t) (num_rows * r->rowSize), first_row * r->rowSize) ? BMP_SUCCESS : BMP_READ_FAILED;
+	}
+
+	// the rows of the strip are next to each other in the file, the last one first
+	size = (size_t) (num_rows * r->rowSize);
+	offset = r->offsetRGB + (r->height - first_row - (long long) num_rows) * r->rowSize;
+
+	if (size > r->rowsSize){
+		free(r->rows);
+		r->rows = malloc(size);
+		r->rowsSize = (r->rows != NULL) ? size : 0;
+
+		if (r->rows == NULL){
+			return BMP_FAILED_ALLOCATE_BUFFER;
+		}
+	}
+
+	if (!bmp_ReadAt(r->fd, r->rows, size, offset)){
+		return BMP_READ_FAILED;
+	}
+
+	for (i = 0; i < num_rows; i++){
+		row = r->rows + (size_t) ((num_rows - 1 - i) * r->rowSize);
+
+		for (j = 0; j < r->width; j++, rgb += 3){
+			// each pixel is stored as blue, green, red
+			if (r->bitDepth == 24){
+				rgb[0] = row[j * 3 + 2];
+				rgb[1] = row[j * 3 + 1];
+				rgb[2] = row[j * 3];
+			}
+
+			else if (row[j] < r->numColours){
+				entry = r->palette + row[j] * 4;
+				rgb[0] = entry[2];
+				rgb[1] = entry[1];
+				rgb[2] = entry[0];
+			}
+
+			else{
+				return BMP_READ_FAILED;
+			}
+		}
+	}
+
+	return BMP_SUCCESS;
+}
+
+int bmp_GetStripWidth(BmpStripReader r)
+{
+	return r->width;
+}
+
+int bmp_GetStripHeight(BmpStripReader r)
+{
+	return r->height;
+}
+
+long long bmp_GetStripFileSize(BmpStripReader r)
+{
+	return r->fileSize;
+}
+
+int bmp_IsStripGrayscale(BmpStripReader r)
+{
+	return r->grayscale;
+}
+
+void bmp_CloseStrips(BmpStripReader r)
+{
+	if (r->fd >= 0){
+		close(r->fd);
+	}
+
+	free(r->rows);
+	free(r);
+}
+
+int bmp_ReadAt(int fd, Byte *buffer, size_t n, long long offset)
+{
+	ssize_t got = 0;
+
+	// pread may return fewer bytes than asked for, e.g. when interrupted
+	while (n > 0){
+		got = pread(fd, buffer, n, (off_t) offset);
+
+		if (got <= 0){
+			return 0;
+		}
+
+		buffer += got;
+		n -= (size_t) got;
+		offset += got;
+	}
+
+	return 1;
+}
+
 // helper function that determines the size of a file
-int determineFileSize(FILE *f)
+long long determineFileSize(FILE *f)
 {
-    int end;
+    off_t end;
 
-    fseek (f, 0, SEEK_END);
-    end = ftell (f);
-    fseek (f, 0, SEEK_SET);
+    fseeko (f, 0, SEEK_END);
+    end = ftello (f);
+    fseeko (f, 0, SEEK_SET);
 
-    return end;
+    return (long long) end;
 }
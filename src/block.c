@@ -32,6 +32,11 @@ void set_value_block(Block b, int x, int y, double v)
 	b->values[ (y * NUM_COEFFICIENTS_ROW) + x ] = v;
 }
 
+double *block_values(Block b)
+{
+	return b->values;
+}
+
 Block copy_block(Block b)
 {
 	Block copy_block = new_block();
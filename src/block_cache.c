@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "headers/block_cache.h"
+#include "headers/cpu_kernels.h"
+
+#ifdef JPG_X86_KERNELS
+#include <nmmintrin.h>
+#endif
+
+#define BLOCK_SIZE 64
+
+// CRC32C polynomial (bits reversed)
+#define CRC32C_POLY 0x82F63B78u
+
+typedef struct _cache_entry{
+	int used;
+	int table;
+	unsigned int hash;
+	short samples[BLOCK_SIZE];
+	double values[BLOCK_SIZE];
+	int zz[BLOCK_SIZE];
+} CacheEntry;
+
+typedef struct _block_cache{
+	CacheEntry *entries;
+	unsigned int mask; // number of entries - 1
+
+	long hits;
+	long misses;
+} block_cache;
+
+// remainders of each byte, built by init_crc32c
+static unsigned int crc_table[256];
+
+// hash of a key
+unsigned int hash_key(int table, const short *samples);
+
+/* ==================================== Function definitions ===================================== */
+
+BlockCache create_block_cache(int num_entries)
+{
+	BlockCache cache = NULL;
+	unsigned int size = 1;
+
+	while (size < (unsigned int) num_entries && size < (1u << 24)){
+		size <<= 1;
+	}
+
+	cache = calloc(1, sizeof(block_cache));
+
+	if (cache != NULL){
+		cache->entries = calloc(size, sizeof(CacheEntry));
+		cache->mask = size - 1;
+
+		if (cache->entries == NULL){
+			free(cache);
+			cache = NULL;
+		}
+	}
+
+	return cache;
+}
+
+int block_cache_find(BlockCache cache, int table, const short *samples, const double *values, unsigned int *hash, int *zz)
+{
+	CacheEntry *e = NULL;
+
+	*hash = hash_key(table, samples);
+	e = &cache->entries[*hash & cache->mask];
+
+	// the samples are compared as well since different blocks can share a hash
+	if (e->used && e->hash == *hash && e->table == table && memcmp(e->samples, samples, sizeof(e->samples)) == 0 &&
+	    (values == NULL || memcmp(e->values, values, sizeof(e->values)) == 0)){
+		memcpy(zz, e->zz, sizeof(e->zz));
+		cache->hits++;
+		return 1;
+	}
+
+	cache->misses++;
+	return 0;
+}
+
+void block_cache_add(BlockCache cache, int table, const short *samples, const double *values, unsigned int hash, const int *zz)
+{
+	CacheEntry *e = &cache->entries[hash & cache->mask];
+
+	e->used = 1;
+	e->table = table;
+	e->hash = hash;
+	memcpy(e->samples, samples, sizeof(e->samples));
+	memcpy(e->zz, zz, sizeof(e->zz));
+
+	if (values != NULL){
+		memcpy(e->values, values, sizeof(e->values));
+	}
+}
+
+long block_cache_hits(BlockCache cache)
+{
+	return cache->hits;
+}
+
+long block_cache_misses(BlockCache cache)
+{
+	return cache->misses;
+}
+
+void destroy_block_cache(BlockCache cache)
+{
+	if (cache != NULL){
+		free(cache->entries);
+		free(cache);
+	}
+}
+
+unsigned int hash_key(int table, const short *samples)
+{
+	const JpgKernels *kernels = jpg_kernels();
+	unsigned int crc = kernels->crc32c(0, &table, sizeof(table));
+
+	return kernels->crc32c(crc, samples, sizeof(short) * BLOCK_SIZE);
+}
+
+unsigned int crc32c(unsigned int crc, const void *data, size_t size)
+{
+	return jpg_kernels()->crc32c(crc, data, size);
+}
+
+void init_crc32c(void)
+{
+	unsigned int r = 0;
+	int i = 0, k = 0;
+
+	for (i = 0; i < 256; i++){
+		r = i;
+
+		for (k = 0; k < 8; k++){
+			r = (r & 1) ? (r >> 1) ^ CRC32C_POLY : r >> 1;
+		}
+
+		crc_table[i] = r;
+	}
+}
+
+unsigned int crc32c_scalar(unsigned int crc, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	crc = ~crc;
+
+	for (; size > 0; size--, p++){
+		crc = crc_table[(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+#ifdef JPG_X86_KERNELS
+
+// the CRC32 instruction works out CRC32C, 8 bytes at a time on x86-64 and 4 otherwise
+__attribute__((target("sse4.2")))
+unsigned int crc32c_sse42(unsigned int crc, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	unsigned int c = ~crc;
+
+#ifdef __x86_64__
+	uint64_t c64 = c, word = 0;
+
+	for (; size >= 8; size -= 8, p += 8){
+		memcpy(&word, p, 8);
+		c64 = _mm_crc32_u64(c64, word);
+	}
+
+	c = (unsigned int) c64;
+#else
+	unsigned int word = 0;
+
+	for (; size >= 4; size -= 4, p += 4){
+		memcpy(&word, p, 4);
+		c = _mm_crc32_u32(c, word);
+	}
+#endif
+
+	for (; size > 0; size--, p++){
+		c = _mm_crc32_u8(c, *p);
+	}
+
+	return ~c;
+}
+
+#endif
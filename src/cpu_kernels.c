@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "headers/cpu_kernels.h"
+#include "headers/fdct.h"
+#include "headers/huffman.h"
+#include "headers/upsample.h"
+#include "headers/block_cache.h"
+
+#ifdef JPG_X86_KERNELS
+#include <cpuid.h>
+#endif
+
+// random blocks and rows the self test checks before a level is used
+#define SELF_TEST_BLOCKS 32
+
+// longest row of pixels the self test converts
+#define SELF_TEST_ROW 64
+
+// the kernels of each level, a level starts with those of the level below it
+static JpgKernels kernel_levels[JPG_NUM_CPU_LEVELS];
+
+// the kernels in use, set once the levels are filled in
+static const JpgKernels *kernels_in_use = NULL;
+
+static int cpu_level = JPG_CPU_SCALAR; // from CPUID
+static int env_level = JPG_CPU_AUTO; // from JPG_CPU_LEVEL
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static const char *level_names[JPG_NUM_CPU_LEVELS] = {"scalar", "sse2", "ssse3", "avx2", "avx512bw"};
+
+// fills in the kernels of each level and picks the ones to use
+void init_kernels(void);
+
+// reads JPG_CPU_LEVEL (a name or a number), JPG_CPU_AUTO if it isn't set or isn't a level
+int read_level_env(void);
+
+// the level to use for one that was asked for: no higher than the CPU, lowered until its self test passes
+int usable_level(int level);
+
+// the self test of a level without the checks of jpg_kernel_self_test
+int check_kernels(int level, int num_blocks);
+
+// a pseudo random number (xorshift), the same ones every run
+unsigned int next_random(unsigned int *state);
+
+#ifdef JPG_X86_KERNELS
+// the register state the operating system saves (XCR0)
+unsigned long long read_xcr0(void);
+#endif
+
+/* ==================================== Function definitions ===================================== */
+
+const JpgKernels *jpg_kernels(void)
+{
+	const JpgKernels *kernels = __atomic_load_n(&kernels_in_use, __ATOMIC_ACQUIRE);
+
+	if (kernels == NULL){
+		pthread_once(&kernels_once, init_kernels);
+		kernels = __atomic_load_n(&kernels_in_use, __ATOMIC_ACQUIRE);
+	}
+
+	return kernels;
+}
+
+int jpg_cpu_detect(void)
+{
+#ifdef JPG_X86_KERNELS
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0, ecx_1 = 0;
+	unsigned long long xcr0 = 0;
+	int level = JPG_CPU_SCALAR;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & bit_SSE2)){
+		return level;
+	}
+
+	level = (ecx & bit_SSSE3) ? JPG_CPU_SSSE3 : JPG_CPU_SSE2;
+	ecx_1 = ecx;
+
+	// the YMM registers can only be used if the operating system saves them
+	if (level < JPG_CPU_SSSE3 || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)){
+		return level;
+	}
+
+	xcr0 = read_xcr0();
+
+	if ((xcr0 & 0x6) != 0x6 || __get_cpuid_max(0, NULL) < 7){
+		return level;
+	}
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	// every CPU with AVX2 has SSE4.2 too, it is checked anyway for the CRC32 instruction
+	if (!(ebx & bit_AVX2) || !(ecx_1 & bit_SSE4_2)){
+		return level;
+	}
+
+	level = JPG_CPU_AVX2;
+
+	// and for AVX-512 the mask registers and the upper halves of the ZMM registers
+	if ((xcr0 & 0xE6) == 0xE6 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW)){
+		level = JPG_CPU_AVX512BW;
+	}
+
+	return level;
+#else
+	return JPG_CPU_SCALAR;
+#endif
+}
+
+int jpg_set_cpu_level(int level)
+{
+	const JpgKernels *kernels = NULL;
+
+	pthread_once(&kernels_once, init_kernels);
+
+	kernels = &kernel_levels[usable_level(level)];
+	__atomic_store_n(&kernels_in_use, kernels, __ATOMIC_RELEASE);
+
+	return kernels->level;
+}
+
+const JpgKernels *jpg_kernels_for_level(int level)
+{
+	pthread_once(&kernels_once, init_kernels);
+
+	level = (level < JPG_CPU_SCALAR) ? JPG_CPU_SCALAR : (level >= JPG_NUM_CPU_LEVELS) ? JPG_NUM_CPU_LEVELS - 1 : level;
+
+	return &kernel_levels[level];
+}
+
+int jpg_kernel_self_test(int level, int num_blocks)
+{
+	pthread_once(&kernels_once, init_kernels);
+
+	if (level < JPG_CPU_SCALAR || level > cpu_level){
+		return -1;
+	}
+
+	return check_kernels(level, num_blocks);
+}
+
+const char *jpg_cpu_level_name(int level)
+{
+	return (level >= 0 && level < JPG_NUM_CPU_LEVELS) ? level_names[level] : "unknown";
+}
+
+void init_kernels(void)
+{
+	JpgKernels *k = &kernel_levels[JPG_CPU_SCALAR];
+	int level = 0;
+
+	init_fdct();
+	init_upsample();
+	init_crc32c();
+
+	k->level = JPG_CPU_SCALAR;
+	k->fdct_float = fdct_float_scalar;
+	k->fdct_integer = fdct_integer_scalar;
+	k->nonzero_mask = nonzero_mask_scalar;
+	k->crc32c = crc32c_scalar;
+	k->ycc_to_rgb_row_h1 = ycc_to_rgb_row_h1_scalar;
+	k->ycc_to_rgb_row_h2 = ycc_to_rgb_row_h2_scalar;
+
+	for (level = JPG_CPU_SCALAR + 1; level < JPG_NUM_CPU_LEVELS; level++){
+		kernel_levels[level] = kernel_levels[level - 1];
+		kernel_levels[level].level = level;
+	}
+
+#ifdef JPG_X86_KERNELS
+	k = &kernel_levels[JPG_CPU_SSE2];
+	k->fdct_float = fdct_float_sse2;
+	k->fdct_integer = fdct_integer_sse2;
+	k->nonzero_mask = nonzero_mask_sse2;
+	k->ycc_to_rgb_row_h1 = ycc_to_rgb_row_h1_sse2;
+	k->ycc_to_rgb_row_h2 = ycc_to_rgb_row_h2_sse2;
+
+	// nothing needs SSSE3 yet, it has the SSE2 kernels
+	kernel_levels[JPG_CPU_SSSE3] = *k;
+	kernel_levels[JPG_CPU_SSSE3].level = JPG_CPU_SSSE3;
+
+	k = &kernel_levels[JPG_CPU_AVX2];
+	*k = kernel_levels[JPG_CPU_SSSE3];
+	k->level = JPG_CPU_AVX2;
+	k->fdct_float = fdct_float_avx2;
+	k->fdct_integer = fdct_integer_avx2;
+	k->nonzero_mask = nonzero_mask_avx2;
+	k->crc32c = crc32c_sse42;
+
+	k = &kernel_levels[JPG_CPU_AVX512BW];
+	*k = kernel_levels[JPG_CPU_AVX2];
+	k->level = JPG_CPU_AVX512BW;
+	k->fdct_float = fdct_float_avx512;
+	k->fdct_integer = fdct_integer_avx512bw;
+	k->nonzero_mask = nonzero_mask_avx512bw;
+#endif
+
+	cpu_level = jpg_cpu_detect();
+	env_level = read_level_env();
+
+	__atomic_store_n(&kernels_in_use, &kernel_levels[usable_level(JPG_CPU_AUTO)], __ATOMIC_RELEASE);
+}
+
+int read_level_env(void)
+{
+	const char *value = getenv("JPG_CPU_LEVEL");
+	int level = 0;
+
+	if (value == NULL){
+		return JPG_CPU_AUTO;
+	}
+
+	for (level = 0; level < JPG_NUM_CPU_LEVELS; level++){
+		if (strcmp(value, level_names[level]) == 0 || (value[0] == '0' + level && value[1] == '\0')){
+			return level;
+		}
+	}
+
+	return JPG_CPU_AUTO;
+}
+
+int usable_level(int level)
+{
+	if (level == JPG_CPU_AUTO){
+		level = (env_level != JPG_CPU_AUTO && env_level < cpu_level) ? env_level : cpu_level;
+	}
+
+	level = (level < JPG_CPU_SCALAR) ? JPG_CPU_SCALAR : (level > cpu_level) ? cpu_level : level;
+
+	while (level > JPG_CPU_SCALAR && check_kernels(level, SELF_TEST_BLOCKS) != 0){
+		level--;
+	}
+
+	return level;
+}
+
+int check_kernels(int level, int num_blocks)
+{
+	const JpgKernels *k = &kernel_levels[level], *ref = &kernel_levels[JPG_CPU_SCALAR];
+	double samples[64], float_out[64], float_ref[64];
+	short ints[64];
+	int int_out[64], int_ref[64], zz[64];
+	unsigned char y[SELF_TEST_ROW], cb[SELF_TEST_ROW], cr[SELF_TEST_ROW];
+	unsigned char rgb_out[SELF_TEST_ROW * 4], rgb_ref[SELF_TEST_ROW * 4];
+	unsigned int seed = 0x9E3779B9;
+	int failed[6] = {0};
+	int n = 0, i = 0, width = 0, format = 0, size = 0, count = 0;
+
+	for (n = 0; n < num_blocks; n++){
+		for (i = 0; i < 64; i++){
+			samples[i] = (next_random(&seed) % 25600) / 100.0 - 128.0;
+			ints[i] = (short) ((int) (next_random(&seed) % 512) - 256);
+
+			// mostly zeroes like a quantised block, with values that only saturating packs keep non-zero
+			zz[i] = (next_random(&seed) % 4 == 0) ? (int) (next_random(&seed) % 262144) - 131072 : 0;
+			zz[i] = (n == 0) ? 0 : (n == 1) ? (i + 1) << 16 : zz[i];
+		}
+
+		k->fdct_float(samples, float_out);
+		ref->fdct_float(samples, float_ref);
+		failed[0] |= memcmp(float_out, float_ref, sizeof(float_out)) != 0;
+
+		k->fdct_integer(ints, int_out);
+		ref->fdct_integer(ints, int_ref);
+		failed[1] |= memcmp(int_out, int_ref, sizeof(int_out)) != 0;
+
+		failed[2] |= k->nonzero_mask(zz) != ref->nonzero_mask(zz);
+
+		// rows of any width, so the vector loops and the pixels after them are both covered
+		width = 1 + next_random(&seed) % SELF_TEST_ROW;
+		format = (n % 2 == 0) ? JPG_PIXEL_RGB : JPG_PIXEL_BGRA;
+		size = pixel_size(format);
+
+		for (i = 0; i < SELF_TEST_ROW; i++){
+			y[i] = (unsigned char) next_random(&seed);
+			cb[i] = (unsigned char) next_random(&seed);
+			cr[i] = (unsigned char) next_random(&seed);
+		}
+
+		k->ycc_to_rgb_row_h1(y, cb, cr, rgb_out, width, format);
+		ref->ycc_to_rgb_row_h1(y, cb, cr, rgb_ref, width, format);
+		failed[3] |= memcmp(rgb_out, rgb_ref, width * size) != 0;
+
+		k->ycc_to_rgb_row_h2(y, cb, cr, rgb_out, width, format);
+		ref->ycc_to_rgb_row_h2(y, cb, cr, rgb_ref, width, format);
+		failed[4] |= memcmp(rgb_out, rgb_ref, width * size) != 0;
+
+		// the samples of a block or a few bytes less, so the bytes after the wide steps are covered
+		size = sizeof(ints) - next_random(&seed) % 15;
+		failed[5] |= k->crc32c(n, ints, size) != ref->crc32c(n, ints, size);
+	}
+
+	for (i = 0; i < 6; i++){
+		count += failed[i];
+	}
+
+	return count;
+}
+
+unsigned int next_random(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+#ifdef JPG_X86_KERNELS
+
+unsigned long long read_xcr0(void)
+{
+	unsigned int lo = 0, hi = 0;
+
+	__asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+
+	return ((unsigned long long) hi << 32) | lo;
+}
+
+#endif
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "headers/jpg_encode.h"
 #include "headers/block.h"
 #include "headers/dct.h"
+#include "headers/fdct.h"
 
 #ifndef M_PI
 #define M_PI (3.14159265358979323846)
@@ -12,48 +14,154 @@
 
 #define ALPHA(x) (x == 0 ? 1/sqrt(2) : 1)
 
-// performs the DCT-II algorithm to convert a block from the spatial domain
-// into the frequency domain
-// void dct_block(Block b);
+// transforms the blocks of a component with the floating point or fixed point DCT
+void dct_component(Block *blocks, Byte *flat, int num_blocks, int integer);
 
 void dct(JpgData j_data)
+{
+    int integer = (j_data->options.dct_method == JPG_DCT_INTEGER);
+
+    dct_component(j_data->Y, j_data->flat_Y, j_data->num_blocks_Y, integer);
+    dct_component(j_data->Cb, j_data->flat_Cb, j_data->num_blocks_Cb, integer);
+    dct_component(j_data->Cr, j_data->flat_Cr, j_data->num_blocks_Cr, integer);
+}
+
+void dct_component(Block *blocks, Byte *flat, int num_blocks, int integer)
 {
     int i = 0;
 
-    for (i = 0; i < j_data->num_blocks_Y; i++){
-        dct_block(j_data->Y[i]);
-    }
+    for (i = 0; i < num_blocks; i++){
+        if (IS_FLAT(flat, i)){
+            if (integer) dct_flat_block_integer(blocks[i]);
+            else dct_flat_block(blocks[i]);
+        }
 
-    for (i = 0; i < j_data->num_blocks_Cb; i++){
-        dct_block(j_data->Cb[i]);
-    }
+        else if (integer){
+            dct_block_integer(blocks[i]);
+        }
 
-    for (i = 0; i < j_data->num_blocks_Cr; i++){
-        dct_block(j_data->Cr[i]);
+        else{
+            dct_block(blocks[i]);
+        }
     }
 }
 
+void dct_flat_block(Block b)
+{
+    double dc = fdct_float_dc(block_values(b));
+
+    memset(block_values(b), 0, sizeof(double) * 64);
+    set_value_block(b, 0, 0, dc);
+}
+
+void dct_flat_block_integer(Block b)
+{
+    short samples[64];
+
+    fdct_integer_samples(block_values(b), samples);
+    memset(block_values(b), 0, sizeof(double) * 64);
+    set_value_block(b, 0, 0, fdct_integer_dc(samples) / (double) (1 << FDCT_INTEGER_SHIFT));
+}
+
+// builds the 1D transform from the low coefficients of scale neighbouring blocks to the coefficients of one block
+void build_scale_matrix(int scale, double matrix[8][8]);
+
 void dct_block(Block b)
 {
-    int u = 0, v = 0;
-    int x = 0, y = 0;
-    double dct_value = 0.0;
-    Block temp = copy_block(b);
+    double coefficients[64];
 
-    for (u = 0; u < 8; u++){
-        for (v = 0; v < 8; v++){
-            dct_value = 0.0;
-            for (x = 0; x < 8; x++){
-                for (y = 0; y < 8; y++){
-                    dct_value += get_value_block(temp, x, y)
-                                 * cos( ( (2*x + 1) * u * M_PI ) / 16 )
-                                 * cos( ( (2*y + 1) * v * M_PI ) / 16 );
+    jpg_kernels()->fdct_float(block_values(b), coefficients);
+    memcpy(block_values(b), coefficients, sizeof(coefficients));
+}
+
+void dct_block_integer(Block b)
+{
+    double *values = block_values(b);
+    short samples[64];
+    int coefficients[64];
+    int k = 0;
+
+    fdct_integer_samples(values, samples);
+    jpg_kernels()->fdct_integer(samples, coefficients);
+
+    // exact in a double, so rounding it divided by a quantization value rounds like the kernels
+    for (k = 0; k < 64; k++){
+        values[k] = coefficients[k] / (double) (1 << FDCT_INTEGER_SHIFT);
+    }
+}
+
+void dct_downscale(Block *src, int src_width, int src_height, Block *dst, int dst_width, int dst_height, int scale)
+{
+    double matrix[8][8], low[8][8], temp[8][8];
+    double value = 0.0;
+    int k = 8 / scale;
+    int bx = 0, by = 0, sx = 0, sy = 0;
+    int r = 0, c = 0, u = 0, v = 0;
+    Block b = NULL;
+
+    build_scale_matrix(scale, matrix);
+
+    for (by = 0; by < dst_height; by++){
+        for (bx = 0; bx < dst_width; bx++){
+            // low[r][c] holds the low coefficients of the scale x scale source blocks side by side
+            for (r = 0; r < 8; r++){
+                sy = by * scale + r / k;
+                sy = (sy < src_height) ? sy : src_height - 1;
+
+                for (c = 0; c < 8; c++){
+                    sx = bx * scale + c / k;
+                    sx = (sx < src_width) ? sx : src_width - 1;
+
+                    low[r][c] = get_value_block(src[sy * src_width + sx], c % k, r % k);
+                }
+            }
+
+            // rows then columns: dst = matrix * low * matrix^T
+            for (r = 0; r < 8; r++){
+                for (u = 0; u < 8; u++){
+                    temp[r][u] = 0.0;
+                    for (c = 0; c < 8; c++){
+                        temp[r][u] += low[r][c] * matrix[u][c];
+                    }
                 }
             }
 
-            set_value_block(b, u, v, 0.25 * ALPHA(u) * ALPHA(v) * dct_value);
+            b = dst[by * dst_width + bx];
+
+            for (v = 0; v < 8; v++){
+                for (u = 0; u < 8; u++){
+                    value = 0.0;
+                    for (r = 0; r < 8; r++){
+                        value += matrix[v][r] * temp[r][u];
+                    }
+
+                    set_value_block(b, u, v, value);
+                }
+            }
         }
     }
+}
+
+void build_scale_matrix(int scale, double matrix[8][8])
+{
+    int k = 8 / scale;
+    int u = 0, j = 0, x = 0, m = 0;
+    double sum = 0.0, idct = 0.0;
 
-    destroy_block(temp);
+    // column j is coefficient m = j % k of source block j / k. Its k point inverse DCT (scaled by
+    // sqrt(k / 8) so the pixels are averages) gives pixels (j / k) * k + x of the new block, which the
+    // 8 point DCT turns into coefficient u.
+    for (u = 0; u < 8; u++){
+        for (j = 0; j < 8; j++){
+            m = j % k;
+            sum = 0.0;
+
+            for (x = 0; x < k; x++){
+                idct = ((m == 0) ? sqrt(1.0 / k) : sqrt(2.0 / k)) * cos( ( (2*x + 1) * m * M_PI ) / (2 * k) );
+                sum += 0.5 * ALPHA(u) * cos( ( (2*((j / k) * k + x) + 1) * u * M_PI ) / 16 ) * idct;
+            }
+
+            matrix[u][j] = sqrt(k / 8.0) * sum;
+        }
+    }
 }
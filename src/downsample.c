@@ -17,16 +17,16 @@ void chroma_subsample(JpgData j_data)
     }
 
     else{
-        printf("Not doing any Chroma Subsampling.\n");
+        log_message(j_data, JPG_LOG_INFO, "Not doing any Chroma Subsampling.");
     }
 }
 
 void subsample_422(JpgData j_data)
 {
-    printf("4:2:2 not ready yet.\n");
+    log_message(j_data, JPG_LOG_WARNING, "4:2:2 not ready yet.");
 }
 
 void subsample_420(JpgData j_data)
 {
-    printf("4:2:0 not ready yet.\n");
+    log_message(j_data, JPG_LOG_WARNING, "4:2:0 not ready yet.");
 }
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "headers/fdct.h"
+
+#ifdef JPG_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+#define ALPHA(x) (x == 0 ? 1/sqrt(2) : 1)
+
+// shifts right rounding to the nearest
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+// cosines of the 1D DCT: dct_cos[u][x] = ALPHA(u) / 2 * cos((2x + 1)uπ / 16), and transposed
+static double dct_cos[8][8];
+static double dct_cos_t[8][8];
+
+// the cosines scaled by 2^FDCT_FIXED_BITS
+static int dct_fixed[8][8];
+
+// for the SIMD fixed point DCTs, 16 bit cosines side by side so each multiply-add takes two of
+// them: dct_fixed_pairs[v][p] holds dct_fixed[v][2p] (low half) and dct_fixed[v][2p + 1], and
+// dct_fixed_columns[p][2u + i] is dct_fixed[u][2p + i]
+static int dct_fixed_pairs[8][4];
+static short dct_fixed_columns[4][16];
+
+/* ==================================== Function definitions ===================================== */
+
+void init_fdct(void)
+{
+	int u = 0, x = 0, p = 0;
+
+	for (u = 0; u < 8; u++){
+		for (x = 0; x < 8; x++){
+			dct_cos[u][x] = ALPHA(u) / 2 * cos( ( (2*x + 1) * u * M_PI ) / 16 );
+			dct_cos_t[x][u] = dct_cos[u][x];
+			dct_fixed[u][x] = (int) floor(dct_cos[u][x] * (1 << FDCT_FIXED_BITS) + 0.5);
+		}
+	}
+
+	for (u = 0; u < 8; u++){
+		for (p = 0; p < 4; p++){
+			dct_fixed_pairs[u][p] = (int) (((unsigned int) dct_fixed[u][2*p] & 0xFFFF) | ((unsigned int) dct_fixed[u][2*p + 1] << 16));
+			dct_fixed_columns[p][2*u] = (short) dct_fixed[u][2*p];
+			dct_fixed_columns[p][2*u + 1] = (short) dct_fixed[u][2*p + 1];
+		}
+	}
+}
+
+void fdct_float_scalar(const double *samples, double *coefficients)
+{
+	double rows[64], value = 0.0;
+	int x = 0, y = 0, u = 0, v = 0;
+
+	// 1D DCT of each row, then of each column of the result
+	for (y = 0; y < 8; y++){
+		for (u = 0; u < 8; u++){
+			value = 0.0;
+			for (x = 0; x < 8; x++){
+				value += samples[y * 8 + x] * dct_cos[u][x];
+			}
+
+			rows[y * 8 + u] = value;
+		}
+	}
+
+	for (v = 0; v < 8; v++){
+		for (u = 0; u < 8; u++){
+			value = 0.0;
+			for (y = 0; y < 8; y++){
+				value += rows[y * 8 + u] * dct_cos[v][y];
+			}
+
+			coefficients[v * 8 + u] = value;
+		}
+	}
+}
+
+void fdct_integer_scalar(const short *samples, int *coefficients)
+{
+	int columns[64];
+	int x = 0, y = 0, u = 0, v = 0, value = 0;
+
+	// 1D DCT of each column keeping FDCT_PASS_BITS fraction bits, the results fit in 16 bits
+	for (v = 0; v < 8; v++){
+		for (x = 0; x < 8; x++){
+			value = 0;
+			for (y = 0; y < 8; y++){
+				value += dct_fixed[v][y] * samples[y * 8 + x];
+			}
+
+			columns[v * 8 + x] = DESCALE(value, FDCT_FIXED_BITS - FDCT_PASS_BITS);
+		}
+	}
+
+	// then of each row, left scaled up
+	for (v = 0; v < 8; v++){
+		for (u = 0; u < 8; u++){
+			value = 0;
+			for (x = 0; x < 8; x++){
+				value += columns[v * 8 + x] * dct_fixed[u][x];
+			}
+
+			coefficients[v * 8 + u] = value;
+		}
+	}
+}
+
+double fdct_float_dc(const double *samples)
+{
+	double value = 0.0, dc = 0.0;
+	int x = 0, y = 0;
+
+	// u = 0 of each row, then v = 0 of that column, added up in the same order as fdct_float_scalar
+	for (y = 0; y < 8; y++){
+		value = 0.0;
+		for (x = 0; x < 8; x++){
+			value += samples[y * 8 + x] * dct_cos[0][x];
+		}
+
+		dc += value * dct_cos[0][y];
+	}
+
+	return dc;
+}
+
+int fdct_integer_dc(const short *samples)
+{
+	int x = 0, y = 0, value = 0, dc = 0;
+
+	// v = 0 of each column, then u = 0 of that row, as in fdct_integer_scalar
+	for (x = 0; x < 8; x++){
+		value = 0;
+		for (y = 0; y < 8; y++){
+			value += dct_fixed[0][y] * samples[y * 8 + x];
+		}
+
+		dc += DESCALE(value, FDCT_FIXED_BITS - FDCT_PASS_BITS) * dct_fixed[0][x];
+	}
+
+	return dc;
+}
+
+void fdct_integer_samples(const double *values, short *samples)
+{
+	int k = 0, value = 0;
+
+	for (k = 0; k < 64; k++){
+		value = (int) floor(values[k] + 0.5);
+		samples[k] = (short) ((value < -256) ? -256 : (value > 255) ? 255 : value);
+	}
+}
+
+#ifdef JPG_X86_KERNELS
+
+/*
+	The floating point versions work out several u (or a whole row) at once. Each lane adds up the
+	same products in the same order as fdct_float_scalar, with no fused multiply-add, so the
+	results are identical.
+*/
+
+__attribute__((target("sse2")))
+void fdct_float_sse2(const double *samples, double *coefficients)
+{
+	double rows[64];
+	__m128d acc[4], s;
+	int x = 0, y = 0, v = 0, k = 0;
+
+	for (y = 0; y < 8; y++){
+		for (k = 0; k < 4; k++) acc[k] = _mm_setzero_pd();
+
+		for (x = 0; x < 8; x++){
+			s = _mm_set1_pd(samples[y * 8 + x]);
+			for (k = 0; k < 4; k++){
+				acc[k] = _mm_add_pd(acc[k], _mm_mul_pd(s, _mm_loadu_pd(&dct_cos_t[x][2*k])));
+			}
+		}
+
+		for (k = 0; k < 4; k++) _mm_storeu_pd(rows + y * 8 + 2*k, acc[k]);
+	}
+
+	for (v = 0; v < 8; v++){
+		for (k = 0; k < 4; k++) acc[k] = _mm_setzero_pd();
+
+		for (y = 0; y < 8; y++){
+			s = _mm_set1_pd(dct_cos[v][y]);
+			for (k = 0; k < 4; k++){
+				acc[k] = _mm_add_pd(acc[k], _mm_mul_pd(_mm_loadu_pd(rows + y * 8 + 2*k), s));
+			}
+		}
+
+		for (k = 0; k < 4; k++) _mm_storeu_pd(coefficients + v * 8 + 2*k, acc[k]);
+	}
+}
+
+__attribute__((target("avx2")))
+void fdct_float_avx2(const double *samples, double *coefficients)
+{
+	double rows[64];
+	__m256d lo, hi, s;
+	int x = 0, y = 0, v = 0;
+
+	for (y = 0; y < 8; y++){
+		lo = hi = _mm256_setzero_pd();
+
+		for (x = 0; x < 8; x++){
+			s = _mm256_set1_pd(samples[y * 8 + x]);
+			lo = _mm256_add_pd(lo, _mm256_mul_pd(s, _mm256_loadu_pd(&dct_cos_t[x][0])));
+			hi = _mm256_add_pd(hi, _mm256_mul_pd(s, _mm256_loadu_pd(&dct_cos_t[x][4])));
+		}
+
+		_mm256_storeu_pd(rows + y * 8, lo);
+		_mm256_storeu_pd(rows + y * 8 + 4, hi);
+	}
+
+	for (v = 0; v < 8; v++){
+		lo = hi = _mm256_setzero_pd();
+
+		for (y = 0; y < 8; y++){
+			s = _mm256_set1_pd(dct_cos[v][y]);
+			lo = _mm256_add_pd(lo, _mm256_mul_pd(_mm256_loadu_pd(rows + y * 8), s));
+			hi = _mm256_add_pd(hi, _mm256_mul_pd(_mm256_loadu_pd(rows + y * 8 + 4), s));
+		}
+
+		_mm256_storeu_pd(coefficients + v * 8, lo);
+		_mm256_storeu_pd(coefficients + v * 8 + 4, hi);
+	}
+
+	// the upper halves of the registers are cleared for the SSE code that runs next, which GCC only
+	// does by itself when it optimizes
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx512f")))
+void fdct_float_avx512(const double *samples, double *coefficients)
+{
+	double rows[64];
+	__m512d acc;
+	int x = 0, y = 0, v = 0;
+
+	for (y = 0; y < 8; y++){
+		acc = _mm512_setzero_pd();
+
+		for (x = 0; x < 8; x++){
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(_mm512_set1_pd(samples[y * 8 + x]), _mm512_loadu_pd(&dct_cos_t[x][0])));
+		}
+
+		_mm512_storeu_pd(rows + y * 8, acc);
+	}
+
+	for (v = 0; v < 8; v++){
+		acc = _mm512_setzero_pd();
+
+		for (y = 0; y < 8; y++){
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(_mm512_loadu_pd(rows + y * 8), _mm512_set1_pd(dct_cos[v][y])));
+		}
+
+		_mm512_storeu_pd(coefficients + v * 8, acc);
+	}
+
+	_mm256_zeroupper();
+}
+
+/*
+	The fixed point versions multiply 16 bit samples by two cosines at a time (pmaddwd). For the
+	columns, rows y and y + 1 are interleaved so each pair of values meets cosines y and y + 1 of
+	frequency v. For the rows, a pair of values of the column pass meets the cosines of every u.
+*/
+
+// the pair of 16 bit values at x and x + 1 of a row as one 32 bit word (x86 is little endian)
+#define VALUE_PAIR(row, x) ((int) (((unsigned int) (row)[x] & 0xFFFF) | ((unsigned int) (row)[(x) + 1] << 16)))
+
+__attribute__((target("sse2")))
+void fdct_integer_sse2(const short *samples, int *coefficients)
+{
+	const __m128i half = _mm_set1_epi32(1 << (FDCT_FIXED_BITS - FDCT_PASS_BITS - 1));
+	__m128i lo[4], hi[4], acc_lo, acc_hi, cosines;
+	short columns[64];
+	int p = 0, v = 0;
+
+	for (p = 0; p < 4; p++){
+		lo[p] = _mm_unpacklo_epi16(_mm_loadu_si128((const __m128i *) (samples + 16*p)), _mm_loadu_si128((const __m128i *) (samples + 16*p + 8)));
+		hi[p] = _mm_unpackhi_epi16(_mm_loadu_si128((const __m128i *) (samples + 16*p)), _mm_loadu_si128((const __m128i *) (samples + 16*p + 8)));
+	}
+
+	for (v = 0; v < 8; v++){
+		acc_lo = acc_hi = _mm_setzero_si128();
+
+		for (p = 0; p < 4; p++){
+			cosines = _mm_set1_epi32(dct_fixed_pairs[v][p]);
+			acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(lo[p], cosines));
+			acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(hi[p], cosines));
+		}
+
+		acc_lo = _mm_srai_epi32(_mm_add_epi32(acc_lo, half), FDCT_FIXED_BITS - FDCT_PASS_BITS);
+		acc_hi = _mm_srai_epi32(_mm_add_epi32(acc_hi, half), FDCT_FIXED_BITS - FDCT_PASS_BITS);
+		_mm_storeu_si128((__m128i *) (columns + v * 8), _mm_packs_epi32(acc_lo, acc_hi));
+	}
+
+	for (v = 0; v < 8; v++){
+		acc_lo = acc_hi = _mm_setzero_si128();
+
+		for (p = 0; p < 4; p++){
+			cosines = _mm_set1_epi32(VALUE_PAIR(columns + v * 8, 2*p));
+			acc_lo = _mm_add_epi32(acc_lo, _mm_madd_epi16(cosines, _mm_loadu_si128((const __m128i *) &dct_fixed_columns[p][0])));
+			acc_hi = _mm_add_epi32(acc_hi, _mm_madd_epi16(cosines, _mm_loadu_si128((const __m128i *) &dct_fixed_columns[p][8])));
+		}
+
+		_mm_storeu_si128((__m128i *) (coefficients + v * 8), acc_lo);
+		_mm_storeu_si128((__m128i *) (coefficients + v * 8 + 4), acc_hi);
+	}
+}
+
+__attribute__((target("avx2")))
+void fdct_integer_avx2(const short *samples, int *coefficients)
+{
+	const __m256i half = _mm256_set1_epi32(1 << (FDCT_FIXED_BITS - FDCT_PASS_BITS - 1));
+	__m128i a, b;
+	__m256i pairs[4], acc;
+	short columns[64];
+	int p = 0, v = 0;
+
+	// all 8 pairs of rows 2p and 2p + 1 in one register
+	for (p = 0; p < 4; p++){
+		a = _mm_loadu_si128((const __m128i *) (samples + 16*p));
+		b = _mm_loadu_si128((const __m128i *) (samples + 16*p + 8));
+		pairs[p] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, b)), _mm_unpackhi_epi16(a, b), 1);
+	}
+
+	for (v = 0; v < 8; v++){
+		acc = _mm256_setzero_si256();
+
+		for (p = 0; p < 4; p++){
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs[p], _mm256_set1_epi32(dct_fixed_pairs[v][p])));
+		}
+
+		acc = _mm256_srai_epi32(_mm256_add_epi32(acc, half), FDCT_FIXED_BITS - FDCT_PASS_BITS);
+
+		// the pack works within each 128 bit half, the permute puts the 8 values together
+		acc = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc, acc), 0x08);
+		_mm_storeu_si128((__m128i *) (columns + v * 8), _mm256_castsi256_si128(acc));
+	}
+
+	for (v = 0; v < 8; v++){
+		acc = _mm256_setzero_si256();
+
+		for (p = 0; p < 4; p++){
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi32(VALUE_PAIR(columns + v * 8, 2*p)),
+			                                              _mm256_loadu_si256((const __m256i *) dct_fixed_columns[p])));
+		}
+
+		_mm256_storeu_si256((__m256i *) (coefficients + v * 8), acc);
+	}
+
+	_mm256_zeroupper();
+}
+
+// two values of v at once, one in each 256 bit half
+__attribute__((target("avx512bw")))
+void fdct_integer_avx512bw(const short *samples, int *coefficients)
+{
+	const __m512i half = _mm512_set1_epi32(1 << (FDCT_FIXED_BITS - FDCT_PASS_BITS - 1));
+	__m128i a, b;
+	__m512i pairs[4], columns_cos[4], acc;
+	short columns[64];
+	int p = 0, v = 0;
+
+	for (p = 0; p < 4; p++){
+		a = _mm_loadu_si128((const __m128i *) (samples + 16*p));
+		b = _mm_loadu_si128((const __m128i *) (samples + 16*p + 8));
+		pairs[p] = _mm512_broadcast_i64x4(_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(a, b)), _mm_unpackhi_epi16(a, b), 1));
+		columns_cos[p] = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i *) dct_fixed_columns[p]));
+	}
+
+	for (v = 0; v < 8; v += 2){
+		acc = _mm512_setzero_si512();
+
+		for (p = 0; p < 4; p++){
+			acc = _mm512_add_epi32(acc, _mm512_madd_epi16(pairs[p], _mm512_inserti64x4(_mm512_castsi256_si512(
+			      _mm256_set1_epi32(dct_fixed_pairs[v][p])), _mm256_set1_epi32(dct_fixed_pairs[v + 1][p]), 1)));
+		}
+
+		acc = _mm512_srai_epi32(_mm512_add_epi32(acc, half), FDCT_FIXED_BITS - FDCT_PASS_BITS);
+		_mm256_storeu_si256((__m256i *) (columns + v * 8), _mm512_cvtsepi32_epi16(acc));
+	}
+
+	for (v = 0; v < 8; v += 2){
+		acc = _mm512_setzero_si512();
+
+		for (p = 0; p < 4; p++){
+			acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_inserti64x4(_mm512_castsi256_si512(
+			      _mm256_set1_epi32(VALUE_PAIR(columns + v * 8, 2*p))), _mm256_set1_epi32(VALUE_PAIR(columns + v * 8 + 8, 2*p)), 1),
+			      columns_cos[p]));
+		}
+
+		_mm512_storeu_si512((void *) (coefficients + v * 8), acc);
+	}
+
+	_mm256_zeroupper();
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+	This file contains reads and writes of whole files in the background, so a batch of images can
+	read its next inputs and write its finished outputs while the current one is encoded (see
+	jpg_batch.h).
+
+	On Linux the requests are submitted to io_uring when the kernel allows it (the system calls are
+	made directly, liburing isn't needed). The files are opened, sized, read or written and closed
+	through the ring one step after another, so the calling thread never waits on the file system
+	(a close can take a while on network file systems), only a write that fails is removed by it.
+	io_uring needs Linux 5.6 for this. Otherwise, or when asked for, a worker thread per request
+	does blocking calls. Either way requests complete in any order and are collected with async_io_wait, and
+	each one is a span in the trace (see trace.h): "io_read" or "io_write" on a worker, "io_wait" on
+	the thread collecting them.
+*/
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stddef.h>
+
+// backends
+#define JPG_IO_AUTO 0 // io_uring when it is available, otherwise threads
+#define JPG_IO_URING 1
+#define JPG_IO_THREADS 2
+
+// kinds of request
+#define JPG_IO_READ 0
+#define JPG_IO_WRITE 1
+
+typedef struct _async_io *AsyncIo;
+
+// a finished request
+typedef struct _async_io_result{
+	int kind; // JPG_IO_READ or JPG_IO_WRITE
+	int tag; // given with the request
+	unsigned char *data; // read: the contents of the file, freed by the caller. write: NULL (the data was freed)
+	size_t size;
+	int error; // 0 or the errno of the open, read or write that failed
+} AsyncIoResult;
+
+/*
+	Sets up a backend for up to depth requests at a time.
+
+	If NULL is returned then io_uring was asked for and isn't available, or there isn't enough memory
+*/
+AsyncIo create_async_io(int backend, int depth);
+
+// returns JPG_IO_URING or JPG_IO_THREADS
+int async_io_backend(AsyncIo io);
+
+/*
+	Starts reading a whole file. A file that can't be opened completes straight away with its error.
+
+	Input:
+	* filename: it must stay valid until the request completes
+	* tag: returned with the result, e.g. the index of the image
+
+	Output:
+	* 1 if the request was started, 0 if depth requests are already in flight
+*/
+int async_read_file(AsyncIo io, const char *filename, int tag);
+
+// as async_read_file for writing size bytes of data to a file, which takes data and frees it once written
+int async_write_file(AsyncIo io, const char *filename, unsigned char *data, size_t size, int tag);
+
+// requests started and not yet collected
+int async_io_pending(AsyncIo io);
+
+/*
+	Waits for a request to complete.
+
+	Output:
+	* 1 with the result filled in, or 0 if no request is pending
+*/
+int async_io_wait(AsyncIo io, AsyncIoResult *result);
+
+// waits for any requests still pending (their data is freed) and frees the backend
+void destroy_async_io(AsyncIo io);
+
+#endif
@@ -10,6 +10,8 @@
 #ifndef BITMAP_H
 #define BITMAP_H
 
+#include <stddef.h>
+
 // error codes
 #define BMP_SUCCESS 0
 #define BMP_FILE_DOESNT_EXIST 1
@@ -19,6 +21,23 @@
 typedef struct _bitmap *BmpImage;
 typedef unsigned char Byte;
 
+// header fields of a bitmap image
+typedef struct _bmp_info {
+	int width;
+	int height;
+	short bitDepth;
+	int offsetRGB;	// offset to the RGB data
+	long long fileSize;
+} BmpInfo;
+
+/*
+	Reads the rows of a bitmap (or of a raw file of RGB pixels) a strip at a time with positioned
+	reads, for images too large to hold in memory (see jpg_tiled.h). Only the header, the colour
+	table and the rows asked for are read. Offsets are 64 bit so the file may be larger than 4 GB,
+	the size field in the header of such a bitmap is ignored.
+*/
+typedef struct _bmp_strip_reader *BmpStripReader;
+
 /*
 	Opens an existing bitmap image file and returns a handle to it.
 
@@ -28,6 +47,64 @@ typedef unsigned char Byte;
 */
 BmpImage bmp_OpenBitmap(const char *file);
 
+/*
+	As bmp_OpenBitmap for the contents of a bitmap file that has already been read into memory
+	(e.g. by the asynchronous reads of a batch, see jpg_batch.h). The data isn't kept.
+*/
+BmpImage bmp_OpenBitmapFromMemory(const Byte *data, size_t size);
+
+/*
+	Reads the header of a bitmap image without loading the pixel data.
+
+	Only the first few bytes of the file are read, so this is cheap enough to call
+	on every file before deciding whether to open it.
+
+	Returns BMP_SUCCESS or one of the error codes above
+*/
+int bmp_ProbeBitmap(const char *file, BmpInfo *info);
+
+/*
+	Opens a 24-bit or 8-bit bitmap to be read a strip at a time.
+
+	If NULL is returned then the file couldn't be read, isn't a bitmap of those depths or is
+	shorter than its rows
+*/
+BmpStripReader bmp_OpenStrips(const char *file);
+
+/*
+	Opens a raw file of width x height pixels to be read a strip at a time. Each pixel is red,
+	green, blue (a byte each) and the rows go from the top down without padding.
+
+	If NULL is returned then the file couldn't be read or is too short
+*/
+BmpStripReader bmp_OpenRawStrips(const char *file, int width, int height);
+
+/*
+	Reads rows first_row to first_row + num_rows - 1 (counted from the top of the image) into rgb
+	as red, green, blue bytes, width * 3 bytes for each row.
+
+	Returns BMP_SUCCESS or one of the error codes above
+*/
+int bmp_ReadStrip(BmpStripReader reader, int first_row, int num_rows, Byte *rgb);
+
+/*
+	Returns the width and height of the image read in strips, and the size of its file
+*/
+int bmp_GetStripWidth(BmpStripReader reader);
+int bmp_GetStripHeight(BmpStripReader reader);
+long long bmp_GetStripFileSize(BmpStripReader reader);
+
+/*
+	Returns 1 for an 8-bit image whose colour table is all grey (24-bit and raw images return 0,
+	the pixels aren't read ahead of the strips)
+*/
+int bmp_IsStripGrayscale(BmpStripReader reader);
+
+/*
+	Closes the file and frees the reader
+*/
+void bmp_CloseStrips(BmpStripReader reader);
+
 /*
     Returns the red channel data
 */
@@ -43,6 +120,11 @@ Byte *bmp_GetGreen(BmpImage b);
 */
 Byte *bmp_GetBlue(BmpImage b);
 
+/*
+	Returns 1 if every pixel is grey (R == G == B), e.g. an 8-bit greyscale image
+*/
+int bmp_IsGrayscale(BmpImage b);
+
 /*
 	Returns the width of the image
 */
@@ -56,7 +138,7 @@ int bmp_GetHeight(BmpImage b);
 /*
     Returns the number of pixels in the image
 */
-int bmp_GetNumPixels(BmpImage b);
+long long bmp_GetNumPixels(BmpImage b);
 
 /*
 	Dumps information about the BMP file
@@ -66,7 +148,7 @@ void bmp_ShowBmpInfo(BmpImage b);
 /*
 	Determines the file size of the Bitmap image
 */
-int bmp_GetFileSize(BmpImage b);
+long long bmp_GetFileSize(BmpImage b);
 
 /*
 	Displays the last error that occured
@@ -24,6 +24,11 @@ double get_value_block(Block b, int x, int y);
 */
 void set_value_block(Block b, int x, int y, double v);
 
+/*
+    Returns the 64 values of the block, row by row (the value at (x,y) is at y * 8 + x)
+*/
+double *block_values(Block b);
+
 /*
     Returns a copy of the specified block
 */
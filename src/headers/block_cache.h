@@ -0,0 +1,65 @@
+/*
+	A cache of encoded blocks for images that repeat the same 8x8 blocks (backgrounds, text, borders).
+
+	Blocks are keyed on their 64 samples rounded to whole numbers and the quantization table they
+	use, the value is the quantised coefficients in zig-zag order so a hit skips the DCT and
+	quantization. For the floating point DCT the exact values are compared as well. The cache is
+	direct mapped with a fixed number of entries, a new block replaces whatever was in its slot.
+	Keys are hashed with CRC32C (the SSE4.2 instruction when the CPU has it, see cpu_kernels.h).
+*/
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stddef.h>
+
+#include "cpu_kernels.h"
+
+typedef struct _block_cache *BlockCache;
+
+/*
+	Creates an empty cache holding up to num_entries blocks (rounded up to a power of 2).
+
+	If NULL is returned then the cache could not be created
+*/
+BlockCache create_block_cache(int num_entries);
+
+/*
+	Looks up a block.
+
+	Input:
+	* table: the quantization table the block uses (any id that is different for different tables)
+	* samples: the values of the block before the DCT rounded as for the fixed point DCT (see fdct_integer_samples)
+	* values: the values themselves, compared as well when not NULL
+	* hash: set to the hash of the key so block_cache_add doesn't work it out again
+	* zz: set to the quantised coefficients (zig-zag order) on a hit
+
+	Output:
+	* 1 on a hit, 0 on a miss
+*/
+int block_cache_find(BlockCache cache, int table, const short *samples, const double *values, unsigned int *hash, int *zz);
+
+// stores the quantised coefficients of a block that missed, hash comes from block_cache_find
+void block_cache_add(BlockCache cache, int table, const short *samples, const double *values, unsigned int hash, const int *zz);
+
+// number of lookups that hit and missed
+long block_cache_hits(BlockCache cache);
+long block_cache_misses(BlockCache cache);
+
+// frees the cache
+void destroy_block_cache(BlockCache cache);
+
+// CRC32C (Castagnoli) of some bytes, continuing from crc (0 to start), with the version in jpg_kernels
+unsigned int crc32c(unsigned int crc, const void *data, size_t size);
+
+// builds the table of crc32c_scalar, before it is used (see jpg_kernels)
+void init_crc32c(void);
+
+// the versions of crc32c, see cpu_kernels.h
+unsigned int crc32c_scalar(unsigned int crc, const void *data, size_t size);
+
+#ifdef JPG_X86_KERNELS
+unsigned int crc32c_sse42(unsigned int crc, const void *data, size_t size);
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+/*
+	This file contains the registry of the kernels that have SIMD versions: the forward DCTs, the
+	mask of non zero coefficients used by the entropy coder, the CRC32C of the block cache and the
+	colour conversion rows of the decoder.
+
+	The instruction sets of the CPU are read with CPUID (and XGETBV, so the operating system has to
+	save the wider registers too) the first time the kernels are asked for. Each kernel is the best
+	version for the level found, or for a lower level when it has nothing newer. The level can be
+	capped with the JPG_CPU_LEVEL environment variable (scalar, sse2, ssse3, avx2 or avx512bw) or
+	jpg_set_cpu_level, e.g. to compare levels on the same machine. Every version gives exactly the
+	same results as the scalar one, which a self test checks on random blocks before the kernels are
+	first used: a level that fails is dropped for the one below it.
+*/
+
+#ifndef CPU_KERNELS_H
+#define CPU_KERNELS_H
+
+#include <stddef.h>
+
+// SIMD kernels are built for x86 with GCC or Clang, each one with the target attribute of its
+// instruction set so the rest of the code doesn't need it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JPG_X86_KERNELS 1
+#endif
+
+// instruction set levels, each one includes those below it
+#define JPG_CPU_SCALAR 0
+#define JPG_CPU_SSE2 1
+#define JPG_CPU_SSSE3 2
+#define JPG_CPU_AVX2 3 // with SSE4.2 as well
+#define JPG_CPU_AVX512BW 4
+#define JPG_NUM_CPU_LEVELS 5
+
+// for jpg_set_cpu_level: back to the level of the CPU (capped by JPG_CPU_LEVEL)
+#define JPG_CPU_AUTO (-1)
+
+typedef struct _jpg_kernels{
+	int level; // the level the kernels were picked for
+
+	// forward DCTs of a block in row major order, see fdct.h
+	void (*fdct_float)(const double *samples, double *coefficients);
+	void (*fdct_integer)(const short *samples, int *coefficients);
+
+	// bit k is set if coefficient k of a block (zig-zag order) isn't 0
+	unsigned long long (*nonzero_mask)(const int *zz);
+
+	// CRC32C of some bytes continuing from crc, see block_cache.h
+	unsigned int (*crc32c)(unsigned int crc, const void *data, size_t size);
+
+	// YCbCr => RGB / BGRA rows with full size and halved chroma, see upsample.h
+	void (*ycc_to_rgb_row_h1)(const unsigned char *y, const unsigned char *cb, const unsigned char *cr, unsigned char *out, int width, int format);
+	void (*ycc_to_rgb_row_h2)(const unsigned char *y, const unsigned char *cb, const unsigned char *cr, unsigned char *out, int width, int format);
+} JpgKernels;
+
+// returns the kernels in use, picked the first time it is called
+const JpgKernels *jpg_kernels(void);
+
+// returns the highest level the CPU and operating system support
+int jpg_cpu_detect(void);
+
+/*
+	Changes the level of the kernels in use. Levels above what the CPU supports, or that fail the
+	self test, are lowered. It shouldn't be called while images are being encoded or decoded.
+
+	Input:
+	* level: one of the levels above, or JPG_CPU_AUTO
+
+	Output:
+	* the level now in use
+*/
+int jpg_set_cpu_level(int level);
+
+// returns the kernels of a level (e.g. to time them), even one the CPU doesn't support
+const JpgKernels *jpg_kernels_for_level(int level);
+
+/*
+	Checks each kernel of a level against the scalar one on random blocks and rows.
+
+	Output:
+	* the number of kernels whose results differ, 0 if they all match, or -1 if the CPU doesn't
+	support the level
+*/
+int jpg_kernel_self_test(int level, int num_blocks);
+
+// "scalar", "sse2" ... for a level, or "unknown"
+const char *jpg_cpu_level_name(int level);
+
+#endif
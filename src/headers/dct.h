@@ -4,9 +4,35 @@
 #include "jpg_encode.h"
 #include "block.h"
 
-// performs a discrete cosine transformation on the YUV data
+// performs a discrete cosine transformation on the YUV data, with the DCT in its options
 void dct(JpgData j_data);
 
+// floating point DCT of a block, through the fastest version for the CPU (see cpu_kernels.h)
 void dct_block(Block b);
 
+/*
+	Fixed point DCT of a block, as the MCU kernels do it for JPG_DCT_INTEGER: the samples are
+	rounded to integers first and the coefficients left scaled down to the size of dct_block's.
+*/
+void dct_block_integer(Block b);
+
+// DCT of a flat block: only the DC coefficient (the average) is worked out, the others are 0
+void dct_flat_block(Block b);
+
+// as dct_flat_block with the DC value of dct_block_integer
+void dct_flat_block_integer(Block b);
+
+/*
+	Shrinks a component by 2, 4 or 8 without going back to pixels. The low (8 / scale) x (8 / scale)
+	coefficients of each block hold its pixels averaged down to that size, so a block of the smaller
+	image is built from the low coefficients of scale x scale source blocks with one matrix product
+	(the same as an inverse DCT of the low coefficients followed by a DCT).
+
+	Input:
+	* src: DCT blocks of the component, src_width x src_height blocks (row major)
+	* dst: blocks to fill in, dst_width x dst_height blocks. Source blocks past the edge repeat the last row or column.
+	* scale: 1, 2, 4 or 8
+*/
+void dct_downscale(Block *src, int src_width, int src_height, Block *dst, int dst_width, int dst_height, int scale);
+
 #endif
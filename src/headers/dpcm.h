@@ -1,8 +0,0 @@
-#ifndef DPCM_H
-#define DPCM_H
-
-#include "jpg_encode.h"
-
-void dpcm(JpgData jpg_data);
-
-#endif
@@ -0,0 +1,57 @@
+/*
+	Separable forward DCTs of an 8x8 block, with the cosines in tables: a 1D DCT of each row or
+	column and then of each column or row of the result, 2 x 8 x 64 multiplies instead of the 64 x 64
+	of the direct formula. The coefficients are in natural order, the value at (u, v) is at v * 8 + u.
+
+	Each DCT has a scalar version and versions for wider instruction sets that give exactly the same
+	results (the sums are done in the same order, or in integers), see cpu_kernels.h for picking one.
+*/
+
+#ifndef FDCT_H
+#define FDCT_H
+
+#include "cpu_kernels.h"
+
+// fraction bits of the fixed point cosines, and those kept between the two passes
+#define FDCT_FIXED_BITS 13
+#define FDCT_PASS_BITS 2
+
+// the fixed point coefficients are this many bits larger than those of the floating point DCT
+#define FDCT_INTEGER_SHIFT (FDCT_FIXED_BITS + FDCT_PASS_BITS)
+
+// builds the cosine tables, before any of the DCTs are used (see jpg_kernels)
+void init_fdct(void);
+
+/*
+	Floating point DCT, rows then columns. The coefficients are those of the DCT-II, scaled by
+	0.25 * α(u) * α(v).
+*/
+void fdct_float_scalar(const double *samples, double *coefficients);
+
+/*
+	Fixed point DCT, columns then rows. The samples should be within -256 - 255, the coefficients
+	are scaled up by 2^FDCT_INTEGER_SHIFT.
+*/
+void fdct_integer_scalar(const short *samples, int *coefficients);
+
+// rounds the values of a block to the nearest whole number within -256 - 255, for the fixed point DCT
+void fdct_integer_samples(const double *values, short *samples);
+
+/*
+	The DC coefficient alone, exactly as fdct_float_scalar and fdct_integer_scalar (and so every
+	version of them) work it out, for flat blocks that skip the rest of the DCT.
+*/
+double fdct_float_dc(const double *samples);
+int fdct_integer_dc(const short *samples);
+
+#ifdef JPG_X86_KERNELS
+void fdct_float_sse2(const double *samples, double *coefficients);
+void fdct_float_avx2(const double *samples, double *coefficients);
+void fdct_float_avx512(const double *samples, double *coefficients);
+
+void fdct_integer_sse2(const short *samples, int *coefficients);
+void fdct_integer_avx2(const short *samples, int *coefficients);
+void fdct_integer_avx512bw(const short *samples, int *coefficients);
+#endif
+
+#endif
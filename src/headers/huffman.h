@@ -7,8 +7,36 @@
 #define HUFFMAN_H
 
 #include "jpg_encode.h"
+#include "cpu_kernels.h"
 
-// performs huffman encoding of the image data
-void huffman_encode(JpgData j_data);
+// clears the frequencies and code lengths of a table
+void initialize_huffman_data(HuffmanData *huffman_data);
+
+// counts the DC symbol of a block, image_data[0] holds the difference from the previous DC value
+void calculate_freq_block_DC(HuffmanData *huffman_data, int *image_data);
+
+// counts the run length | size symbols of the AC coefficients of a block (zig-zag order)
+void calculate_freq_block_AC(HuffmanData *huffman_data, int *image_data);
+
+// returns the class (number of bits needed to store the magnitude) of a value
+int get_class(int value);
+
+// builds optimal code lengths (bits) and the sorted symbols (huffval) from the frequencies
+void construct_huffman_table(HuffmanData *huffman_data);
+
+/*
+	Builds the optimal table for the frequencies and returns the number of bits the counted
+	symbols take with it, including the bits after each symbol (ac is 1 for an AC table).
+*/
+long estimate_huffman_bits(HuffmanData *huffman_data, int ac);
+
+// bit k of the result is set if coefficient k of a block isn't 0, see nonzero_mask in cpu_kernels.h
+unsigned long long nonzero_mask_scalar(const int *zz);
+
+#ifdef JPG_X86_KERNELS
+unsigned long long nonzero_mask_sse2(const int *zz);
+unsigned long long nonzero_mask_avx2(const int *zz);
+unsigned long long nonzero_mask_avx512bw(const int *zz);
+#endif
 
 #endif
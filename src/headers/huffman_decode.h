@@ -0,0 +1,84 @@
+/*
+    This file contains functions to read the entropy coded segment of a jpeg image.
+
+    The bit reader handles byte stuffing (0xFF00) and stops in front of markers, the
+    huffman tables are built from the BITS and HUFFVAL lists stored at the DHT marker.
+*/
+
+#ifndef HUFFMAN_DECODE_H
+#define HUFFMAN_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// number of bits resolved by a single table lookup when decoding a huffman code
+#define HUFF_LOOKAHEAD 9
+
+typedef unsigned char Byte;
+
+typedef struct _decode_huffman_table{
+    int present;
+
+    // lists stored in the jpeg image
+    Byte bits[17]; // number of codes of each length (index 1 - 16)
+    Byte huffval[256]; // symbols sorted by code length
+
+    // derived tables (F.2.2.3 of the spec)
+    int maxcode[18];
+    int mincode[17];
+    int valptr[17];
+
+    // codes with length <= HUFF_LOOKAHEAD, indexed by the next HUFF_LOOKAHEAD bits
+    Byte look_len[1 << HUFF_LOOKAHEAD]; // 0 if the code is longer
+    Byte look_sym[1 << HUFF_LOOKAHEAD];
+} DecodeHuffmanTable;
+
+typedef struct _bit_reader{
+    const Byte *data;
+    size_t pos; // next byte to read
+    size_t end; // end of the data
+
+    uint64_t buffer; // bits that have been read but not consumed
+    int num_bits; // number of valid bits in the buffer
+
+    int marker; // set once a marker has been reached
+} BitReader;
+
+// natural (row major) position of each zig-zag index
+extern const int natural_order[64];
+
+// builds the derived decoding tables once bits and huffval have been filled in, returns 0 if the
+// code lengths don't fit (more codes of a length than the code space has room for)
+int build_decode_table(DecodeHuffmanTable *table);
+
+// starts reading entropy coded data at data[pos]
+void init_bit_reader(BitReader *br, const Byte *data, size_t pos, size_t end);
+
+// discards the remaining bits and steps over the RSTn marker that ends a restart interval
+void restart_bit_reader(BitReader *br);
+
+// decodes a single huffman coded symbol
+int decode_huffman(BitReader *br, const DecodeHuffmanTable *table);
+
+// reads s bits and converts them to a signed value (F.2.2.1 of the spec)
+int receive_extend(BitReader *br, int s);
+
+// discards n bits (n <= 16)
+void skip_bits(BitReader *br, int n);
+
+/*
+    Decodes one 8x8 block into coef (natural order, not dequantised).
+
+    Input:
+    * dc_pred: DC prediction of the component, updated with the new DC value
+    * num_coefs: number of zig-zag coefficients the caller needs. Symbols past this
+                 point are still decoded to advance the bitstream but their values
+                 are never extended or stored (e.g 1 when only the DC value is needed).
+
+    Output:
+    * 1, or 0 if a symbol has more bits than an 8-bit image can have (corrupt data)
+*/
+int decode_block(BitReader *br, const DecodeHuffmanTable *dc, const DecodeHuffmanTable *ac,
+                 int *dc_pred, short *coef, int num_coefs);
+
+#endif
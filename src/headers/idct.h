@@ -0,0 +1,27 @@
+/*
+    This file contains the inverse discrete cosine transformations used by the decoder.
+
+    Besides the full 8x8 transform there are reduced 4x4, 2x2 and 1x1 (DC only) transforms
+    that only use the low frequency coefficients of a block, these produce the block
+    directly at 1/2, 1/4 and 1/8 of its size.
+*/
+
+#ifndef IDCT_H
+#define IDCT_H
+
+typedef unsigned char Byte;
+
+// builds the cosine tables, must be called before idct_block
+void init_idct(void);
+
+/*
+    Input:
+    * coef: coefficients of the block in natural order
+    * quant: quantization table of the component in natural order
+    * out: first sample of the output block
+    * stride: distance between rows of the output
+    * size: width and height of the output block (8, 4, 2 or 1)
+*/
+void idct_block(const short *coef, const int *quant, Byte *out, int stride, int size);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+	This file contains the encoding of a batch of bmp files with the same options.
+
+	While one image is encoded the next ones are read and the finished ones are written in the
+	background (see async_io.h), so a batch of small images waits on the disk for the first read
+	and the last write instead of for every file. Each input is read whole in one request and
+	decoded from memory (see encode_bmp_memory_to_jpeg in jpg_encode.h), each output is encoded
+	into memory and written in one request. The images are the same as those of
+	encode_bmp_to_jpeg_with_options.
+*/
+
+#ifndef JPG_BATCH_H
+#define JPG_BATCH_H
+
+#include "jpg_encode.h"
+#include "async_io.h"
+
+// an image of a batch
+typedef struct _jpg_batch_item{
+	const char *input_filename;
+	const char *output_filename;
+	int error; // filled in: JPG_ENC_SUCCESS or one of the error codes in jpg_encode.h
+} JpgBatchItem;
+
+/*
+	Encodes a batch of bmp files in order.
+
+	Input:
+	* items: the files, the error of each one is filled in
+	* options: as for encode_bmp_to_jpeg_with_options, the stats are those of the last image
+	* prefetch: inputs read ahead of the one being encoded, also the most outputs still being written
+	* io_backend: JPG_IO_AUTO, JPG_IO_URING or JPG_IO_THREADS (see async_io.h)
+
+	Output:
+	* JPG_ENC_SUCCESS if every image was written, otherwise the first error. JPG_ENC_BAD_OPTIONS if
+	there are no items, prefetch isn't positive or io_uring was asked for and isn't available
+*/
+int encode_bmp_batch(JpgBatchItem *items, int num_items, const JpgEncodeOptions *options, int prefetch, int io_backend);
+
+#endif
@@ -7,4 +7,295 @@
 #ifndef JPG_DEC
 #define JPG_DEC
 
+#include <stddef.h>
+
+#include "huffman_decode.h"
+#include "thread_pool.h"
+#include "upsample.h"
+#include "jpg_write.h"
+
+// Scaling constants, the decoded image is 1 / scale of the original size
+#define JPG_SCALE_FULL 1
+#define JPG_SCALE_HALF 2 // 4x4 inverse DCT per block
+#define JPG_SCALE_QUARTER 4 // 2x2 inverse DCT per block
+#define JPG_SCALE_EIGHTH 8 // DC only, AC coefficients are skipped
+
+// error codes
+#define JPG_DEC_SUCCESS 0
+#define JPG_DEC_FILE_DOESNT_EXIST 1
+#define JPG_DEC_READ_FAILED 2
+#define JPG_DEC_NOT_A_JPEG 3
+#define JPG_DEC_UNSUPPORTED 4
+#define JPG_DEC_CORRUPT 5
+#define JPG_DEC_FAILED_ALLOCATE_BUFFER 6
+#define JPG_DEC_BAD_REGION 7
+
+#define JPG_MAX_COMPONENTS 3
+
+typedef struct _jpeg_decode_data *JpgDecodeData;
+
+typedef struct _decode_component{
+	int id;
+	int h_samp;
+	int v_samp;
+	int quant_table;
+	int dc_table;
+	int ac_table;
+
+	// number of blocks covering the component inside the region (padded to whole MCUs)
+	int width_in_blocks;
+	int height_in_blocks;
+
+	// decoded samples at the output scale
+	Byte *samples;
+	int sample_width;
+	int sample_height;
+} DecodeComponent;
+
+typedef struct _jpeg_decode_data{
+	char *input_filename;
+	int error;
+
+	// contents of the jpeg file
+	Byte *data;
+	size_t size;
+
+	// properties of the JPEG image
+	int width;
+	int height;
+	int num_components;
+	DecodeComponent components[JPG_MAX_COMPONENTS];
+
+	// tables stored in the image, quantization tables are in natural order
+	int quant[4][64];
+	DecodeHuffmanTable dc_tables[4];
+	DecodeHuffmanTable ac_tables[4];
+
+	// MCU layout
+	int max_h;
+	int max_v;
+	int mcus_per_row;
+	int mcu_rows;
+	int restart_interval;
+
+	// the scan (index into components) and where its entropy coded data starts
+	int num_scan_components;
+	int scan_components[JPG_MAX_COMPONENTS];
+	size_t scan_start;
+
+	// start of each restart interval, only indexed when decoding can jump ahead or run in parallel
+	size_t *restart_offsets;
+	int num_restart_offsets;
+	int first_interval; // first interval covering the region
+	int corrupt; // set by the thread of an interval that finds corrupt data
+
+	// region being decoded (pixels of the full size image) and the MCUs covering it
+	int region_x;
+	int region_y;
+	int region_w;
+	int region_h;
+	int first_mcu_col;
+	int last_mcu_col;
+	int first_mcu_row;
+	int last_mcu_row;
+
+	// output settings
+	int scale;
+	int format; // pixel layout (JPG_PIXEL_RGB or JPG_PIXEL_BGRA)
+	int block_size; // size of a decoded block (8 / scale)
+	int output_width;
+	int output_height;
+
+	// threads used to decode restart intervals and convert rows (NULL when decoding serially)
+	int num_threads;
+	ThreadPool pool;
+
+	// output of the decoder, frame is set when the quantised coefficients are read instead of samples
+	Byte *rgb;
+	JpgFrame *frame;
+} JpegDecodeData;
+
+// properties of a JPEG image read from its frame header
+typedef struct _jpeg_info{
+	int width;
+	int height;
+	int num_components;
+	int precision; // bits per sample
+	int sof_marker; // frame type: 0xC0 baseline, 0xC1 extended, 0xC2 progressive etc.
+	int decodable; // 1 if this decoder supports the frame type and component count
+
+	// sampling factors of each component (up to 4, CMYK images have 4 components)
+	int h_samp[4];
+	int v_samp[4];
+} JpegInfo;
+
+// planes of a decoded image before colour conversion
+typedef struct _yuv_image{
+	int width; // size of the Y plane
+	int height;
+	int num_planes; // 1 for greyscale images, otherwise Y, Cb, Cr
+
+	Byte *planes[JPG_MAX_COMPONENTS];
+	int plane_width[JPG_MAX_COMPONENTS]; // subsampled planes are smaller than the image
+	int plane_height[JPG_MAX_COMPONENTS];
+	int stride[JPG_MAX_COMPONENTS]; // bytes between rows, planes are padded to whole MCUs
+} YuvImage;
+
+// where the parts of a baseline image with a single scan are in its file, see read_jpeg_layout
+typedef struct _jpeg_layout{
+	// contents of the file
+	Byte *data;
+	size_t size;
+
+	// size, components (without blocks), quantization tables and restart interval of the image
+	JpgFrame frame;
+
+	// huffman tables of each table set (JpgComponent.huff_table)
+	JpgHuffmanTable dc_tables[2];
+	JpgHuffmanTable ac_tables[2];
+
+	int mcus_per_row;
+	int mcu_rows;
+
+	// start of the entropy coded data of each restart interval (one interval without restart markers).
+	// Interval i ends at the RSTn marker 2 bytes before interval i + 1 and the last one at scan_end.
+	size_t *interval_offsets;
+	int num_intervals;
+	size_t scan_end; // the EOI marker after the scan
+} JpegLayout;
+
+/*
+	Reads the size and sampling of a JPEG image without decoding it.
+
+	The markers are walked with small reads, segments before the frame header (EXIF,
+	ICC profiles etc.) are seeked over and reading stops at the SOF marker, so the
+	entropy coded data is never touched.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* info: filled in with the properties of the image
+
+	Output:
+	* JPG_DEC_SUCCESS or one of the error codes above
+*/
+int probe_jpeg(const char *input_filename, JpegInfo *info);
+
+/*
+	Decodes a baseline JPEG image into interleaved RGB values.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* scale: one of the scaling constants above. Reduced scales use smaller inverse
+	         transforms per block so a thumbnail costs a fraction of a full decode.
+	* width, height: set to the size of the decoded image
+
+	Output:
+	* array of width * height * 3 bytes (R, G, B), or NULL if the image could not be decoded.
+	  The caller frees the array.
+*/
+Byte *decode_jpeg_to_rgb(const char *input_filename, int scale, int *width, int *height);
+
+/*
+	Decodes the part of a baseline JPEG image inside a rectangle into interleaved RGB values.
+
+	Only the MCUs that intersect the rectangle go through the inverse DCT and colour conversion.
+	MCUs above and beside it are entropy decoded just far enough to keep the DC predictions,
+	and when the image has restart markers whole intervals before the rectangle are skipped.
+	Decoding stops after the last MCU row of the rectangle.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* scale: one of the scaling constants above
+	* x, y, w, h: the rectangle in pixels of the full size image, clipped to the image
+	* width, height: set to the size of the decoded region
+
+	Output:
+	* array of width * height * 3 bytes (R, G, B), or NULL if the region could not be decoded.
+	  The caller frees the array.
+*/
+Byte *decode_jpeg_region_to_rgb(const char *input_filename, int scale, int x, int y, int w, int h, int *width, int *height);
+
+/*
+	Decodes a baseline JPEG image into 4 byte B, G, R, A pixels (alpha is always 255), the layout
+	expected by most frame buffers and GPU texture uploads. Takes the same arguments as
+	decode_jpeg_to_rgb and returns an array of width * height * 4 bytes.
+*/
+Byte *decode_jpeg_to_bgra(const char *input_filename, int scale, int *width, int *height);
+
+/*
+	Decodes a baseline JPEG image into its Y, Cb and Cr planes without upsampling or colour
+	conversion, for consumers (video encoders, GPU shaders) that work in YCbCr anyway.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* scale: one of the scaling constants above
+	* yuv: filled in with the planes, release them with free_yuv_image
+
+	Output:
+	* JPG_DEC_SUCCESS or one of the error codes above
+*/
+int decode_jpeg_to_yuv(const char *input_filename, int scale, YuvImage *yuv);
+
+// frees the planes of a decoded image
+void free_yuv_image(YuvImage *yuv);
+
+/*
+	Entropy decodes a baseline JPEG image into its quantised DCT coefficients, without the
+	inverse DCT or colour conversion. The frame can be changed in the DCT domain and written
+	again with write_jpeg.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* frame: filled in with the components (blocks in zig-zag order), quantization tables
+	         and restart interval of the image. Release the blocks with free_jpeg_frame.
+
+	Output:
+	* JPG_DEC_SUCCESS or one of the error codes above
+*/
+int read_jpeg_coefficients(const char *input_filename, JpgFrame *frame);
+
+/*
+	Reads the markers and tables of a baseline JPEG image and finds where each of its restart
+	intervals starts, without decoding any blocks, so intervals can be replaced one at a time.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* layout: filled in with the contents of the file and where its parts are. Release it with free_jpeg_layout.
+
+	Output:
+	* JPG_DEC_SUCCESS or one of the error codes above. JPG_DEC_UNSUPPORTED if the components are
+	  in a different order in the scan than in the frame, or use more than two pairs of huffman tables.
+*/
+int read_jpeg_layout(const char *input_filename, JpegLayout *layout);
+
+// frees the contents and offsets held by a layout
+void free_jpeg_layout(JpegLayout *layout);
+
+/*
+	Decodes a baseline JPEG image into interleaved RGB values using several threads.
+
+	The restart markers (RSTn) of the image are indexed with a quick scan of the entropy
+	coded data, then the restart intervals are decoded and transformed on a thread pool.
+	Images without restart markers are entropy decoded serially, the colour conversion is
+	split between the threads either way.
+
+	Input:
+	* input_filename: name of the JPEG file
+	* scale: one of the scaling constants above
+	* num_threads: number of threads to use (including the calling thread)
+	* width, height: set to the size of the decoded image
+
+	Output:
+	* array of width * height * 3 bytes (R, G, B), or NULL if the image could not be decoded.
+	  The caller frees the array.
+*/
+Byte *decode_jpeg_to_rgb_parallel(const char *input_filename, int scale, int num_threads, int *width, int *height);
+
+/*
+	Sets where the decoder reports why an image couldn't be decoded, as a JPG_LOG_ERROR message (see
+	jpg_encode.h). Nothing is reported while log is NULL, which is the default. It applies to every
+	decode, so it shouldn't be changed while images are being decoded.
+*/
+void set_jpeg_decode_log(JpgLogCallback log, void *context);
+
 #endif
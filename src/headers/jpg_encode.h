@@ -14,10 +14,190 @@
 #define HORIZONTAL_SUBSAMPLING 1 // 4:2:2 chroma subsampling
 #define HORIZONTAL_VERTICAL_SUBSAMPLING 2 // 4:2:0 chroma subsampling
 
+// Effort presets, from the fastest encode to the smallest file (see jpg_preset_options)
+#define JPG_EFFORT_FASTEST 0
+#define JPG_EFFORT_FAST 1
+#define JPG_EFFORT_BALANCED 2
+#define JPG_EFFORT_SMALLEST 3
+#define JPG_NUM_EFFORTS 4
+
+// error codes
+#define JPG_ENC_SUCCESS 0
+#define JPG_ENC_READ_FAILED 1
+#define JPG_ENC_WRITE_FAILED 2
+#define JPG_ENC_FAILED_ALLOCATE_BUFFER 3
+#define JPG_ENC_TARGET_TOO_SMALL 4 // even quality 1 is larger than the target size
+#define JPG_ENC_BAD_OPTIONS 5
+
+#include <stddef.h>
+#include <time.h>
+
 typedef struct _jpeg_data *JpgData;
 
+// 1 if block i of a colour channel is flat (see flat_Y in JpegData)
+#define IS_FLAT(flat, i) ((flat) != NULL && (flat)[i])
+
 typedef unsigned char Byte;
 
+// a scan of a progressive image, defined in jpg_write.h
+typedef struct _jpg_scan JpgScan;
+
+// a growable buffer holding an encoded image, defined in jpg_write.h
+typedef struct _jpg_buffer JpgBuffer;
+
+// stages of an encode (indexes into JpgEncodeStats.stages)
+#define JPG_STAGE_PREPROCESS 0 // reading the input, colour conversion and level shift
+#define JPG_STAGE_SUBSAMPLE 1
+#define JPG_STAGE_DCT 2 // includes quantization and zig-zag ordering unless they're done as stages of their own
+#define JPG_STAGE_QUANTISE 3
+#define JPG_STAGE_ZIG_ZAG 4
+#define JPG_STAGE_HUFFMAN 5 // DC differences, huffman tables and entropy coding into memory
+#define JPG_STAGE_WRITE 6 // writing the file
+#define JPG_NUM_STAGES 7
+
+// hardware performance counters (indexes into JpgStageStats.counters)
+#define JPG_COUNTER_CYCLES 0
+#define JPG_COUNTER_INSTRUCTIONS 1
+#define JPG_COUNTER_L1D_MISSES 2 // level 1 data cache read misses
+#define JPG_COUNTER_LLC_MISSES 3 // last level cache read misses
+#define JPG_COUNTER_BRANCH_MISSES 4
+#define JPG_NUM_COUNTERS 5
+
+// time spent in a stage (milliseconds)
+typedef struct _jpg_stage_stats{
+	double wall_ms;
+	double cpu_ms; // processor time of the whole process
+
+	// counts from the CPU (see hardware_counters), -1 for counters that weren't read
+	long long counters[JPG_NUM_COUNTERS];
+} JpgStageStats;
+
+// counts from an encode
+typedef struct _jpg_encode_stats{
+	int blocks; // blocks in all colour channels
+	int flat_blocks; // blocks that skipped the DCT because they were flat (DC only)
+
+	// lookups in the duplicate block cache (see block_cache_size)
+	long cache_hits;
+	long cache_misses;
+
+	JpgStageStats stages[JPG_NUM_STAGES];
+
+	size_t input_bytes; // size of the bitmap file or the YUV planes
+	size_t output_bytes; // size of the JPEG image
+
+	double zero_ratio; // quantised coefficients that are 0 out of all of them
+
+	// huffman symbols (ZRL and EOB included) coded with the luminance [0] and chrominance [1] tables,
+	// counted as for a baseline scan
+	long dc_symbols[2];
+	long ac_symbols[2];
+
+	long allocations; // heap allocations for the blocks, coefficients and output buffer
+} JpgEncodeStats;
+
+// kinds of log message
+#define JPG_LOG_INFO 0
+#define JPG_LOG_WARNING 1
+#define JPG_LOG_ERROR 2 // only from the decoder (see set_jpeg_decode_log in jpg_decode.h)
+
+// ways of doing the DCT (see dct_method)
+#define JPG_DCT_FLOAT 0 // double precision
+#define JPG_DCT_INTEGER 1 // fixed point with 13 bit cosines, samples rounded to whole numbers first
+
+// for num_threads: one thread per processor
+#define JPG_THREADS_AUTO (-1)
+
+// for progressive: a baseline image is encoded as well and the smaller of the two is written (only
+// by encode_bmp_to_jpeg_with_options and encode_yuv_to_jpeg, otherwise it is the same as 1)
+#define JPG_PROGRESSIVE_IF_SMALLER 2
+
+// receives the messages of the encoder, context is the log_context of the options
+typedef void (*JpgLogCallback)(void *context, int level, const char *message);
+
+typedef struct _jpg_encode_options{
+	int quality; // 1 - 100
+	int sample_ratio; // one of the chroma subsampling constants above
+	int optimize_huffman; // 1 to build huffman tables for the image
+	int restart_interval; // MCUs between restart markers, 0 for none
+
+	// progressive encoding (SOF2), the scans are written in the order of the script
+	int progressive;
+	const JpgScan *scans; // NULL for the standard script (see build_scan_script in jpg_write.h)
+	int num_scans;
+
+	// blocks whose values (in a colour channel) differ by at most this much are coded as their average,
+	// skipping the DCT. 0 only takes blocks that are exactly flat, which code the same as the full DCT,
+	// and a negative value turns this off.
+	double flat_threshold;
+
+	JpgEncodeStats *stats; // filled in when not NULL
+
+	// entries in a cache of encoded blocks so repeated blocks skip the DCT and quantization (see
+	// block_cache.h), 0 for none. Only used by encode_bmp_to_jpeg_with_options.
+	int block_cache_size;
+
+	// progress and warnings go here when not NULL, nothing is printed otherwise
+	JpgLogCallback log;
+	void *log_context;
+
+	// 1 to read the performance counters of the CPU around each stage as well as timing it (only with
+	// stats, Linux only). Counters the CPU, kernel or permissions don't allow are left out. With
+	// num_threads each worker of the MCU kernels counts its own bands, which are added to the DCT stage.
+	int hardware_counters;
+
+	// JPG_DCT_FLOAT or JPG_DCT_INTEGER, the blocks go through the MCU kernel for this DCT (see
+	// mcu_kernel.h). The block cache, target size and variants use the same DCT.
+	int dct_method;
+
+	// threads for the MCU kernels (including the calling thread), 0 or 1 for none or JPG_THREADS_AUTO.
+	// The image is the same for any number of threads.
+	int num_threads;
+
+	// strips in flight between the stages of the tiled encoder (see jpg_tiled.h), which then reads,
+	// transforms and entropy codes them on three threads, 0 for none. Only used by the tiled encoder.
+	int pipeline;
+} JpgEncodeOptions;
+
+// layouts of YUV images
+#define JPG_YUV_I420 0 // 4:2:0, planes of Y then U then V
+#define JPG_YUV_NV12 1 // 4:2:0, a plane of Y then a plane of U and V interleaved (U first)
+#define JPG_YUV_YUYV 2 // 4:2:2, one plane of Y0 U Y1 V for each pair of pixels
+
+// an image in memory from a camera or video decoder
+typedef struct _jpg_yuv_image{
+	int format; // one of the layouts above
+	int width;
+	int height;
+
+	// I420: Y, U and V. NV12: Y and UV. YUYV: the packed pixels. Unused planes are ignored.
+	const Byte *planes[3];
+	int strides[3]; // bytes from the start of one row of a plane to the next
+} JpgYuvImage;
+
+// one of the images made by encode_bmp_to_jpeg_variants
+typedef struct _jpg_output_spec{
+	const char *output_filename;
+	int scale; // 1, 2, 4 or 8: the image is 1 / scale of the original width and height
+	JpgEncodeOptions options; // the sample ratio of the first output is used for all of them
+	int error; // set to JPG_ENC_SUCCESS or one of the error codes above
+} JpgOutputSpec;
+
+// what encode_bmp_to_jpeg_target_size did to reach the target size
+typedef struct _jpg_rate_stats{
+	int quality; // quality of the image written
+	int iterations; // qualities tried in the search (each one is quantised and its size estimated)
+	int passes; // entropy coding passes, 1 unless the estimate was too small
+
+	size_t estimated_size; // bytes, for the quality written
+	size_t size; // bytes written
+
+	// time spent (milliseconds of processor time)
+	double transform_ms; // reading the bitmap, colour conversion and DCT (done once)
+	double search_ms; // quantising and estimating sizes
+	double encode_ms; // entropy coding and writing the file
+} JpgRateStats;
+
 typedef struct _huffman_data{
 	// index is: run_length | size
 
@@ -38,13 +218,36 @@ typedef struct _jpeg_data{
 	char *output_filename;
 	char *input_filename;
 
+	// contents of the input file when it has already been read into memory (see jpg_batch.h), used
+	// instead of input_filename
+	const Byte *input_data;
+	size_t input_size;
+
+	// when not NULL the image is left here instead of being written to output_filename
+	JpgBuffer *output_buffer;
+
 	// properties of the JPEG image
 	int width;
 	int height;
+	int num_components; // 1 for greyscale images (Y only), otherwise 3
+
+	// luminance samples for each chroma sample across and down (2 for subsampled chroma), the chroma
+	// channels cover width_in_blocks / h_samp x height_in_blocks / v_samp blocks
+	int h_samp;
+	int v_samp;
+
+	// blocks covering the image once it is padded to whole MCUs
+	int width_in_blocks;
+	int height_in_blocks;
 
 	// these variables control the quality of the image
 	int sample_ratio;
 	int quality;
+	JpgEncodeOptions options;
+
+	// quantization tables scaled to the quality (natural order)
+	int quant_lum[64];
+	int quant_chr[64];
 
 	// number of blocks in each colour channel
 	int num_blocks_Y;
@@ -56,17 +259,35 @@ typedef struct _jpeg_data{
 	Block *Cb;
 	Block *Cr;
 
+	// 1 for each block that is flat enough to skip the DCT (see flat_threshold), NULL if not known
+	Byte *flat_Y;
+	Byte *flat_Cb;
+	Byte *flat_Cr;
+	int num_flat_blocks;
+
+	long cache_hits;
+	long cache_misses;
+
+	// only kept when the options have stats: time spent in each stage and when the current one
+	// started (see begin_stage), sizes and allocations
+	JpgStageStats stages[JPG_NUM_STAGES];
+	double stage_wall;
+	clock_t stage_clock;
+	struct _perf_counters *perf; // NULL if hardware counters weren't wanted or none could be opened
+	int perf_opened;
+	size_t input_bytes;
+	size_t output_bytes;
+	long allocations;
+
+	// huffman symbols counted by the MCU kernels (luminance DC, AC then chrominance DC, AC), only
+	// when symbols_counted is 1
+	HuffmanData symbol_freq[4];
+	int symbols_counted;
+
 	// zig zag data
 	int **zig_zag_Y;
 	int **zig_zag_Cb;
 	int **zig_zag_Cr;
-
-	// huffman encoding data
-	HuffmanData lum_DC;
-	HuffmanData lum_AC;
-
-	HuffmanData chrom_DC;
-	HuffmanData chrom_AC;
 } JpegData;
 
 /*
@@ -84,6 +305,150 @@ typedef struct _jpeg_data{
 */
 void encode_bmp_to_jpeg(const char *input_filename, const char *output_filename, int quality, int sample_ratio);
 
+/*
+	As encode_bmp_to_jpeg, with the rest of the options chosen by an effort preset.
+
+	Input:
+	* input_filename, output_filename, quality, sample_ratio: as for encode_bmp_to_jpeg
+	* effort: one of the JPG_EFFORT constants
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes above
+*/
+int encode_bmp_to_jpeg_with_effort(const char *input_filename, const char *output_filename, int quality, int sample_ratio, int effort);
+
+/*
+	Fills in options for a quality, sample ratio and effort, so only those need choosing. The other
+	options are cleared and can be changed afterwards (e.g. to add stats).
+
+	fastest:  fixed point DCT, standard huffman tables, blocks within 2 of flat are coded as flat
+	fast:     fixed point DCT, huffman tables built for the image
+	balanced: floating point DCT, huffman tables built for the image
+	smallest: floating point DCT, huffman tables built for the image, progressive unless the
+	          baseline image is smaller (both are entropy coded)
+
+	Every preset uses a thread per processor for the MCU kernels. The fixed point DCT moves a few
+	coefficients by one, the near flat blocks of fastest lose a little detail in smooth areas (see
+	the README for sizes and speeds from jpg_bench).
+
+	Output:
+	* JPG_ENC_SUCCESS, or JPG_ENC_BAD_OPTIONS for an unknown effort
+*/
+int jpg_preset_options(int effort, int quality, int sample_ratio, JpgEncodeOptions *options);
+
+/*
+	Encodes a bmp file with more control over the JPEG image, e.g. progressive output.
+
+	Input:
+	* input_filename: name of the BMP file
+	* output_filename: name of the JPEG file to create
+	* options: quality, subsampling, huffman tables, restart interval and scan script
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes above
+*/
+int encode_bmp_to_jpeg_with_options(const char *input_filename, const char *output_filename, const JpgEncodeOptions *options);
+
+/*
+	As encode_bmp_to_jpeg_with_options for a bitmap file that is already in memory, with the image
+	left in a buffer instead of a file, so the files can be read and written elsewhere (see
+	jpg_batch.h).
+
+	Input:
+	* bmp, size: the contents of a BMP file
+	* out: filled in with the image, its data is freed with free_jpeg_buffer (see jpg_write.h)
+	* options: as for encode_bmp_to_jpeg_with_options
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes above
+*/
+int encode_bmp_memory_to_jpeg(const Byte *bmp, size_t size, JpgBuffer *out, const JpgEncodeOptions *options);
+
+/*
+	Encodes a bmp file with the highest quality that fits in a file size.
+
+	The DCT is done once. The quality is then found with a binary search where each quality is
+	quantised from the same DCT coefficients and its size is estimated from the huffman symbol
+	frequencies, so the image is only entropy coded at the end. Optimal huffman tables are
+	always used. Progressive images are estimated as if they were baseline, which is usually a
+	little larger.
+
+	Input:
+	* input_filename: name of the BMP file
+	* output_filename: name of the JPEG file to create
+	* target_size: largest file size wanted in bytes
+	* options: as for encode_bmp_to_jpeg_with_options, the quality is ignored
+	* stats: filled in with the quality, iterations and time taken (may be NULL)
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes above. With JPG_ENC_TARGET_TOO_SMALL the image is
+	still written at quality 1.
+*/
+int encode_bmp_to_jpeg_target_size(const char *input_filename, const char *output_filename, size_t target_size, const JpgEncodeOptions *options, JpgRateStats *stats);
+
+/*
+	Encodes a bmp file into several JPEG images (e.g. two qualities and a preview) at the cost of
+	about one encode.
+
+	The colour conversion and DCT are done once. Smaller images are made from the DCT coefficients
+	(see dct_downscale) once per scale, and each image is quantised once per quality then entropy
+	coded.
+
+	Input:
+	* input_filename: name of the BMP file
+	* outputs: the images to make, the error of each one is filled in
+	* num_outputs: number of outputs
+
+	Output:
+	* JPG_ENC_SUCCESS if every image was written, otherwise the first error
+*/
+int encode_bmp_to_jpeg_variants(const char *input_filename, JpgOutputSpec *outputs, int num_outputs);
+
+/*
+	Encodes a YUV image (e.g. a camera frame) without any colour conversion or resampling.
+
+	The samples go straight into the blocks, the chroma keeps its own resolution so I420 and NV12 images
+	are written as 4:2:0 and YUYV images as 4:2:2. The samples should be full range (0 - 255) like JFIF,
+	limited range video (16 - 235) is stored as it is and looks a little flat.
+
+	Input:
+	* image: the layout, size and planes of the image
+	* output_filename: name of the JPEG file to create
+	* options: as for encode_bmp_to_jpeg_with_options, the sample ratio comes from the layout
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes above
+*/
+int encode_yuv_to_jpeg(const JpgYuvImage *image, const char *output_filename, const JpgEncodeOptions *options);
+
+/*
+	The stages of the encoder, for tools that run or time them one at a time (see jpg_bench.c).
+	The data from create_jpeg_data goes through preprocess_jpeg (preprocess.h), chroma_subsample,
+	dct, quantise and zig_zag, then write_output codes it into a buffer.
+*/
+JpgData create_jpeg_data(void);
+
+// frees the blocks and the data structure
+void destroy_jpeg_data(JpgData j_data);
+
+// builds a frame from the zig-zag ordered blocks and encodes the JPEG image into a buffer
+int write_output(JpgData j_data, JpgBuffer *out);
+
+// start and end timing a stage (JPG_STAGE_*), which is also a span in a trace (see trace.h). Without
+// stats or a trace these do nothing.
+void begin_stage(JpgData j_data, int stage);
+void end_stage(JpgData j_data, int stage);
+
+// passes a message (printf style) to the log callback of the options, if any
+void log_message(JpgData j_data, int level, const char *format, ...);
+
+/*
+	Adds the symbol frequencies of the blocks of a component to the DC and AC tables (the DC
+	values are differenced first). The blocks are taken in raster order, one per MCU, as they
+	are without subsampling.
+*/
+void count_symbols(int **blocks, int num_blocks, int restart_interval, HuffmanData *dc, HuffmanData *ac);
+
 /*
 	Takes in an array of RGB values in memory and writes it to a JPEG image on disk.
 
@@ -0,0 +1,67 @@
+/*
+	Encodes a stream of YUV frames (all the same size and layout) as Motion JPEG: every frame is a
+	baseline JPEG image and the stream is the images one after another.
+
+	Everything that doesn't depend on the pixels is set up once for the sequence: the quantization
+	and huffman tables, the header bytes, the blocks the DCT works in and the output buffers, so a
+	frame only costs the DCT, quantization and entropy coding of its blocks.
+
+	When unchanged MCUs are detected each frame is compared with the previous one and restart
+	intervals whose samples didn't change reuse the bytes written for them in the previous frame.
+	Intervals are coded on their own (the DC prediction starts again after each restart marker and
+	the huffman tables never change) so the copied bytes are the same as coding them again.
+*/
+
+#ifndef JPG_SEQUENCE_H
+#define JPG_SEQUENCE_H
+
+#include <stddef.h>
+
+#include "jpg_encode.h"
+
+typedef struct _jpg_sequence *JpgSequence;
+
+// counts for all the frames of a sequence so far
+typedef struct _jpg_sequence_stats{
+	int frames;
+	long intervals_encoded; // restart intervals that went through the DCT and entropy coding
+	long intervals_reused; // restart intervals copied from the previous frame
+	size_t bytes; // size of all the images
+} JpgSequenceStats;
+
+/*
+	Sets up the encoder for a sequence.
+
+	Input:
+	* output_filename: file the images are written to, or NULL to only keep them in memory (see jpeg_sequence_frame)
+	* format, width, height: the layout and size of every frame (see JpgYuvImage)
+	* options: quality, restart_interval and flat_threshold are used. The images always use the huffman
+	  tables in Annex K and are never progressive. With detect_unchanged set and no restart interval
+	  the intervals are one row of MCUs.
+	* detect_unchanged: 1 to reuse the intervals that are the same as in the previous frame
+
+	If NULL is returned then the settings don't make sense, the file could not be opened or there
+	wasn't enough memory
+*/
+JpgSequence create_jpeg_sequence(const char *output_filename, int format, int width, int height,
+								 const JpgEncodeOptions *options, int detect_unchanged);
+
+/*
+	Encodes a frame and writes it to the output file (if any).
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes in jpg_encode.h (JPG_ENC_BAD_OPTIONS if the frame
+	  doesn't have the format and size of the sequence)
+*/
+int jpeg_sequence_add_frame(JpgSequence seq, const JpgYuvImage *frame);
+
+// returns the image of the last frame added (NULL before the first one), valid until the next frame is added
+const Byte *jpeg_sequence_frame(JpgSequence seq, size_t *size);
+
+// copies the counts of the sequence so far
+void jpeg_sequence_stats(JpgSequence seq, JpgSequenceStats *stats);
+
+// closes the output file and frees the encoder, returns JPG_ENC_WRITE_FAILED if closing the file failed
+int destroy_jpeg_sequence(JpgSequence seq);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+	This file contains functions for changing part of an existing JPEG image without encoding
+	all of it again.
+
+	The restart intervals of a baseline image can be decoded on their own: the DC prediction
+	starts again after each RSTn marker and the tables are shared by the whole scan. So when a
+	region of the image changes (a watermark, an overlay) only the intervals holding its MCUs
+	are encoded from the new pixels, with the quantization and huffman tables of the image, and
+	put in place of the old ones. Every other interval is copied byte for byte and the restart
+	markers are numbered again in order, so the work depends on the size of the region and not
+	the image.
+*/
+
+#ifndef JPG_SPLICE_H
+#define JPG_SPLICE_H
+
+#include <stddef.h>
+
+#include "jpg_encode.h"
+
+// error codes
+#define JPG_SPLICE_SUCCESS 0
+#define JPG_SPLICE_READ_FAILED 1 // the image could not be read or isn't a baseline JPEG
+#define JPG_SPLICE_WRITE_FAILED 2
+#define JPG_SPLICE_BAD_REGION 3
+#define JPG_SPLICE_FAILED_ALLOCATE_BUFFER 4
+
+// the huffman tables of the image have no code for a symbol of the new blocks (images with tables
+// built for their own contents), the whole image has to be encoded again
+#define JPG_SPLICE_TABLES_INCOMPLETE 5
+
+// what splice_jpeg_region did
+typedef struct _jpg_splice_stats{
+	int intervals; // restart intervals in the image (1 if it has no restart markers)
+	int intervals_encoded; // intervals encoded from the new pixels
+	size_t input_size; // bytes
+	size_t output_size;
+} JpgSpliceStats;
+
+/*
+	Encodes the restart intervals of a JPEG image that overlap a rectangle again from new pixels.
+
+	Input:
+	* input_filename: a baseline JPEG image, ideally with restart markers (an image without them
+	  is one interval, so all of it is encoded again)
+	* output_filename: the changed image is written here (it may be the input file)
+	* rgb: the new pixels of the whole image, width * height * 3 bytes (R, G, B) the same size
+	  as the JPEG image (e.g. from decode_jpeg_to_rgb). Only the pixels of the intervals that
+	  are encoded again are read, so pixels outside the rectangle may change as well if they
+	  share an interval with it.
+	* x, y, w, h: the rectangle that changed (pixels), it is clipped to the image
+	* stats: filled in when not NULL
+
+	Output:
+	* JPG_SPLICE_SUCCESS or one of the error codes above
+*/
+int splice_jpeg_region(const char *input_filename, const char *output_filename, const Byte *rgb,
+					   int x, int y, int w, int h, JpgSpliceStats *stats);
+
+#endif
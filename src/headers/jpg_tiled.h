@@ -0,0 +1,63 @@
+/*
+	This file contains the tiled encoder for images too large to hold in memory, up to the
+	65535 x 65535 pixels a JPEG image can have.
+
+	The input is read a strip of MCU rows at a time with positioned reads (see BmpStripReader in
+	bitmap.h), converted into YCbCr blocks, taken through the MCU kernel and entropy coded straight
+	into the output file (see StreamWriter in jpg_write.h). Memory holds the pixels, blocks and
+	coefficients of one strip whatever the size of the image, a strip is as many MCU rows as fit
+	in JPG_TILED_STRIP_PIXELS (at least one). Sizes and offsets in the files are 64 bit.
+
+	Huffman tables built for the image need its symbols before anything is written, so with
+	optimize_huffman the input is read and transformed twice: once to count the symbols and once
+	to write the image.
+
+	With pipeline in the options the stages run on three threads instead of one after the other:
+	one reads and converts strips, one takes them through the MCU kernel and the calling thread
+	entropy codes them, so reading, the transform and the entropy coder overlap within one image
+	(restart markers aren't needed). The strips are handed on through lock-free rings (see
+	spsc_ring.h) and pipeline is the number of strips in flight, which share the memory of one
+	strip of the serial encoder. Once all of them are in use the reader waits for the entropy
+	coder, which shows in the trace as "free_slots" spans on the tiled_reader thread. The image is
+	the same with or without the pipeline.
+
+	The images are the same as those of encode_bmp_to_jpeg_with_options with the same options,
+	except that:
+	* progressive images are written as baseline (every coefficient would have to be kept)
+	* 24-bit bitmaps are always colour, only an 8-bit bitmap with a grey colour table is greyscale
+	* block_cache_size and num_threads aren't used
+*/
+
+#ifndef JPG_TILED_H
+#define JPG_TILED_H
+
+#include "jpg_encode.h"
+
+// largest width and height of a JPEG image
+#define JPG_TILED_MAX_SIZE 65535
+
+// pixels in a strip of the input, about 40 bytes each once they are blocks and coefficients
+#define JPG_TILED_STRIP_PIXELS (1 << 20)
+
+/*
+	Encodes a bmp file a strip at a time.
+
+	Input:
+	* input_filename: name of the BMP file (24-bit or 8-bit, it may be larger than 4 GB)
+	* output_filename: name of the JPEG file to create
+	* options: as for encode_bmp_to_jpeg_with_options, the stats are filled in except for the
+	  huffman symbol counts
+
+	Output:
+	* JPG_ENC_SUCCESS or one of the error codes in jpg_encode.h, JPG_ENC_BAD_OPTIONS if the image
+	is larger than JPG_TILED_MAX_SIZE
+*/
+int encode_bmp_to_jpeg_tiled(const char *input_filename, const char *output_filename, const JpgEncodeOptions *options);
+
+/*
+	As encode_bmp_to_jpeg_tiled for a raw file of width x height pixels: red, green and blue bytes
+	for each pixel, the rows from the top down without padding.
+*/
+int encode_raw_to_jpeg_tiled(const char *input_filename, int width, int height, const char *output_filename, const JpgEncodeOptions *options);
+
+#endif
@@ -0,0 +1,63 @@
+/*
+	This file contains functions for lossless transformations of JPEG images.
+
+	The image is entropy decoded into its quantised DCT coefficients, rotated, flipped or
+	cropped by moving whole blocks and changing the signs (or order) of coefficients within
+	each block, then entropy coded again. No inverse DCT, colour conversion or forward DCT
+	takes place, so apart from requantization the pixels are exactly the same.
+
+	Like jpegtran's -trim option, flips of an image whose size is not a multiple of the MCU
+	size drop the partial MCUs on the edge that would otherwise move.
+*/
+
+#ifndef JPG_TRANSFORM_H
+#define JPG_TRANSFORM_H
+
+#include "jpg_write.h"
+
+// transformations
+#define JPG_TRANSFORM_NONE 0
+#define JPG_TRANSFORM_FLIP_H 1 // mirror left to right
+#define JPG_TRANSFORM_FLIP_V 2 // mirror top to bottom
+#define JPG_TRANSFORM_TRANSPOSE 3 // across the top left to bottom right diagonal
+#define JPG_TRANSFORM_TRANSVERSE 4 // across the top right to bottom left diagonal
+#define JPG_TRANSFORM_ROTATE_90 5 // clockwise
+#define JPG_TRANSFORM_ROTATE_180 6
+#define JPG_TRANSFORM_ROTATE_270 7
+
+// error codes
+#define JPG_TRANS_SUCCESS 0
+#define JPG_TRANS_READ_FAILED 1
+#define JPG_TRANS_WRITE_FAILED 2
+#define JPG_TRANS_BAD_OPTIONS 3
+#define JPG_TRANS_FAILED_ALLOCATE_BUFFER 4
+
+typedef struct _jpg_transform_options{
+	int transform; // one of the transformations above
+
+	// crop rectangle in pixels of the transformed image, a width or height of 0 keeps the whole
+	// image. The top left corner is moved back to the nearest MCU boundary.
+	int crop_x;
+	int crop_y;
+	int crop_w;
+	int crop_h;
+
+	int quality; // 1 - 100 requantizes with tables no finer than the image's, 0 keeps the tables
+	int optimize_huffman; // 1 to build huffman tables for the result
+} JpgTransformOptions;
+
+/*
+	Transforms a baseline JPEG file and writes the result to another file.
+
+	Output:
+	* JPG_TRANS_SUCCESS or one of the error codes above
+*/
+int transform_jpeg(const char *input_filename, const char *output_filename, const JpgTransformOptions *options);
+
+// applies the transformation, crop and requantization of the options to a frame of coefficients
+int transform_jpeg_frame(JpgFrame *frame, const JpgTransformOptions *options);
+
+// returns the transformation that displays an image with the given EXIF orientation (1 - 8) upright
+int exif_orientation_transform(int orientation);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+	This file contains functions for writing a JPEG image from quantised DCT coefficients.
+
+	The image is built in memory: markers, tables and a single interleaved baseline scan
+	(with optional restart markers). Huffman codes either come from the example tables in
+	Annex K of the spec or are built for the image from a first pass over the coefficients.
+
+	Progressive images (SOF2) are sent as a script of scans. Each scan carries a band of
+	coefficients (spectral selection) and/or some of their bits (successive approximation),
+	and always gets huffman tables built for it since the tables in Annex K have no codes
+	for runs of end of blocks.
+*/
+
+#ifndef JPG_WRITE_H
+#define JPG_WRITE_H
+
+#include <stddef.h>
+
+#include "jpg_encode.h"
+
+// error codes
+#define JPG_WRITE_SUCCESS 0
+#define JPG_WRITE_FAILED_ALLOCATE_BUFFER 1
+#define JPG_WRITE_FAILED 2
+#define JPG_WRITE_BAD_FRAME 3
+
+#define JPG_FRAME_COMPONENTS 3
+
+// scans in the scripts made by build_scan_script
+#define JPG_MAX_SCRIPT_SCANS 10
+
+// huffman table sets
+#define JPG_HUFF_LUMINANCE 0
+#define JPG_HUFF_CHROMINANCE 1
+
+typedef struct _jpg_component{
+	int id;
+	int h_samp;
+	int v_samp;
+	int quant_table; // index into the quantization tables of the frame
+	int huff_table; // one of the huffman table sets above
+
+	// blocks covering the component, padded to whole MCUs (row major)
+	int width_in_blocks;
+	int height_in_blocks;
+
+	// quantised coefficients of each block in zig-zag order, the DC value is not differenced
+	int **blocks;
+	int *coefficients; // storage the blocks point into when allocated in one piece, otherwise NULL
+} JpgComponent;
+
+// a scan of a progressive image (G.1.1 of the spec), JpgScan is declared in jpg_encode.h
+struct _jpg_scan{
+	int num_components;
+	int component_index[JPG_FRAME_COMPONENTS]; // indexes into the components of the frame
+
+	// first and last coefficient (zig-zag order). DC scans (0 - 0) may hold several components,
+	// AC scans hold one
+	int ss;
+	int se;
+
+	// successive approximation: bit position sent by the previous scan of these coefficients (0 for the
+	// first scan) and the bit position of this one
+	int ah;
+	int al;
+};
+
+typedef struct _jpg_frame{
+	int width;
+	int height;
+	int num_components;
+	JpgComponent components[JPG_FRAME_COMPONENTS];
+
+	// quantization tables in natural order
+	int quant[4][64];
+
+	int restart_interval; // MCUs per restart interval, 0 for none
+	int optimize_huffman; // 1 to build huffman tables for the image, 0 to use the tables in Annex K
+
+	// symbol frequencies of a baseline scan already counted for optimize_huffman (luminance DC, AC then
+	// chrominance DC, AC), NULL to count them from the blocks
+	const HuffmanData *symbol_freq;
+
+	// progressive images only
+	int progressive;
+	const JpgScan *scans; // NULL for the script from build_scan_script (with refinement)
+	int num_scans;
+} JpgFrame;
+
+// a growable block of memory holding the encoded image, JpgBuffer is declared in jpg_encode.h
+struct _jpg_buffer{
+	Byte *data;
+	size_t size;
+	size_t capacity;
+	long allocations; // times data was allocated or grown
+};
+
+/*
+	Encodes a frame of quantised coefficients as a baseline (or progressive) JPEG image.
+
+	Input:
+	* frame: the components, tables and settings of the image
+	* out: an empty buffer (zero initialised), the encoded image is appended to it
+
+	Output:
+	* JPG_WRITE_SUCCESS or one of the error codes above
+*/
+int write_jpeg(const JpgFrame *frame, JpgBuffer *out);
+
+/*
+	Counts the huffman symbols a baseline scan of the frame codes with each table set (index
+	JPG_HUFF_LUMINANCE or JPG_HUFF_CHROMINANCE), ZRL and EOB included. The counts are added to
+	dc_symbols and ac_symbols.
+*/
+void count_frame_symbols(const JpgFrame *frame, long dc_symbols[2], long ac_symbols[2]);
+
+/*
+	Fills in the standard scan script for a progressive image: the DC coefficients first,
+	then the low and high AC bands of luminance with the chrominance in between. With
+	refine set the first scans leave out the lowest bits which later scans send.
+
+	Input:
+	* num_components: 1 or 3
+	* refine: 1 to use successive approximation
+	* scans: room for JPG_MAX_SCRIPT_SCANS scans
+
+	Output:
+	* the number of scans
+*/
+int build_scan_script(int num_components, int refine, JpgScan *scans);
+
+/*
+	Writes a baseline image one restart interval at a time, so the entropy coded data of intervals
+	can be kept and reused (e.g. by frames of a video that only change in places). The huffman
+	tables are fixed before any block is seen (the standard ones from Annex K or tables given by
+	the caller) so each interval can be coded on its own.
+*/
+typedef struct _interval_writer *IntervalWriter;
+
+// a huffman table as stored at a DHT marker
+typedef struct _jpg_huffman_table{
+	Byte bits[17]; // number of codes of each length (index 1 - 16)
+	Byte huffval[256]; // symbols sorted by code length
+} JpgHuffmanTable;
+
+/*
+	Builds the huffman codes for a frame. The frame is copied but not its blocks, which are read
+	each time an interval is encoded.
+
+	If NULL is returned then the frame is progressive, not valid or there wasn't enough memory
+*/
+IntervalWriter create_interval_writer(const JpgFrame *frame);
+
+/*
+	As create_interval_writer but the intervals are coded with the DC and AC tables given for each
+	table set, e.g. the tables of an image that is being changed in places.
+*/
+IntervalWriter create_interval_writer_with_tables(const JpgFrame *frame, const JpgHuffmanTable dc[2], const JpgHuffmanTable ac[2]);
+
+// returns the number of restart intervals in the scan (1 if the frame has no restart interval)
+int interval_writer_count(IntervalWriter writer);
+
+// appends the markers and tables before the entropy coded data (SOI to SOS)
+int interval_writer_headers(IntervalWriter writer, JpgBuffer *out);
+
+/*
+	Entropy codes restart interval i from the blocks of the frame and appends it, followed by its
+	RST marker unless it is the last interval.
+
+	Output:
+	* JPG_WRITE_SUCCESS, JPG_WRITE_BAD_FRAME if a block needs a symbol the tables have no code
+	  for, or JPG_WRITE_FAILED_ALLOCATE_BUFFER
+*/
+int interval_writer_encode(IntervalWriter writer, int i, JpgBuffer *out);
+
+// appends the EOI marker
+int interval_writer_end(IntervalWriter writer, JpgBuffer *out);
+
+// frees the writer
+void destroy_interval_writer(IntervalWriter writer);
+
+/*
+	Writes a baseline image to a file a strip of MCU rows at a time, so only the coefficients of one
+	strip have to be in memory (see jpg_tiled.h). The blocks of the components in the frame cover a
+	strip: whole rows of MCUs from the top of the strip, width_in_blocks across and height_in_blocks
+	down. Each strip is entropy coded into a buffer that is written to the file and emptied.
+
+	Like the interval writer the huffman tables are fixed before any block is seen. For
+	optimize_huffman they are built from the symbol_freq of the frame, which has to be counted over
+	the whole image beforehand.
+*/
+typedef struct _stream_writer *StreamWriter;
+
+/*
+	Builds the huffman codes for a frame and writes the markers and tables before the entropy coded
+	data (SOI to SOS) to fp, which is left open. The frame is copied but not its blocks.
+
+	If NULL is returned then the frame is progressive, not valid, has optimize_huffman without
+	symbol_freq, or the headers couldn't be written
+*/
+StreamWriter create_stream_writer(const JpgFrame *frame, FILE *fp);
+
+/*
+	Entropy codes the next num_rows rows of MCUs from the blocks of the frame (the first of them is
+	the top row of the blocks) and writes them to the file, restart markers included. Rows past the
+	bottom of the image are ignored.
+
+	Output:
+	* JPG_WRITE_SUCCESS, JPG_WRITE_BAD_FRAME if a block needs a symbol the tables have no code for
+	  or the blocks don't hold num_rows rows, JPG_WRITE_FAILED_ALLOCATE_BUFFER or JPG_WRITE_FAILED
+*/
+int stream_writer_encode(StreamWriter writer, int num_rows);
+
+// points the writer at other blocks for the next strip (blocks[i] for component i, with the same
+// size as those of the frame), e.g. when strips are double buffered
+void stream_writer_set_blocks(StreamWriter writer, int **blocks[]);
+
+// pads the last byte and writes the EOI marker (every row should have been encoded)
+int stream_writer_end(StreamWriter writer);
+
+// bytes written to the file so far
+long long stream_writer_bytes(StreamWriter writer);
+
+// frees the writer, the file isn't closed
+void destroy_stream_writer(StreamWriter writer);
+
+// appends bytes to a buffer, returns 0 if there wasn't enough memory
+int append_bytes(JpgBuffer *out, const Byte *bytes, size_t n);
+
+// writes the contents of a buffer to a file
+int write_jpeg_file(const char *filename, const JpgBuffer *buffer);
+
+// frees the memory held by a buffer
+void free_jpeg_buffer(JpgBuffer *buffer);
+
+// frees coefficient blocks allocated in one piece (JpgComponent.coefficients)
+void free_jpeg_frame(JpgFrame *frame);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+	This file contains the kernels that take the blocks of one MCU through the DCT, quantization and
+	zig-zag ordering in a single pass, counting their huffman symbols as well when the image gets
+	tables of its own.
+
+	A kernel is generated at compile time (see DEFINE_MCU_KERNEL in mcu_kernel.c) for each layout of
+	MCU (4:4:4, 4:2:2, 4:2:0 and greyscale), DCT (floating point or fixed point) and kind of huffman
+	table (standard or optimized), so the number of blocks in an MCU, where they are and which table
+	each one uses are constants. The kernel for an image is picked once with select_mcu_kernel.
+*/
+
+#ifndef MCU_KERNEL_H
+#define MCU_KERNEL_H
+
+#include "jpg_encode.h"
+#include "cpu_kernels.h"
+
+// what the kernels of an image share
+typedef struct _mcu_state{
+	const JpgKernels *kernels; // the DCTs for the CPU
+
+	// quantization tables (natural order) of the luminance [0] and chrominance [1], for the fixed point
+	// DCT they are scaled up to the precision of its coefficients
+	int quant[2][64];
+	int quant_shift; // bits they are scaled up by, 0 for the floating point DCT
+
+	int dc_pred[3]; // DC value of the last block of each component, for counting the DC differences
+
+	// symbol frequencies: luminance DC, AC then chrominance DC, AC (only counted by the optimized kernels)
+	HuffmanData *freq;
+} McuState;
+
+// encodes the MCU at (mx, my), in MCUs from the top left of the image
+typedef void (*McuKernel)(JpgData j_data, McuState *state, int mx, int my);
+
+/*
+	Returns the kernel for the layout of an image (its components and sampling factors), the
+	DCT in its options and whether it gets optimal huffman tables, or NULL if there isn't one.
+*/
+McuKernel select_mcu_kernel(JpgData j_data);
+
+// as select_mcu_kernel, with count 1 for a kernel that counts the huffman symbols or 0 for one that doesn't
+McuKernel select_mcu_kernel_for(JpgData j_data, int count);
+
+/*
+	Sets up the state the kernels of an image share: the quantization tables for its quality (also
+	left in quant_lum and quant_chr), the kernels for the CPU and the DC predictions at 0. freq is
+	left NULL for the caller to point at its symbol counts.
+*/
+void init_mcu_state(JpgData j_data, McuState *state);
+
+/*
+	DCT, quantization and zig-zag ordering of one block as the kernels do it, for code that goes
+	through the blocks in its own order. flat is 1 for a block marked flat, t the quantization
+	table (0 luminance, 1 chrominance), the DCT is the one init_mcu_state was set up for.
+*/
+void transform_block(const McuState *state, Block b, int flat, int t, int *zz);
+
+/*
+	DCT, quantization and zig-zag ordering of every block of the image, an MCU at a time through
+	the kernel from select_mcu_kernel. For optimal huffman tables of a baseline image the symbol
+	frequencies are left in symbol_freq so the writer doesn't count them again.
+
+	With num_threads in the options the rows of MCUs are split into a band per thread, each with
+	its own symbol counts that are added up afterwards. The coefficients and counts are the same
+	for any number of threads. With hardware counters a worker counts the bands it does and they
+	are added to the DCT stage.
+
+	Output:
+	* JPG_ENC_SUCCESS, JPG_ENC_BAD_OPTIONS when there's no kernel for the image, or
+	JPG_ENC_FAILED_ALLOCATE_BUFFER
+*/
+int transform_mcus(JpgData j_data);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+	This file contains functions for reading the hardware performance counters of the CPU (cycles,
+	instructions, cache and branch misses) around a piece of code, with perf_event_open on Linux.
+
+	Each counter is opened on its own, so a counter the CPU or kernel doesn't have (e.g. in a
+	virtual machine, or with perf_event_paranoid set too high) is left out without losing the
+	others. Only the calling thread is counted, in user space, so work handed to other threads
+	needs counters of its own (see transform_mcus in mcu_kernel.h). On other systems no counter is
+	ever available.
+*/
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "jpg_encode.h"
+
+typedef struct _perf_counters *PerfCounters;
+
+// opens the counters in JPG_COUNTER_*, returns NULL if none of them are available (or no memory)
+PerfCounters open_perf_counters(void);
+
+// 1 if the counter was opened
+int perf_counter_available(PerfCounters counters, int counter);
+
+// sets the counters to 0 and starts counting
+void start_perf_counters(PerfCounters counters);
+
+// stops counting and adds the counts since start_perf_counters to values (counters that aren't available are skipped)
+void add_perf_counters(PerfCounters counters, long long values[JPG_NUM_COUNTERS]);
+
+void close_perf_counters(PerfCounters counters);
+
+#endif
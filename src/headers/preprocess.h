@@ -6,4 +6,47 @@
 // preps the RGB values for JPEG compression
 void preprocess_jpeg(JpgData j_data);
 
+/*
+	Builds the blocks straight from the samples of a YUV image (level shifted, no colour conversion).
+
+	Output:
+	* JPG_ENC_SUCCESS, or JPG_ENC_BAD_OPTIONS if the layout, size or strides don't make sense
+*/
+int preprocess_yuv(JpgData j_data, const JpgYuvImage *image);
+
+// where the samples of one channel of a YUV image are, step is the number of bytes between samples
+typedef struct _yuv_plane{
+	const Byte *samples;
+	int stride;
+	int step;
+	int width;
+	int height;
+} YuvPlane;
+
+/*
+	Finds the planes of the Y, U and V channels of an image and how much the chroma is subsampled.
+
+	Output:
+	* JPG_ENC_SUCCESS, or JPG_ENC_BAD_OPTIONS if the layout, size or strides don't make sense
+*/
+int yuv_planes(const JpgYuvImage *image, YuvPlane planes[3], int *h_samp, int *v_samp);
+
+/*
+	Copies (and level shifts) block (bx, by) of a plane, samples past the edge repeat the last row
+	and column. Returns 1 if the block is flat (no more than threshold between its samples).
+*/
+int fill_block(Block b, const YuvPlane *plane, int bx, int by, double threshold);
+
+/*
+	Converts rows of RGB pixels (red, green, blue bytes, width * 3 for each row) into the level
+	shifted blocks of j_data and finds the flat ones, as preprocess_jpeg does for a whole bitmap.
+	The pixels are rows first_row to first_row + num_rows - 1 of the image and fill the first
+	num_blocks blocks of each channel, width_in_blocks across. Pixels past the right or bottom edge
+	repeat the last column and row.
+*/
+void convert_rgb_rows(JpgData j_data, const Byte *rgb, int first_row, int num_rows, int num_blocks);
+
+// sets the number of blocks covering the image once it is padded to whole MCUs
+void determine_resolutions(JpgData j_data);
+
 #endif
@@ -6,10 +6,28 @@
 
 #define TABLE_SIZE 8
 
-void quantise_lum(Block b);
-void quantise_chr(Block b);
+// divides each coefficient of a block by its entry in a table (natural order) and rounds it
+void quantise_block(Block b, const int *table);
 
 // perform quantization on he image data
 void quantise(JpgData j_data);
 
+/*
+	Quantises the DCT blocks straight into the zig-zag ordered blocks (see allocate_zig_zag).
+	The DCT blocks are left untouched so they can be quantised again at another quality.
+*/
+void quantise_coefficients(JpgData j_data);
+
+// quantises a block with a table (natural order) into zig-zag order
+void quantise_zig_zag(Block b, const int *table, int *zz);
+
+// quantises a flat block (only the DC coefficient is set) into zig-zag order
+void quantise_flat_zig_zag(Block b, const int *table, int *zz);
+
+/*
+	Scales one of the tables in tables.h to a quality setting (1 - 100), the values are
+	limited to 1 - 255 so they fit in a baseline image. The table is in natural order.
+*/
+void build_quant_table(const int base[TABLE_SIZE][TABLE_SIZE], int quality, int *table);
+
 #endif
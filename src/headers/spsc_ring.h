@@ -0,0 +1,38 @@
+/*
+	This file contains a bounded ring buffer of ints between one producer thread and one consumer
+	thread, used to hand work from one stage of a pipeline to the next.
+
+	Pushing and popping don't take a lock while the ring has room and values: each side only
+	writes its own position and reads the other one with atomics. A producer that finds the ring
+	full or a consumer that finds it empty sleeps on a condition variable until the other side moves,
+	so a slow stage holds back the stage before it (backpressure) instead of letting work pile up.
+	Time spent waiting shows in the trace (see trace.h) as a span with the name of the ring, its
+	index is 1 for a producer waiting for room and 0 for a consumer waiting for a value.
+*/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+typedef struct _spsc_ring *SpscRing;
+
+/*
+	Creates a ring.
+
+	Input:
+	* capacity: values the ring holds before a push waits
+	* name: of its waits in the trace, it must stay valid until stop_trace (e.g. a string literal)
+
+	If NULL is returned then the ring could not be created
+*/
+SpscRing create_spsc_ring(int capacity, const char *name);
+
+// adds a value at the back, waiting while the ring is full (producer thread only)
+void spsc_ring_push(SpscRing ring, int value);
+
+// removes the value at the front, waiting while the ring is empty (consumer thread only)
+int spsc_ring_pop(SpscRing ring);
+
+// frees a ring, neither thread should be using it
+void destroy_spsc_ring(SpscRing ring);
+
+#endif
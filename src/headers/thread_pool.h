@@ -0,0 +1,32 @@
+/*
+    A small pool of worker threads for splitting work into independent tasks.
+
+    The thread calling thread_pool_run works on the tasks as well, so a pool of
+    n threads starts n - 1 workers.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+typedef struct _thread_pool *ThreadPool;
+
+// a task receives the argument given to thread_pool_run and its index
+typedef void (*ThreadTask)(void *arg, int index);
+
+/*
+    Starts the worker threads.
+
+    If NULL is returned then the pool could not be created
+*/
+ThreadPool create_thread_pool(int num_threads);
+
+// returns the number of threads working on tasks (including the caller)
+int thread_pool_size(ThreadPool pool);
+
+// runs task(arg, i) for 0 <= i < num_tasks and returns once all of them have finished
+void thread_pool_run(ThreadPool pool, ThreadTask task, void *arg, int num_tasks);
+
+// stops the worker threads and frees the pool
+void destroy_thread_pool(ThreadPool pool);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+	This file contains a tracer that records when each piece of work (a stage of the encoder, a
+	restart interval or band of rows on a worker thread, a frame) starts and ends, and writes it
+	as a Chrome trace event file. The file opens in Perfetto (ui.perfetto.dev) or chrome://tracing
+	with a row for each thread, so uneven work and threads waiting on each other stand out.
+
+	Each thread records into a ring buffer of its own without taking a lock: the newest events are
+	kept and older ones are overwritten when it is full. A span is stored once it ends, with its
+	start time and duration. When tracing is off trace_begin and trace_end only check a flag.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// error codes
+#define JPG_TRACE_SUCCESS 0
+#define JPG_TRACE_NOT_STARTED 1
+#define JPG_TRACE_WRITE_FAILED 2
+#define JPG_TRACE_FAILED_ALLOCATE_BUFFER 3
+
+// spans a thread can have open inside each other, deeper ones are not recorded
+#define JPG_TRACE_MAX_DEPTH 16
+
+/*
+	Starts recording.
+
+	Input:
+	* events_per_thread: spans kept by each thread (the newest ones), e.g. 65536
+
+	Output:
+	* JPG_TRACE_SUCCESS or one of the error codes above
+*/
+int start_trace(int events_per_thread);
+
+/*
+	Stops recording and writes the spans of every thread to a file. It should be called once the
+	work being traced has finished, the buffers are freed.
+
+	Input:
+	* filename: the JSON trace file to write
+
+	Output:
+	* JPG_TRACE_SUCCESS or one of the error codes above
+*/
+int stop_trace(const char *filename);
+
+// start and end a span on the calling thread. name must stay valid until stop_trace (e.g. a string
+// literal), index tells spans with the same name apart (a band, interval or frame, -1 for none)
+void trace_begin(const char *name, int index);
+void trace_end(void);
+
+// names the calling thread in the trace (e.g. "worker"), it must stay valid until stop_trace
+void trace_thread_name(const char *name);
+
+#endif
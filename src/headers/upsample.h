@@ -0,0 +1,54 @@
+/*
+    This file contains functions for upsampling the chroma components of a decoded image
+    and converting YCbCr => RGB in a single pass ("merged" upsampling).
+
+    Subsampled chroma rows are read directly, a chroma sample is converted once and used for
+    every pixel it covers, so full resolution Cb and Cr planes are never built. The conversion
+    uses fixed point tables, with SSE2 kernels for the common 4:4:4, 4:2:2 and 4:2:0 layouts
+    that give identical results (picked at run time, see cpu_kernels.h).
+*/
+
+#ifndef UPSAMPLE_H
+#define UPSAMPLE_H
+
+#include "cpu_kernels.h"
+
+typedef unsigned char Byte;
+
+// layouts of the decoded pixels
+#define JPG_PIXEL_RGB 0 // 3 bytes per pixel: R, G, B
+#define JPG_PIXEL_BGRA 1 // 4 bytes per pixel: B, G, R, 255
+
+// builds the conversion tables, must be called before converting any rows
+void init_upsample(void);
+
+// returns the number of bytes per pixel of a pixel layout
+int pixel_size(int format);
+
+/*
+    Converts one row of YCbCr samples into pixels.
+
+    Input:
+    * y: luminance samples of the row
+    * cb, cr: chroma samples of the row, each covers h_factor luminance samples
+    * phase: number of luminance samples of the first chroma sample that come before the row
+    * out: first pixel of the output row
+    * width: number of pixels to convert
+    * h_factor: horizontal upsampling factor (1 for 4:4:4, 2 for 4:2:2 and 4:2:0, or more)
+    * format: one of the pixel layouts above
+*/
+void ycc_to_rgb_row(const Byte *y, const Byte *cb, const Byte *cr, int phase, Byte *out, int width, int h_factor, int format);
+
+// converts one row of greyscale samples into pixels
+void gray_to_rgb_row(const Byte *y, Byte *out, int width, int format);
+
+// rows with full size (h1) and halved (h2) chroma, from the start of a chroma sample
+void ycc_to_rgb_row_h1_scalar(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format);
+void ycc_to_rgb_row_h2_scalar(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format);
+
+#ifdef JPG_X86_KERNELS
+void ycc_to_rgb_row_h1_sse2(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format);
+void ycc_to_rgb_row_h2_sse2(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format);
+#endif
+
+#endif
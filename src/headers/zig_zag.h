@@ -4,9 +4,15 @@
 #include "jpg_encode.h"
 #include "block.h"
 
+// position of each coefficient (row, column) in the zig-zag order
+extern const int scan_order[8][8];
+
 // groups pixel data in a zig-zag formation
 void zig_zag(JpgData j_data);
 
+// allocates the zig-zag ordered blocks of each colour channel (once)
+void allocate_zig_zag(JpgData j_data);
+
 // groups the pixel data of a single block in zig-zag formation
 void zig_zag_block(Block b, int *zz);
 
@@ -4,100 +4,64 @@
 
 #include "headers/huffman.h"
 #include "headers/block.h"
+#include "headers/cpu_kernels.h"
 
-// intializes huffman data structures
-void initialize_huffman(JpgData j_data);
+#ifdef JPG_X86_KERNELS
+#include <immintrin.h>
+#endif
 
-// calculates frequencies for a block of image data
-void calculate_freq_block_DC(HuffmanData *huffman_data, int *image_data);
-
-// performs run length encoding on the AC coefficients
-void calculate_freq_block_AC(HuffmanData *huffman_data, int *image_data);
-
-// returns the class of a value
-int get_class(int value);
-
-// constructs the huffman table for the image data
-void construct_huffman_table(HuffmanData *huffman_data);
-
-void huffman_encode(JpgData j_data)
-{
-    int i = 0;
-
-    initialize_huffman(j_data);
-
-    for (i = 0; i < j_data->num_blocks_Y; i++){
-        calculate_freq_block_DC(&j_data->lum_DC, j_data->zig_zag_Y[i]);
-        calculate_freq_block_AC(&j_data->lum_AC, j_data->zig_zag_Y[i]);
-    }
-
-    for (i = 0; i < j_data->num_blocks_Cb; i++){
-        calculate_freq_block_DC(&j_data->chrom_DC, j_data->zig_zag_Cb[i]);
-        calculate_freq_block_AC(&j_data->chrom_AC, j_data->zig_zag_Cb[i]);
-    }
-
-    for (i = 0; i < j_data->num_blocks_Cr; i++){
-        calculate_freq_block_DC(&j_data->chrom_DC, j_data->zig_zag_Cr[i]);
-        calculate_freq_block_AC(&j_data->chrom_AC, j_data->zig_zag_Cr[i]);
-    }
-
-    construct_huffman_table(&j_data->lum_DC);
-    construct_huffman_table(&j_data->lum_AC);
-
-    construct_huffman_table(&j_data->chrom_DC);
-    construct_huffman_table(&j_data->chrom_AC);
-}
-
-void initialize_huffman(JpgData j_data)
+void initialize_huffman_data(HuffmanData *huffman_data)
 {
-    // reserve one code point
-    j_data->lum_DC.freq[256] = j_data->lum_AC.freq[256] = j_data->chrom_DC.freq[256] = j_data->chrom_AC.freq[256] = 1;
-
     int i = 0;
 
-    for (i = 0; i < 256; i++){
-        j_data->lum_DC.freq[i] = j_data->lum_AC.freq[i] = j_data->chrom_DC.freq[i] = j_data->chrom_AC.freq[i] = 0;
+    for (i = 0; i < 257; i++){
+        huffman_data->freq[i] = 0;
+        huffman_data->code_len[i] = 0;
+        huffman_data->others[i] = -1;
     }
 
-    for (i = 0; i <= 256; i++){
-        j_data->lum_DC.code_len[i] = j_data->lum_AC.code_len[i] = j_data->chrom_DC.code_len[i] = j_data->chrom_AC.code_len[i] = 0;
-        j_data->lum_DC.others[i] = j_data->lum_AC.others[i] = j_data->chrom_DC.others[i] = j_data->chrom_AC.others[i] = -1;
-    }
+    // reserve one code point so no code is all 1 bits
+    huffman_data->freq[256] = 1;
 
     for (i = 0; i < 32; i++){
-        j_data->lum_AC.bits[i] = j_data->lum_DC.bits[i] = j_data->chrom_DC.bits[i] = j_data->chrom_AC.bits[i] = 0;
+        huffman_data->bits[i] = 0;
     }
 
     for (i = 0; i < 256; i++){
-        j_data->lum_DC.huffval[i] = j_data->lum_AC.huffval[i] = j_data->chrom_DC.huffval[i] = j_data->chrom_AC.huffval[i] = 0;
+        huffman_data->huffval[i] = 0;
     }
 }
 
 void construct_huffman_table(HuffmanData *huffman_data)
 {
+    int freq[257], bits[258];
     int v1 = -1, v2 = -1;
-    int i = 0;
+    int i = 0, j = 0, k = 0;
 
-    // find huffman code sizes
+    // the frequencies are kept so they can still be used to estimate the size of the image
+    for (i = 0; i < 257; i++){
+        freq[i] = huffman_data->freq[i];
+        huffman_data->code_len[i] = 0;
+        huffman_data->others[i] = -1;
+    }
+
+    for (i = 0; i < 258; i++){
+        bits[i] = 0;
+    }
+
+    // find huffman code sizes (K.2 of the spec)
     while (1){
-        // get an initial value for v1
-        for (i = 0; i < 257; i++){
-            if (huffman_data->freq[i] > 0){
-                v1 = i;
-                break;
-            }
-        }
+        v1 = v2 = -1;
 
-        // find smallest v1 such that freq[v1] > 0
+        // smallest frequencies, ties go to the larger value so the reserved code point gets the longest code
         for (i = 0; i < 257; i++){
-            if (huffman_data->freq[i] > 0 && huffman_data->freq[i] < huffman_data->freq[v1]){
+            if (freq[i] > 0 && (v1 == -1 || freq[i] <= freq[v1])){
                 v1 = i;
             }
         }
 
-        // find next smallest value v2 such that freq[v2] > 0
         for (i = 0; i < 257; i++){
-            if (huffman_data->freq[i] > 0 && huffman_data->freq[i] < huffman_data->freq[v2] && v1 != v2){
+            if (freq[i] > 0 && i != v1 && (v2 == -1 || freq[i] <= freq[v2])){
                 v2 = i;
             }
         }
@@ -107,71 +71,63 @@ void construct_huffman_table(HuffmanData *huffman_data)
             break;
         }
 
-        huffman_data->freq[v1] += huffman_data->freq[v2];
-        huffman_data->freq[v2] = 0;
+        freq[v1] += freq[v2];
+        freq[v2] = 0;
 
         huffman_data->code_len[v1]++;
-
-        while ( !(huffman_data->others[v1] == -1) ){
-            huffman_data->code_len[v1]++;
+        while (huffman_data->others[v1] != -1){
             v1 = huffman_data->others[v1];
+            huffman_data->code_len[v1]++;
         }
 
         huffman_data->others[v1] = v2;
 
         huffman_data->code_len[v2]++;
-
-        while ( !(huffman_data->others[v2] == -1) ){
-            huffman_data->code_len[v2]++;
+        while (huffman_data->others[v2] != -1){
             v2 = huffman_data->others[v2];
+            huffman_data->code_len[v2]++;
         }
     }
 
     // find the number of codes of each size
     for (i = 0; i < 257; i++){
         if (huffman_data->code_len[i] != 0){
-            huffman_data->bits[ huffman_data->code_len[i] ]++;
+            bits[ huffman_data->code_len[i] ]++;
         }
     }
 
-    // adjust the bits such that no code is > 16 bits
-    i = 31;
-    int j = 0;
-    while (1){
-        if (huffman_data->bits[i] > 0){
-            j = i - 1;
-            do {
+    // adjust the bits such that no code is > 16 bits (K.3 of the spec)
+    for (i = 257; i > 16; i--){
+        while (bits[i] > 0){
+            j = i - 2;
+            while (bits[j] == 0){
                 j--;
-            } while (! (huffman_data->bits[j] > 0) );
+            }
 
-            huffman_data->bits[i] -= 2;
-            huffman_data->bits[i-1]++;
-            huffman_data->bits[j+1] += 2;
-            huffman_data->bits[j]--;
+            bits[i] -= 2;
+            bits[i-1]++;
+            bits[j+1] += 2;
+            bits[j]--;
         }
+    }
 
-        else{
-            i--;
-
-            if (i == 16){
-                while (huffman_data->bits[i] == 0){
-                    i--;
-                }
-
-                huffman_data->bits[i]--;
-
-                break;
-            }
-        }
+    // remove the reserved code point from the longest codes
+    while (i > 0 && bits[i] == 0){
+        i--;
     }
 
-    // sort the input values according to the code size
-    i = 1;
-    int k = 0;
+    if (i > 0){
+        bits[i]--;
+    }
 
     for (i = 0; i < 32; i++){
+        huffman_data->bits[i] = (i <= 16) ? bits[i] : 0;
+    }
+
+    // sort the input values according to the code size (K.4 of the spec)
+    for (i = 1; i <= 256; i++){
         for (j = 0; j < 256; j++){
-            while (huffman_data->code_len[j] == i){
+            if (huffman_data->code_len[j] == i){
                 huffman_data->huffval[k] = j;
                 k++;
             }
@@ -186,39 +142,43 @@ void calculate_freq_block_DC(HuffmanData *huffman_data, int *image_data)
 
 void calculate_freq_block_AC(HuffmanData *huffman_data, int *image_data)
 {
-    int i = 0;
-    int num_zeroes = 0;
-    int last_non_zero_index = 0;
+    unsigned long long mask = jpg_kernels()->nonzero_mask(image_data) & ~1ULL;
+    int k = 0, last = 0, run = 0;
+
+    // jump from one non-zero coefficient to the next
+    while (mask){
+        k = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        run = k - last - 1;
+        last = k;
+
+        // a ZRL for each run of 16 zeroes, then run length | code size
+        huffman_data->freq[0xF0] += run >> 4;
+        huffman_data->freq[((run & 15) << 4) | get_class(image_data[k])]++;
+    }
 
-    // find the last non-zero coefficient
-    for (i = 63; i > 0; i--){
-        if (image_data[i] != 0){
-            last_non_zero_index = i;
-            break;
-        }
+    // EOB unless the last coefficient is non-zero
+    if (last != 63){
+        huffman_data->freq[0x00]++;
     }
+}
 
-    // perform run length encoding
-    for (i = 1; i < 64; i++){
-        if (i == last_non_zero_index + 1){ // +1 because we don't want the coefficient
-            huffman_data->freq[0x00]++; // EOB
-            break;
-        }
+long estimate_huffman_bits(HuffmanData *huffman_data, int ac)
+{
+    long total = 0;
+    int l = 0, i = 0, k = 0, symbol = 0;
 
-        if (image_data[i] == 0){
-            num_zeroes++;
-            if (num_zeroes == 16){
-                huffman_data->freq[0xF0]++; // ZRL
-                num_zeroes = 0;
-            }
-        }
+    construct_huffman_table(huffman_data);
 
-        else{
-            // run length | code size
-            huffman_data->freq[num_zeroes | get_class(image_data[i])]++;
-            num_zeroes = 0;
+    // the symbols are sorted by code length
+    for (l = 1; l <= 16; l++){
+        for (i = 0; i < huffman_data->bits[l]; i++){
+            symbol = huffman_data->huffval[k++];
+            total += (long) huffman_data->freq[symbol] * (l + ((ac) ? (symbol & 0x0F) : symbol));
         }
     }
+
+    return total;
 }
 
 int get_class(int value)
@@ -233,3 +193,81 @@ int get_class(int value)
 
     return class;
 }
+
+unsigned long long nonzero_mask_scalar(const int *zz)
+{
+    unsigned long long mask = 0;
+    int k = 0;
+
+    for (k = 0; k < 64; k++){
+        if (zz[k] != 0){
+            mask |= 1ULL << k;
+        }
+    }
+
+    return mask;
+}
+
+#ifdef JPG_X86_KERNELS
+
+// the saturating packs keep values non-zero, so 16 coefficients become 16 bytes to compare with 0
+
+__attribute__((target("sse2")))
+unsigned long long nonzero_mask_sse2(const int *zz)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i *p = (const __m128i *) zz;
+    unsigned long long zeroes = 0;
+    __m128i bytes;
+    int k = 0;
+
+    for (k = 0; k < 4; k++){
+        bytes = _mm_packs_epi16(_mm_packs_epi32(_mm_loadu_si128(p + 4*k), _mm_loadu_si128(p + 4*k + 1)),
+                                _mm_packs_epi32(_mm_loadu_si128(p + 4*k + 2), _mm_loadu_si128(p + 4*k + 3)));
+        zeroes |= (unsigned long long) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)) << (16 * k);
+    }
+
+    return ~zeroes;
+}
+
+__attribute__((target("avx2")))
+unsigned long long nonzero_mask_avx2(const int *zz)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i *p = (const __m256i *) zz;
+    unsigned long long zeroes = 0;
+    __m256i words_lo, words_hi, bytes;
+    int k = 0;
+
+    // the packs work within each 128 bit half, the permutes put the values back in order
+    for (k = 0; k < 2; k++){
+        words_lo = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_loadu_si256(p + 4*k), _mm256_loadu_si256(p + 4*k + 1)), 0xD8);
+        words_hi = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_loadu_si256(p + 4*k + 2), _mm256_loadu_si256(p + 4*k + 3)), 0xD8);
+        bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(words_lo, words_hi), 0xD8);
+        zeroes |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, zero)) << (32 * k);
+    }
+
+    // clears the upper halves of the registers for the SSE code after it (see fdct_float_avx2)
+    _mm256_zeroupper();
+
+    return ~zeroes;
+}
+
+__attribute__((target("avx512bw")))
+unsigned long long nonzero_mask_avx512bw(const int *zz)
+{
+    unsigned long long mask = 0;
+    __m512i values;
+    int k = 0;
+
+    for (k = 0; k < 4; k++){
+        values = _mm512_loadu_si512((const void *) (zz + 16*k));
+        mask |= (unsigned long long) _mm512_test_epi32_mask(values, values) << (16 * k);
+    }
+
+    _mm256_zeroupper();
+
+    return mask;
+}
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/huffman_decode.h"
+
+const int natural_order[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// reads bytes into the bit buffer until it holds more than 56 bits
+void fill_bits(BitReader *br);
+
+int build_decode_table(DecodeHuffmanTable *table)
+{
+    int huffsize[257], huffcode[257];
+    int num_codes = 0, code = 0, size = 0;
+    int i = 0, j = 0, k = 0, l = 0;
+    int fill = 0, base = 0;
+
+    // generate the size of each code (C.1 of the spec)
+    for (l = 1; l <= 16; l++){
+        for (i = 0; i < table->bits[l] && num_codes < 256; i++){
+            huffsize[num_codes++] = l;
+        }
+    }
+    huffsize[num_codes] = 0;
+
+    // generate the codes (C.2 of the spec), each one has to fit in its length
+    size = huffsize[0];
+    while (huffsize[k]){
+        while (huffsize[k] == size){
+            if (code > (1 << size) - 1){
+                return 0;
+            }
+
+            huffcode[k++] = code++;
+        }
+
+        code <<= 1;
+        size++;
+    }
+
+    // tables used when decoding codes longer than the lookahead
+    for (l = 1; l <= 16; l++){
+        if (table->bits[l]){
+            table->valptr[l] = j;
+            table->mincode[l] = huffcode[j];
+            j += table->bits[l];
+            table->maxcode[l] = huffcode[j - 1];
+        }
+
+        else{
+            table->maxcode[l] = -1;
+        }
+    }
+    table->maxcode[17] = 0x7FFFFFFF;
+
+    // lookup table for the short (common) codes
+    memset(table->look_len, 0, sizeof(table->look_len));
+    for (k = 0; k < num_codes; k++){
+        l = huffsize[k];
+        if (l <= HUFF_LOOKAHEAD){
+            fill = 1 << (HUFF_LOOKAHEAD - l);
+            base = huffcode[k] << (HUFF_LOOKAHEAD - l);
+
+            for (i = 0; i < fill; i++){
+                table->look_len[base + i] = l;
+                table->look_sym[base + i] = table->huffval[k];
+            }
+        }
+    }
+
+    table->present = 1;
+
+    return 1;
+}
+
+void init_bit_reader(BitReader *br, const Byte *data, size_t pos, size_t end)
+{
+    br->data = data;
+    br->pos = pos;
+    br->end = end;
+    br->buffer = 0;
+    br->num_bits = 0;
+    br->marker = 0;
+}
+
+void restart_bit_reader(BitReader *br)
+{
+    size_t pos = br->pos;
+
+    // inside the entropy coded segment 0xFF is always stuffed, so the first 0xFF Dn is the marker
+    while (pos + 1 < br->end && !(br->data[pos] == 0xFF && br->data[pos + 1] >= 0xD0 && br->data[pos + 1] <= 0xD7)){
+        pos++;
+    }
+
+    if (pos + 1 < br->end){
+        pos += 2;
+    }
+
+    init_bit_reader(br, br->data, pos, br->end);
+}
+
+void fill_bits(BitReader *br)
+{
+    int byte = 0;
+
+    while (br->num_bits <= 56){
+        byte = 0;
+
+        // once a marker is reached the decoder is fed zeroes
+        if (!br->marker && br->pos < br->end){
+            byte = br->data[br->pos];
+
+            if (byte == 0xFF){
+                if (br->pos + 1 < br->end && br->data[br->pos + 1] == 0x00){
+                    br->pos += 2;
+                }
+
+                else{
+                    br->marker = 1;
+                    byte = 0;
+                }
+            }
+
+            else{
+                br->pos++;
+            }
+        }
+
+        br->buffer = (br->buffer << 8) | byte;
+        br->num_bits += 8;
+    }
+}
+
+int decode_huffman(BitReader *br, const DecodeHuffmanTable *table)
+{
+    int look = 0, len = 0, code = 0, l = 0;
+
+    if (br->num_bits < 16){
+        fill_bits(br);
+    }
+
+    look = (int) (br->buffer >> (br->num_bits - HUFF_LOOKAHEAD)) & ((1 << HUFF_LOOKAHEAD) - 1);
+    len = table->look_len[look];
+
+    if (len){
+        br->num_bits -= len;
+        return table->look_sym[look];
+    }
+
+    // code is longer than the lookahead
+    for (l = HUFF_LOOKAHEAD + 1; l <= 16; l++){
+        code = (int) (br->buffer >> (br->num_bits - l)) & ((1 << l) - 1);
+
+        if (code <= table->maxcode[l]){
+            br->num_bits -= l;
+            return table->huffval[ table->valptr[l] + code - table->mincode[l] ];
+        }
+    }
+
+    // corrupt data, skip the bits and carry on
+    br->num_bits -= 16;
+    return 0;
+}
+
+int receive_extend(BitReader *br, int s)
+{
+    int value = 0;
+
+    if (s == 0){
+        return 0;
+    }
+
+    if (br->num_bits < s){
+        fill_bits(br);
+    }
+
+    br->num_bits -= s;
+    value = (int) (br->buffer >> br->num_bits) & ((1 << s) - 1);
+
+    // values with a leading zero bit are negative
+    if (value < (1 << (s - 1))){
+        value = value - (1 << s) + 1;
+    }
+
+    return value;
+}
+
+void skip_bits(BitReader *br, int n)
+{
+    if (br->num_bits < n){
+        fill_bits(br);
+    }
+
+    br->num_bits -= n;
+}
+
+int decode_block(BitReader *br, const DecodeHuffmanTable *dc, const DecodeHuffmanTable *ac,
+                 int *dc_pred, short *coef, int num_coefs)
+{
+    int k = 0, rs = 0, r = 0, s = 0;
+
+    // only the DC value is read when a single coefficient is needed
+    if (num_coefs > 1){
+        memset(coef, 0, sizeof(short) * 64);
+    }
+
+    // 8-bit samples have DC differences of at most 11 bits and AC values of at most 10
+    s = decode_huffman(br, dc);
+    if (s > 11){
+        return 0;
+    }
+
+    *dc_pred += receive_extend(br, s);
+    coef[0] = (short) *dc_pred;
+
+    for (k = 1; k < 64; k++){
+        rs = decode_huffman(br, ac);
+        r = rs >> 4;
+        s = rs & 15;
+
+        if (s == 0){
+            if (r != 15){
+                break; // EOB
+            }
+
+            k += 15; // ZRL
+            continue;
+        }
+
+        if (s > 10){
+            return 0;
+        }
+
+        k += r;
+
+        if (k < num_coefs){
+            coef[ natural_order[k] ] = (short) receive_extend(br, s);
+        }
+
+        else{
+            skip_bits(br, s);
+        }
+    }
+
+    return 1;
+}
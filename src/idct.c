@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "headers/idct.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+#define ALPHA(x) (x == 0 ? 1/sqrt(2) : 1)
+
+/*
+    basis[n][x][u] is the cosine of frequency u averaged over the 8 >> n full size samples
+    that make up output sample x, so a reduced transform gives the box filtered result of
+    the full 8x8 inverse DCT without computing it.
+*/
+static double basis[4][8][8];
+
+// clamps a sample to 0 - 255
+Byte clamp_sample(double v);
+
+void init_idct(void)
+{
+    int n = 0, size = 0, m = 0;
+    int x = 0, u = 0, j = 0;
+    double sum = 0.0;
+
+    for (n = 0; n < 4; n++){
+        size = 8 >> n;
+        m = 8 / size;
+
+        for (x = 0; x < size; x++){
+            for (u = 0; u < 8; u++){
+                sum = 0.0;
+                for (j = 0; j < m; j++){
+                    sum += cos( ( (2 * (m*x + j) + 1) * u * M_PI ) / 16 );
+                }
+
+                basis[n][x][u] = ALPHA(u) / 2 * sum / m;
+            }
+        }
+    }
+}
+
+void idct_block(const short *coef, const int *quant, Byte *out, int stride, int size)
+{
+    double temp[8][8];
+    double (*table)[8] = NULL;
+    double value = 0.0;
+    int x = 0, y = 0, u = 0, v = 0;
+    int dc_only = 1, row_empty = 0;
+
+    // a 1x1 block is the DC value, as are blocks without AC coefficients (common after quantization)
+    for (v = 0; v < 64 && size > 1; v++){
+        if (v && coef[v]){
+            dc_only = 0;
+            break;
+        }
+    }
+
+    if (dc_only){
+        Byte dc = clamp_sample(coef[0] * quant[0] / 8.0 + 128);
+        for (y = 0; y < size; y++){
+            for (x = 0; x < size; x++){
+                out[y * stride + x] = dc;
+            }
+        }
+        return;
+    }
+
+    table = basis[ size == 8 ? 0 : size == 4 ? 1 : 2 ];
+
+    // transform the rows, producing size outputs per row
+    for (v = 0; v < 8; v++){
+        row_empty = 1;
+        for (u = 0; u < 8; u++){
+            if (coef[v * 8 + u]){
+                row_empty = 0;
+                break;
+            }
+        }
+
+        for (x = 0; x < size; x++){
+            value = 0.0;
+            for (u = 0; u < 8 && !row_empty; u++){
+                value += coef[v * 8 + u] * quant[v * 8 + u] * table[x][u];
+            }
+            temp[v][x] = value;
+        }
+    }
+
+    // transform the columns
+    for (y = 0; y < size; y++){
+        for (x = 0; x < size; x++){
+            value = 0.0;
+            for (v = 0; v < 8; v++){
+                value += temp[v][x] * table[y][v];
+            }
+            out[y * stride + x] = clamp_sample(value + 128);
+        }
+    }
+}
+
+Byte clamp_sample(double v)
+{
+    if (v <= 0){
+        return 0;
+    }
+
+    if (v >= 255){
+        return 255;
+    }
+
+    return (Byte) (v + 0.5);
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "headers/jpg_batch.h"
+#include "headers/jpg_write.h"
+#include "headers/async_io.h"
+#include "headers/trace.h"
+
+// the state of a batch
+typedef struct _batch{
+	JpgBatchItem *items;
+	int num_items;
+	AsyncIo io;
+
+	AsyncIoResult *inputs; // reads that have completed, by item
+	int *read; // 1 once the read of an item has completed
+	int next_read; // the next item to start reading
+	int writing; // writes in flight
+} Batch;
+
+// waits for a read or write to complete and keeps its result
+void collect_io(Batch *batch);
+
+// encodes an item once its input has been read and starts writing it
+void encode_item(Batch *batch, int i, const JpgEncodeOptions *options, int prefetch);
+
+/* ==================================== Function definitions ===================================== */
+
+int encode_bmp_batch(JpgBatchItem *items, int num_items, const JpgEncodeOptions *options, int prefetch, int io_backend)
+{
+	Batch batch;
+	int i = 0, error = JPG_ENC_SUCCESS;
+
+	if (num_items <= 0 || prefetch <= 0){
+		return JPG_ENC_BAD_OPTIONS;
+	}
+
+	for (i = 0; i < num_items; i++){
+		items[i].error = JPG_ENC_READ_FAILED;
+	}
+
+	batch.items = items;
+	batch.num_items = num_items;
+	batch.next_read = 0;
+	batch.writing = 0;
+
+	// prefetch reads and prefetch writes, so starting one never has to wait for a free request
+	batch.io = create_async_io(io_backend, 2 * prefetch);
+	batch.inputs = calloc(num_items, sizeof(AsyncIoResult));
+	batch.read = calloc(num_items, sizeof(int));
+
+	if (batch.io == NULL || batch.inputs == NULL || batch.read == NULL){
+		error = (batch.io == NULL && io_backend == JPG_IO_URING) ? JPG_ENC_BAD_OPTIONS : JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	for (i = 0; i < num_items && error != JPG_ENC_SUCCESS; i++){
+		items[i].error = error;
+	}
+
+	if (error == JPG_ENC_SUCCESS){
+		for (; batch.next_read < num_items && batch.next_read < prefetch; batch.next_read++){
+			async_read_file(batch.io, items[batch.next_read].input_filename, batch.next_read);
+		}
+
+		for (i = 0; i < num_items; i++){
+			while (!batch.read[i]){
+				collect_io(&batch);
+			}
+
+			// its read is done, so there is room for the next one
+			if (batch.next_read < num_items){
+				async_read_file(batch.io, items[batch.next_read].input_filename, batch.next_read);
+				batch.next_read++;
+			}
+
+			encode_item(&batch, i, options, prefetch);
+		}
+
+		while (async_io_pending(batch.io) > 0){
+			collect_io(&batch);
+		}
+
+		for (i = 0; i < num_items && error == JPG_ENC_SUCCESS; i++){
+			error = items[i].error;
+		}
+	}
+
+	destroy_async_io(batch.io);
+	free(batch.inputs);
+	free(batch.read);
+
+	return error;
+}
+
+void collect_io(Batch *batch)
+{
+	AsyncIoResult result;
+
+	if (!async_io_wait(batch->io, &result)){
+		return;
+	}
+
+	if (result.kind == JPG_IO_READ){
+		batch->inputs[result.tag] = result;
+		batch->read[result.tag] = 1;
+	}
+
+	else{
+		batch->items[result.tag].error = (result.error == 0) ? JPG_ENC_SUCCESS : JPG_ENC_WRITE_FAILED;
+		batch->writing--;
+	}
+}
+
+void encode_item(Batch *batch, int i, const JpgEncodeOptions *options, int prefetch)
+{
+	AsyncIoResult *input = &batch->inputs[i];
+	JpgBuffer buffer = {NULL, 0, 0};
+	int error = JPG_ENC_READ_FAILED;
+
+	// a span per item so the trace shows which image held up the batch
+	trace_begin("encode_item", i);
+
+	if (input->error == 0){
+		error = encode_bmp_memory_to_jpeg(input->data, input->size, &buffer, options);
+	}
+
+	free(input->data);
+	input->data = NULL;
+
+	if (error == JPG_ENC_SUCCESS){
+		while (batch->writing >= prefetch){
+			collect_io(batch);
+		}
+
+		// the write takes the image and the item is done once it completes
+		error = JPG_ENC_WRITE_FAILED;
+
+		if (async_write_file(batch->io, batch->items[i].output_filename, buffer.data, buffer.size, i)){
+			batch->writing++;
+			buffer.data = NULL;
+		}
+
+		free_jpeg_buffer(&buffer);
+	}
+
+	batch->items[i].error = error;
+	trace_end();
+}
@@ -0,0 +1,885 @@
+/*
+	Benchmark for the stages of the encoder.
+
+	Each input is written to a bitmap of the size asked for and taken through the stages one at
+	a time: colour conversion (reading the bitmap, RGB to YCbCr and the level shift), the MCU
+	kernels (DCT, quantization and zig-zag ordering in one pass, see mcu_kernel.h), then the DCT,
+	quantization and zig-zag ordering as stages of their own, huffman statistics (DC differences
+	and symbol counts) and writing the bitstream with the tables in Annex K. Chroma subsampling
+	isn't a stage, it doesn't change the blocks at any ratio yet. The whole encode (with huffman tables built for the image) is then timed on its own,
+	followed by an encode with each effort preset (see jpg_preset_options) and the size of its file,
+	and by the same encode through the strips of the tiled encoder (see jpg_tiled.h) on one thread
+	and as a pipeline of three threads.
+
+	Every case is run at each level of SIMD kernels the CPU supports (see cpu_kernels.h), or at the
+	levels asked for, once the self test of the level has been reported.
+
+	With --tiled a square bitmap of that size (up to 65535, over 12 GB for the largest) is written a
+	row at a time and encoded with the tiled encoder (see jpg_tiled.h) before any other case, so the
+	peak resident memory is that of the strips. It is coded in one pass with the tables in Annex K.
+
+	The inputs are synthetic images (noise, gradient, flat, text) made from a fixed seed and the
+	bitmaps in images/ (or the directory given with --images), scaled to each size. For every stage
+	the time, megapixels per second and nanoseconds per block are reported, along with the peak
+	resident memory of the process so far (cases run from the smallest size up). Results can be
+	saved as JSON and compared with an earlier run, a stage that is slower than the threshold fails
+	the run.
+
+	Usage:
+	jpg_bench [--sizes 1,4,16,100] [--inputs noise,gradient,flat,text,images] [--repeat n]
+	          [--json results.json] [--baseline baseline.json] [--threshold percent] [--images dir]
+	          [--levels scalar,sse2,ssse3,avx2,avx512bw] [--tiled 65535] [--tiled-input text]
+
+	The results are written to stderr.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include "headers/jpg_encode.h"
+#include "headers/jpg_write.h"
+#include "headers/preprocess.h"
+#include "headers/dct.h"
+#include "headers/quantise.h"
+#include "headers/zig_zag.h"
+#include "headers/huffman.h"
+#include "headers/bitmap.h"
+#include "headers/mcu_kernel.h"
+#include "headers/cpu_kernels.h"
+#include "headers/jpg_tiled.h"
+
+#define MAX_SIZES 16
+#define MAX_CASES 256
+#define NAME_SIZE 64
+
+// files written while the benchmark runs
+#define BENCH_INPUT "bench_input.bmp"
+#define BENCH_OUTPUT "bench_output.jpg"
+#define BENCH_TILED_INPUT "bench_tiled.bmp"
+
+#define BENCH_QUALITY 75
+
+// random blocks each level of the kernels is checked on
+#define SELF_TEST_BLOCKS 1000
+
+// the stages in the order they run, the last one is the whole encode
+#define NUM_STAGES 14
+#define STAGE_ENCODE 7
+#define STAGE_EFFORT 8 // the first of the effort presets, in the order of JPG_EFFORT_*
+#define STAGE_TILED 12
+#define STAGE_PIPELINE 13
+
+// strips in flight in the pipelined encode
+#define BENCH_PIPELINE_SLOTS 4
+
+static const char *stage_names[NUM_STAGES] = {
+	"colour_conversion", "mcu_kernel", "dct", "quantise", "zig_zag", "huffman_stats", "bitstream", "encode",
+	"effort_fastest", "effort_fast", "effort_balanced", "effort_smallest", "tiled", "tiled_pipeline"
+};
+
+typedef struct _bench_case{
+	char name[NAME_SIZE * 2]; // input, size and level of the kernels
+	char input[NAME_SIZE];
+	int width;
+	int height;
+	long blocks; // in all colour channels
+	size_t bytes; // size of the encoded image
+	size_t effort_bytes[JPG_NUM_EFFORTS]; // with each effort preset
+	long peak_rss_kb;
+	double ms[NUM_STAGES]; // fastest of the repeats
+} BenchCase;
+
+typedef struct _bench_settings{
+	double sizes[MAX_SIZES]; // megapixels
+	int num_sizes;
+	const char *inputs;
+	const char *image_dir;
+	int repeat;
+	const char *json;
+	const char *baseline;
+	double threshold; // percent
+	const char *levels; // of the kernels, NULL for all those the CPU supports
+	int tiled; // width and height of the tiled case, 0 for none
+	const char *tiled_input; // synthetic input of the tiled case
+} BenchSettings;
+
+// reads the command line, returns 0 if it doesn't make sense
+int read_settings(int argc, char **argv, BenchSettings *settings);
+
+// 1 if name is one of the comma separated words in list
+int in_list(const char *list, const char *name);
+
+// fills in the pixels (R, G, B) of a synthetic input, returns 0 if there is no such input
+int make_synthetic(const char *input, Byte *rgb, int width, int height);
+
+// fills in row y of a synthetic input, seed carries the noise from one row to the next
+int make_synthetic_row(const char *input, Byte *row, int y, int width, int height, unsigned int *seed);
+
+// writes a 24-bit bitmap of a synthetic input a row at a time, returns 0 on failure
+int write_synthetic_bitmap(const char *file, const char *input, int width, int height);
+
+// encodes a large synthetic bitmap with the tiled encoder and prints the results
+void run_tiled(const BenchSettings *settings);
+
+// scales a bitmap to width x height (nearest pixel) into rgb
+void scale_bitmap(BmpImage bmp, Byte *rgb, int width, int height);
+
+// writes a 24-bit bitmap, returns 0 on failure
+int write_bitmap(const char *file, const Byte *rgb, int width, int height);
+
+// sets up a case for an input of the given size
+void name_case(BenchCase *c, const char *input, int length, double mp, int width, int height, int level);
+
+// runs a case for BENCH_INPUT at each level of the kernels, returns the number of cases added
+int run_levels(BenchCase *cases, int max_cases, const BenchSettings *settings, const char *input, int length, double mp, int width, int height);
+
+// times the stages of one input that has been written to BENCH_INPUT
+int run_case(BenchCase *c, int repeat);
+
+// takes the bitmap through each stage once, keeping the fastest time of each
+int run_stages(BenchCase *c);
+
+// size of a file in bytes, 0 if it can't be read
+size_t file_size(const char *file);
+
+// milliseconds since some fixed point (wall clock)
+double now_ms(void);
+
+// peak resident memory of the process in KB
+long peak_rss_kb(void);
+
+// prints the results of a case
+void show_case(const BenchCase *c);
+
+// writes the results as JSON, returns 0 on failure
+int write_json(const char *file, const BenchCase *cases, int num_cases);
+
+// compares the cases with a JSON file written earlier, returns the number of stages that got slower
+int compare_baseline(const char *file, const BenchCase *cases, int num_cases, double threshold);
+
+int main(int argc, char **argv)
+{
+	static BenchCase cases[MAX_CASES];
+	const char *synthetic[4] = {"noise", "gradient", "flat", "text"};
+	BenchSettings settings;
+	BmpImage bmp = NULL;
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+	char path[1024];
+	Byte *rgb = NULL;
+	int num_cases = 0, s = 0, i = 0, width = 0, height = 0, slower = 0, level = 0, failed = 0;
+	size_t length = 0;
+
+	if (!read_settings(argc, argv, &settings)){
+		fprintf(stderr, "usage: %s [--sizes 1,4,16,100] [--inputs noise,gradient,flat,text,images] [--repeat n]\n"
+		                "       [--json file] [--baseline file] [--threshold percent] [--images dir]\n"
+		                "       [--levels scalar,sse2,ssse3,avx2,avx512bw] [--tiled 65535] [--tiled-input text]\n", argv[0]);
+		return 2;
+	}
+
+	fprintf(stderr, "CPU level: %s\n", jpg_cpu_level_name(jpg_cpu_detect()));
+
+	for (level = 0; level < JPG_NUM_CPU_LEVELS; level++){
+		failed = jpg_kernel_self_test(level, SELF_TEST_BLOCKS);
+
+		if (failed < 0) fprintf(stderr, "  %-8s not supported\n", jpg_cpu_level_name(level));
+		else if (failed == 0) fprintf(stderr, "  %-8s self test passed\n", jpg_cpu_level_name(level));
+		else fprintf(stderr, "  %-8s self test failed (%d kernels differ)\n", jpg_cpu_level_name(level), failed);
+	}
+
+	if (settings.tiled > 0){
+		run_tiled(&settings);
+	}
+
+	for (s = 0; s < settings.num_sizes; s++){
+		// 4:3 images of the size asked for
+		width = (int) sqrt(settings.sizes[s] * 1e6 * 4.0 / 3.0);
+		height = (int) (settings.sizes[s] * 1e6 / width);
+		rgb = malloc((size_t) width * height * 3);
+
+		if (rgb == NULL){
+			fprintf(stderr, "%gMP: not enough memory\n", settings.sizes[s]);
+			continue;
+		}
+
+		for (i = 0; i < 4 && num_cases < MAX_CASES; i++){
+			if (in_list(settings.inputs, synthetic[i]) && make_synthetic(synthetic[i], rgb, width, height)){
+				if (write_bitmap(BENCH_INPUT, rgb, width, height)){
+					num_cases += run_levels(cases + num_cases, MAX_CASES - num_cases, &settings, synthetic[i], strlen(synthetic[i]),
+					                        settings.sizes[s], width, height);
+				}
+			}
+		}
+
+		dir = in_list(settings.inputs, "images") ? opendir(settings.image_dir) : NULL;
+
+		while (dir != NULL && (entry = readdir(dir)) != NULL && num_cases < MAX_CASES){
+			length = strlen(entry->d_name);
+			if (length < 5 || strcmp(entry->d_name + length - 4, ".bmp") != 0){
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "%s/%s", settings.image_dir, entry->d_name);
+			bmp = bmp_OpenBitmap(path);
+
+			if (bmp != NULL && bmp_GetWidth(bmp) > 0 && bmp_GetHeight(bmp) > 0 && bmp_GetRed(bmp) != NULL){
+				scale_bitmap(bmp, rgb, width, height);
+
+				if (write_bitmap(BENCH_INPUT, rgb, width, height)){
+					num_cases += run_levels(cases + num_cases, MAX_CASES - num_cases, &settings, entry->d_name, length - 4,
+					                        settings.sizes[s], width, height);
+				}
+			}
+
+			if (bmp != NULL){
+				bmp_DestroyBitmap(bmp);
+			}
+		}
+
+		if (dir != NULL){
+			closedir(dir);
+		}
+
+		free(rgb);
+	}
+
+	remove(BENCH_INPUT);
+	remove(BENCH_OUTPUT);
+	jpg_set_cpu_level(JPG_CPU_AUTO);
+
+	if (settings.json != NULL && !write_json(settings.json, cases, num_cases)){
+		fprintf(stderr, "could not write %s\n", settings.json);
+		return 2;
+	}
+
+	if (settings.baseline != NULL){
+		slower = compare_baseline(settings.baseline, cases, num_cases, settings.threshold);
+	}
+
+	return (slower > 0) ? 1 : 0;
+}
+
+int read_settings(int argc, char **argv, BenchSettings *settings)
+{
+	char *p = NULL;
+	int i = 0;
+
+	settings->sizes[0] = 1.0;
+	settings->num_sizes = 1;
+	settings->inputs = "noise,gradient,flat,text,images";
+	settings->image_dir = "images";
+	settings->repeat = 1;
+	settings->json = NULL;
+	settings->baseline = NULL;
+	settings->threshold = 10.0;
+	settings->levels = NULL;
+	settings->tiled = 0;
+	settings->tiled_input = "text";
+
+	for (i = 1; i + 1 < argc; i += 2){
+		if (strcmp(argv[i], "--sizes") == 0){
+			settings->num_sizes = 0;
+			p = argv[i + 1];
+
+			while (*p != '\0' && settings->num_sizes < MAX_SIZES){
+				settings->sizes[settings->num_sizes] = strtod(p, &p);
+				if (settings->sizes[settings->num_sizes] <= 0.0) return 0;
+
+				settings->num_sizes++;
+				if (*p == ',') p++;
+				else if (*p != '\0') return 0;
+			}
+		}
+
+		else if (strcmp(argv[i], "--inputs") == 0) settings->inputs = argv[i + 1];
+		else if (strcmp(argv[i], "--images") == 0) settings->image_dir = argv[i + 1];
+		else if (strcmp(argv[i], "--repeat") == 0) settings->repeat = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--json") == 0) settings->json = argv[i + 1];
+		else if (strcmp(argv[i], "--baseline") == 0) settings->baseline = argv[i + 1];
+		else if (strcmp(argv[i], "--threshold") == 0) settings->threshold = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "--levels") == 0) settings->levels = argv[i + 1];
+		else if (strcmp(argv[i], "--tiled") == 0) settings->tiled = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--tiled-input") == 0) settings->tiled_input = argv[i + 1];
+		else return 0;
+	}
+
+	return i == argc && settings->num_sizes > 0 && settings->repeat > 0 && settings->tiled >= 0 && settings->tiled <= JPG_TILED_MAX_SIZE;
+}
+
+int in_list(const char *list, const char *name)
+{
+	size_t n = strlen(name);
+	const char *p = list;
+
+	while ((p = strstr(p, name)) != NULL){
+		if ((p == list || p[-1] == ',') && (p[n] == ',' || p[n] == '\0')){
+			return 1;
+		}
+
+		p += n;
+	}
+
+	return 0;
+}
+
+int make_synthetic(const char *input, Byte *rgb, int width, int height)
+{
+	unsigned int seed = 12345;
+	int y = 0;
+
+	for (y = 0; y < height; y++){
+		if (!make_synthetic_row(input, rgb + (size_t) y * width * 3, y, width, height, &seed)){
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int make_synthetic_row(const char *input, Byte *row, int y, int width, int height, unsigned int *seed)
+{
+	unsigned int glyph = 0;
+	Byte *p = NULL;
+	int x = 0, gx = 0, gy = 0, ink = 0;
+
+	for (x = 0; x < width; x++){
+		p = row + (size_t) x * 3;
+
+		if (strcmp(input, "noise") == 0){
+			*seed = *seed * 1103515245u + 12345u;
+			p[0] = (Byte) (*seed >> 24);
+			p[1] = (Byte) (*seed >> 16);
+			p[2] = (Byte) (*seed >> 8);
+		}
+
+		else if (strcmp(input, "gradient") == 0){
+			p[0] = (Byte) ((long) x * 255 / width);
+			p[1] = (Byte) ((long) y * 255 / height);
+			p[2] = (Byte) ((long) (x + y) * 255 / (width + height));
+		}
+
+		else if (strcmp(input, "flat") == 0){
+			p[0] = 200;
+			p[1] = 120;
+			p[2] = 60;
+		}
+
+		// black 5x7 glyphs in 6x14 cells on white, the shape of each glyph comes from its position
+		else if (strcmp(input, "text") == 0){
+			gx = x % 6;
+			gy = y % 14;
+			glyph = (unsigned int) (x / 6) * 2654435761u ^ (unsigned int) (y / 14) * 40503u;
+			ink = gx < 5 && gy >= 3 && gy < 10 && ((glyph >> ((gy - 3) * 5 + gx) % 32) & 1);
+			p[0] = p[1] = p[2] = ink ? 0 : 255;
+		}
+
+		else{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+void scale_bitmap(BmpImage bmp, Byte *rgb, int width, int height)
+{
+	Byte *r = bmp_GetRed(bmp), *g = bmp_GetGreen(bmp), *b = bmp_GetBlue(bmp);
+	int bw = bmp_GetWidth(bmp), bh = bmp_GetHeight(bmp);
+	int x = 0, y = 0;
+	size_t src = 0, dst = 0;
+
+	for (y = 0; y < height; y++){
+		for (x = 0; x < width; x++){
+			src = (size_t) ((long) y * bh / height) * bw + (size_t) ((long) x * bw / width);
+			dst = ((size_t) y * width + x) * 3;
+
+			rgb[dst] = r[src];
+			rgb[dst + 1] = g[src];
+			rgb[dst + 2] = b[src];
+		}
+	}
+}
+
+int write_bitmap(const char *file, const Byte *rgb, int width, int height)
+{
+	FILE *fp = NULL;
+	Byte header[54] = {'B', 'M'};
+	Byte *row = NULL;
+	int stride = (width * 3 + 3) & ~3;
+	unsigned int size = 54 + (unsigned int) stride * height;
+	int x = 0, y = 0, ok = 1;
+
+	// file size, offset of the pixels, header size, width, height, planes and bits per pixel
+	header[2] = size & 0xFF; header[3] = (size >> 8) & 0xFF; header[4] = (size >> 16) & 0xFF; header[5] = (size >> 24) & 0xFF;
+	header[10] = 54;
+	header[14] = 40;
+	header[18] = width & 0xFF; header[19] = (width >> 8) & 0xFF; header[20] = (width >> 16) & 0xFF; header[21] = (width >> 24) & 0xFF;
+	header[22] = height & 0xFF; header[23] = (height >> 8) & 0xFF; header[24] = (height >> 16) & 0xFF; header[25] = (height >> 24) & 0xFF;
+	header[26] = 1;
+	header[28] = 24;
+
+	fp = fopen(file, "wb");
+	row = calloc(stride, 1);
+
+	if (fp == NULL || row == NULL){
+		ok = 0;
+	}
+
+	else{
+		ok = fwrite(header, 1, 54, fp) == 54;
+
+		// rows are stored bottom up as B, G, R
+		for (y = height - 1; ok && y >= 0; y--){
+			for (x = 0; x < width; x++){
+				row[x * 3] = rgb[((size_t) y * width + x) * 3 + 2];
+				row[x * 3 + 1] = rgb[((size_t) y * width + x) * 3 + 1];
+				row[x * 3 + 2] = rgb[((size_t) y * width + x) * 3];
+			}
+
+			ok = fwrite(row, 1, stride, fp) == (size_t) stride;
+		}
+	}
+
+	if (fp != NULL && fclose(fp) != 0){
+		ok = 0;
+	}
+
+	free(row);
+
+	return ok;
+}
+
+int write_synthetic_bitmap(const char *file, const char *input, int width, int height)
+{
+	FILE *fp = NULL;
+	Byte header[54] = {'B', 'M'};
+	Byte *rgb = NULL, *row = NULL;
+	unsigned int seed = 12345;
+	long long stride = (width * 3 + 3) & ~3;
+	long long size = 54 + stride * height;
+	int x = 0, y = 0, ok = 1;
+
+	// the size field is left at 0 when the file is too large for it, readers take the size of the file
+	size = (size < 0xFFFFFFFFLL) ? size : 0;
+
+	header[2] = size & 0xFF; header[3] = (size >> 8) & 0xFF; header[4] = (size >> 16) & 0xFF; header[5] = (size >> 24) & 0xFF;
+	header[10] = 54;
+	header[14] = 40;
+	header[18] = width & 0xFF; header[19] = (width >> 8) & 0xFF; header[20] = (width >> 16) & 0xFF; header[21] = (width >> 24) & 0xFF;
+	header[22] = height & 0xFF; header[23] = (height >> 8) & 0xFF; header[24] = (height >> 16) & 0xFF; header[25] = (height >> 24) & 0xFF;
+	header[26] = 1;
+	header[28] = 24;
+
+	fp = fopen(file, "wb");
+	rgb = malloc((size_t) width * 3);
+	row = calloc(stride, 1);
+
+	if (fp == NULL || rgb == NULL || row == NULL){
+		ok = 0;
+	}
+
+	else{
+		ok = fwrite(header, 1, 54, fp) == 54;
+
+		// rows are stored bottom up as B, G, R
+		for (y = height - 1; ok && y >= 0; y--){
+			ok = make_synthetic_row(input, rgb, y, width, height, &seed);
+
+			for (x = 0; ok && x < width; x++){
+				row[x * 3] = rgb[x * 3 + 2];
+				row[x * 3 + 1] = rgb[x * 3 + 1];
+				row[x * 3 + 2] = rgb[x * 3];
+			}
+
+			ok = ok && fwrite(row, 1, stride, fp) == (size_t) stride;
+		}
+	}
+
+	if (fp != NULL && fclose(fp) != 0){
+		ok = 0;
+	}
+
+	free(rgb);
+	free(row);
+
+	return ok;
+}
+
+void run_tiled(const BenchSettings *settings)
+{
+	JpgEncodeStats stats;
+	JpgEncodeOptions options = {0};
+	int size = settings->tiled;
+	double mp = (double) size * size / 1e6, start = 0.0, ms = 0.0;
+	int error = 0;
+
+	fprintf(stderr, "tiled %s %d x %d: writing the bitmap\n", settings->tiled_input, size, size);
+
+	if (!write_synthetic_bitmap(BENCH_TILED_INPUT, settings->tiled_input, size, size)){
+		fprintf(stderr, "tiled: could not write %s\n", BENCH_TILED_INPUT);
+		remove(BENCH_TILED_INPUT);
+		return;
+	}
+
+	options.quality = BENCH_QUALITY;
+	options.sample_ratio = NO_CHROMA_SUBSAMPLING;
+	options.stats = &stats;
+
+	start = now_ms();
+	error = encode_bmp_to_jpeg_tiled(BENCH_TILED_INPUT, BENCH_OUTPUT, &options);
+	ms = now_ms() - start;
+
+	if (error != JPG_ENC_SUCCESS){
+		fprintf(stderr, "tiled: could not be encoded (%d)\n", error);
+	}
+
+	else{
+		fprintf(stderr, "tiled %s %d x %d: %zu bytes in, %zu bytes out, peak RSS %ld KB\n", settings->tiled_input, size, size,
+		        stats.input_bytes, stats.output_bytes, peak_rss_kb());
+		fprintf(stderr, "  %-18s %10.2f ms %10.2f MP/s %10.1f ns/block\n", "encode", ms, mp / (ms / 1000.0), ms * 1e6 / stats.blocks);
+		fprintf(stderr, "  %-18s %10.2f ms\n", "read_convert", stats.stages[JPG_STAGE_PREPROCESS].wall_ms);
+		fprintf(stderr, "  %-18s %10.2f ms\n", "mcu_kernel", stats.stages[JPG_STAGE_DCT].wall_ms);
+		fprintf(stderr, "  %-18s %10.2f ms\n", "bitstream", stats.stages[JPG_STAGE_HUFFMAN].wall_ms);
+	}
+
+	remove(BENCH_TILED_INPUT);
+}
+
+void name_case(BenchCase *c, const char *input, int length, double mp, int width, int height, int level)
+{
+	snprintf(c->input, NAME_SIZE, "%.*s", length, input);
+	snprintf(c->name, NAME_SIZE * 2, "%s_%gmp_%s", c->input, mp, jpg_cpu_level_name(level));
+	c->width = width;
+	c->height = height;
+}
+
+int run_levels(BenchCase *cases, int max_cases, const BenchSettings *settings, const char *input, int length, double mp, int width, int height)
+{
+	int level = 0, num_cases = 0;
+
+	for (level = 0; level <= jpg_cpu_detect() && num_cases < max_cases; level++){
+		if (settings->levels != NULL && !in_list(settings->levels, jpg_cpu_level_name(level))){
+			continue;
+		}
+
+		// a level that fails its self test would run with the kernels of the one below it
+		if (jpg_set_cpu_level(level) != level){
+			fprintf(stderr, "%.*s: level %s isn't usable, skipped\n", length, input, jpg_cpu_level_name(level));
+			continue;
+		}
+
+		name_case(&cases[num_cases], input, length, mp, width, height, level);
+
+		if (run_case(&cases[num_cases], settings->repeat)){
+			show_case(&cases[num_cases]);
+			num_cases++;
+		}
+	}
+
+	return num_cases;
+}
+
+int run_case(BenchCase *c, int repeat)
+{
+	JpgEncodeOptions options = {0}, preset;
+	double start = 0.0, ms = 0.0;
+	int i = 0, k = 0, effort = 0;
+
+	for (k = 0; k < NUM_STAGES; k++){
+		c->ms[k] = -1.0;
+	}
+
+	options.quality = BENCH_QUALITY;
+	options.sample_ratio = NO_CHROMA_SUBSAMPLING;
+	options.optimize_huffman = 1;
+
+	for (i = 0; i < repeat; i++){
+		if (!run_stages(c)){
+			fprintf(stderr, "%s: could not be encoded\n", c->name);
+			return 0;
+		}
+
+		start = now_ms();
+		encode_bmp_to_jpeg_with_options(BENCH_INPUT, BENCH_OUTPUT, &options);
+		ms = now_ms() - start;
+
+		if (c->ms[STAGE_ENCODE] < 0.0 || ms < c->ms[STAGE_ENCODE]){
+			c->ms[STAGE_ENCODE] = ms;
+		}
+	}
+
+	c->bytes = file_size(BENCH_OUTPUT);
+
+	for (effort = 0; effort < JPG_NUM_EFFORTS; effort++){
+		jpg_preset_options(effort, BENCH_QUALITY, NO_CHROMA_SUBSAMPLING, &preset);
+		k = STAGE_EFFORT + effort;
+
+		for (i = 0; i < repeat; i++){
+			start = now_ms();
+			encode_bmp_to_jpeg_with_options(BENCH_INPUT, BENCH_OUTPUT, &preset);
+			ms = now_ms() - start;
+
+			if (c->ms[k] < 0.0 || ms < c->ms[k]){
+				c->ms[k] = ms;
+			}
+		}
+
+		c->effort_bytes[effort] = file_size(BENCH_OUTPUT);
+	}
+
+	for (k = STAGE_TILED; k <= STAGE_PIPELINE; k++){
+		options.pipeline = (k == STAGE_PIPELINE) ? BENCH_PIPELINE_SLOTS : 0;
+
+		for (i = 0; i < repeat; i++){
+			start = now_ms();
+			encode_bmp_to_jpeg_tiled(BENCH_INPUT, BENCH_OUTPUT, &options);
+			ms = now_ms() - start;
+
+			if (c->ms[k] < 0.0 || ms < c->ms[k]){
+				c->ms[k] = ms;
+			}
+		}
+	}
+
+	c->peak_rss_kb = peak_rss_kb();
+
+	return 1;
+}
+
+int run_stages(BenchCase *c)
+{
+	JpgData j_data = create_jpeg_data();
+	JpgBuffer buffer = {NULL, 0, 0};
+	HuffmanData dc[2], ac[2];
+	int **blocks[3];
+	int num_blocks[3];
+	double start = 0.0, ms[NUM_STAGES];
+	int k = 0, ok = 0;
+
+	if (j_data == NULL){
+		return 0;
+	}
+
+	j_data->input_filename = BENCH_INPUT;
+	j_data->quality = j_data->options.quality = BENCH_QUALITY;
+	j_data->sample_ratio = j_data->options.sample_ratio = NO_CHROMA_SUBSAMPLING;
+
+	start = now_ms();
+	preprocess_jpeg(j_data);
+	ms[0] = now_ms() - start;
+
+	// chroma_subsample isn't timed, it only logs a message at every ratio (see downsample.c)
+	if (j_data->num_blocks_Y > 0){
+		// before the DCT stage, which transforms the blocks in place; zig_zag writes over its output
+		start = now_ms();
+		transform_mcus(j_data);
+		ms[1] = now_ms() - start;
+
+		start = now_ms();
+		dct(j_data);
+		ms[2] = now_ms() - start;
+
+		start = now_ms();
+		quantise(j_data);
+		ms[3] = now_ms() - start;
+
+		start = now_ms();
+		zig_zag(j_data);
+		ms[4] = now_ms() - start;
+
+		// the DC differences and symbol counts an optimized image needs, then its tables
+		blocks[0] = j_data->zig_zag_Y;
+		blocks[1] = j_data->zig_zag_Cb;
+		blocks[2] = j_data->zig_zag_Cr;
+		num_blocks[0] = j_data->num_blocks_Y;
+		num_blocks[1] = j_data->num_blocks_Cb;
+		num_blocks[2] = j_data->num_blocks_Cr;
+
+		start = now_ms();
+		for (k = 0; k < 2; k++){
+			initialize_huffman_data(&dc[k]);
+			initialize_huffman_data(&ac[k]);
+		}
+
+		for (k = 0; k < j_data->num_components; k++){
+			count_symbols(blocks[k], num_blocks[k], 0, &dc[k > 0], &ac[k > 0]);
+		}
+
+		for (k = 0; k < 2; k++){
+			construct_huffman_table(&dc[k]);
+			construct_huffman_table(&ac[k]);
+		}
+		ms[5] = now_ms() - start;
+
+		start = now_ms();
+		ok = write_output(j_data, &buffer) == JPG_ENC_SUCCESS;
+		ms[6] = now_ms() - start;
+
+		c->blocks = (long) j_data->num_blocks_Y + j_data->num_blocks_Cb + j_data->num_blocks_Cr;
+
+		for (k = 0; ok && k < STAGE_ENCODE; k++){
+			if (c->ms[k] < 0.0 || ms[k] < c->ms[k]){
+				c->ms[k] = ms[k];
+			}
+		}
+	}
+
+	free_jpeg_buffer(&buffer);
+	destroy_jpeg_data(j_data);
+
+	return ok;
+}
+
+size_t file_size(const char *file)
+{
+	FILE *fp = fopen(file, "rb");
+	size_t size = 0;
+
+	if (fp != NULL){
+		fseek(fp, 0, SEEK_END);
+		size = (size_t) ftell(fp);
+		fclose(fp);
+	}
+
+	return size;
+}
+
+double now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+long peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0){
+		return 0;
+	}
+
+	return usage.ru_maxrss; // KB on Linux
+}
+
+void show_case(const BenchCase *c)
+{
+	double mp = (double) c->width * c->height / 1e6;
+	int k = 0;
+
+	fprintf(stderr, "%s: %d x %d, %ld blocks, %zu bytes, peak RSS %ld KB\n", c->name, c->width, c->height, c->blocks, c->bytes, c->peak_rss_kb);
+
+	for (k = 0; k < NUM_STAGES; k++){
+		fprintf(stderr, "  %-18s %10.2f ms %10.2f MP/s %10.1f ns/block", stage_names[k], c->ms[k],
+		        (c->ms[k] > 0.0) ? mp / (c->ms[k] / 1000.0) : 0.0, c->ms[k] * 1e6 / c->blocks);
+
+		if (k >= STAGE_EFFORT && k < STAGE_TILED){
+			fprintf(stderr, " %10zu bytes", c->effort_bytes[k - STAGE_EFFORT]);
+		}
+
+		fprintf(stderr, "\n");
+	}
+}
+
+int write_json(const char *file, const BenchCase *cases, int num_cases)
+{
+	FILE *fp = fopen(file, "w");
+	const BenchCase *c = NULL;
+	double mp = 0.0;
+	int i = 0, k = 0;
+
+	if (fp == NULL){
+		return 0;
+	}
+
+	// one stage per line so compare_baseline can read it back without a JSON parser
+	fprintf(fp, "{\n  \"version\": 1,\n  \"quality\": %d,\n  \"cases\": [\n", BENCH_QUALITY);
+
+	for (i = 0; i < num_cases; i++){
+		c = &cases[i];
+		mp = (double) c->width * c->height / 1e6;
+
+		fprintf(fp, "    {\n");
+		fprintf(fp, "      \"name\": \"%s\",\n", c->name);
+		fprintf(fp, "      \"input\": \"%s\",\n", c->input);
+		fprintf(fp, "      \"width\": %d,\n      \"height\": %d,\n      \"megapixels\": %.3f,\n", c->width, c->height, mp);
+		fprintf(fp, "      \"blocks\": %ld,\n      \"bytes\": %zu,\n      \"peak_rss_kb\": %ld,\n", c->blocks, c->bytes, c->peak_rss_kb);
+		fprintf(fp, "      \"stages\": {\n");
+
+		for (k = 0; k < NUM_STAGES; k++){
+			fprintf(fp, "        \"%s\": {\"ms\": %.3f, \"mp_per_s\": %.3f, \"ns_per_block\": %.1f", stage_names[k], c->ms[k],
+			        (c->ms[k] > 0.0) ? mp / (c->ms[k] / 1000.0) : 0.0, c->ms[k] * 1e6 / c->blocks);
+
+			// the presets also have the size of their file
+			if (k >= STAGE_EFFORT && k < STAGE_TILED){
+				fprintf(fp, ", \"bytes\": %zu", c->effort_bytes[k - STAGE_EFFORT]);
+			}
+
+			fprintf(fp, "}%s\n", (k < NUM_STAGES - 1) ? "," : "");
+		}
+
+		fprintf(fp, "      }\n    }%s\n", (i < num_cases - 1) ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+
+	return fclose(fp) == 0;
+}
+
+int compare_baseline(const char *file, const BenchCase *cases, int num_cases, double threshold)
+{
+	FILE *fp = fopen(file, "r");
+	const BenchCase *c = NULL;
+	char line[512], name[NAME_SIZE * 2], stage[NAME_SIZE];
+	double base = 0.0, change = 0.0;
+	int i = 0, k = 0, slower = 0;
+
+	if (fp == NULL){
+		fprintf(stderr, "could not read the baseline %s\n", file);
+		return 1;
+	}
+
+	fprintf(stderr, "compared with %s (threshold %.1f%%):\n", file, threshold);
+
+	while (fgets(line, sizeof(line), fp) != NULL){
+		if (sscanf(line, " \"name\": \"%127[^\"]\"", name) == 1){
+			c = NULL;
+
+			for (i = 0; i < num_cases; i++){
+				if (strcmp(cases[i].name, name) == 0) c = &cases[i];
+			}
+		}
+
+		else if (c != NULL && sscanf(line, " \"%63[^\"]\": {\"ms\": %lf", stage, &base) == 2){
+			for (k = 0; k < NUM_STAGES; k++){
+				if (strcmp(stage_names[k], stage) != 0 || base <= 0.0){
+					continue;
+				}
+
+				change = (c->ms[k] - base) * 100.0 / base;
+
+				// stages under a millisecond are mostly noise
+				if (change > threshold && base >= 1.0){
+					fprintf(stderr, "  SLOWER %s %s: %.2f ms -> %.2f ms (%+.1f%%)\n", c->name, stage, base, c->ms[k], change);
+					slower++;
+				}
+
+				else{
+					fprintf(stderr, "  ok     %s %s: %.2f ms -> %.2f ms (%+.1f%%)\n", c->name, stage, base, c->ms[k], change);
+				}
+			}
+		}
+	}
+
+	fclose(fp);
+
+	return slower;
+}
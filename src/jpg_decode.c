@@ -0,0 +1,1305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "headers/jpg_decode.h"
+#include "headers/huffman_decode.h"
+#include "headers/idct.h"
+#include "headers/thread_pool.h"
+#include "headers/upsample.h"
+#include "headers/trace.h"
+
+// markers
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOF0 0xC0
+#define MARKER_SOF1 0xC1
+#define MARKER_DHT 0xC4
+#define MARKER_SOS 0xDA
+#define MARKER_DQT 0xDB
+#define MARKER_DRI 0xDD
+#define MARKER_RST0 0xD0
+#define MARKER_RST7 0xD7
+#define MARKER_TEM 0x01
+
+// number of output rows converted to pixels at a time
+#define CONVERT_BAND_ROWS 16
+
+// where the errors go (see set_jpeg_decode_log), nothing is reported without a callback
+static JpgLogCallback decode_log = NULL;
+static void *decode_log_context = NULL;
+
+/* ===================================== Small helper functions ================================== */
+JpgDecodeData create_decode_data(void);
+void destroy_decode_data(JpgDecodeData d);
+
+// passes the last error that occured to the log callback
+void log_decode_error(JpgDecodeData d);
+
+// reads the frame header of a jpeg file
+int read_frame_header(FILE *fp, JpegInfo *info);
+
+// returns 1 if a marker is a start of frame
+int is_sof_marker(int marker);
+
+// reads the whole jpeg file into memory
+void read_jpeg_file(JpgDecodeData d);
+
+// reads the markers up to and including the start of scan
+void read_markers(JpgDecodeData d);
+
+// parse the segments of each marker
+void parse_dqt(JpgDecodeData d, const Byte *segment, int length);
+void parse_dht(JpgDecodeData d, const Byte *segment, int length);
+void parse_sof(JpgDecodeData d, const Byte *segment, int length);
+void parse_sos(JpgDecodeData d, const Byte *segment, int length);
+
+// determines the MCU layout and allocates the sample planes for the region at the output scale
+void setup_components(JpgDecodeData d);
+
+// allocates the coefficient blocks of a component when reading coefficients instead of samples
+void allocate_coefficients(JpgDecodeData d, int index);
+
+// finds the start of every restart interval in the entropy coded data
+void index_restart_intervals(JpgDecodeData d);
+
+// fills in the frame, table sets and intervals of a layout from the markers that have been read
+void fill_layout(JpgDecodeData d, JpegLayout *layout);
+
+// runs each stage of the decoder, returns the pixels in d->format
+Byte *decode_jpeg(JpgDecodeData d);
+
+// reads the image and decodes the samples of each component
+void decode_components(JpgDecodeData d);
+
+// entropy decodes the scan and performs the inverse DCT on each block inside the region
+void decode_scan(JpgDecodeData d);
+
+// decodes the restart intervals covering the region in parallel
+void decode_scan_parallel(JpgDecodeData d);
+
+// task run by the thread pool, decodes a single restart interval
+void decode_interval(void *arg, int index);
+
+// decodes the blocks of one MCU, the inverse DCT is skipped unless transform is set. Returns 0 if
+// the data is corrupt.
+int decode_mcu(JpgDecodeData d, BitReader *br, int *dc_pred, int mx, int my, int transform);
+
+// upsamples the chroma components and converts YCbCr => RGB / BGRA
+Byte *convert_to_rgb(JpgDecodeData d);
+
+// task run by the thread pool, converts a band of output rows
+void convert_rows(void *arg, int index);
+
+// returns the row of a component's samples used by output row y (relative to the first decoded MCU)
+const Byte *component_row(JpgDecodeData d, const DecodeComponent *c, int y);
+
+// replicates the samples of a component across one output row, for unusual sampling layouts
+void upsample_row(JpgDecodeData d, const DecodeComponent *c, const Byte *row, int origin_x, Byte *out);
+
+/* ==================================== Function definitions ===================================== */
+
+int probe_jpeg(const char *input_filename, JpegInfo *info)
+{
+	FILE *fp = NULL;
+	int error = JPG_DEC_SUCCESS;
+
+	memset(info, 0, sizeof(JpegInfo));
+	fp = fopen(input_filename, "rb");
+
+	if (fp != NULL){
+		error = read_frame_header(fp, info);
+		fclose(fp);
+	}
+
+	else{
+		error = JPG_DEC_FILE_DOESNT_EXIST;
+	}
+
+	return error;
+}
+
+Byte *decode_jpeg_to_rgb(const char *input_filename, int scale, int *width, int *height)
+{
+	return decode_jpeg_region_to_rgb(input_filename, scale, 0, 0, INT_MAX, INT_MAX, width, height);
+}
+
+Byte *decode_jpeg_region_to_rgb(const char *input_filename, int scale, int x, int y, int w, int h, int *width, int *height)
+{
+	JpgDecodeData d = NULL;
+	Byte *rgb = NULL;
+
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+		d->scale = scale;
+		d->region_x = x;
+		d->region_y = y;
+		d->region_w = w;
+		d->region_h = h;
+
+		rgb = decode_jpeg(d);
+
+		if (rgb != NULL){
+			*width = d->output_width;
+			*height = d->output_height;
+		}
+
+		destroy_decode_data(d);
+	}
+
+	return rgb;
+}
+
+Byte *decode_jpeg_to_bgra(const char *input_filename, int scale, int *width, int *height)
+{
+	JpgDecodeData d = NULL;
+	Byte *bgra = NULL;
+
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+		d->scale = scale;
+		d->region_w = d->region_h = INT_MAX;
+		d->format = JPG_PIXEL_BGRA;
+
+		bgra = decode_jpeg(d);
+
+		if (bgra != NULL){
+			*width = d->output_width;
+			*height = d->output_height;
+		}
+
+		destroy_decode_data(d);
+	}
+
+	return bgra;
+}
+
+int decode_jpeg_to_yuv(const char *input_filename, int scale, YuvImage *yuv)
+{
+	JpgDecodeData d = NULL;
+	DecodeComponent *c = NULL;
+	int i = 0, error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+
+	memset(yuv, 0, sizeof(YuvImage));
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+		d->scale = scale;
+		d->region_w = d->region_h = INT_MAX;
+
+		decode_components(d);
+
+		// the decoded sample planes are handed over as they are, no conversion or copying
+		if (d->error == JPG_DEC_SUCCESS){
+			yuv->width = d->output_width;
+			yuv->height = d->output_height;
+			yuv->num_planes = d->num_components;
+
+			for (i = 0; i < d->num_components; i++){
+				c = &d->components[i];
+				yuv->planes[i] = c->samples;
+				yuv->plane_width[i] = (d->output_width * c->h_samp + d->max_h - 1) / d->max_h;
+				yuv->plane_height[i] = (d->output_height * c->v_samp + d->max_v - 1) / d->max_v;
+				yuv->stride[i] = c->sample_width;
+				c->samples = NULL;
+			}
+		}
+
+		else{
+			log_decode_error(d);
+		}
+
+		error = d->error;
+		destroy_decode_data(d);
+	}
+
+	return error;
+}
+
+void free_yuv_image(YuvImage *yuv)
+{
+	int i = 0;
+
+	for (i = 0; i < JPG_MAX_COMPONENTS; i++){
+		free(yuv->planes[i]);
+		yuv->planes[i] = NULL;
+	}
+}
+
+int read_jpeg_coefficients(const char *input_filename, JpgFrame *frame)
+{
+	JpgDecodeData d = NULL;
+	int i = 0, error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+
+	memset(frame, 0, sizeof(JpgFrame));
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+		d->scale = JPG_SCALE_FULL;
+		d->region_w = d->region_h = INT_MAX;
+		d->frame = frame;
+
+		decode_components(d);
+
+		if (d->error == JPG_DEC_SUCCESS){
+			frame->width = d->width;
+			frame->height = d->height;
+			frame->num_components = d->num_components;
+			frame->restart_interval = d->restart_interval;
+
+			for (i = 0; i < 4; i++){
+				memcpy(frame->quant[i], d->quant[i], sizeof(frame->quant[i]));
+			}
+		}
+
+		else{
+			log_decode_error(d);
+			free_jpeg_frame(frame);
+		}
+
+		error = d->error;
+		destroy_decode_data(d);
+	}
+
+	return error;
+}
+
+int read_jpeg_layout(const char *input_filename, JpegLayout *layout)
+{
+	JpgDecodeData d = NULL;
+	int error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+
+	memset(layout, 0, sizeof(JpegLayout));
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+
+		read_jpeg_file(d);
+		if (d->error == JPG_DEC_SUCCESS) read_markers(d);
+		if (d->error == JPG_DEC_SUCCESS) fill_layout(d, layout);
+
+		// the file now belongs to the layout
+		if (d->error == JPG_DEC_SUCCESS){
+			layout->data = d->data;
+			layout->size = d->size;
+			d->data = NULL;
+		}
+
+		else{
+			log_decode_error(d);
+			free_jpeg_layout(layout);
+		}
+
+		error = d->error;
+		destroy_decode_data(d);
+	}
+
+	return error;
+}
+
+void free_jpeg_layout(JpegLayout *layout)
+{
+	free(layout->data);
+	free(layout->interval_offsets);
+	layout->data = NULL;
+	layout->interval_offsets = NULL;
+}
+
+Byte *decode_jpeg_to_rgb_parallel(const char *input_filename, int scale, int num_threads, int *width, int *height)
+{
+	JpgDecodeData d = NULL;
+	Byte *rgb = NULL;
+
+	d = create_decode_data();
+
+	if (d != NULL){
+		d->input_filename = (char *) input_filename;
+		d->scale = scale;
+		d->region_w = d->region_h = INT_MAX;
+		d->num_threads = num_threads;
+
+		rgb = decode_jpeg(d);
+
+		if (rgb != NULL){
+			*width = d->output_width;
+			*height = d->output_height;
+		}
+
+		destroy_decode_data(d);
+	}
+
+	return rgb;
+}
+
+Byte *decode_jpeg(JpgDecodeData d)
+{
+	Byte *rgb = NULL;
+
+	decode_components(d);
+
+	if (d->error == JPG_DEC_SUCCESS) rgb = convert_to_rgb(d);
+
+	if (rgb == NULL){
+		log_decode_error(d);
+	}
+
+	return rgb;
+}
+
+void decode_components(JpgDecodeData d)
+{
+	if (d->scale != JPG_SCALE_FULL && d->scale != JPG_SCALE_HALF && d->scale != JPG_SCALE_QUARTER && d->scale != JPG_SCALE_EIGHTH){
+		d->error = JPG_DEC_UNSUPPORTED;
+	}
+
+	if (d->error == JPG_DEC_SUCCESS) read_jpeg_file(d);
+	if (d->error == JPG_DEC_SUCCESS) read_markers(d);
+	if (d->error == JPG_DEC_SUCCESS) setup_components(d);
+
+	if (d->error == JPG_DEC_SUCCESS){
+		trace_begin("decode_scan", -1);
+
+		// restart intervals can be decoded independently, without them the scan is serial
+		if (d->pool != NULL && d->num_restart_offsets){
+			decode_scan_parallel(d);
+		}
+
+		else{
+			decode_scan(d);
+		}
+
+		trace_end();
+	}
+}
+
+JpgDecodeData create_decode_data(void)
+{
+	JpgDecodeData d = calloc(1, sizeof(JpegDecodeData));
+	return d;
+}
+
+void destroy_decode_data(JpgDecodeData d)
+{
+	int i = 0;
+
+	for (i = 0; i < JPG_MAX_COMPONENTS; i++){
+		free(d->components[i].samples);
+	}
+
+	if (d->pool != NULL){
+		destroy_thread_pool(d->pool);
+	}
+
+	free(d->restart_offsets);
+	free(d->data);
+	free(d);
+}
+
+void set_jpeg_decode_log(JpgLogCallback log, void *context)
+{
+	decode_log = log;
+	decode_log_context = context;
+}
+
+void log_decode_error(JpgDecodeData d)
+{
+	char message[256];
+
+	if (decode_log == NULL){
+		return;
+	}
+
+	switch (d->error){
+		case JPG_DEC_FILE_DOESNT_EXIST:
+			snprintf(message, sizeof(message), "%s doesn't exist", d->input_filename);
+			break;
+
+		case JPG_DEC_READ_FAILED:
+			snprintf(message, sizeof(message), "Reading JPEG image failed");
+			break;
+
+		case JPG_DEC_NOT_A_JPEG:
+			snprintf(message, sizeof(message), "%s is not a JPEG image", d->input_filename);
+			break;
+
+		case JPG_DEC_UNSUPPORTED:
+			snprintf(message, sizeof(message), "Only baseline JPEG images with 1 or 3 components can be decoded");
+			break;
+
+		case JPG_DEC_CORRUPT:
+			snprintf(message, sizeof(message), "JPEG image is corrupt");
+			break;
+
+		case JPG_DEC_FAILED_ALLOCATE_BUFFER:
+			snprintf(message, sizeof(message), "Failed to allocate a buffer.");
+			break;
+
+		case JPG_DEC_BAD_REGION:
+			snprintf(message, sizeof(message), "Region lies outside the image");
+			break;
+
+		default:
+			return;
+	}
+
+	decode_log(decode_log_context, JPG_LOG_ERROR, message);
+}
+
+int read_frame_header(FILE *fp, JpegInfo *info)
+{
+	Byte header[4], segment[6 + 3 * 255];
+	int marker = 0, length = 0, i = 0;
+
+	if (fread(header, sizeof(Byte), 2, fp) != 2 || header[0] != 0xFF || header[1] != MARKER_SOI){
+		return JPG_DEC_NOT_A_JPEG;
+	}
+
+	while (fread(header, sizeof(Byte), 2, fp) == 2){
+		if (header[0] != 0xFF){
+			return JPG_DEC_CORRUPT;
+		}
+
+		// fill bytes and markers without a segment
+		marker = header[1];
+		if (marker == 0xFF){
+			fseek(fp, -1, SEEK_CUR);
+			continue;
+		}
+
+		if (marker == MARKER_SOI || (marker >= MARKER_RST0 && marker <= MARKER_RST7) || marker == MARKER_TEM){
+			continue;
+		}
+
+		if (marker == MARKER_EOI || marker == MARKER_SOS || fread(header + 2, sizeof(Byte), 2, fp) != 2){
+			break;
+		}
+
+		length = (header[2] << 8) | header[3];
+		if (length < 2){
+			return JPG_DEC_CORRUPT;
+		}
+
+		if (is_sof_marker(marker)){
+			if (length < 8 || length - 2 > (int) sizeof(segment) || fread(segment, sizeof(Byte), length - 2, fp) != (size_t) (length - 2)){
+				return JPG_DEC_CORRUPT;
+			}
+
+			info->sof_marker = marker;
+			info->precision = segment[0];
+			info->height = (segment[1] << 8) | segment[2];
+			info->width = (segment[3] << 8) | segment[4];
+			info->num_components = segment[5];
+
+			if (length - 8 < 3 * info->num_components){
+				return JPG_DEC_CORRUPT;
+			}
+
+			for (i = 0; i < info->num_components && i < 4; i++){
+				info->h_samp[i] = segment[7 + 3*i] >> 4;
+				info->v_samp[i] = segment[7 + 3*i] & 15;
+			}
+
+			info->decodable = (marker == MARKER_SOF0 || marker == MARKER_SOF1) && info->precision == 8
+			                  && (info->num_components == 1 || info->num_components == 3);
+
+			return JPG_DEC_SUCCESS;
+		}
+
+		// APPn, COM, tables etc. are skipped without being read
+		if (fseek(fp, length - 2, SEEK_CUR) != 0){
+			break;
+		}
+	}
+
+	return JPG_DEC_CORRUPT; // never reached a frame header
+}
+
+int is_sof_marker(int marker)
+{
+	// 0xC4 (DHT), 0xC8 (JPG) and 0xCC (DAC) share the range
+	return marker >= MARKER_SOF0 && marker <= 0xCF && marker != MARKER_DHT && marker != 0xC8 && marker != 0xCC;
+}
+
+void read_jpeg_file(JpgDecodeData d)
+{
+	FILE *fp = NULL;
+	long fs = 0;
+
+	fp = fopen(d->input_filename, "rb");
+
+	if (fp != NULL){
+		fseek(fp, 0, SEEK_END);
+		fs = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		d->data = malloc(sizeof(Byte) * (fs + 1));
+
+		if (d->data == NULL){
+			d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+		}
+
+		else if (fs <= 0 || fread(d->data, sizeof(Byte), fs, fp) != (size_t) fs){
+			d->error = JPG_DEC_READ_FAILED;
+		}
+
+		d->size = (size_t) fs;
+		fclose(fp);
+	}
+
+	else{
+		d->error = JPG_DEC_FILE_DOESNT_EXIST;
+	}
+}
+
+void read_markers(JpgDecodeData d)
+{
+	const Byte *data = d->data;
+	size_t pos = 0;
+	int marker = 0, length = 0;
+	int have_frame = 0;
+
+	if (d->size < 4 || data[0] != 0xFF || data[1] != MARKER_SOI){
+		d->error = JPG_DEC_NOT_A_JPEG;
+		return;
+	}
+
+	pos = 2;
+	while (pos + 4 <= d->size && d->error == JPG_DEC_SUCCESS){
+		if (data[pos] != 0xFF){
+			d->error = JPG_DEC_CORRUPT;
+			break;
+		}
+
+		marker = data[pos + 1];
+		pos += 2;
+
+		// fill bytes and markers without a segment
+		if (marker == 0xFF){
+			pos--;
+			continue;
+		}
+
+		if (marker == MARKER_SOI || (marker >= MARKER_RST0 && marker <= MARKER_RST7) || marker == MARKER_TEM){
+			continue;
+		}
+
+		if (marker == MARKER_EOI){
+			break;
+		}
+
+		length = (data[pos] << 8) | data[pos + 1];
+		if (length < 2 || pos + length > d->size){
+			d->error = JPG_DEC_CORRUPT;
+			break;
+		}
+
+		switch (marker){
+			case MARKER_DQT:
+				parse_dqt(d, data + pos + 2, length - 2);
+				break;
+
+			case MARKER_DHT:
+				parse_dht(d, data + pos + 2, length - 2);
+				break;
+
+			case MARKER_SOF0:
+			case MARKER_SOF1:
+				parse_sof(d, data + pos + 2, length - 2);
+				have_frame = 1;
+				break;
+
+			case MARKER_DRI:
+				d->restart_interval = (data[pos + 2] << 8) | data[pos + 3];
+				break;
+
+			case MARKER_SOS:
+				if (!have_frame){
+					d->error = JPG_DEC_CORRUPT;
+					return;
+				}
+
+				parse_sos(d, data + pos + 2, length - 2);
+				d->scan_start = pos + length;
+				return;
+
+			default:
+				// progressive, lossless and arithmetic coded frames
+				if (is_sof_marker(marker)){
+					d->error = JPG_DEC_UNSUPPORTED;
+				}
+				// APPn, COM etc. are skipped
+				break;
+		}
+
+		pos += length;
+	}
+
+	if (d->error == JPG_DEC_SUCCESS){
+		d->error = JPG_DEC_CORRUPT; // never reached a scan
+	}
+}
+
+void parse_dqt(JpgDecodeData d, const Byte *segment, int length)
+{
+	int pos = 0, k = 0;
+	int precision = 0, table = 0;
+
+	while (pos < length){
+		precision = segment[pos] >> 4;
+		table = segment[pos] & 3;
+		pos++;
+
+		if (pos + 64 * (precision + 1) > length){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+
+		// values are stored in zig-zag order
+		for (k = 0; k < 64; k++){
+			if (precision){
+				d->quant[table][ natural_order[k] ] = (segment[pos] << 8) | segment[pos + 1];
+				pos += 2;
+			}
+
+			else{
+				d->quant[table][ natural_order[k] ] = segment[pos++];
+			}
+		}
+	}
+}
+
+void parse_dht(JpgDecodeData d, const Byte *segment, int length)
+{
+	DecodeHuffmanTable *table = NULL;
+	int pos = 0, i = 0, total = 0;
+
+	while (pos + 17 <= length){
+		table = (segment[pos] >> 4) ? &d->ac_tables[segment[pos] & 3] : &d->dc_tables[segment[pos] & 3];
+		pos++;
+
+		total = 0;
+		table->bits[0] = 0;
+		for (i = 1; i <= 16; i++){
+			table->bits[i] = segment[pos++];
+			total += table->bits[i];
+		}
+
+		if (total > 256 || pos + total > length){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+
+		for (i = 0; i < total; i++){
+			table->huffval[i] = segment[pos++];
+		}
+
+		if (!build_decode_table(table)){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+	}
+}
+
+void parse_sof(JpgDecodeData d, const Byte *segment, int length)
+{
+	DecodeComponent *c = NULL;
+	int i = 0;
+
+	if (length < 6 || segment[0] != 8){
+		d->error = JPG_DEC_UNSUPPORTED;
+		return;
+	}
+
+	d->height = (segment[1] << 8) | segment[2];
+	d->width = (segment[3] << 8) | segment[4];
+	d->num_components = segment[5];
+
+	if ((d->num_components != 1 && d->num_components != 3) || d->width == 0 || d->height == 0){
+		d->error = JPG_DEC_UNSUPPORTED;
+		return;
+	}
+
+	if (length < 6 + 3 * d->num_components){
+		d->error = JPG_DEC_CORRUPT;
+		return;
+	}
+
+	for (i = 0; i < d->num_components; i++){
+		c = &d->components[i];
+		c->id = segment[6 + 3*i];
+		c->h_samp = segment[7 + 3*i] >> 4;
+		c->v_samp = segment[7 + 3*i] & 15;
+		c->quant_table = segment[8 + 3*i] & 3;
+
+		if (c->h_samp < 1 || c->h_samp > 4 || c->v_samp < 1 || c->v_samp > 4){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+	}
+}
+
+void parse_sos(JpgDecodeData d, const Byte *segment, int length)
+{
+	DecodeComponent *c = NULL;
+	int i = 0, j = 0, found = 0;
+
+	d->num_scan_components = segment[0];
+
+	// a single interleaved scan must hold every component
+	if (d->num_scan_components != d->num_components || length < 1 + 2 * d->num_scan_components + 3){
+		d->error = JPG_DEC_UNSUPPORTED;
+		return;
+	}
+
+	for (i = 0; i < d->num_scan_components; i++){
+		found = 0;
+		for (j = 0; j < d->num_components; j++){
+			if (d->components[j].id == segment[1 + 2*i]){
+				c = &d->components[j];
+				c->dc_table = segment[2 + 2*i] >> 4 & 3;
+				c->ac_table = segment[2 + 2*i] & 3;
+				d->scan_components[i] = j;
+				found = 1;
+			}
+		}
+
+		if (!found || !d->dc_tables[c->dc_table].present || !d->ac_tables[c->ac_table].present){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+	}
+}
+
+void setup_components(JpgDecodeData d)
+{
+	DecodeComponent *c = NULL;
+	int i = 0;
+	int mcu_width = 0, mcu_height = 0;
+	int region_right = 0, region_bottom = 0;
+
+	// sampling factors have no meaning in a single component image, each block is an MCU
+	if (d->num_components == 1){
+		d->components[0].h_samp = d->components[0].v_samp = 1;
+	}
+
+	d->max_h = d->max_v = 1;
+	for (i = 0; i < d->num_components; i++){
+		if (d->components[i].h_samp > d->max_h) d->max_h = d->components[i].h_samp;
+		if (d->components[i].v_samp > d->max_v) d->max_v = d->components[i].v_samp;
+	}
+
+	mcu_width = 8 * d->max_h;
+	mcu_height = 8 * d->max_v;
+	d->mcus_per_row = (d->width + mcu_width - 1) / mcu_width;
+	d->mcu_rows = (d->height + mcu_height - 1) / mcu_height;
+
+	if (d->region_x < 0 || d->region_y < 0 || d->region_w <= 0 || d->region_h <= 0
+		|| d->region_x >= d->width || d->region_y >= d->height){
+		d->error = JPG_DEC_BAD_REGION;
+		return;
+	}
+
+	region_right = (d->region_w > d->width - d->region_x) ? d->width : d->region_x + d->region_w;
+	region_bottom = (d->region_h > d->height - d->region_y) ? d->height : d->region_y + d->region_h;
+	d->region_w = region_right - d->region_x;
+	d->region_h = region_bottom - d->region_y;
+
+	// only the MCUs that intersect the region are transformed
+	d->first_mcu_col = d->region_x / mcu_width;
+	d->last_mcu_col = (region_right - 1) / mcu_width;
+	d->first_mcu_row = d->region_y / mcu_height;
+	d->last_mcu_row = (region_bottom - 1) / mcu_height;
+
+	d->block_size = 8 / d->scale;
+	d->output_width = (region_right + d->scale - 1) / d->scale - d->region_x / d->scale;
+	d->output_height = (region_bottom + d->scale - 1) / d->scale - d->region_y / d->scale;
+
+	for (i = 0; i < d->num_components; i++){
+		c = &d->components[i];
+		c->width_in_blocks = (d->last_mcu_col - d->first_mcu_col + 1) * c->h_samp;
+		c->height_in_blocks = (d->last_mcu_row - d->first_mcu_row + 1) * c->v_samp;
+		c->sample_width = c->width_in_blocks * d->block_size;
+		c->sample_height = c->height_in_blocks * d->block_size;
+
+		if (d->frame != NULL){
+			allocate_coefficients(d, i);
+		}
+
+		else{
+			c->samples = malloc(sizeof(Byte) * c->sample_width * c->sample_height);
+		}
+
+		if (c->samples == NULL && d->frame == NULL){
+			d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+		}
+
+		if (d->error != JPG_DEC_SUCCESS){
+			return;
+		}
+	}
+
+	if (d->num_threads > 1){
+		d->pool = create_thread_pool(d->num_threads);
+	}
+
+	// a region that starts part way through the image can jump straight to its restart interval,
+	// and each interval can be given to a different thread
+	if (d->restart_interval && (d->first_mcu_row > 0 || d->first_mcu_col > 0 || d->pool != NULL)){
+		index_restart_intervals(d);
+	}
+
+	init_idct();
+	init_upsample();
+}
+
+void allocate_coefficients(JpgDecodeData d, int index)
+{
+	DecodeComponent *c = &d->components[index];
+	JpgComponent *fc = &d->frame->components[index];
+	size_t num_blocks = 0, b = 0;
+
+	fc->id = c->id;
+	fc->h_samp = c->h_samp;
+	fc->v_samp = c->v_samp;
+	fc->quant_table = c->quant_table;
+	fc->huff_table = (index == 0) ? JPG_HUFF_LUMINANCE : JPG_HUFF_CHROMINANCE;
+	fc->width_in_blocks = c->width_in_blocks;
+	fc->height_in_blocks = c->height_in_blocks;
+
+	num_blocks = (size_t) c->width_in_blocks * c->height_in_blocks;
+	fc->blocks = malloc(sizeof(int *) * num_blocks);
+	fc->coefficients = malloc(sizeof(int) * 64 * num_blocks);
+
+	if (fc->blocks == NULL || fc->coefficients == NULL){
+		d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+		return;
+	}
+
+	for (b = 0; b < num_blocks; b++){
+		fc->blocks[b] = fc->coefficients + 64 * b;
+	}
+}
+
+void index_restart_intervals(JpgDecodeData d)
+{
+	const Byte *data = d->data;
+	const Byte *p = NULL;
+	size_t pos = 0;
+	int expected = 0, n = 0;
+
+	expected = (d->mcus_per_row * d->mcu_rows + d->restart_interval - 1) / d->restart_interval;
+	d->restart_offsets = malloc(sizeof(size_t) * expected);
+
+	if (d->restart_offsets == NULL){
+		return;
+	}
+
+	d->restart_offsets[n++] = d->scan_start;
+
+	// stuffed bytes (0xFF00) are the only other use of 0xFF inside the entropy coded segment
+	pos = d->scan_start;
+	while (n < expected && pos + 1 < d->size){
+		p = memchr(data + pos, 0xFF, d->size - pos - 1);
+		if (p == NULL){
+			break;
+		}
+
+		pos = p - data;
+		if (data[pos + 1] >= MARKER_RST0 && data[pos + 1] <= MARKER_RST7){
+			d->restart_offsets[n++] = pos + 2;
+		}
+
+		else if (data[pos + 1] != 0x00 && data[pos + 1] != 0xFF){
+			break; // end of the scan
+		}
+
+		pos++;
+	}
+
+	// a damaged file is decoded from the start instead
+	if (n == expected){
+		d->num_restart_offsets = n;
+	}
+
+	else{
+		free(d->restart_offsets);
+		d->restart_offsets = NULL;
+	}
+}
+
+void fill_layout(JpgDecodeData d, JpegLayout *layout)
+{
+	const DecodeComponent *c = NULL;
+	JpgComponent *fc = NULL;
+	const Byte *data = d->data;
+	int set_dc[2] = {-1, -1}, set_ac[2] = {-1, -1};
+	int i = 0, s = 0, num_sets = 0;
+	size_t pos = 0;
+
+	if (d->num_components == 1){
+		d->components[0].h_samp = d->components[0].v_samp = 1;
+	}
+
+	layout->frame.width = d->width;
+	layout->frame.height = d->height;
+	layout->frame.num_components = d->num_components;
+	layout->frame.restart_interval = d->restart_interval;
+	memcpy(layout->frame.quant, d->quant, sizeof(d->quant));
+
+	d->max_h = d->max_v = 1;
+	for (i = 0; i < d->num_components; i++){
+		c = &d->components[i];
+
+		// the blocks of an MCU are written in frame order
+		if (d->scan_components[i] != i){
+			d->error = JPG_DEC_UNSUPPORTED;
+			return;
+		}
+
+		// each distinct pair of DC and AC tables becomes a table set
+		s = 0;
+		while (s < num_sets && (set_dc[s] != c->dc_table || set_ac[s] != c->ac_table)){
+			s++;
+		}
+
+		if (s == num_sets){
+			if (num_sets == 2){
+				d->error = JPG_DEC_UNSUPPORTED;
+				return;
+			}
+
+			set_dc[s] = c->dc_table;
+			set_ac[s] = c->ac_table;
+			memcpy(layout->dc_tables[s].bits, d->dc_tables[c->dc_table].bits, 17);
+			memcpy(layout->dc_tables[s].huffval, d->dc_tables[c->dc_table].huffval, 256);
+			memcpy(layout->ac_tables[s].bits, d->ac_tables[c->ac_table].bits, 17);
+			memcpy(layout->ac_tables[s].huffval, d->ac_tables[c->ac_table].huffval, 256);
+			num_sets++;
+		}
+
+		fc = &layout->frame.components[i];
+		fc->id = c->id;
+		fc->h_samp = c->h_samp;
+		fc->v_samp = c->v_samp;
+		fc->quant_table = c->quant_table;
+		fc->huff_table = s;
+
+		if (c->h_samp > d->max_h) d->max_h = c->h_samp;
+		if (c->v_samp > d->max_v) d->max_v = c->v_samp;
+	}
+
+	d->mcus_per_row = (d->width + 8 * d->max_h - 1) / (8 * d->max_h);
+	d->mcu_rows = (d->height + 8 * d->max_v - 1) / (8 * d->max_v);
+	layout->mcus_per_row = d->mcus_per_row;
+	layout->mcu_rows = d->mcu_rows;
+
+	for (i = 0; i < d->num_components; i++){
+		fc = &layout->frame.components[i];
+		fc->width_in_blocks = d->mcus_per_row * fc->h_samp;
+		fc->height_in_blocks = d->mcu_rows * fc->v_samp;
+	}
+
+	if (d->restart_interval){
+		index_restart_intervals(d);
+
+		if (d->restart_offsets == NULL){
+			d->error = JPG_DEC_CORRUPT;
+			return;
+		}
+
+		layout->interval_offsets = d->restart_offsets;
+		layout->num_intervals = d->num_restart_offsets;
+		d->restart_offsets = NULL;
+	}
+
+	else{
+		layout->interval_offsets = malloc(sizeof(size_t));
+
+		if (layout->interval_offsets == NULL){
+			d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+			return;
+		}
+
+		layout->interval_offsets[0] = d->scan_start;
+		layout->num_intervals = 1;
+	}
+
+	// the scan ends at the first marker after the last interval that isn't a stuffed byte or fill
+	pos = layout->interval_offsets[layout->num_intervals - 1];
+	while (pos + 1 < d->size && !(data[pos] == 0xFF && data[pos + 1] != 0x00 && data[pos + 1] != 0xFF)){
+		pos++;
+	}
+
+	if (pos + 1 >= d->size || data[pos + 1] != MARKER_EOI){
+		d->error = (pos + 1 >= d->size) ? JPG_DEC_CORRUPT : JPG_DEC_UNSUPPORTED;
+		return;
+	}
+
+	layout->scan_end = pos;
+}
+
+void decode_scan(JpgDecodeData d)
+{
+	BitReader br;
+	int dc_pred[JPG_MAX_COMPONENTS] = {0};
+	int mcu = 0, first = 0, last = 0;
+	int fresh_mcu = 0, interval = 0;
+	int ri = 0, mcus_per_row = 0, my = 0, i = 0;
+
+	ri = d->restart_interval;
+	mcus_per_row = d->mcus_per_row;
+
+	init_bit_reader(&br, d->data, d->scan_start, d->size);
+	fresh_mcu = mcu = 0;
+
+	for (my = d->first_mcu_row; my <= d->last_mcu_row; my++){
+		first = my * mcus_per_row + d->first_mcu_col;
+		last = my * mcus_per_row + d->last_mcu_col;
+
+		// jump over whole restart intervals instead of decoding them
+		if (d->num_restart_offsets && first / ri > mcu / ri){
+			interval = first / ri;
+			init_bit_reader(&br, d->data, d->restart_offsets[interval], d->size);
+			for (i = 0; i < JPG_MAX_COMPONENTS; i++){
+				dc_pred[i] = 0;
+			}
+
+			fresh_mcu = mcu = interval * ri;
+		}
+
+		// MCUs before the region are only decoded far enough to track the DC predictions
+		for (; mcu <= last; mcu++){
+			if (ri && mcu % ri == 0 && mcu != fresh_mcu){
+				restart_bit_reader(&br);
+				for (i = 0; i < JPG_MAX_COMPONENTS; i++){
+					dc_pred[i] = 0;
+				}
+			}
+
+			if (!decode_mcu(d, &br, dc_pred, mcu % mcus_per_row, my, mcu >= first)){
+				d->error = JPG_DEC_CORRUPT;
+				return;
+			}
+		}
+	}
+}
+
+void decode_scan_parallel(JpgDecodeData d)
+{
+	int last_interval = 0;
+
+	d->first_interval = (d->first_mcu_row * d->mcus_per_row + d->first_mcu_col) / d->restart_interval;
+	last_interval = (d->last_mcu_row * d->mcus_per_row + d->last_mcu_col) / d->restart_interval;
+
+	thread_pool_run(d->pool, decode_interval, d, last_interval - d->first_interval + 1);
+
+	if (__atomic_load_n(&d->corrupt, __ATOMIC_RELAXED)){
+		d->error = JPG_DEC_CORRUPT;
+	}
+}
+
+void decode_interval(void *arg, int index)
+{
+	JpgDecodeData d = arg;
+	BitReader br;
+	int dc_pred[JPG_MAX_COMPONENTS] = {0};
+	int interval = 0, mcu = 0, end = 0;
+	int mx = 0, my = 0;
+
+	interval = d->first_interval + index;
+	mcu = interval * d->restart_interval;
+	end = mcu + d->restart_interval;
+
+	if (end > d->mcus_per_row * d->mcu_rows){
+		end = d->mcus_per_row * d->mcu_rows;
+	}
+
+	init_bit_reader(&br, d->data, d->restart_offsets[interval], d->size);
+	trace_begin("decode_interval", interval);
+
+	// the blocks of an interval are written by this thread alone, so no locking is needed
+	for (; mcu < end; mcu++){
+		mx = mcu % d->mcus_per_row;
+		my = mcu / d->mcus_per_row;
+
+		if (my > d->last_mcu_row){
+			break;
+		}
+
+		if (!decode_mcu(d, &br, dc_pred, mx, my, my >= d->first_mcu_row && mx >= d->first_mcu_col && mx <= d->last_mcu_col)){
+			__atomic_store_n(&d->corrupt, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	trace_end();
+}
+
+int decode_mcu(JpgDecodeData d, BitReader *br, int *dc_pred, int mx, int my, int transform)
+{
+	DecodeComponent *c = NULL;
+	short coef[64];
+	int num_coefs = 0, bs = 0;
+	int bx = 0, by = 0, k = 0;
+	int i = 0, h = 0, v = 0;
+	int *block = NULL;
+
+	bs = d->block_size;
+
+	// at 1/8 scale only the DC value is used, the AC coefficients are skipped rather than stored
+	num_coefs = (d->frame == NULL && (bs == 1 || !transform)) ? 1 : 64;
+
+	for (i = 0; i < d->num_scan_components; i++){
+		c = &d->components[ d->scan_components[i] ];
+
+		for (v = 0; v < c->v_samp; v++){
+			for (h = 0; h < c->h_samp; h++){
+				if (!decode_block(br, &d->dc_tables[c->dc_table], &d->ac_tables[c->ac_table], &dc_pred[ d->scan_components[i] ], coef, num_coefs)){
+					return 0;
+				}
+
+				// position of the block within the decoded region
+				bx = (mx - d->first_mcu_col) * c->h_samp + h;
+				by = (my - d->first_mcu_row) * c->v_samp + v;
+
+				if (d->frame != NULL){
+					block = d->frame->components[ d->scan_components[i] ].blocks[by * c->width_in_blocks + bx];
+					for (k = 0; k < 64; k++){
+						block[k] = coef[ natural_order[k] ];
+					}
+				}
+
+				else if (transform){
+					idct_block(coef, d->quant[c->quant_table], c->samples + (by * bs * c->sample_width) + bx * bs, c->sample_width, bs);
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+Byte *convert_to_rgb(JpgDecodeData d)
+{
+	int i = 0, num_bands = 0;
+
+	d->rgb = malloc(sizeof(Byte) * d->output_width * d->output_height * pixel_size(d->format));
+	num_bands = (d->output_height + CONVERT_BAND_ROWS - 1) / CONVERT_BAND_ROWS;
+
+	if (d->rgb == NULL){
+		d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+		return NULL;
+	}
+
+	trace_begin("convert", -1);
+
+	// each band of rows is written by one thread
+	if (d->pool != NULL){
+		thread_pool_run(d->pool, convert_rows, d, num_bands);
+	}
+
+	else{
+		for (i = 0; i < num_bands; i++){
+			convert_rows(d, i);
+		}
+	}
+
+	trace_end();
+
+	if (d->error != JPG_DEC_SUCCESS){
+		free(d->rgb);
+		d->rgb = NULL;
+	}
+
+	return d->rgb;
+}
+
+void convert_rows(void *arg, int index)
+{
+	JpgDecodeData d = arg;
+	DecodeComponent *c = d->components;
+	Byte *out = NULL, *rows[JPG_MAX_COMPONENTS] = {NULL};
+	int i = 0, y = 0, y0 = 0, y1 = 0;
+	int w = 0, size = 0, factor = 0, merged = 0;
+	int origin_x = 0, origin_y = 0;
+
+	trace_begin("convert_rows", index);
+
+	w = d->output_width;
+	size = pixel_size(d->format);
+	y0 = index * CONVERT_BAND_ROWS;
+	y1 = (y0 + CONVERT_BAND_ROWS > d->output_height) ? d->output_height : y0 + CONVERT_BAND_ROWS;
+
+	// first output pixel relative to the first decoded MCU
+	origin_x = d->region_x / d->scale - d->first_mcu_col * d->max_h * d->block_size;
+	origin_y = d->region_y / d->scale - d->first_mcu_row * d->max_v * d->block_size;
+
+	// the chroma rows are read directly when Y is at full resolution and Cb, Cr are sampled alike
+	if (d->num_components == 3){
+		merged = c[0].h_samp == d->max_h && c[1].h_samp == c[2].h_samp && d->max_h % c[1].h_samp == 0;
+		factor = d->max_h / c[1].h_samp;
+
+		// otherwise each component is replicated into a row of the output width first
+		if (!merged){
+			for (i = 0; i < 3; i++){
+				rows[i] = malloc(sizeof(Byte) * w);
+
+				if (rows[i] == NULL){
+					d->error = JPG_DEC_FAILED_ALLOCATE_BUFFER;
+					y1 = y0;
+				}
+			}
+		}
+	}
+
+	for (y = y0; y < y1; y++){
+		out = d->rgb + (size_t) y * w * size;
+
+		if (d->num_components == 1){
+			gray_to_rgb_row(component_row(d, &c[0], origin_y + y) + origin_x, out, w, d->format);
+		}
+
+		else if (merged){
+			ycc_to_rgb_row(component_row(d, &c[0], origin_y + y) + origin_x,
+			               component_row(d, &c[1], origin_y + y) + origin_x / factor,
+			               component_row(d, &c[2], origin_y + y) + origin_x / factor,
+			               origin_x % factor, out, w, factor, d->format);
+		}
+
+		else{
+			for (i = 0; i < 3; i++){
+				upsample_row(d, &c[i], component_row(d, &c[i], origin_y + y), origin_x, rows[i]);
+			}
+
+			ycc_to_rgb_row(rows[0], rows[1], rows[2], 0, out, w, 1, d->format);
+		}
+	}
+
+	for (i = 0; i < JPG_MAX_COMPONENTS; i++){
+		free(rows[i]);
+	}
+
+	trace_end();
+}
+
+const Byte *component_row(JpgDecodeData d, const DecodeComponent *c, int y)
+{
+	return c->samples + (size_t) (y * c->v_samp / d->max_v) * c->sample_width;
+}
+
+void upsample_row(JpgDecodeData d, const DecodeComponent *c, const Byte *row, int origin_x, Byte *out)
+{
+	int x = 0;
+
+	for (x = 0; x < d->output_width; x++){
+		out[x] = row[(origin_x + x) * c->h_samp / d->max_h];
+	}
+}
@@ -6,22 +6,79 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "headers/jpg_encode.h"
+#include "headers/jpg_decode.h"
+#include "headers/jpg_transform.h"
+#include "headers/jpg_sequence.h"
+#include "headers/jpg_splice.h"
+#include "headers/jpg_tiled.h"
+#include "headers/jpg_batch.h"
+#include "headers/async_io.h"
+#include "headers/trace.h"
+#include "headers/cpu_kernels.h"
 #include "headers/bitmap.h"
 #include "headers/block.h"
 #include "headers/dct.h"
 #include "headers/quantise.h"
 #include "headers/zig_zag.h"
+#include "headers/tables.h"
 
 void test_bitmap(void);
 void test_jpeg(void);
 void test_dct(void);
+void test_decode(void);
+void test_transform(void);
+void test_target_size(void);
+void test_variants(void);
+void test_flat_blocks(void);
+void test_flat_dct_methods(void);
+void test_block_cache(void);
+void test_grayscale(void);
+void test_yuv(void);
+void test_sequence(void);
+void test_splice(void);
+void test_encode_stats(void);
+void test_trace(void);
+void test_dct_methods(void);
+void test_cpu_kernels(void);
+void test_effort(void);
+void test_tiled(void);
+void test_pipeline(void);
+void test_batch(void);
+void print_log(void *context, int level, const char *message);
+
+// 1 if two files hold the same bytes
+int same_file(const char *a, const char *b);
+
+// writes an 8-bit bitmap with a grey colour table holding a diagonal ramp, 1 on success
+int write_grey_bitmap(const char *file, int width, int height);
 
 int main(void)
 {
 	// test_bitmap();
 	// test_jpeg();
+	// test_decode();
+	// test_transform();
+	// test_target_size();
+	// test_variants();
+	// test_flat_blocks();
+	// test_flat_dct_methods();
+	// test_block_cache();
+	// test_grayscale();
+	// test_yuv();
+	// test_sequence();
+	// test_splice();
+	// test_encode_stats();
+	// test_trace();
+	// test_dct_methods();
+	// test_cpu_kernels();
+	// test_effort();
+	// test_tiled();
+	// test_pipeline();
+	// test_batch();
 	test_dct();
 }
 
@@ -48,13 +105,534 @@ void test_bitmap(void)
 
 void test_jpeg(void)
 {
+	JpgEncodeOptions options = {.quality = 50, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .progressive = 1};
+
 	encode_bmp_to_jpeg("images/redFlowers.bmp", "output/new.jpg", 50, NO_CHROMA_SUBSAMPLING);
+
+	// progressive with the standard scan script
+	if (encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/progressive.jpg", &options) != JPG_ENC_SUCCESS){
+		printf("Progressive encode failed\n");
+	}
+}
+
+void test_decode(void)
+{
+	int scales[4] = {JPG_SCALE_FULL, JPG_SCALE_HALF, JPG_SCALE_QUARTER, JPG_SCALE_EIGHTH};
+	int i = 0, w = 0, h = 0;
+	Byte *rgb = NULL;
+	YuvImage yuv;
+	JpegInfo info;
+
+	// failed decodes say why
+	set_jpeg_decode_log(print_log, "decode");
+
+	if (probe_jpeg("output/new.jpg", &info) == JPG_DEC_SUCCESS){
+		printf("Probe: %d x %d, %d components, first sampling %dx%d\n", info.width, info.height, info.num_components, info.h_samp[0], info.v_samp[0]);
+	}
+
+	for (i = 0; i < 4; i++){
+		rgb = decode_jpeg_to_rgb("output/new.jpg", scales[i], &w, &h);
+
+		if (rgb != NULL){
+			printf("1/%d scale: %d x %d, first pixel [R]: %d, [G]: %d [B]: %d\n", scales[i], w, h, rgb[0], rgb[1], rgb[2]);
+			free(rgb);
+		}
+	}
+
+	// decode a 64x64 crop from the middle of the image
+	rgb = decode_jpeg_region_to_rgb("output/new.jpg", JPG_SCALE_FULL, 100, 100, 64, 64, &w, &h);
+
+	if (rgb != NULL){
+		printf("Region: %d x %d, first pixel [R]: %d, [G]: %d [B]: %d\n", w, h, rgb[0], rgb[1], rgb[2]);
+		free(rgb);
+	}
+
+	// decode the restart intervals on 4 threads
+	rgb = decode_jpeg_to_rgb_parallel("output/new.jpg", JPG_SCALE_FULL, 4, &w, &h);
+
+	if (rgb != NULL){
+		printf("Parallel: %d x %d, first pixel [R]: %d, [G]: %d [B]: %d\n", w, h, rgb[0], rgb[1], rgb[2]);
+		free(rgb);
+	}
+
+	rgb = decode_jpeg_to_bgra("output/new.jpg", JPG_SCALE_FULL, &w, &h);
+
+	if (rgb != NULL){
+		printf("BGRA: %d x %d, first pixel [B]: %d, [G]: %d [R]: %d [A]: %d\n", w, h, rgb[0], rgb[1], rgb[2], rgb[3]);
+		free(rgb);
+	}
+
+	// the planes straight out of the inverse DCT
+	if (decode_jpeg_to_yuv("output/new.jpg", JPG_SCALE_FULL, &yuv) == JPG_DEC_SUCCESS){
+		for (i = 0; i < yuv.num_planes; i++){
+			printf("Plane %d: %d x %d (stride %d)\n", i, yuv.plane_width[i], yuv.plane_height[i], yuv.stride[i]);
+		}
+
+		free_yuv_image(&yuv);
+	}
+}
+
+void test_transform(void)
+{
+	JpgTransformOptions options = {.transform = JPG_TRANSFORM_ROTATE_90, .optimize_huffman = 1};
+	int error = 0;
+
+	error = transform_jpeg("output/new.jpg", "output/rotated.jpg", &options);
+	printf("Rotate: %d\n", error);
+
+	// keep a 128x128 corner and requantize it at quality 50
+	options.transform = JPG_TRANSFORM_NONE;
+	options.crop_w = 128;
+	options.crop_h = 128;
+	options.quality = 50;
+
+	error = transform_jpeg("output/new.jpg", "output/cropped.jpg", &options);
+	printf("Crop: %d\n", error);
+}
+
+void test_target_size(void)
+{
+	JpgEncodeOptions options = {.sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1};
+	JpgRateStats stats;
+	int error = 0;
+
+	// highest quality that fits in 50KB
+	error = encode_bmp_to_jpeg_target_size("images/redFlowers.bmp", "output/target.jpg", 50000, &options, &stats);
+
+	printf("Target size: %d, quality %d, %d iterations, %d passes, %zu bytes (estimated %zu)\n", error, stats.quality, stats.iterations, stats.passes, stats.size, stats.estimated_size);
+	printf("DCT %.1fms, search %.1fms, encode %.1fms\n", stats.transform_ms, stats.search_ms, stats.encode_ms);
+}
+
+void test_variants(void)
+{
+	// two qualities at full size and a quarter size preview from one colour conversion and DCT
+	JpgOutputSpec outputs[3] = {
+		{.output_filename = "output/q85.jpg", .scale = 1, .options = {.quality = 85, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1}},
+		{.output_filename = "output/q60.jpg", .scale = 1, .options = {.quality = 60, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1}},
+		{.output_filename = "output/preview.jpg", .scale = 4, .options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1}}
+	};
+
+	printf("Variants: %d\n", encode_bmp_to_jpeg_variants("images/redFlowers.bmp", outputs, 3));
+}
+
+void test_flat_blocks(void)
+{
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .stats = &stats};
+	clock_t start = 0;
+	double threshold[3] = {-1.0, 0.0, 2.0};
+	int i = 0;
+
+	// no fast path, exactly flat blocks only (same output) and nearly flat blocks
+	for (i = 0; i < 3; i++){
+		options.flat_threshold = threshold[i];
+		start = clock();
+		encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/flat.jpg", &options);
+
+		printf("Flat threshold %.1f: %.1fms, %d of %d blocks flat (%.1f%%)\n", threshold[i], 1000.0 * (clock() - start) / CLOCKS_PER_SEC,
+			stats.flat_blocks, stats.blocks, 100.0 * stats.flat_blocks / stats.blocks);
+	}
+}
+
+void test_flat_dct_methods(void)
+{
+	const char *names[2] = {"float", "integer"};
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {0};
+	int method = 0;
+
+	options.quality = 75;
+	options.sample_ratio = NO_CHROMA_SUBSAMPLING;
+	options.optimize_huffman = 1;
+	options.stats = &stats;
+
+	// exactly flat blocks get the DC value of the full DCT, so either DCT writes the same file with the fast path on or off
+	for (method = JPG_DCT_FLOAT; method <= JPG_DCT_INTEGER; method++){
+		options.dct_method = method;
+
+		options.flat_threshold = -1.0;
+		encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/flat_off.jpg", &options);
+
+		options.flat_threshold = 0.0;
+		encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/flat_on.jpg", &options);
+
+		printf("Flat blocks with the %s DCT: %d flat, same file %d\n", names[method], stats.flat_blocks,
+		       same_file("output/flat_off.jpg", "output/flat_on.jpg"));
+	}
+}
+
+void test_block_cache(void)
+{
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .stats = &stats, .block_cache_size = 4096};
+	clock_t start = clock();
+
+	encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/cached.jpg", &options);
+
+	printf("Block cache: %.1fms, %ld hits, %ld misses\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC, stats.cache_hits, stats.cache_misses);
+}
+
+void test_grayscale(void)
+{
+	BmpImage bmp = NULL;
+
+	if (!write_grey_bitmap("output/grey.bmp", 100, 75)){
+		printf("Greyscale: couldn't write output/grey.bmp\n");
+		return;
+	}
+
+	bmp = bmp_OpenBitmap("output/grey.bmp");
+
+	// greyscale bitmaps are encoded with a single component
+	if (bmp != NULL){
+		printf("Greyscale: %d\n", bmp_IsGrayscale(bmp));
+		bmp_DestroyBitmap(bmp);
+	}
+
+	encode_bmp_to_jpeg("output/grey.bmp", "output/grey.jpg", 75, NO_CHROMA_SUBSAMPLING);
+}
+
+void test_yuv(void)
+{
+	// a 320x240 NV12 frame: a horizontal ramp of luminance over a vertical ramp of colour
+	int width = 320, height = 240, x = 0, y = 0;
+	Byte *frame = malloc(width * height * 3 / 2);
+	JpgYuvImage image = {.format = JPG_YUV_NV12, .width = 320, .height = 240, .planes = {frame, frame + 320 * 240}, .strides = {320, 320}};
+	JpgEncodeOptions options = {.quality = 75, .optimize_huffman = 1};
+
+	for (y = 0; y < height; y++){
+		for (x = 0; x < width; x++){
+			frame[y * width + x] = (Byte) (x * 255 / width);
+		}
+	}
+
+	for (y = 0; y < height / 2; y++){
+		for (x = 0; x < width; x += 2){
+			frame[width * height + y * width + x] = (Byte) (y * 255 / (height / 2));
+			frame[width * height + y * width + x + 1] = (Byte) (255 - y * 255 / (height / 2));
+		}
+	}
+
+	printf("YUV: %d\n", encode_yuv_to_jpeg(&image, "output/nv12.jpg", &options));
+	free(frame);
+}
+
+void test_sequence(void)
+{
+	// 30 I420 frames of a grey 320x240 image with a 16x16 square moving across it
+	int width = 320, height = 240, i = 0, x = 0, y = 0;
+	Byte *frame = malloc(width * height * 3 / 2);
+	JpgYuvImage image = {.format = JPG_YUV_I420, .width = 320, .height = 240, .planes = {frame, frame + 320 * 240, frame + 320 * 240 * 5 / 4}, .strides = {320, 160, 160}};
+	JpgEncodeOptions options = {.quality = 75};
+	JpgSequence seq = create_jpeg_sequence("output/sequence.mjpg", JPG_YUV_I420, 320, 240, &options, 1);
+	JpgSequenceStats stats;
+
+	if (seq == NULL){
+		printf("Sequence: could not be created\n");
+		free(frame);
+		return;
+	}
+
+	for (i = 0; i < 30; i++){
+		memset(frame, 128, width * height * 3 / 2);
+
+		for (y = 100; y < 116; y++){
+			for (x = i * 8; x < i * 8 + 16; x++){
+				frame[y * width + x] = 255;
+			}
+		}
+
+		jpeg_sequence_add_frame(seq, &image);
+	}
+
+	jpeg_sequence_stats(seq, &stats);
+	printf("Sequence: %d frames, %ld intervals encoded, %ld reused, %zu bytes\n", stats.frames, stats.intervals_encoded, stats.intervals_reused, stats.bytes);
+
+	destroy_jpeg_sequence(seq);
+	free(frame);
+}
+
+void test_splice(void)
+{
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .restart_interval = 8};
+	JpgSpliceStats stats;
+	Byte *rgb = NULL;
+	int w = 0, h = 0, x = 0, y = 0, error = 0;
+
+	// an image with restart markers and the standard huffman tables
+	encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/restarts.jpg", &options);
+	rgb = decode_jpeg_to_rgb("output/restarts.jpg", JPG_SCALE_FULL, &w, &h);
+
+	if (rgb == NULL){
+		return;
+	}
+
+	// a white 64x16 label in the top left corner
+	for (y = 8; y < 24 && y < h; y++){
+		for (x = 8; x < 72 && x < w; x++){
+			rgb[(y * w + x) * 3] = rgb[(y * w + x) * 3 + 1] = rgb[(y * w + x) * 3 + 2] = 255;
+		}
+	}
+
+	error = splice_jpeg_region("output/restarts.jpg", "output/spliced.jpg", rgb, 8, 8, 64, 16, &stats);
+	printf("Splice: %d, %d of %d intervals encoded, %zu bytes\n", error, stats.intervals_encoded, stats.intervals, stats.output_size);
+
+	free(rgb);
+}
+
+void test_encode_stats(void)
+{
+	const char *names[JPG_NUM_STAGES] = {"preprocess", "subsample", "dct", "quantise", "zig_zag", "huffman", "write"};
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .stats = &stats,
+	                            .log = print_log, .log_context = "encode", .hardware_counters = 1};
+	JpgStageStats *s = NULL;
+	int i = 0;
+
+	encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/stats.jpg", &options);
+
+	// the counters are -1 when they couldn't be read
+	for (i = 0; i < JPG_NUM_STAGES; i++){
+		s = &stats.stages[i];
+		printf("%-10s %8.2fms wall %8.2fms cpu, %lld cycles, %lld instructions, %lld L1D misses, %lld LLC misses, %lld branch misses\n",
+			names[i], s->wall_ms, s->cpu_ms, s->counters[JPG_COUNTER_CYCLES], s->counters[JPG_COUNTER_INSTRUCTIONS],
+			s->counters[JPG_COUNTER_L1D_MISSES], s->counters[JPG_COUNTER_LLC_MISSES], s->counters[JPG_COUNTER_BRANCH_MISSES]);
+	}
+
+	printf("%zu bytes in, %zu bytes out, %d blocks, %.1f%% zero coefficients, %ld allocations\n", stats.input_bytes, stats.output_bytes,
+		stats.blocks, 100.0 * stats.zero_ratio, stats.allocations);
+	printf("Symbols: luminance DC %ld AC %ld, chrominance DC %ld AC %ld\n", stats.dc_symbols[0], stats.ac_symbols[0], stats.dc_symbols[1], stats.ac_symbols[1]);
+}
+
+void test_trace(void)
+{
+	Byte *rgb = NULL;
+	int w = 0, h = 0;
+
+	// open output/trace.json in ui.perfetto.dev, the parallel decode has a row per worker
+	start_trace(65536);
+
+	encode_bmp_to_jpeg("images/redFlowers.bmp", "output/new.jpg", 75, NO_CHROMA_SUBSAMPLING);
+	rgb = decode_jpeg_to_rgb_parallel("output/restarts.jpg", JPG_SCALE_FULL, 4, &w, &h);
+
+	printf("Trace: %d\n", stop_trace("output/trace.json"));
+	free(rgb);
+}
+
+void test_dct_methods(void)
+{
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .stats = &stats, .dct_method = JPG_DCT_FLOAT};
+
+	encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/dct_float.jpg", &options);
+	printf("Float DCT: %.2fms, %zu bytes\n", stats.stages[JPG_STAGE_DCT].wall_ms, stats.output_bytes);
+
+	options.dct_method = JPG_DCT_INTEGER;
+	encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", "output/dct_integer.jpg", &options);
+	printf("Integer DCT: %.2fms, %zu bytes\n", stats.stages[JPG_STAGE_DCT].wall_ms, stats.output_bytes);
+}
+
+void test_cpu_kernels(void)
+{
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .dct_method = JPG_DCT_FLOAT};
+	char output[64];
+	int level = 0;
+
+	printf("CPU level: %s, in use: %s\n", jpg_cpu_level_name(jpg_cpu_detect()), jpg_cpu_level_name(jpg_kernels()->level));
+
+	// each level should write exactly the same file
+	for (level = 0; level <= jpg_cpu_detect(); level++){
+		printf("%s: self test %d, ", jpg_cpu_level_name(level), jpg_kernel_self_test(level, 1000));
+
+		jpg_set_cpu_level(level);
+		sprintf(output, "output/cpu_%s.jpg", jpg_cpu_level_name(level));
+		printf("encode %d\n", encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", output, &options));
+	}
+
+	jpg_set_cpu_level(JPG_CPU_AUTO);
+}
+
+void test_effort(void)
+{
+	const char *names[JPG_NUM_EFFORTS] = {"fastest", "fast", "balanced", "smallest"};
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options;
+	char output[64];
+	int effort = 0;
+
+	for (effort = 0; effort < JPG_NUM_EFFORTS; effort++){
+		jpg_preset_options(effort, 75, NO_CHROMA_SUBSAMPLING, &options);
+		options.stats = &stats;
+
+		sprintf(output, "output/effort_%s.jpg", names[effort]);
+		encode_bmp_to_jpeg_with_options("images/redFlowers.bmp", output, &options);
+		printf("%s: DCT %.2fms, huffman %.2fms, %zu bytes\n", names[effort], stats.stages[JPG_STAGE_DCT].wall_ms,
+		       stats.stages[JPG_STAGE_HUFFMAN].wall_ms, stats.output_bytes);
+	}
+}
+
+void test_tiled(void)
+{
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {.quality = 75, .sample_ratio = NO_CHROMA_SUBSAMPLING, .optimize_huffman = 1, .stats = &stats,
+	                            .log = print_log, .log_context = "tiled", .dct_method = JPG_DCT_FLOAT};
+	BmpImage bmp = NULL;
+	FILE *fp = NULL;
+	int i = 0;
+
+	// the same image as encode_bmp_to_jpeg_with_options, a strip at a time
+	printf("Tiled: %d, ", encode_bmp_to_jpeg_tiled("images/redFlowers.bmp", "output/tiled.jpg", &options));
+	printf("%zu bytes in, %zu bytes out, %.2fms reading\n", stats.input_bytes, stats.output_bytes, stats.stages[JPG_STAGE_PREPROCESS].wall_ms);
+
+	// a raw copy of the pixels gives the same image again
+	bmp = bmp_OpenBitmap("images/redFlowers.bmp");
+	fp = fopen("output/redFlowers.rgb", "wb");
+
+	for (i = 0; bmp != NULL && fp != NULL && i < bmp_GetNumPixels(bmp); i++){
+		fputc(bmp_GetRed(bmp)[i], fp);
+		fputc(bmp_GetGreen(bmp)[i], fp);
+		fputc(bmp_GetBlue(bmp)[i], fp);
+	}
+
+	if (fp != NULL){
+		fclose(fp);
+	}
+
+	if (bmp != NULL){
+		printf("Tiled raw: %d\n", encode_raw_to_jpeg_tiled("output/redFlowers.rgb", bmp_GetWidth(bmp), bmp_GetHeight(bmp), "output/tiled_raw.jpg", &options));
+		bmp_DestroyBitmap(bmp);
+	}
+}
+
+void test_pipeline(void)
+{
+	JpgEncodeStats stats = {0};
+	JpgEncodeOptions options = {0};
+	int slots = 0;
+
+	options.quality = 75;
+	options.sample_ratio = NO_CHROMA_SUBSAMPLING;
+	options.optimize_huffman = 1;
+	options.stats = &stats;
+
+	start_trace(65536);
+
+	// the same image with any number of strips in flight (0 runs the stages one after the other)
+	for (slots = 0; slots <= 4; slots += 2){
+		options.pipeline = slots;
+		printf("Pipeline %d: %d, ", slots, encode_bmp_to_jpeg_tiled("images/redFlowers.bmp", "output/pipeline.jpg", &options));
+		printf("read %.2fms, transform %.2fms, entropy %.2fms, %zu bytes\n", stats.stages[JPG_STAGE_PREPROCESS].wall_ms,
+		       stats.stages[JPG_STAGE_DCT].wall_ms, stats.stages[JPG_STAGE_HUFFMAN].wall_ms, stats.output_bytes);
+	}
+
+	// a row for the reader and transformer threads, with the time they wait on each other
+	printf("Trace: %d\n", stop_trace("output/pipeline.json"));
+}
+
+void test_batch(void)
+{
+	JpgEncodeOptions options = {0};
+	JpgBatchItem items[] = {
+		{"images/redFlowers.bmp", "output/batch0.jpg", 0},
+		{"images/missing.bmp", "output/batch1.jpg", 0},
+		{"images/redFlowers.bmp", "output/batch2.jpg", 0}
+	};
+	int i = 0, backend = 0;
+
+	options.quality = 75;
+	options.sample_ratio = HORIZONTAL_VERTICAL_SUBSAMPLING;
+
+	start_trace(65536);
+
+	// the same images from each backend, the missing one fails on its own
+	for (backend = JPG_IO_AUTO; backend <= JPG_IO_THREADS; backend++){
+		printf("Batch with backend %d: %d,", backend, encode_bmp_batch(items, 3, &options, 2, backend));
+
+		for (i = 0; i < 3; i++){
+			printf(" %d", items[i].error);
+		}
+
+		printf("\n");
+	}
+
+	// the reads and writes overlapping the encodes
+	printf("Trace: %d\n", stop_trace("output/batch.json"));
+}
+
+void print_log(void *context, int level, const char *message)
+{
+	printf("[%s] %s%s\n", (const char *) context, (level == JPG_LOG_ERROR) ? "error: " : (level == JPG_LOG_WARNING) ? "warning: " : "", message);
+}
+
+int same_file(const char *a, const char *b)
+{
+	FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+	int ca = 0, cb = 0;
+
+	if (fa != NULL && fb != NULL){
+		do{
+			ca = fgetc(fa);
+			cb = fgetc(fb);
+		} while (ca == cb && ca != EOF);
+	}
+
+	if (fa != NULL) fclose(fa);
+	if (fb != NULL) fclose(fb);
+
+	return fa != NULL && fb != NULL && ca == cb;
+}
+
+int write_grey_bitmap(const char *file, int width, int height)
+{
+	FILE *fp = fopen(file, "wb");
+	Byte header[54 + 256 * 4] = {'B', 'M'};
+	Byte *row = NULL;
+	int stride = (width + 3) & ~3;
+	int size = 54 + 256 * 4 + stride * height;
+	int i = 0, x = 0, y = 0, ok = 0;
+
+	header[2] = size & 0xFF; header[3] = (size >> 8) & 0xFF; header[4] = (size >> 16) & 0xFF; header[5] = (size >> 24) & 0xFF;
+	header[10] = (54 + 256 * 4) & 0xFF; header[11] = ((54 + 256 * 4) >> 8) & 0xFF;
+	header[14] = 40;
+	header[18] = width & 0xFF; header[19] = (width >> 8) & 0xFF;
+	header[22] = height & 0xFF; header[23] = (height >> 8) & 0xFF;
+	header[26] = 1;
+	header[28] = 8;
+
+	// the colour table maps each index to the grey of that level (blue, green, red, unused)
+	for (i = 0; i < 256; i++){
+		header[54 + i * 4] = header[54 + i * 4 + 1] = header[54 + i * 4 + 2] = (Byte) i;
+	}
+
+	row = calloc(stride, 1);
+
+	if (fp != NULL && row != NULL){
+		ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+
+		// rows are stored bottom up
+		for (y = height - 1; ok && y >= 0; y--){
+			for (x = 0; x < width; x++){
+				row[x] = (Byte) ((x + y) * 255 / (width + height - 2));
+			}
+
+			ok = fwrite(row, 1, stride, fp) == (size_t) stride;
+		}
+	}
+
+	if (fp != NULL && fclose(fp) != 0){
+		ok = 0;
+	}
+
+	free(row);
+
+	return ok;
 }
 
 void test_dct(void)
 {
 	Block b = new_block();
 	int i = 0;
+	int table[64];
 
 	// compare with the one in Wikipedia
 	set_value_block(b, 0, 0, -76);
@@ -136,7 +714,8 @@ void test_dct(void)
 	show_block(b);
 
 	// test quantization
-	quantise_lum(b);
+	build_quant_table(quanMatrixLum, 50, table);
+	quantise_block(b, table);
 	show_block(b);
 
 	// test zig-zag ordering
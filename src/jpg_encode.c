@@ -1,5 +1,11 @@
+// clock_gettime
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
 
 #include "headers/jpg_encode.h"
 #include "headers/preprocess.h"
@@ -8,51 +14,895 @@
 #include "headers/dct.h"
 #include "headers/quantise.h"
 #include "headers/zig_zag.h"
-#include "headers/dpcm.h"
+#include "headers/jpg_write.h"
 #include "headers/huffman.h"
+#include "headers/block_cache.h"
+#include "headers/mcu_kernel.h"
+#include "headers/fdct.h"
+#include "headers/perf_counters.h"
+#include "headers/trace.h"
+#include "headers/tables.h"
+
+// bytes of the markers and tables other than huffman tables for n components: SOI, APP0, DQT (1 table
+// for greyscale, otherwise 2), SOF, SOS and EOI
+#define HEADER_BYTES(n) (2 + 18 + (((n) == 1) ? 1 : 2) * 69 + (10 + 3 * (n)) + (8 + 2 * (n)) + 2)
+
+// bytes of a DHT segment before its symbols
+#define DHT_BYTES 21
+
+// blocks of the fastest preset that differ by at most this much are coded as flat
+#define FASTEST_FLAT_THRESHOLD 2.0
+
+// names of the stages in traces
+static const char *stage_names[JPG_NUM_STAGES] = {"preprocess", "subsample", "dct", "quantise", "zig_zag", "huffman", "write"};
 
 /* ===================================== Small helper functions ================================== */
-JpgData create_jpeg_data(void);
+
+// writes the encoded image to the output file
+int write_output_file(JpgData j_data, const JpgBuffer *buffer);
+
+// estimates the size in bytes of the image with optimal huffman tables from its symbol frequencies
+size_t estimate_jpeg_size(JpgData j_data);
+
+// milliseconds of processor time since start
+double elapsed_ms(clock_t start);
+
+// milliseconds of wall clock time since some fixed point
+double wall_ms(void);
+
+// runs a stage of the encoder, timing it when the options have stats
+void run_stage(JpgData j_data, int stage, void (*function)(JpgData));
+
+// fills in a frame from the zig-zag ordered blocks (which it points to)
+void build_frame(JpgData j_data, JpgFrame *frame);
+
+// makes the DCT blocks of the image shrunk by scale (2, 4 or 8) from those of the full size image
+JpgData create_scaled_data(JpgData j_data, int scale);
+
+// encodes the outputs of one scale, each quality is only quantised once
+void encode_scaled_outputs(JpgData j_data, JpgOutputSpec *outputs, int num_outputs, int scale);
+
+// DCT, quantization and zig-zag ordering of every block through a cache of repeated blocks
+int transform_blocks_cached(JpgData j_data);
+
+// fills in the stats of the options (if any) once the blocks are known
+void report_stats(JpgData j_data);
+
+// DCT, quantization and zig-zag ordering of the blocks, then writes the image
+int encode_and_write(JpgData j_data);
+
+// encodes a baseline image as well as the progressive one in buffer and keeps the smaller of them
+int keep_smaller_baseline(JpgData j_data, JpgBuffer *buffer);
 
 /* ==================================== Function definitions ===================================== */
 
 void encode_bmp_to_jpeg(const char *input, const char *output, int quality, int sample_ratio)
+{
+	JpgEncodeOptions options = {0};
+
+	options.quality = quality;
+	options.sample_ratio = sample_ratio;
+
+	encode_bmp_to_jpeg_with_options(input, output, &options);
+}
+
+int encode_bmp_to_jpeg_with_effort(const char *input, const char *output, int quality, int sample_ratio, int effort)
+{
+	JpgEncodeOptions options;
+	int error = jpg_preset_options(effort, quality, sample_ratio, &options);
+
+	if (error == JPG_ENC_SUCCESS){
+		error = encode_bmp_to_jpeg_with_options(input, output, &options);
+	}
+
+	return error;
+}
+
+int jpg_preset_options(int effort, int quality, int sample_ratio, JpgEncodeOptions *options)
+{
+	memset(options, 0, sizeof(JpgEncodeOptions));
+
+	options->quality = quality;
+	options->sample_ratio = sample_ratio;
+	options->num_threads = JPG_THREADS_AUTO;
+
+	switch (effort){
+		case JPG_EFFORT_FASTEST:
+			options->dct_method = JPG_DCT_INTEGER;
+			options->flat_threshold = FASTEST_FLAT_THRESHOLD;
+			break;
+
+		case JPG_EFFORT_FAST:
+			options->dct_method = JPG_DCT_INTEGER;
+			options->optimize_huffman = 1;
+			break;
+
+		case JPG_EFFORT_BALANCED:
+			options->dct_method = JPG_DCT_FLOAT;
+			options->optimize_huffman = 1;
+			break;
+
+		case JPG_EFFORT_SMALLEST:
+			options->dct_method = JPG_DCT_FLOAT;
+			options->optimize_huffman = 1;
+			options->progressive = JPG_PROGRESSIVE_IF_SMALLER;
+			break;
+
+		default:
+			return JPG_ENC_BAD_OPTIONS;
+	}
+
+	return JPG_ENC_SUCCESS;
+}
+
+int encode_bmp_to_jpeg_with_options(const char *input, const char *output, const JpgEncodeOptions *options)
 {
 	JpgData j_data = NULL;
+	int error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
 
 	j_data = create_jpeg_data();
 
 	if (j_data != NULL){
-		j_data->sample_ratio = sample_ratio;
-		j_data->quality = quality;
+		j_data->options = *options;
+		j_data->sample_ratio = options->sample_ratio;
+		j_data->quality = options->quality;
 		j_data->output_filename = (char *) output;
 		j_data->input_filename =  (char *) input;
 
 		// convert RGB to YCbCr
-		preprocess_jpeg(j_data);
+		run_stage(j_data, JPG_STAGE_PREPROCESS, preprocess_jpeg);
+
+		if (j_data->num_blocks_Y > 0){
+			// downsample the image
+			run_stage(j_data, JPG_STAGE_SUBSAMPLE, chroma_subsample);
+
+			error = encode_and_write(j_data);
+		}
+
+		else{
+			error = JPG_ENC_READ_FAILED;
+		}
+
+		destroy_jpeg_data(j_data);
+	}
+
+	return error;
+}
+
+int encode_bmp_memory_to_jpeg(const Byte *bmp, size_t size, JpgBuffer *out, const JpgEncodeOptions *options)
+{
+	JpgData j_data = NULL;
+	int error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
+
+	j_data = create_jpeg_data();
+
+	if (j_data != NULL){
+		j_data->options = *options;
+		j_data->sample_ratio = options->sample_ratio;
+		j_data->quality = options->quality;
+		j_data->input_data = bmp;
+		j_data->input_size = size;
+		j_data->output_buffer = out;
+
+		run_stage(j_data, JPG_STAGE_PREPROCESS, preprocess_jpeg);
+
+		if (j_data->num_blocks_Y > 0){
+			run_stage(j_data, JPG_STAGE_SUBSAMPLE, chroma_subsample);
+
+			error = encode_and_write(j_data);
+		}
+
+		else{
+			error = JPG_ENC_READ_FAILED;
+		}
+
+		destroy_jpeg_data(j_data);
+	}
+
+	return error;
+}
+
+int encode_yuv_to_jpeg(const JpgYuvImage *image, const char *output, const JpgEncodeOptions *options)
+{
+	JpgData j_data = NULL;
+	int error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
+
+	j_data = create_jpeg_data();
+
+	if (j_data != NULL){
+		j_data->options = *options;
+		j_data->quality = options->quality;
+		j_data->output_filename = (char *) output;
+
+		// the blocks are cut straight from the planes, the chroma is already subsampled
+		begin_stage(j_data, JPG_STAGE_PREPROCESS);
+		error = preprocess_yuv(j_data, image);
+		end_stage(j_data, JPG_STAGE_PREPROCESS);
+
+		if (error == JPG_ENC_SUCCESS){
+			error = encode_and_write(j_data);
+		}
+
+		destroy_jpeg_data(j_data);
+	}
+
+	return error;
+}
+
+int encode_and_write(JpgData j_data)
+{
+	JpgBuffer buffer = {NULL, 0, 0};
+	int error = JPG_ENC_SUCCESS;
+
+	if (j_data->options.block_cache_size > 0){
+		begin_stage(j_data, JPG_STAGE_DCT);
+		error = transform_blocks_cached(j_data);
+		end_stage(j_data, JPG_STAGE_DCT);
+	}
 
-		// downsample the image
-		chroma_subsample(j_data);
+	else{
+		// DCT, quantization and zig-zag ordering an MCU at a time
+		begin_stage(j_data, JPG_STAGE_DCT);
+		error = transform_mcus(j_data);
+		end_stage(j_data, JPG_STAGE_DCT);
+	}
+
+	// DC differences and huffman encoding happen as the image is written
+	if (error == JPG_ENC_SUCCESS){
+		begin_stage(j_data, JPG_STAGE_HUFFMAN);
+		error = write_output(j_data, &buffer);
 
-		// perform DCT on the image data
-		dct(j_data);
+		if (error == JPG_ENC_SUCCESS && j_data->options.progressive == JPG_PROGRESSIVE_IF_SMALLER){
+			error = keep_smaller_baseline(j_data, &buffer);
+		}
 
-		// quantise the image data
-		quantise(j_data);
+		end_stage(j_data, JPG_STAGE_HUFFMAN);
+	}
+
+	if (error == JPG_ENC_SUCCESS && j_data->output_buffer == NULL){
+		begin_stage(j_data, JPG_STAGE_WRITE);
+		error = write_output_file(j_data, &buffer);
+		end_stage(j_data, JPG_STAGE_WRITE);
+	}
 
-		// perform zig-zag ordering
-		zig_zag(j_data);
+	j_data->output_bytes = (error == JPG_ENC_SUCCESS) ? buffer.size : 0;
+	j_data->allocations += buffer.allocations;
 
-		// perform DPCM
-		dpcm(j_data);
+	report_stats(j_data);
 
-		// huffman encoding
-		huffman_encode(j_data);
+	// the caller takes the image instead of a file
+	if (error == JPG_ENC_SUCCESS && j_data->output_buffer != NULL){
+		*j_data->output_buffer = buffer;
+		buffer.data = NULL;
+	}
+
+	free_jpeg_buffer(&buffer);
+
+	return error;
+}
+
+int keep_smaller_baseline(JpgData j_data, JpgBuffer *buffer)
+{
+	JpgBuffer baseline = {NULL, 0, 0};
+	JpgBuffer swap;
+	int error = JPG_ENC_SUCCESS;
+
+	// the kernels didn't count the symbols for a progressive image, the writer counts them itself
+	j_data->options.progressive = 0;
+	error = write_output(j_data, &baseline);
+	j_data->options.progressive = JPG_PROGRESSIVE_IF_SMALLER;
+
+	if (error == JPG_ENC_SUCCESS && baseline.size < buffer->size){
+		swap = *buffer;
+		*buffer = baseline;
+		baseline = swap;
+	}
+
+	buffer->allocations += baseline.allocations;
+	free_jpeg_buffer(&baseline);
+
+	return error;
+}
+
+int encode_bmp_to_jpeg_target_size(const char *input, const char *output, size_t target_size, const JpgEncodeOptions *options, JpgRateStats *stats)
+{
+	JpgData j_data = NULL;
+	JpgBuffer buffer = {NULL, 0, 0};
+	JpgRateStats s = {0};
+	clock_t start = clock();
+	int error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	int low = 1, high = 100, mid = 0, quality = 0;
+	size_t estimate = 0;
+
+	j_data = create_jpeg_data();
+
+	if (j_data == NULL){
+		return error;
+	}
+
+	j_data->options = *options;
+	j_data->options.optimize_huffman = 1; // the estimates are for optimal tables
+	j_data->sample_ratio = options->sample_ratio;
+	j_data->output_filename = (char *) output;
+	j_data->input_filename =  (char *) input;
+
+	// the DCT coefficients are the same for every quality
+	run_stage(j_data, JPG_STAGE_PREPROCESS, preprocess_jpeg);
+
+	if (j_data->num_blocks_Y <= 0){
+		destroy_jpeg_data(j_data);
+		return JPG_ENC_READ_FAILED;
+	}
+
+	run_stage(j_data, JPG_STAGE_SUBSAMPLE, chroma_subsample);
+	run_stage(j_data, JPG_STAGE_DCT, dct);
+	allocate_zig_zag(j_data);
+	s.transform_ms = elapsed_ms(start);
+
+	// find the highest quality whose estimate fits, the size falls with the quality
+	start = clock();
+
+	while (low <= high){
+		mid = (low + high) / 2;
+		j_data->quality = mid;
+		run_stage(j_data, JPG_STAGE_QUANTISE, quantise_coefficients);
+
+		begin_stage(j_data, JPG_STAGE_HUFFMAN);
+		estimate = estimate_jpeg_size(j_data);
+		end_stage(j_data, JPG_STAGE_HUFFMAN);
+		s.iterations++;
+
+		if (estimate <= target_size){
+			quality = mid;
+			s.estimated_size = estimate;
+			low = mid + 1;
+		}
+
+		else{
+			high = mid - 1;
+		}
+	}
+
+	if (quality == 0){
+		quality = 1;
+		s.estimated_size = estimate; // the last quality tried was 1
+	}
+
+	if (quality != j_data->quality){
+		j_data->quality = quality;
+		run_stage(j_data, JPG_STAGE_QUANTISE, quantise_coefficients);
+	}
+
+	s.search_ms = elapsed_ms(start);
+
+	// entropy code the image, the estimate averages a few things (e.g. byte stuffing) so step
+	// down in the rare case the image is still too large
+	start = clock();
+
+	while (1){
+		j_data->allocations += buffer.allocations;
+		free_jpeg_buffer(&buffer);
+
+		begin_stage(j_data, JPG_STAGE_HUFFMAN);
+		error = write_output(j_data, &buffer);
+		end_stage(j_data, JPG_STAGE_HUFFMAN);
+		s.passes++;
+
+		if (error != JPG_ENC_SUCCESS || buffer.size <= target_size || j_data->quality == 1){
+			break;
+		}
+
+		j_data->quality--;
+		run_stage(j_data, JPG_STAGE_QUANTISE, quantise_coefficients);
+	}
+
+	if (error == JPG_ENC_SUCCESS){
+		begin_stage(j_data, JPG_STAGE_WRITE);
+		error = write_output_file(j_data, &buffer);
+		end_stage(j_data, JPG_STAGE_WRITE);
+
+		if (error == JPG_ENC_SUCCESS && buffer.size > target_size){
+			error = JPG_ENC_TARGET_TOO_SMALL;
+		}
+	}
+
+	s.encode_ms = elapsed_ms(start);
+	s.quality = j_data->quality;
+	s.size = buffer.size;
+
+	j_data->output_bytes = buffer.size;
+	j_data->allocations += buffer.allocations;
+	report_stats(j_data);
+
+	if (stats != NULL){
+		*stats = s;
+	}
+
+	free_jpeg_buffer(&buffer);
+	destroy_jpeg_data(j_data);
+
+	return error;
+}
+
+int encode_bmp_to_jpeg_variants(const char *input, JpgOutputSpec *outputs, int num_outputs)
+{
+	JpgData j_data = NULL, scaled = NULL;
+	int i = 0, scale = 0, error = JPG_ENC_SUCCESS;
+
+	if (num_outputs <= 0){
+		return JPG_ENC_BAD_OPTIONS;
+	}
+
+	for (i = 0; i < num_outputs; i++){
+		scale = outputs[i].scale;
+		outputs[i].error = (scale == 1 || scale == 2 || scale == 4 || scale == 8) ? JPG_ENC_READ_FAILED : JPG_ENC_BAD_OPTIONS;
+	}
+
+	j_data = create_jpeg_data();
+
+	if (j_data == NULL){
+		return JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	j_data->options = outputs[0].options;
+	j_data->sample_ratio = outputs[0].options.sample_ratio;
+	j_data->input_filename = (char *) input;
+
+	// colour conversion and DCT are shared by every output, which are all the stats cover
+	run_stage(j_data, JPG_STAGE_PREPROCESS, preprocess_jpeg);
+
+	if (j_data->num_blocks_Y > 0){
+		run_stage(j_data, JPG_STAGE_SUBSAMPLE, chroma_subsample);
+		run_stage(j_data, JPG_STAGE_DCT, dct);
+		report_stats(j_data);
+
+		for (scale = 1; scale <= 8; scale *= 2){
+			for (i = 0; i < num_outputs && outputs[i].scale != scale; i++);
+
+			if (i == num_outputs){
+				continue;
+			}
+
+			if (scale == 1){
+				encode_scaled_outputs(j_data, outputs, num_outputs, scale);
+			}
+
+			else{
+				scaled = create_scaled_data(j_data, scale);
+
+				if (scaled != NULL){
+					encode_scaled_outputs(scaled, outputs, num_outputs, scale);
+					destroy_jpeg_data(scaled);
+				}
+
+				else{
+					for (i = 0; i < num_outputs; i++){
+						if (outputs[i].scale == scale){
+							outputs[i].error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	destroy_jpeg_data(j_data);
+
+	for (i = 0; i < num_outputs && error == JPG_ENC_SUCCESS; i++){
+		error = outputs[i].error;
+	}
+
+	return error;
+}
+
+JpgData create_scaled_data(JpgData j_data, int scale)
+{
+	JpgData scaled = create_jpeg_data();
+	int i = 0;
+
+	if (scaled == NULL){
+		return NULL;
+	}
+
+	scaled->sample_ratio = j_data->sample_ratio;
+	scaled->num_components = j_data->num_components;
+	scaled->width = (j_data->width + scale - 1) / scale;
+	scaled->height = (j_data->height + scale - 1) / scale;
+	determine_resolutions(scaled);
+
+	scaled->num_blocks_Y = scaled->width_in_blocks * scaled->height_in_blocks;
+	scaled->num_blocks_Cb = (scaled->num_components == 3) ? scaled->num_blocks_Y : 0;
+	scaled->num_blocks_Cr = scaled->num_blocks_Cb;
+
+	scaled->Y  = malloc(sizeof(Block) * scaled->num_blocks_Y);
+	scaled->Cb = malloc(sizeof(Block) * scaled->num_blocks_Cb);
+	scaled->Cr = malloc(sizeof(Block) * scaled->num_blocks_Cr);
+
+	for (i = 0; i < scaled->num_blocks_Y; i++){
+		scaled->Y[i]  = new_block();
+	}
+
+	for (i = 0; i < scaled->num_blocks_Cb; i++){
+		scaled->Cb[i] = new_block();
+		scaled->Cr[i] = new_block();
+	}
+
+	dct_downscale(j_data->Y, j_data->width_in_blocks, j_data->height_in_blocks, scaled->Y, scaled->width_in_blocks, scaled->height_in_blocks, scale);
+
+	if (scaled->num_components == 3){
+		dct_downscale(j_data->Cb, j_data->width_in_blocks, j_data->height_in_blocks, scaled->Cb, scaled->width_in_blocks, scaled->height_in_blocks, scale);
+		dct_downscale(j_data->Cr, j_data->width_in_blocks, j_data->height_in_blocks, scaled->Cr, scaled->width_in_blocks, scaled->height_in_blocks, scale);
+	}
+
+	return scaled;
+}
+
+void encode_scaled_outputs(JpgData j_data, JpgOutputSpec *outputs, int num_outputs, int scale)
+{
+	JpgBuffer buffer = {NULL, 0, 0};
+	int i = 0, j = 0;
+
+	allocate_zig_zag(j_data);
+
+	for (i = 0; i < num_outputs; i++){
+		if (outputs[i].scale != scale || outputs[i].error != JPG_ENC_READ_FAILED){
+			continue;
+		}
+
+		j_data->quality = outputs[i].options.quality;
+		quantise_coefficients(j_data);
+
+		// every output of this scale and quality uses the same coefficients
+		for (j = i; j < num_outputs; j++){
+			if (outputs[j].scale != scale || outputs[j].options.quality != j_data->quality){
+				continue;
+			}
+
+			j_data->options = outputs[j].options;
+			j_data->output_filename = (char *) outputs[j].output_filename;
+
+			outputs[j].error = write_output(j_data, &buffer);
+
+			if (outputs[j].error == JPG_ENC_SUCCESS){
+				outputs[j].error = write_output_file(j_data, &buffer);
+			}
+
+			free_jpeg_buffer(&buffer);
+		}
 	}
 }
 
 JpgData create_jpeg_data(void)
 {
-	JpgData j_data = malloc(sizeof(JpegData));
+	JpgData j_data = calloc(1, sizeof(JpegData));
+
+	// full size chroma unless the input is already subsampled
+	if (j_data != NULL){
+		j_data->h_samp = 1;
+		j_data->v_samp = 1;
+	}
+
 	return j_data;
 }
+
+int write_output(JpgData j_data, JpgBuffer *out)
+{
+	JpgFrame frame;
+	int error = JPG_ENC_SUCCESS;
+
+	build_frame(j_data, &frame);
+
+	if (write_jpeg(&frame, out) != JPG_WRITE_SUCCESS){
+		error = JPG_ENC_WRITE_FAILED;
+	}
+
+	return error;
+}
+
+void build_frame(JpgData j_data, JpgFrame *frame)
+{
+	JpgComponent *c = NULL;
+	int **blocks[3] = {j_data->zig_zag_Y, j_data->zig_zag_Cb, j_data->zig_zag_Cr};
+	int i = 0;
+
+	frame->width = j_data->width;
+	frame->height = j_data->height;
+	frame->num_components = j_data->num_components;
+	frame->restart_interval = j_data->options.restart_interval;
+	frame->optimize_huffman = j_data->options.optimize_huffman;
+	frame->symbol_freq = j_data->symbols_counted ? j_data->symbol_freq : NULL;
+	frame->progressive = j_data->options.progressive;
+	frame->scans = j_data->options.scans;
+	frame->num_scans = j_data->options.num_scans;
+
+	memcpy(frame->quant[0], j_data->quant_lum, sizeof(frame->quant[0]));
+	memcpy(frame->quant[1], j_data->quant_chr, sizeof(frame->quant[1]));
+
+	// chroma is only subsampled when the input was (see preprocess_yuv)
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		c->id = i + 1;
+		c->h_samp = (i == 0) ? j_data->h_samp : 1;
+		c->v_samp = (i == 0) ? j_data->v_samp : 1;
+		c->quant_table = (i == 0) ? 0 : 1;
+		c->huff_table = (i == 0) ? JPG_HUFF_LUMINANCE : JPG_HUFF_CHROMINANCE;
+		c->width_in_blocks = (i == 0) ? j_data->width_in_blocks : j_data->width_in_blocks / j_data->h_samp;
+		c->height_in_blocks = (i == 0) ? j_data->height_in_blocks : j_data->height_in_blocks / j_data->v_samp;
+		c->blocks = blocks[i];
+		c->coefficients = NULL;
+	}
+}
+
+int write_output_file(JpgData j_data, const JpgBuffer *buffer)
+{
+	return (write_jpeg_file(j_data->output_filename, buffer) == JPG_WRITE_SUCCESS) ? JPG_ENC_SUCCESS : JPG_ENC_WRITE_FAILED;
+}
+
+size_t estimate_jpeg_size(JpgData j_data)
+{
+	HuffmanData tables[4]; // DC and AC of luminance then chrominance
+	long bits = 0;
+	size_t bytes = HEADER_BYTES(j_data->num_components);
+	int num_tables = (j_data->num_components == 1) ? 2 : 4;
+	int i = 0, l = 0, num_mcus = j_data->width_in_blocks * j_data->height_in_blocks;
+	int restart = j_data->options.restart_interval;
+
+	for (i = 0; i < 4; i++){
+		initialize_huffman_data(&tables[i]);
+	}
+
+	count_symbols(j_data->zig_zag_Y, j_data->num_blocks_Y, restart, &tables[0], &tables[1]);
+	count_symbols(j_data->zig_zag_Cb, j_data->num_blocks_Cb, restart, &tables[2], &tables[3]);
+	count_symbols(j_data->zig_zag_Cr, j_data->num_blocks_Cr, restart, &tables[2], &tables[3]);
+
+	// each table costs its DHT segment plus a byte per symbol
+	for (i = 0; i < num_tables; i++){
+		bits += estimate_huffman_bits(&tables[i], i % 2);
+		bytes += DHT_BYTES;
+
+		for (l = 1; l <= 16; l++){
+			bytes += tables[i].bits[l];
+		}
+	}
+
+	// DRI segment and the markers between restart intervals, each interval is padded to a byte
+	if (restart > 0){
+		bytes += 6 + 2 * ((num_mcus - 1) / restart);
+		bits += 4 * ((num_mcus - 1) / restart);
+	}
+
+	// a 0x00 is stuffed after each 0xFF in the scan, about one byte in 256
+	bytes += (bits + 7) / 8;
+	bytes += (bits / 8) / 256;
+
+	return bytes;
+}
+
+void count_symbols(int **blocks, int num_blocks, int restart_interval, HuffmanData *dc, HuffmanData *ac)
+{
+	int i = 0, prev = 0, diff = 0;
+
+	// without subsampling the blocks of a component are coded in raster order, one per MCU
+	for (i = 0; i < num_blocks; i++){
+		if (restart_interval > 0 && i % restart_interval == 0){
+			prev = 0;
+		}
+
+		diff = blocks[i][0] - prev;
+		prev = blocks[i][0];
+
+		calculate_freq_block_DC(dc, &diff);
+		calculate_freq_block_AC(ac, blocks[i]);
+	}
+}
+
+double elapsed_ms(clock_t start)
+{
+	return 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+}
+
+double wall_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+void begin_stage(JpgData j_data, int stage)
+{
+	trace_begin(stage_names[stage], -1);
+
+	if (j_data->options.stats == NULL){
+		return;
+	}
+
+	// the counters are opened by the first stage that is timed
+	if (j_data->options.hardware_counters && !j_data->perf_opened){
+		j_data->perf = open_perf_counters();
+		j_data->perf_opened = 1;
+	}
+
+	j_data->stage_wall = wall_ms();
+	j_data->stage_clock = clock();
+
+	if (j_data->perf != NULL){
+		start_perf_counters(j_data->perf);
+	}
+}
+
+void end_stage(JpgData j_data, int stage)
+{
+	if (j_data->options.stats != NULL){
+		if (j_data->perf != NULL){
+			add_perf_counters(j_data->perf, j_data->stages[stage].counters);
+		}
+
+		j_data->stages[stage].wall_ms += wall_ms() - j_data->stage_wall;
+		j_data->stages[stage].cpu_ms += elapsed_ms(j_data->stage_clock);
+	}
+
+	trace_end();
+}
+
+void run_stage(JpgData j_data, int stage, void (*function)(JpgData))
+{
+	begin_stage(j_data, stage);
+	function(j_data);
+	end_stage(j_data, stage);
+}
+
+void log_message(JpgData j_data, int level, const char *format, ...)
+{
+	char message[256];
+	va_list args;
+
+	if (j_data->options.log == NULL){
+		return;
+	}
+
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	j_data->options.log(j_data->options.log_context, level, message);
+}
+
+int transform_blocks_cached(JpgData j_data)
+{
+	BlockCache cache = create_block_cache(j_data->options.block_cache_size);
+	Block *blocks[3] = {j_data->Y, j_data->Cb, j_data->Cr};
+	Byte *flat[3] = {j_data->flat_Y, j_data->flat_Cb, j_data->flat_Cr};
+	int num_blocks[3] = {j_data->num_blocks_Y, j_data->num_blocks_Cb, j_data->num_blocks_Cr};
+	int **zz[3];
+	McuState state;
+	const double *values = NULL;
+	short samples[64];
+	unsigned int hash = 0;
+	int c = 0, i = 0, table = 0;
+
+	// the fixed point DCT only sees the rounded samples, the floating point one needs the values to match too
+	int exact = (j_data->options.dct_method != JPG_DCT_INTEGER);
+
+	if (cache == NULL){
+		return JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	allocate_zig_zag(j_data);
+	init_mcu_state(j_data, &state);
+
+	zz[0] = j_data->zig_zag_Y;
+	zz[1] = j_data->zig_zag_Cb;
+	zz[2] = j_data->zig_zag_Cr;
+
+	for (c = 0; c < j_data->num_components; c++){
+		// Cb and Cr share the chrominance table so they share cached blocks too
+		table = (c == 0) ? 0 : 1;
+
+		// a block that misses goes through the same transform as the MCU kernels, so the cache never changes the image
+		for (i = 0; i < num_blocks[c]; i++){
+			if (IS_FLAT(flat[c], i)){
+				transform_block(&state, blocks[c][i], 1, table, zz[c][i]);
+			}
+
+			else{
+				values = block_values(blocks[c][i]);
+				fdct_integer_samples(values, samples);
+
+				if (!block_cache_find(cache, table, samples, exact ? values : NULL, &hash, zz[c][i])){
+					transform_block(&state, blocks[c][i], 0, table, zz[c][i]);
+					block_cache_add(cache, table, samples, exact ? values : NULL, hash, zz[c][i]);
+				}
+			}
+		}
+	}
+
+	j_data->cache_hits = block_cache_hits(cache);
+	j_data->cache_misses = block_cache_misses(cache);
+	destroy_block_cache(cache);
+
+	return JPG_ENC_SUCCESS;
+}
+
+void report_stats(JpgData j_data)
+{
+	JpgEncodeStats *stats = j_data->options.stats;
+	JpgFrame frame;
+	int **blocks[3] = {j_data->zig_zag_Y, j_data->zig_zag_Cb, j_data->zig_zag_Cr};
+	int num_blocks[3] = {j_data->num_blocks_Y, j_data->num_blocks_Cb, j_data->num_blocks_Cr};
+	long zeroes = 0;
+	int c = 0, i = 0, k = 0;
+
+	if (stats == NULL){
+		return;
+	}
+
+	memset(stats, 0, sizeof(JpgEncodeStats));
+	stats->blocks = j_data->num_blocks_Y + j_data->num_blocks_Cb + j_data->num_blocks_Cr;
+	stats->flat_blocks = j_data->num_flat_blocks;
+	stats->cache_hits = j_data->cache_hits;
+	stats->cache_misses = j_data->cache_misses;
+	stats->input_bytes = j_data->input_bytes;
+	stats->output_bytes = j_data->output_bytes;
+	stats->allocations = j_data->allocations;
+	memcpy(stats->stages, j_data->stages, sizeof(stats->stages));
+
+	for (i = 0; i < JPG_NUM_STAGES; i++){
+		for (k = 0; k < JPG_NUM_COUNTERS; k++){
+			if (!perf_counter_available(j_data->perf, k)){
+				stats->stages[i].counters[k] = -1;
+			}
+		}
+	}
+
+	// the coefficients are only known once the blocks are quantised
+	if (j_data->zig_zag_Y != NULL && stats->blocks > 0 && j_data->output_bytes > 0){
+		for (c = 0; c < 3; c++){
+			for (i = 0; i < num_blocks[c]; i++){
+				for (k = 0; k < 64; k++){
+					zeroes += (blocks[c][i][k] == 0);
+				}
+			}
+		}
+
+		stats->zero_ratio = (double) zeroes / (64.0 * stats->blocks);
+
+		build_frame(j_data, &frame);
+		count_frame_symbols(&frame, stats->dc_symbols, stats->ac_symbols);
+	}
+}
+
+void destroy_jpeg_data(JpgData j_data)
+{
+	int i = 0;
+
+	for (i = 0; i < j_data->num_blocks_Y; i++){
+		destroy_block(j_data->Y[i]);
+
+		if (j_data->zig_zag_Y != NULL){
+			free(j_data->zig_zag_Y[i]);
+		}
+	}
+
+	for (i = 0; i < j_data->num_blocks_Cb; i++){
+		destroy_block(j_data->Cb[i]);
+		destroy_block(j_data->Cr[i]);
+
+		if (j_data->zig_zag_Cb != NULL){
+			free(j_data->zig_zag_Cb[i]);
+			free(j_data->zig_zag_Cr[i]);
+		}
+	}
+
+	free(j_data->Y);
+	free(j_data->Cb);
+	free(j_data->Cr);
+	free(j_data->zig_zag_Y);
+	free(j_data->zig_zag_Cb);
+	free(j_data->zig_zag_Cr);
+	free(j_data->flat_Y);
+	free(j_data->flat_Cb);
+	free(j_data->flat_Cr);
+	close_perf_counters(j_data->perf);
+	free(j_data);
+}
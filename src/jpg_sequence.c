@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/jpg_sequence.h"
+#include "headers/jpg_write.h"
+#include "headers/preprocess.h"
+#include "headers/block.h"
+#include "headers/dct.h"
+#include "headers/quantise.h"
+#include "headers/tables.h"
+#include "headers/trace.h"
+
+typedef struct _jpg_sequence{
+	FILE *file;
+	int format;
+	int width;
+	int height;
+	int detect_unchanged;
+	double flat_threshold;
+
+	// the components, tables and blocks of the frames (blocks of reused intervals are left as they were)
+	JpgFrame frame;
+	IntervalWriter writer;
+	JpgBuffer headers; // SOI to SOS, the same for every frame
+
+	int mcus_across;
+	int num_mcus;
+	int num_intervals;
+
+	// the last image and the one before it, offsets[k][i] is where interval i starts in images[k]
+	// (offsets[k][num_intervals] is where the EOI marker is)
+	JpgBuffer images[2];
+	size_t *offsets[2];
+	int current;
+
+	Block scratch; // samples then DCT coefficients of the block being coded
+
+	// samples of the previous frame, one plane per channel without gaps between rows
+	Byte *previous[3];
+	int have_previous;
+
+	JpgSequenceStats stats;
+} jpg_sequence;
+
+// sets up the components of the frame and allocates their blocks
+int setup_frame(JpgSequence seq, int h_samp, int v_samp, const JpgEncodeOptions *options);
+
+// 1 if any sample of the MCUs first to end - 1 differs from the previous frame
+int samples_changed(JpgSequence seq, const YuvPlane *planes, int first, int end);
+
+// DCT, quantization and zig-zag ordering of the blocks of an MCU
+void code_mcu(JpgSequence seq, const YuvPlane *planes, int mcu);
+
+// keeps the samples of a frame to compare the next one with
+void save_planes(JpgSequence seq, const YuvPlane *planes);
+
+/* ==================================== Function definitions ===================================== */
+
+JpgSequence create_jpeg_sequence(const char *output_filename, int format, int width, int height,
+								 const JpgEncodeOptions *options, int detect_unchanged)
+{
+	JpgSequence seq = NULL;
+	int h_samp = 2, v_samp = 2, c = 0, ok = 1;
+
+	if (format == JPG_YUV_YUYV){
+		v_samp = 1;
+	}
+
+	else if (format != JPG_YUV_I420 && format != JPG_YUV_NV12){
+		return NULL;
+	}
+
+	if (width <= 0 || height <= 0 || options->restart_interval < 0){
+		return NULL;
+	}
+
+	seq = calloc(1, sizeof(jpg_sequence));
+
+	if (seq == NULL){
+		return NULL;
+	}
+
+	seq->format = format;
+	seq->width = width;
+	seq->height = height;
+	seq->detect_unchanged = detect_unchanged;
+	seq->flat_threshold = options->flat_threshold;
+	seq->scratch = new_block();
+
+	ok = setup_frame(seq, h_samp, v_samp, options);
+
+	if (ok){
+		seq->writer = create_interval_writer(&seq->frame);
+		ok = seq->writer != NULL && interval_writer_headers(seq->writer, &seq->headers) == JPG_WRITE_SUCCESS;
+	}
+
+	if (ok){
+		seq->num_intervals = interval_writer_count(seq->writer);
+		seq->offsets[0] = malloc(sizeof(size_t) * (seq->num_intervals + 1));
+		seq->offsets[1] = malloc(sizeof(size_t) * (seq->num_intervals + 1));
+		ok = seq->offsets[0] != NULL && seq->offsets[1] != NULL;
+	}
+
+	// the chroma planes are the size of the luminance plane at most
+	for (c = 0; ok && detect_unchanged && c < 3; c++){
+		seq->previous[c] = malloc((size_t) width * height);
+		ok = seq->previous[c] != NULL;
+	}
+
+	if (ok && output_filename != NULL){
+		seq->file = fopen(output_filename, "wb");
+		ok = seq->file != NULL;
+	}
+
+	if (!ok){
+		destroy_jpeg_sequence(seq);
+		seq = NULL;
+	}
+
+	return seq;
+}
+
+int jpeg_sequence_add_frame(JpgSequence seq, const JpgYuvImage *frame)
+{
+	YuvPlane planes[3];
+	JpgBuffer *out = NULL, *last = NULL;
+	size_t *offsets = NULL, *last_offsets = NULL;
+	int h_samp = 0, v_samp = 0, restart = seq->frame.restart_interval;
+	int i = 0, m = 0, first = 0, end = 0, ok = 1;
+
+	if (frame->format != seq->format || frame->width != seq->width || frame->height != seq->height
+		|| yuv_planes(frame, planes, &h_samp, &v_samp) != JPG_ENC_SUCCESS){
+		return JPG_ENC_BAD_OPTIONS;
+	}
+
+	trace_begin("frame", seq->stats.frames);
+
+	// the image before last is overwritten
+	seq->current ^= 1;
+	out = &seq->images[seq->current];
+	last = &seq->images[seq->current ^ 1];
+	offsets = seq->offsets[seq->current];
+	last_offsets = seq->offsets[seq->current ^ 1];
+
+	out->size = 0;
+	ok = append_bytes(out, seq->headers.data, seq->headers.size);
+
+	for (i = 0; ok && i < seq->num_intervals; i++){
+		first = (restart > 0) ? i * restart : 0;
+		end = (restart > 0 && first + restart < seq->num_mcus) ? first + restart : seq->num_mcus;
+		offsets[i] = out->size;
+
+		// the interval (and the restart marker after it) is the same as last time
+		if (seq->have_previous && !samples_changed(seq, planes, first, end)){
+			ok = append_bytes(out, last->data + last_offsets[i], last_offsets[i + 1] - last_offsets[i]);
+			seq->stats.intervals_reused++;
+		}
+
+		else{
+			trace_begin("interval", i);
+
+			for (m = first; m < end; m++){
+				code_mcu(seq, planes, m);
+			}
+
+			ok = interval_writer_encode(seq->writer, i, out) == JPG_WRITE_SUCCESS;
+			seq->stats.intervals_encoded++;
+			trace_end();
+		}
+	}
+
+	if (ok){
+		offsets[seq->num_intervals] = out->size;
+		ok = interval_writer_end(seq->writer, out) == JPG_WRITE_SUCCESS;
+	}
+
+	// a frame that wasn't finished can't be reused, the next one is coded in full
+	if (!ok){
+		out->size = 0;
+		seq->have_previous = 0;
+		trace_end();
+		return JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	if (seq->detect_unchanged){
+		save_planes(seq, planes);
+		seq->have_previous = 1;
+	}
+
+	seq->stats.frames++;
+	seq->stats.bytes += out->size;
+	trace_end();
+
+	if (seq->file != NULL && fwrite(out->data, 1, out->size, seq->file) != out->size){
+		return JPG_ENC_WRITE_FAILED;
+	}
+
+	return JPG_ENC_SUCCESS;
+}
+
+const Byte *jpeg_sequence_frame(JpgSequence seq, size_t *size)
+{
+	JpgBuffer *image = &seq->images[seq->current];
+
+	*size = image->size;
+	return (image->size > 0) ? image->data : NULL;
+}
+
+void jpeg_sequence_stats(JpgSequence seq, JpgSequenceStats *stats)
+{
+	*stats = seq->stats;
+}
+
+int destroy_jpeg_sequence(JpgSequence seq)
+{
+	int error = JPG_ENC_SUCCESS, c = 0;
+
+	if (seq == NULL){
+		return error;
+	}
+
+	if (seq->file != NULL && fclose(seq->file) != 0){
+		error = JPG_ENC_WRITE_FAILED;
+	}
+
+	for (c = 0; c < 3; c++){
+		free(seq->previous[c]);
+	}
+
+	free(seq->offsets[0]);
+	free(seq->offsets[1]);
+	free_jpeg_buffer(&seq->images[0]);
+	free_jpeg_buffer(&seq->images[1]);
+	free_jpeg_buffer(&seq->headers);
+
+	if (seq->writer != NULL){
+		destroy_interval_writer(seq->writer);
+	}
+
+	free_jpeg_frame(&seq->frame);
+	destroy_block(seq->scratch);
+	free(seq);
+
+	return error;
+}
+
+int setup_frame(JpgSequence seq, int h_samp, int v_samp, const JpgEncodeOptions *options)
+{
+	JpgFrame *frame = &seq->frame;
+	JpgComponent *comp = NULL;
+	int mcus_down = 0, num_blocks = 0, c = 0, b = 0;
+
+	seq->mcus_across = (seq->width + 8 * h_samp - 1) / (8 * h_samp);
+	mcus_down = (seq->height + 8 * v_samp - 1) / (8 * v_samp);
+	seq->num_mcus = seq->mcus_across * mcus_down;
+
+	frame->width = seq->width;
+	frame->height = seq->height;
+	frame->num_components = 3;
+	frame->optimize_huffman = 0;
+	frame->progressive = 0;
+	frame->scans = NULL;
+	frame->num_scans = 0;
+
+	// without restart markers the whole frame would have to be the same to reuse anything
+	frame->restart_interval = options->restart_interval;
+	if (seq->detect_unchanged && frame->restart_interval == 0){
+		frame->restart_interval = seq->mcus_across;
+	}
+
+	build_quant_table(quanMatrixLum, options->quality, frame->quant[0]);
+	build_quant_table(quanMatrixChr, options->quality, frame->quant[1]);
+
+	for (c = 0; c < 3; c++){
+		comp = &frame->components[c];
+		comp->id = c + 1;
+		comp->h_samp = (c == 0) ? h_samp : 1;
+		comp->v_samp = (c == 0) ? v_samp : 1;
+		comp->quant_table = (c == 0) ? 0 : 1;
+		comp->huff_table = (c == 0) ? JPG_HUFF_LUMINANCE : JPG_HUFF_CHROMINANCE;
+		comp->width_in_blocks = seq->mcus_across * comp->h_samp;
+		comp->height_in_blocks = mcus_down * comp->v_samp;
+
+		num_blocks = comp->width_in_blocks * comp->height_in_blocks;
+		comp->blocks = malloc(sizeof(int *) * num_blocks);
+		comp->coefficients = calloc((size_t) num_blocks * 64, sizeof(int));
+
+		if (comp->blocks == NULL || comp->coefficients == NULL){
+			return 0;
+		}
+
+		for (b = 0; b < num_blocks; b++){
+			comp->blocks[b] = comp->coefficients + 64 * b;
+		}
+	}
+
+	return 1;
+}
+
+int samples_changed(JpgSequence seq, const YuvPlane *planes, int first, int end)
+{
+	const JpgComponent *comp = NULL;
+	const Byte *row = NULL, *prev = NULL;
+	int m = 0, c = 0, x = 0, y = 0, x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+
+	for (m = first; m < end; m++){
+		for (c = 0; c < 3; c++){
+			comp = &seq->frame.components[c];
+
+			// the samples the blocks of the MCU are cut from (blocks past the edge repeat these)
+			x0 = (m % seq->mcus_across) * 8 * comp->h_samp;
+			y0 = (m / seq->mcus_across) * 8 * comp->v_samp;
+			x1 = (x0 + 8 * comp->h_samp < planes[c].width) ? x0 + 8 * comp->h_samp : planes[c].width;
+			y1 = (y0 + 8 * comp->v_samp < planes[c].height) ? y0 + 8 * comp->v_samp : planes[c].height;
+
+			for (y = y0; y < y1; y++){
+				row = planes[c].samples + (size_t) y * planes[c].stride;
+				prev = seq->previous[c] + (size_t) y * planes[c].width;
+
+				if (planes[c].step == 1){
+					if (memcmp(row + x0, prev + x0, x1 - x0) != 0) return 1;
+				}
+
+				else{
+					for (x = x0; x < x1; x++){
+						if (row[(size_t) x * planes[c].step] != prev[x]) return 1;
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+void code_mcu(JpgSequence seq, const YuvPlane *planes, int mcu)
+{
+	const JpgComponent *comp = NULL;
+	const int *table = NULL;
+	int *zz = NULL;
+	int c = 0, i = 0, j = 0, bx = 0, by = 0;
+
+	for (c = 0; c < 3; c++){
+		comp = &seq->frame.components[c];
+		table = seq->frame.quant[comp->quant_table];
+
+		for (j = 0; j < comp->v_samp; j++){
+			for (i = 0; i < comp->h_samp; i++){
+				bx = (mcu % seq->mcus_across) * comp->h_samp + i;
+				by = (mcu / seq->mcus_across) * comp->v_samp + j;
+				zz = comp->blocks[by * comp->width_in_blocks + bx];
+
+				if (fill_block(seq->scratch, &planes[c], bx, by, seq->flat_threshold)){
+					dct_flat_block(seq->scratch);
+					quantise_flat_zig_zag(seq->scratch, table, zz);
+				}
+
+				else{
+					dct_block(seq->scratch);
+					quantise_zig_zag(seq->scratch, table, zz);
+				}
+			}
+		}
+	}
+}
+
+void save_planes(JpgSequence seq, const YuvPlane *planes)
+{
+	const Byte *row = NULL;
+	Byte *dst = NULL;
+	int c = 0, x = 0, y = 0;
+
+	for (c = 0; c < 3; c++){
+		for (y = 0; y < planes[c].height; y++){
+			row = planes[c].samples + (size_t) y * planes[c].stride;
+			dst = seq->previous[c] + (size_t) y * planes[c].width;
+
+			if (planes[c].step == 1){
+				memcpy(dst, row, planes[c].width);
+			}
+
+			else{
+				for (x = 0; x < planes[c].width; x++){
+					dst[x] = row[(size_t) x * planes[c].step];
+				}
+			}
+		}
+	}
+}
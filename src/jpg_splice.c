@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/jpg_splice.h"
+#include "headers/jpg_decode.h"
+#include "headers/jpg_write.h"
+#include "headers/block.h"
+#include "headers/dct.h"
+#include "headers/quantise.h"
+
+// markers
+#define MARKER_RST0 0xD0
+
+// marks the restart intervals holding an MCU that overlaps the rectangle, returns the number of MCUs in them
+int mark_intervals(const JpegLayout *layout, int x, int y, int w, int h, Byte *dirty);
+
+// points the blocks of the MCUs in the marked intervals into storage, the other blocks are never read
+void assign_blocks(JpegLayout *layout, const Byte *dirty, int *storage);
+
+// colour conversion, DCT and quantization of the blocks of an MCU from the new pixels
+void splice_mcu(JpegLayout *layout, const Byte *rgb, int mcu, Block b);
+
+// writes the headers, the new and old intervals and whatever follows the scan
+int splice_intervals(JpegLayout *layout, IntervalWriter writer, const Byte *rgb, const Byte *dirty, JpgBuffer *out);
+
+/* ==================================== Function definitions ===================================== */
+
+int splice_jpeg_region(const char *input_filename, const char *output_filename, const Byte *rgb,
+					   int x, int y, int w, int h, JpgSpliceStats *stats)
+{
+	JpegLayout layout;
+	JpgFrame *frame = &layout.frame;
+	IntervalWriter writer = NULL;
+	JpgBuffer out = {NULL, 0, 0};
+	Byte *dirty = NULL;
+	int *storage = NULL;
+	int error = JPG_SPLICE_SUCCESS, num_mcus = 0, blocks_in_mcu = 0, i = 0;
+
+	if (read_jpeg_layout(input_filename, &layout) != JPG_DEC_SUCCESS){
+		return JPG_SPLICE_READ_FAILED;
+	}
+
+	// blocks are cut from the pixels with whole factors of the largest sampling factors
+	for (i = 0; i < frame->num_components; i++){
+		if (frame->components[i].h_samp > 2 || frame->components[i].v_samp > 2){
+			error = JPG_SPLICE_READ_FAILED;
+		}
+
+		blocks_in_mcu += frame->components[i].h_samp * frame->components[i].v_samp;
+	}
+
+	if (rgb == NULL || w <= 0 || h <= 0 || x < 0 || y < 0 || x >= frame->width || y >= frame->height){
+		error = JPG_SPLICE_BAD_REGION;
+	}
+
+	if (error == JPG_SPLICE_SUCCESS){
+		dirty = calloc(layout.num_intervals, sizeof(Byte));
+
+		for (i = 0; dirty != NULL && i < frame->num_components; i++){
+			frame->components[i].blocks = calloc((size_t) frame->components[i].width_in_blocks * frame->components[i].height_in_blocks, sizeof(int *));
+			if (frame->components[i].blocks == NULL) error = JPG_SPLICE_FAILED_ALLOCATE_BUFFER;
+		}
+
+		if (dirty == NULL){
+			error = JPG_SPLICE_FAILED_ALLOCATE_BUFFER;
+		}
+	}
+
+	// only the blocks of the intervals being replaced get coefficients
+	if (error == JPG_SPLICE_SUCCESS){
+		num_mcus = mark_intervals(&layout, x, y, w, h, dirty);
+		storage = malloc(sizeof(int) * 64 * blocks_in_mcu * (size_t) num_mcus);
+		writer = create_interval_writer_with_tables(frame, layout.dc_tables, layout.ac_tables);
+
+		if (storage == NULL || writer == NULL){
+			error = JPG_SPLICE_FAILED_ALLOCATE_BUFFER;
+		}
+	}
+
+	if (error == JPG_SPLICE_SUCCESS){
+		assign_blocks(&layout, dirty, storage);
+		error = splice_intervals(&layout, writer, rgb, dirty, &out);
+	}
+
+	if (error == JPG_SPLICE_SUCCESS && write_jpeg_file(output_filename, &out) != JPG_WRITE_SUCCESS){
+		error = JPG_SPLICE_WRITE_FAILED;
+	}
+
+	if (stats != NULL){
+		stats->intervals = layout.num_intervals;
+		stats->intervals_encoded = 0;
+		stats->input_size = layout.size;
+		stats->output_size = (error == JPG_SPLICE_SUCCESS) ? out.size : 0;
+
+		for (i = 0; dirty != NULL && i < layout.num_intervals; i++){
+			stats->intervals_encoded += dirty[i];
+		}
+	}
+
+	if (writer != NULL){
+		destroy_interval_writer(writer);
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		free(frame->components[i].blocks);
+		frame->components[i].blocks = NULL;
+	}
+
+	free(storage);
+	free(dirty);
+	free_jpeg_buffer(&out);
+	free_jpeg_layout(&layout);
+
+	return error;
+}
+
+int mark_intervals(const JpegLayout *layout, int x, int y, int w, int h, Byte *dirty)
+{
+	const JpgFrame *frame = &layout->frame;
+	int mcu_width = 8, mcu_height = 8, restart = frame->restart_interval;
+	int right = 0, bottom = 0, row = 0, col = 0, i = 0, num_mcus = 0;
+	int total = layout->mcus_per_row * layout->mcu_rows;
+
+	for (i = 0; i < frame->num_components; i++){
+		if (8 * frame->components[i].h_samp > mcu_width) mcu_width = 8 * frame->components[i].h_samp;
+		if (8 * frame->components[i].v_samp > mcu_height) mcu_height = 8 * frame->components[i].v_samp;
+	}
+
+	right = (w > frame->width - x) ? frame->width : x + w;
+	bottom = (h > frame->height - y) ? frame->height : y + h;
+
+	for (row = y / mcu_height; row <= (bottom - 1) / mcu_height; row++){
+		for (col = x / mcu_width; col <= (right - 1) / mcu_width; col++){
+			dirty[ (restart > 0) ? (row * layout->mcus_per_row + col) / restart : 0 ] = 1;
+		}
+	}
+
+	for (i = 0; i < layout->num_intervals; i++){
+		if (dirty[i]){
+			num_mcus += (restart > 0 && (i + 1) * restart < total) ? restart : total - ((restart > 0) ? i * restart : 0);
+		}
+	}
+
+	return num_mcus;
+}
+
+void assign_blocks(JpegLayout *layout, const Byte *dirty, int *storage)
+{
+	JpgComponent *c = NULL;
+	int restart = layout->frame.restart_interval;
+	int total = layout->mcus_per_row * layout->mcu_rows;
+	int m = 0, i = 0, h = 0, v = 0, bx = 0, by = 0;
+
+	for (m = 0; m < total; m++){
+		if (!dirty[ (restart > 0) ? m / restart : 0 ]){
+			continue;
+		}
+
+		for (i = 0; i < layout->frame.num_components; i++){
+			c = &layout->frame.components[i];
+
+			for (v = 0; v < c->v_samp; v++){
+				for (h = 0; h < c->h_samp; h++){
+					bx = (m % layout->mcus_per_row) * c->h_samp + h;
+					by = (m / layout->mcus_per_row) * c->v_samp + v;
+
+					c->blocks[by * c->width_in_blocks + bx] = storage;
+					storage += 64;
+				}
+			}
+		}
+	}
+}
+
+void splice_mcu(JpegLayout *layout, const Byte *rgb, int mcu, Block b)
+{
+	const JpgFrame *frame = &layout->frame;
+	const JpgComponent *c = NULL;
+	const Byte *p = NULL;
+	int max_h = 1, max_v = 1, fx = 1, fy = 1;
+	int i = 0, h = 0, v = 0, bx = 0, by = 0, sx = 0, sy = 0, px = 0, py = 0, dx = 0, dy = 0;
+	double sum = 0.0, value = 0.0;
+
+	for (i = 0; i < frame->num_components; i++){
+		if (frame->components[i].h_samp > max_h) max_h = frame->components[i].h_samp;
+		if (frame->components[i].v_samp > max_v) max_v = frame->components[i].v_samp;
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		fx = max_h / c->h_samp;
+		fy = max_v / c->v_samp;
+
+		for (v = 0; v < c->v_samp; v++){
+			for (h = 0; h < c->h_samp; h++){
+				bx = (mcu % layout->mcus_per_row) * c->h_samp + h;
+				by = (mcu / layout->mcus_per_row) * c->v_samp + v;
+
+				// each sample is the average of the fx x fy pixels it covers, the padding repeats
+				// the last column and row of the image
+				for (sy = 0; sy < 8; sy++){
+					for (sx = 0; sx < 8; sx++){
+						sum = 0.0;
+
+						for (dy = 0; dy < fy; dy++){
+							for (dx = 0; dx < fx; dx++){
+								px = ((bx * 8 + sx) * fx + dx < frame->width) ? (bx * 8 + sx) * fx + dx : frame->width - 1;
+								py = ((by * 8 + sy) * fy + dy < frame->height) ? (by * 8 + sy) * fy + dy : frame->height - 1;
+								p = rgb + ((size_t) py * frame->width + px) * 3;
+
+								// convert RGB => YUV
+								if (i == 0) value = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+								else if (i == 1) value = 128 - 0.168736 * p[0] - 0.331264 * p[1] + 0.5 * p[2];
+								else value = 128 + 0.5 * p[0] - 0.418688 * p[1] - 0.081312 * p[2];
+
+								sum += value;
+							}
+						}
+
+						set_value_block(b, sx, sy, sum / (fx * fy) - 128);
+					}
+				}
+
+				dct_block(b);
+				quantise_zig_zag(b, frame->quant[c->quant_table], c->blocks[by * c->width_in_blocks + bx]);
+			}
+		}
+	}
+}
+
+int splice_intervals(JpegLayout *layout, IntervalWriter writer, const Byte *rgb, const Byte *dirty, JpgBuffer *out)
+{
+	Block b = new_block();
+	Byte rst[2] = {0xFF, MARKER_RST0};
+	int restart = layout->frame.restart_interval;
+	int total = layout->mcus_per_row * layout->mcu_rows;
+	int i = 0, m = 0, end = 0, ok = 1, error = JPG_SPLICE_SUCCESS;
+	size_t start = 0, stop = 0;
+
+	// everything up to the entropy coded data (APPn segments, tables, SOS) is kept
+	ok = append_bytes(out, layout->data, layout->interval_offsets[0]);
+
+	for (i = 0; ok && error == JPG_SPLICE_SUCCESS && i < layout->num_intervals; i++){
+		if (dirty[i]){
+			end = (restart > 0 && (i + 1) * restart < total) ? (i + 1) * restart : total;
+
+			for (m = (restart > 0) ? i * restart : 0; m < end; m++){
+				splice_mcu(layout, rgb, m, b);
+			}
+
+			// the writer adds the restart marker
+			switch (interval_writer_encode(writer, i, out)){
+				case JPG_WRITE_SUCCESS:
+					break;
+
+				case JPG_WRITE_BAD_FRAME:
+					error = JPG_SPLICE_TABLES_INCOMPLETE;
+					break;
+
+				default:
+					error = JPG_SPLICE_FAILED_ALLOCATE_BUFFER;
+					break;
+			}
+		}
+
+		// the old interval up to (not including) its restart marker, which is written again in order
+		else{
+			start = layout->interval_offsets[i];
+			stop = (i + 1 < layout->num_intervals) ? layout->interval_offsets[i + 1] - 2 : layout->scan_end;
+			rst[1] = MARKER_RST0 + (i & 7);
+
+			ok = append_bytes(out, layout->data + start, stop - start)
+				 && (i + 1 == layout->num_intervals || append_bytes(out, rst, 2));
+		}
+	}
+
+	// EOI and anything after it
+	ok = ok && append_bytes(out, layout->data + layout->scan_end, layout->size - layout->scan_end);
+
+	if (!ok && error == JPG_SPLICE_SUCCESS){
+		error = JPG_SPLICE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	destroy_block(b);
+
+	return error;
+}
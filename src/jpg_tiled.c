@@ -0,0 +1,730 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "headers/jpg_tiled.h"
+#include "headers/jpg_write.h"
+#include "headers/preprocess.h"
+#include "headers/bitmap.h"
+#include "headers/block.h"
+#include "headers/zig_zag.h"
+#include "headers/huffman.h"
+#include "headers/mcu_kernel.h"
+#include "headers/perf_counters.h"
+#include "headers/spsc_ring.h"
+#include "headers/trace.h"
+
+struct _tiled_pipeline;
+
+// what the strips of an image share
+typedef struct _tiled_encoder{
+	// the options and size of the image, with the blocks and coefficients of one strip (height_in_blocks
+	// is the MCU rows in a strip)
+	JpgData j_data;
+	BmpStripReader reader;
+	McuState state;
+
+	Byte *rgb; // pixels of one strip
+	int strip_rows; // MCU rows in a strip
+	int mcu_rows; // MCU rows in the image
+	long long zeroes; // quantised coefficients that are 0, only counted with stats
+
+	struct _tiled_pipeline *pipeline; // NULL unless the options ask for one
+} TiledEncoder;
+
+// a strip handed from one stage of the pipeline to the next
+typedef struct _tiled_slot{
+	JpgData strip; // blocks and coefficients of the strip, the first slot uses those of the encoder
+	Byte *rgb;
+	int row; // MCU row of the image at the top of the strip
+	int num_rows; // MCU rows in the strip, 0 if it couldn't be read
+} TiledSlot;
+
+/*
+	The threads of a pass: the reader reads and converts strips, the transformer takes them through
+	the MCU kernel and the calling thread entropy codes them, each stage working on a different slot.
+	Slots go round through the rings: free => reader => transformer => entropy coder => free, with
+	-1 after the last strip. When every slot is in use the reader waits for the entropy coder.
+*/
+typedef struct _tiled_pipeline{
+	TiledEncoder *t;
+	McuKernel kernel;
+	TiledSlot *slots;
+	int num_slots;
+
+	SpscRing free_slots; // entropy coder => reader
+	SpscRing read_slots; // reader => transformer
+	SpscRing transformed_slots; // transformer => entropy coder
+
+	JpgData timing[2]; // stage times of the reader and transformer threads
+	int stop; // set when the entropy coder fails so the reader stops early
+} TiledPipeline;
+
+// encodes the image of a reader, which is closed
+int encode_strips(BmpStripReader reader, const char *output_filename, const JpgEncodeOptions *options);
+
+// works out the size of a strip and allocates the blocks, coefficients and pixels of each one
+int setup_strips(TiledEncoder *t);
+
+// allocates the blocks, coefficients and flags of a strip and its pixels, returns 0 if there isn't enough memory
+int allocate_strip(JpgData strip, Byte **rgb);
+
+// reads the strip starting at an MCU row into blocks, returns the MCU rows in it or 0 if it couldn't be read
+int read_strip(TiledEncoder *t, JpgData strip, Byte *rgb, int row);
+
+// DCT, quantization and zig-zag ordering of the MCU rows of a strip, the first of them is MCU row `row` of the image
+void transform_strip(TiledEncoder *t, JpgData strip, McuKernel kernel, int row, int num_rows);
+
+// entropy codes the MCU rows of a strip into the file
+int code_strip(TiledEncoder *t, JpgData strip, StreamWriter writer, int num_rows);
+
+// first pass for huffman tables built for the image: counts the symbols of every strip into symbol_freq
+int count_strip_symbols(TiledEncoder *t);
+
+// second pass: transforms each strip again and entropy codes it into the file
+int write_strips(TiledEncoder *t, FILE *fp, long long *bytes);
+
+// reads and transforms every strip with a kernel, coding them with the writer unless it is NULL
+int encode_pass(TiledEncoder *t, McuKernel kernel, StreamWriter writer);
+
+// encode_pass a strip at a time on the calling thread
+int run_strips(TiledEncoder *t, McuKernel kernel, StreamWriter writer);
+
+// encode_pass with the stages on three threads, returns 0 (and does nothing) if the threads couldn't be started
+int run_pipeline(TiledEncoder *t, McuKernel kernel, StreamWriter writer, int *error);
+
+// main loops of the reader and transformer threads of the pipeline
+void *pipeline_reader(void *arg);
+void *pipeline_transformer(void *arg);
+
+// allocates the slots and rings of the pipeline, returns 0 if there isn't enough memory
+int setup_pipeline(TiledEncoder *t, int num_slots);
+
+// frees the pipeline, the first slot is left to the encoder
+void destroy_pipeline(TiledPipeline *p);
+
+// returns a copy of the data of an image without any of its blocks, stats or counters
+JpgData copy_strip_data(JpgData j_data);
+
+// fills in a frame whose blocks are those of a strip
+void build_strip_frame(TiledEncoder *t, JpgFrame *frame);
+
+// fills in the stats of the options (if any)
+void report_tiled_stats(TiledEncoder *t, long long output_bytes);
+
+// adds the flat blocks and allocations of the other slots and the stage times of the pipeline's threads to the encoder's
+void add_pipeline_stats(TiledPipeline *p);
+
+/* ==================================== Function definitions ===================================== */
+
+int encode_bmp_to_jpeg_tiled(const char *input, const char *output, const JpgEncodeOptions *options)
+{
+	BmpStripReader reader = bmp_OpenStrips(input);
+
+	if (reader == NULL){
+		return JPG_ENC_READ_FAILED;
+	}
+
+	return encode_strips(reader, output, options);
+}
+
+int encode_raw_to_jpeg_tiled(const char *input, int width, int height, const char *output, const JpgEncodeOptions *options)
+{
+	BmpStripReader reader = bmp_OpenRawStrips(input, width, height);
+
+	if (reader == NULL){
+		return JPG_ENC_READ_FAILED;
+	}
+
+	return encode_strips(reader, output, options);
+}
+
+int encode_strips(BmpStripReader reader, const char *output, const JpgEncodeOptions *options)
+{
+	TiledEncoder t;
+	FILE *fp = NULL;
+	long long bytes = 0;
+	int error = JPG_ENC_SUCCESS;
+
+	memset(&t, 0, sizeof(TiledEncoder));
+	t.reader = reader;
+	t.j_data = create_jpeg_data();
+
+	if (t.j_data == NULL){
+		bmp_CloseStrips(reader);
+		return JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	t.j_data->options = *options;
+	t.j_data->quality = options->quality;
+	t.j_data->sample_ratio = options->sample_ratio;
+	t.j_data->output_filename = (char *) output;
+	t.j_data->width = bmp_GetStripWidth(reader);
+	t.j_data->height = bmp_GetStripHeight(reader);
+	t.j_data->num_components = bmp_IsStripGrayscale(reader) ? 1 : 3;
+	t.j_data->input_bytes = (size_t) bmp_GetStripFileSize(reader);
+
+	// every coefficient of the image would have to be kept for the scans of a progressive image
+	if (options->progressive){
+		log_message(t.j_data, JPG_LOG_WARNING, "The tiled encoder writes baseline images, progressive was ignored.");
+		t.j_data->options.progressive = 0;
+	}
+
+	if (t.j_data->width > JPG_TILED_MAX_SIZE || t.j_data->height > JPG_TILED_MAX_SIZE || select_mcu_kernel(t.j_data) == NULL){
+		error = JPG_ENC_BAD_OPTIONS;
+	}
+
+	else if (!setup_strips(&t)){
+		error = JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	if (error == JPG_ENC_SUCCESS && t.j_data->options.optimize_huffman){
+		error = count_strip_symbols(&t);
+	}
+
+	if (error == JPG_ENC_SUCCESS){
+		fp = fopen(output, "wb");
+		error = (fp != NULL) ? write_strips(&t, fp, &bytes) : JPG_ENC_WRITE_FAILED;
+
+		if (fp != NULL && fclose(fp) != 0){
+			error = JPG_ENC_WRITE_FAILED;
+		}
+
+		// nothing is left of an image that couldn't be finished
+		if (fp != NULL && error != JPG_ENC_SUCCESS){
+			remove(output);
+		}
+	}
+
+	if (error == JPG_ENC_SUCCESS){
+		report_tiled_stats(&t, bytes);
+	}
+
+	destroy_pipeline(t.pipeline);
+	free(t.rgb);
+	destroy_jpeg_data(t.j_data);
+	bmp_CloseStrips(reader);
+
+	return error;
+}
+
+int setup_strips(TiledEncoder *t)
+{
+	JpgData j_data = t->j_data;
+	int slots = j_data->options.pipeline;
+
+	// the chroma keeps its full size as with the other bitmap encoders (see chroma_subsample), so
+	// each MCU is one block of each component
+	j_data->width_in_blocks = (j_data->width + 7) / 8;
+	t->mcu_rows = (j_data->height + 7) / 8;
+
+	// the slots of a pipeline share the memory of one strip, and small images are still split into
+	// at least two strips a slot so the stages overlap
+	t->strip_rows = JPG_TILED_STRIP_PIXELS / (j_data->width_in_blocks * 64 * ((slots > 0) ? slots : 1));
+
+	if (slots > 0 && t->strip_rows > (t->mcu_rows + 2 * slots - 1) / (2 * slots)){
+		t->strip_rows = (t->mcu_rows + 2 * slots - 1) / (2 * slots);
+	}
+
+	t->strip_rows = (t->strip_rows < 1) ? 1 : (t->strip_rows > t->mcu_rows) ? t->mcu_rows : t->strip_rows;
+	j_data->height_in_blocks = t->strip_rows;
+
+	j_data->num_blocks_Y = j_data->width_in_blocks * j_data->height_in_blocks;
+	j_data->num_blocks_Cb = (j_data->num_components == 3) ? j_data->num_blocks_Y : 0;
+	j_data->num_blocks_Cr = j_data->num_blocks_Cb;
+
+	if (!allocate_strip(j_data, &t->rgb)){
+		return 0;
+	}
+
+	init_mcu_state(j_data, &t->state);
+
+	return (slots > 0) ? setup_pipeline(t, slots) : 1;
+}
+
+int allocate_strip(JpgData strip, Byte **rgb)
+{
+	int i = 0;
+
+	strip->Y  = malloc(sizeof(Block) * strip->num_blocks_Y);
+	strip->Cb = malloc(sizeof(Block) * strip->num_blocks_Cb);
+	strip->Cr = malloc(sizeof(Block) * strip->num_blocks_Cr);
+
+	strip->flat_Y  = calloc(strip->num_blocks_Y, sizeof(Byte));
+	strip->flat_Cb = calloc(strip->num_blocks_Cb, sizeof(Byte));
+	strip->flat_Cr = calloc(strip->num_blocks_Cr, sizeof(Byte));
+
+	*rgb = malloc((size_t) strip->width * strip->height_in_blocks * 8 * 3);
+
+	if (strip->Y == NULL || strip->Cb == NULL || strip->Cr == NULL || strip->flat_Y == NULL
+		|| strip->flat_Cb == NULL || strip->flat_Cr == NULL || *rgb == NULL){
+		// none of the blocks were allocated for destroy_jpeg_data to free
+		strip->num_blocks_Y = strip->num_blocks_Cb = strip->num_blocks_Cr = 0;
+		return 0;
+	}
+
+	for (i = 0; i < strip->num_blocks_Y; i++){
+		strip->Y[i] = new_block();
+	}
+
+	for (i = 0; i < strip->num_blocks_Cb; i++){
+		strip->Cb[i] = new_block();
+		strip->Cr[i] = new_block();
+	}
+
+	// the lists above, a block each and the pixels
+	strip->allocations += 7 + strip->num_blocks_Y + strip->num_blocks_Cb + strip->num_blocks_Cr;
+
+	allocate_zig_zag(strip);
+
+	return 1;
+}
+
+int read_strip(TiledEncoder *t, JpgData strip, Byte *rgb, int row)
+{
+	JpgData j_data = t->j_data;
+	int first = row * 8;
+	int num_rows = (t->strip_rows * 8 < j_data->height - first) ? t->strip_rows * 8 : j_data->height - first;
+	int mcu_rows = (num_rows + 7) / 8;
+
+	if (bmp_ReadStrip(t->reader, first, num_rows, rgb) != BMP_SUCCESS){
+		return 0;
+	}
+
+	convert_rgb_rows(strip, rgb, first, num_rows, mcu_rows * j_data->width_in_blocks);
+
+	return mcu_rows;
+}
+
+void transform_strip(TiledEncoder *t, JpgData strip, McuKernel kernel, int row, int num_rows)
+{
+	int **zz[3] = {strip->zig_zag_Y, strip->zig_zag_Cb, strip->zig_zag_Cr};
+	int restart = strip->options.restart_interval;
+	int mx = 0, my = 0, n = 0, c = 0, i = 0, k = 0;
+
+	for (my = 0; my < num_rows; my++){
+		for (mx = 0; mx < strip->width_in_blocks; mx++){
+			n = (row + my) * strip->width_in_blocks + mx;
+
+			// the DC values are predicted from 0 at the start of the image and after each restart marker
+			if (n == 0 || (restart && n % restart == 0)){
+				t->state.dc_pred[0] = t->state.dc_pred[1] = t->state.dc_pred[2] = 0;
+			}
+
+			kernel(strip, &t->state, mx, my);
+		}
+	}
+
+	// the blocks of the strip that belong to the image
+	for (c = 0; strip->options.stats != NULL && c < strip->num_components; c++){
+		for (i = 0; i < num_rows * strip->width_in_blocks; i++){
+			for (k = 0; k < 64; k++){
+				t->zeroes += (zz[c][i][k] == 0);
+			}
+		}
+	}
+}
+
+int code_strip(TiledEncoder *t, JpgData strip, StreamWriter writer, int num_rows)
+{
+	int **blocks[3] = {strip->zig_zag_Y, strip->zig_zag_Cb, strip->zig_zag_Cr};
+	int error = JPG_WRITE_SUCCESS;
+
+	begin_stage(t->j_data, JPG_STAGE_HUFFMAN);
+	stream_writer_set_blocks(writer, blocks);
+	error = stream_writer_encode(writer, num_rows);
+	end_stage(t->j_data, JPG_STAGE_HUFFMAN);
+
+	return (error == JPG_WRITE_SUCCESS) ? JPG_ENC_SUCCESS : JPG_ENC_WRITE_FAILED;
+}
+
+int count_strip_symbols(TiledEncoder *t)
+{
+	JpgData j_data = t->j_data;
+	int error = JPG_ENC_SUCCESS, i = 0;
+
+	for (i = 0; i < 4; i++){
+		initialize_huffman_data(&j_data->symbol_freq[i]);
+	}
+
+	t->state.freq = j_data->symbol_freq;
+	error = encode_pass(t, select_mcu_kernel_for(j_data, 1), NULL);
+
+	// the second pass counts the flat blocks and zeroes again
+	j_data->symbols_counted = 1;
+	j_data->num_flat_blocks = 0;
+	t->zeroes = 0;
+	t->state.freq = NULL;
+
+	for (i = 1; t->pipeline != NULL && i < t->pipeline->num_slots; i++){
+		t->pipeline->slots[i].strip->num_flat_blocks = 0;
+	}
+
+	return error;
+}
+
+int write_strips(TiledEncoder *t, FILE *fp, long long *bytes)
+{
+	JpgData j_data = t->j_data;
+	StreamWriter writer = NULL;
+	JpgFrame frame;
+	int error = JPG_ENC_SUCCESS;
+
+	build_strip_frame(t, &frame);
+
+	begin_stage(j_data, JPG_STAGE_HUFFMAN);
+	writer = create_stream_writer(&frame, fp);
+	end_stage(j_data, JPG_STAGE_HUFFMAN);
+
+	if (writer == NULL){
+		return JPG_ENC_WRITE_FAILED;
+	}
+
+	error = encode_pass(t, select_mcu_kernel_for(j_data, 0), writer);
+
+	begin_stage(j_data, JPG_STAGE_WRITE);
+	if (error == JPG_ENC_SUCCESS && stream_writer_end(writer) != JPG_WRITE_SUCCESS){
+		error = JPG_ENC_WRITE_FAILED;
+	}
+	end_stage(j_data, JPG_STAGE_WRITE);
+
+	*bytes = stream_writer_bytes(writer);
+	j_data->allocations += 2; // the writer and its buffer
+	destroy_stream_writer(writer);
+
+	return error;
+}
+
+int encode_pass(TiledEncoder *t, McuKernel kernel, StreamWriter writer)
+{
+	int error = JPG_ENC_SUCCESS;
+
+	// without threads the strips are encoded one after the other
+	if (t->pipeline == NULL || !run_pipeline(t, kernel, writer, &error)){
+		error = run_strips(t, kernel, writer);
+	}
+
+	return error;
+}
+
+int run_strips(TiledEncoder *t, McuKernel kernel, StreamWriter writer)
+{
+	JpgData j_data = t->j_data;
+	int row = 0, num_rows = 0, error = JPG_ENC_SUCCESS;
+
+	for (row = 0; row < t->mcu_rows && error == JPG_ENC_SUCCESS; row += num_rows){
+		begin_stage(j_data, JPG_STAGE_PREPROCESS);
+		num_rows = read_strip(t, j_data, t->rgb, row);
+		end_stage(j_data, JPG_STAGE_PREPROCESS);
+
+		if (num_rows == 0){
+			return JPG_ENC_READ_FAILED;
+		}
+
+		begin_stage(j_data, JPG_STAGE_DCT);
+		transform_strip(t, j_data, kernel, row, num_rows);
+		end_stage(j_data, JPG_STAGE_DCT);
+
+		// entropy coded and written before the next strip replaces the blocks
+		if (writer != NULL){
+			error = code_strip(t, j_data, writer, num_rows);
+		}
+	}
+
+	return error;
+}
+
+int run_pipeline(TiledEncoder *t, McuKernel kernel, StreamWriter writer, int *error)
+{
+	TiledPipeline *p = t->pipeline;
+	TiledSlot *slot = NULL;
+	pthread_t reader, transformer;
+	int i = 0, k = 0;
+
+	p->kernel = kernel;
+	p->stop = 0;
+
+	if (pthread_create(&transformer, NULL, pipeline_transformer, p) != 0){
+		return 0;
+	}
+
+	if (pthread_create(&reader, NULL, pipeline_reader, p) != 0){
+		spsc_ring_push(p->read_slots, -1);
+		spsc_ring_pop(p->transformed_slots); // the -1 passed on by the transformer
+		pthread_join(transformer, NULL);
+		return 0;
+	}
+
+	*error = JPG_ENC_SUCCESS;
+
+	// every slot is handed back to the reader, coded or not, so it never waits on a failed coder
+	while ((i = spsc_ring_pop(p->transformed_slots)) >= 0){
+		slot = &p->slots[i];
+
+		if (*error == JPG_ENC_SUCCESS && slot->num_rows == 0){
+			*error = JPG_ENC_READ_FAILED;
+		}
+
+		else if (*error == JPG_ENC_SUCCESS && writer != NULL){
+			*error = code_strip(t, slot->strip, writer, slot->num_rows);
+		}
+
+		if (*error != JPG_ENC_SUCCESS){
+			__atomic_store_n(&p->stop, 1, __ATOMIC_SEQ_CST);
+		}
+
+		spsc_ring_push(p->free_slots, i);
+	}
+
+	pthread_join(reader, NULL);
+	pthread_join(transformer, NULL);
+
+	// the counters were opened by threads that have finished, the next pass opens its own
+	for (k = 0; k < 2; k++){
+		close_perf_counters(p->timing[k]->perf);
+		p->timing[k]->perf = NULL;
+		p->timing[k]->perf_opened = 0;
+	}
+
+	return 1;
+}
+
+void *pipeline_reader(void *arg)
+{
+	TiledPipeline *p = arg;
+	TiledEncoder *t = p->t;
+	TiledSlot *slot = NULL;
+	int row = 0, num_rows = 1, i = 0;
+
+	trace_thread_name("tiled_reader");
+
+	for (row = 0; row < t->mcu_rows && num_rows > 0 && !__atomic_load_n(&p->stop, __ATOMIC_SEQ_CST); row += num_rows){
+		// waits here while every slot is further down the pipeline
+		i = spsc_ring_pop(p->free_slots);
+		slot = &p->slots[i];
+
+		begin_stage(p->timing[0], JPG_STAGE_PREPROCESS);
+		num_rows = read_strip(t, slot->strip, slot->rgb, row);
+		end_stage(p->timing[0], JPG_STAGE_PREPROCESS);
+
+		slot->row = row;
+		slot->num_rows = num_rows;
+		spsc_ring_push(p->read_slots, i);
+	}
+
+	spsc_ring_push(p->read_slots, -1);
+
+	return NULL;
+}
+
+void *pipeline_transformer(void *arg)
+{
+	TiledPipeline *p = arg;
+	TiledSlot *slot = NULL;
+	int i = 0;
+
+	trace_thread_name("tiled_transformer");
+
+	while ((i = spsc_ring_pop(p->read_slots)) >= 0){
+		slot = &p->slots[i];
+
+		if (slot->num_rows > 0){
+			begin_stage(p->timing[1], JPG_STAGE_DCT);
+			transform_strip(p->t, slot->strip, p->kernel, slot->row, slot->num_rows);
+			end_stage(p->timing[1], JPG_STAGE_DCT);
+		}
+
+		spsc_ring_push(p->transformed_slots, i);
+	}
+
+	spsc_ring_push(p->transformed_slots, -1);
+
+	return NULL;
+}
+
+int setup_pipeline(TiledEncoder *t, int num_slots)
+{
+	TiledPipeline *p = calloc(1, sizeof(TiledPipeline));
+	int i = 0, k = 0, ok = 0;
+
+	if (p == NULL){
+		return 0;
+	}
+
+	t->pipeline = p;
+	p->t = t;
+	p->slots = calloc(num_slots, sizeof(TiledSlot));
+	p->num_slots = num_slots;
+
+	// the rings between the stages also hold the -1 after the last strip
+	p->free_slots = create_spsc_ring(num_slots, "free_slots");
+	p->read_slots = create_spsc_ring(num_slots + 1, "read_slots");
+	p->transformed_slots = create_spsc_ring(num_slots + 1, "transformed_slots");
+	for (k = 0; k < 2; k++){
+		p->timing[k] = copy_strip_data(t->j_data);
+
+		// only their stages are used
+		if (p->timing[k] != NULL){
+			p->timing[k]->num_blocks_Y = p->timing[k]->num_blocks_Cb = p->timing[k]->num_blocks_Cr = 0;
+		}
+	}
+
+	ok = p->slots != NULL && p->free_slots != NULL && p->read_slots != NULL && p->transformed_slots != NULL
+		&& p->timing[0] != NULL && p->timing[1] != NULL;
+
+	if (ok){
+		p->slots[0].strip = t->j_data;
+		p->slots[0].rgb = t->rgb;
+		spsc_ring_push(p->free_slots, 0);
+	}
+
+	for (i = 1; ok && i < num_slots; i++){
+		p->slots[i].strip = copy_strip_data(t->j_data);
+		ok = p->slots[i].strip != NULL && allocate_strip(p->slots[i].strip, &p->slots[i].rgb);
+		spsc_ring_push(p->free_slots, i);
+	}
+
+	return ok;
+}
+
+void destroy_pipeline(TiledPipeline *p)
+{
+	int i = 0, k = 0;
+
+	if (p == NULL){
+		return;
+	}
+
+	for (i = 1; p->slots != NULL && i < p->num_slots; i++){
+		if (p->slots[i].strip != NULL){
+			destroy_jpeg_data(p->slots[i].strip);
+		}
+
+		free(p->slots[i].rgb);
+	}
+
+	for (k = 0; k < 2; k++){
+		if (p->timing[k] != NULL){
+			destroy_jpeg_data(p->timing[k]);
+		}
+	}
+
+	destroy_spsc_ring(p->free_slots);
+	destroy_spsc_ring(p->read_slots);
+	destroy_spsc_ring(p->transformed_slots);
+	free(p->slots);
+	free(p);
+}
+
+JpgData copy_strip_data(JpgData j_data)
+{
+	JpgData copy = create_jpeg_data();
+
+	if (copy != NULL){
+		*copy = *j_data;
+
+		// what destroy_jpeg_data frees isn't shared
+		copy->Y = copy->Cb = copy->Cr = NULL;
+		copy->flat_Y = copy->flat_Cb = copy->flat_Cr = NULL;
+		copy->zig_zag_Y = copy->zig_zag_Cb = copy->zig_zag_Cr = NULL;
+		copy->perf = NULL;
+		copy->perf_opened = 0;
+
+		copy->num_flat_blocks = 0;
+		copy->allocations = 0;
+		memset(copy->stages, 0, sizeof(copy->stages));
+	}
+
+	return copy;
+}
+
+void build_strip_frame(TiledEncoder *t, JpgFrame *frame)
+{
+	JpgData j_data = t->j_data;
+	JpgComponent *c = NULL;
+	int **blocks[3] = {j_data->zig_zag_Y, j_data->zig_zag_Cb, j_data->zig_zag_Cr};
+	int i = 0;
+
+	memset(frame, 0, sizeof(JpgFrame));
+	frame->width = j_data->width;
+	frame->height = j_data->height;
+	frame->num_components = j_data->num_components;
+	frame->restart_interval = j_data->options.restart_interval;
+	frame->optimize_huffman = j_data->options.optimize_huffman;
+	frame->symbol_freq = j_data->symbols_counted ? j_data->symbol_freq : NULL;
+
+	memcpy(frame->quant[0], j_data->quant_lum, sizeof(frame->quant[0]));
+	memcpy(frame->quant[1], j_data->quant_chr, sizeof(frame->quant[1]));
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		c->id = i + 1;
+		c->h_samp = 1;
+		c->v_samp = 1;
+		c->quant_table = (i == 0) ? 0 : 1;
+		c->huff_table = (i == 0) ? JPG_HUFF_LUMINANCE : JPG_HUFF_CHROMINANCE;
+		c->width_in_blocks = j_data->width_in_blocks;
+		c->height_in_blocks = j_data->height_in_blocks;
+		c->blocks = blocks[i];
+		c->coefficients = NULL;
+	}
+}
+
+void report_tiled_stats(TiledEncoder *t, long long output_bytes)
+{
+	JpgData j_data = t->j_data;
+	JpgEncodeStats *stats = j_data->options.stats;
+	int i = 0, k = 0;
+
+	if (stats == NULL){
+		return;
+	}
+
+	if (t->pipeline != NULL){
+		add_pipeline_stats(t->pipeline);
+	}
+
+	memset(stats, 0, sizeof(JpgEncodeStats));
+	stats->blocks = t->mcu_rows * j_data->width_in_blocks * j_data->num_components;
+	stats->flat_blocks = j_data->num_flat_blocks;
+	stats->input_bytes = j_data->input_bytes;
+	stats->output_bytes = (size_t) output_bytes;
+	stats->allocations = j_data->allocations;
+	stats->zero_ratio = (stats->blocks > 0) ? (double) t->zeroes / (64.0 * stats->blocks) : 0.0;
+	memcpy(stats->stages, j_data->stages, sizeof(stats->stages));
+
+	for (i = 0; i < JPG_NUM_STAGES; i++){
+		for (k = 0; k < JPG_NUM_COUNTERS; k++){
+			if (!perf_counter_available(j_data->perf, k)){
+				stats->stages[i].counters[k] = -1;
+			}
+		}
+	}
+}
+
+void add_pipeline_stats(TiledPipeline *p)
+{
+	JpgData j_data = p->t->j_data;
+	int i = 0, k = 0, c = 0;
+
+	for (i = 1; i < p->num_slots; i++){
+		j_data->num_flat_blocks += p->slots[i].strip->num_flat_blocks;
+		j_data->allocations += p->slots[i].strip->allocations;
+	}
+
+	// the stages overlap, so their times add up to more than the encode took
+	for (k = 0; k < 2; k++){
+		for (i = 0; i < JPG_NUM_STAGES; i++){
+			j_data->stages[i].wall_ms += p->timing[k]->stages[i].wall_ms;
+			j_data->stages[i].cpu_ms += p->timing[k]->stages[i].cpu_ms;
+
+			for (c = 0; c < JPG_NUM_COUNTERS; c++){
+				j_data->stages[i].counters[c] += p->timing[k]->stages[i].counters[c];
+			}
+		}
+	}
+
+	// the slots and rings
+	j_data->allocations += 5;
+}
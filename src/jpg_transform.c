@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/jpg_transform.h"
+#include "headers/jpg_decode.h"
+#include "headers/quantise.h"
+#include "headers/tables.h"
+
+/*
+	Changes to the coefficients inside each block. The transformations only move blocks
+	around and record these, then every block is rewritten in a single pass.
+	Transposing happens first, then the signs are changed.
+*/
+typedef struct _block_changes{
+	int transposed;
+	int negate_u; // odd horizontal frequencies change sign
+	int negate_v; // odd vertical frequencies change sign
+} BlockChanges;
+
+/* ===================================== Small helper functions ================================== */
+
+// size of an MCU in pixels
+void mcu_size(const JpgFrame *frame, int *mcu_width, int *mcu_height);
+
+// sampling factors of a component within the scan (1 x 1 when the scan isn't interleaved)
+void scan_sampling(const JpgFrame *frame, const JpgComponent *c, int *h_samp, int *v_samp);
+
+// the basic transformations, every other one is built from them
+int flip_horizontal(JpgFrame *frame, BlockChanges *changes);
+int flip_vertical(JpgFrame *frame, BlockChanges *changes);
+int transpose(JpgFrame *frame, BlockChanges *changes);
+
+// rewrites the coefficients of every block
+void apply_block_changes(JpgFrame *frame, const BlockChanges *changes);
+
+// keeps the MCUs covering a rectangle
+int crop(JpgFrame *frame, int x, int y, int w, int h);
+
+// requantizes every block with tables built for a quality setting
+int requantize(JpgFrame *frame, int quality);
+
+/* ==================================== Function definitions ===================================== */
+
+int transform_jpeg(const char *input_filename, const char *output_filename, const JpgTransformOptions *options)
+{
+	JpgFrame frame;
+	JpgBuffer buffer = {NULL, 0, 0};
+	int error = JPG_TRANS_SUCCESS;
+
+	if (read_jpeg_coefficients(input_filename, &frame) != JPG_DEC_SUCCESS){
+		return JPG_TRANS_READ_FAILED;
+	}
+
+	error = transform_jpeg_frame(&frame, options);
+
+	if (error == JPG_TRANS_SUCCESS){
+		frame.optimize_huffman = options->optimize_huffman;
+
+		if (write_jpeg(&frame, &buffer) != JPG_WRITE_SUCCESS || write_jpeg_file(output_filename, &buffer) != JPG_WRITE_SUCCESS){
+			error = JPG_TRANS_WRITE_FAILED;
+		}
+	}
+
+	free_jpeg_buffer(&buffer);
+	free_jpeg_frame(&frame);
+
+	return error;
+}
+
+int transform_jpeg_frame(JpgFrame *frame, const JpgTransformOptions *options)
+{
+	BlockChanges changes = {0, 0, 0};
+	int error = JPG_TRANS_SUCCESS;
+
+	switch (options->transform){
+		case JPG_TRANSFORM_NONE:
+			break;
+
+		case JPG_TRANSFORM_FLIP_H:
+			error = flip_horizontal(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_FLIP_V:
+			error = flip_vertical(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_TRANSPOSE:
+			error = transpose(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_TRANSVERSE:
+			error = transpose(frame, &changes);
+			if (error == JPG_TRANS_SUCCESS) error = flip_horizontal(frame, &changes);
+			if (error == JPG_TRANS_SUCCESS) error = flip_vertical(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_ROTATE_90:
+			error = transpose(frame, &changes);
+			if (error == JPG_TRANS_SUCCESS) error = flip_horizontal(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_ROTATE_180:
+			error = flip_horizontal(frame, &changes);
+			if (error == JPG_TRANS_SUCCESS) error = flip_vertical(frame, &changes);
+			break;
+
+		case JPG_TRANSFORM_ROTATE_270:
+			error = transpose(frame, &changes);
+			if (error == JPG_TRANS_SUCCESS) error = flip_vertical(frame, &changes);
+			break;
+
+		default:
+			error = JPG_TRANS_BAD_OPTIONS;
+			break;
+	}
+
+	if (error == JPG_TRANS_SUCCESS && options->crop_w > 0 && options->crop_h > 0){
+		error = crop(frame, options->crop_x, options->crop_y, options->crop_w, options->crop_h);
+	}
+
+	// only the blocks that survive the crop are rewritten
+	if (error == JPG_TRANS_SUCCESS){
+		apply_block_changes(frame, &changes);
+	}
+
+	if (error == JPG_TRANS_SUCCESS && options->quality > 0){
+		error = requantize(frame, options->quality);
+	}
+
+	return error;
+}
+
+int exif_orientation_transform(int orientation)
+{
+	// the inverse of the transformation each orientation describes
+	const int transforms[9] = {
+		JPG_TRANSFORM_NONE, JPG_TRANSFORM_NONE, JPG_TRANSFORM_FLIP_H, JPG_TRANSFORM_ROTATE_180, JPG_TRANSFORM_FLIP_V,
+		JPG_TRANSFORM_TRANSPOSE, JPG_TRANSFORM_ROTATE_90, JPG_TRANSFORM_TRANSVERSE, JPG_TRANSFORM_ROTATE_270
+	};
+
+	return (orientation >= 1 && orientation <= 8) ? transforms[orientation] : JPG_TRANSFORM_NONE;
+}
+
+void mcu_size(const JpgFrame *frame, int *mcu_width, int *mcu_height)
+{
+	int i = 0, max_h = 1, max_v = 1;
+
+	for (i = 0; i < frame->num_components && frame->num_components > 1; i++){
+		if (frame->components[i].h_samp > max_h) max_h = frame->components[i].h_samp;
+		if (frame->components[i].v_samp > max_v) max_v = frame->components[i].v_samp;
+	}
+
+	*mcu_width = 8 * max_h;
+	*mcu_height = 8 * max_v;
+}
+
+void scan_sampling(const JpgFrame *frame, const JpgComponent *c, int *h_samp, int *v_samp)
+{
+	*h_samp = (frame->num_components == 1) ? 1 : c->h_samp;
+	*v_samp = (frame->num_components == 1) ? 1 : c->v_samp;
+}
+
+int flip_horizontal(JpgFrame *frame, BlockChanges *changes)
+{
+	JpgComponent *c = NULL;
+	int **blocks = NULL;
+	int mcu_width = 0, mcu_height = 0, width = 0, w = 0;
+	int h_samp = 0, v_samp = 0;
+	int i = 0, bx = 0, by = 0;
+
+	mcu_size(frame, &mcu_width, &mcu_height);
+
+	// the partial MCU on the right edge can't move to the left edge
+	width = frame->width / mcu_width * mcu_width;
+	if (width == 0){
+		return JPG_TRANS_BAD_OPTIONS;
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		scan_sampling(frame, c, &h_samp, &v_samp);
+
+		w = width / mcu_width * h_samp;
+		blocks = malloc(sizeof(int *) * w * c->height_in_blocks);
+
+		if (blocks == NULL){
+			return JPG_TRANS_FAILED_ALLOCATE_BUFFER;
+		}
+
+		for (by = 0; by < c->height_in_blocks; by++){
+			for (bx = 0; bx < w; bx++){
+				blocks[by * w + bx] = c->blocks[by * c->width_in_blocks + (w - 1 - bx)];
+			}
+		}
+
+		free(c->blocks);
+		c->blocks = blocks;
+		c->width_in_blocks = w;
+	}
+
+	frame->width = width;
+
+	// odd horizontal frequencies change sign when a block is mirrored
+	changes->negate_u ^= 1;
+
+	return JPG_TRANS_SUCCESS;
+}
+
+int flip_vertical(JpgFrame *frame, BlockChanges *changes)
+{
+	JpgComponent *c = NULL;
+	int **blocks = NULL;
+	int mcu_width = 0, mcu_height = 0, height = 0, h = 0;
+	int h_samp = 0, v_samp = 0;
+	int i = 0, bx = 0, by = 0;
+
+	mcu_size(frame, &mcu_width, &mcu_height);
+
+	height = frame->height / mcu_height * mcu_height;
+	if (height == 0){
+		return JPG_TRANS_BAD_OPTIONS;
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		scan_sampling(frame, c, &h_samp, &v_samp);
+
+		h = height / mcu_height * v_samp;
+		blocks = malloc(sizeof(int *) * c->width_in_blocks * h);
+
+		if (blocks == NULL){
+			return JPG_TRANS_FAILED_ALLOCATE_BUFFER;
+		}
+
+		for (by = 0; by < h; by++){
+			for (bx = 0; bx < c->width_in_blocks; bx++){
+				blocks[by * c->width_in_blocks + bx] = c->blocks[(h - 1 - by) * c->width_in_blocks + bx];
+			}
+		}
+
+		free(c->blocks);
+		c->blocks = blocks;
+		c->height_in_blocks = h;
+	}
+
+	frame->height = height;
+	changes->negate_v ^= 1;
+
+	return JPG_TRANS_SUCCESS;
+}
+
+int transpose(JpgFrame *frame, BlockChanges *changes)
+{
+	JpgComponent *c = NULL;
+	int **blocks = NULL;
+	int i = 0, k = 0, bx = 0, by = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		blocks = malloc(sizeof(int *) * c->width_in_blocks * c->height_in_blocks);
+
+		if (blocks == NULL){
+			return JPG_TRANS_FAILED_ALLOCATE_BUFFER;
+		}
+
+		for (by = 0; by < c->width_in_blocks; by++){
+			for (bx = 0; bx < c->height_in_blocks; bx++){
+				blocks[by * c->height_in_blocks + bx] = c->blocks[bx * c->width_in_blocks + by];
+			}
+		}
+
+		free(c->blocks);
+		c->blocks = blocks;
+
+		k = c->width_in_blocks;
+		c->width_in_blocks = c->height_in_blocks;
+		c->height_in_blocks = k;
+
+		k = c->h_samp;
+		c->h_samp = c->v_samp;
+		c->v_samp = k;
+	}
+
+	k = frame->width;
+	frame->width = frame->height;
+	frame->height = k;
+
+	// sign changes made so far now belong to the other axis
+	k = changes->negate_u;
+	changes->negate_u = changes->negate_v;
+	changes->negate_v = k;
+	changes->transposed ^= 1;
+
+	return JPG_TRANS_SUCCESS;
+}
+
+void apply_block_changes(JpgFrame *frame, const BlockChanges *changes)
+{
+	JpgComponent *c = NULL;
+	int target[64], sign[64], zig_zag_index[64], temp[64];
+	int i = 0, k = 0, n = 0, u = 0, v = 0, b = 0;
+	int *block = NULL;
+
+	if (!changes->transposed && !changes->negate_u && !changes->negate_v){
+		return;
+	}
+
+	for (k = 0; k < 64; k++){
+		zig_zag_index[ natural_order[k] ] = k;
+	}
+
+	// where each coefficient moves to and whether it changes sign
+	for (k = 0; k < 64; k++){
+		u = natural_order[k] % 8;
+		v = natural_order[k] / 8;
+
+		if (changes->transposed){
+			n = u;
+			u = v;
+			v = n;
+		}
+
+		target[k] = zig_zag_index[v * 8 + u];
+		sign[k] = ((changes->negate_u && (u & 1)) != (changes->negate_v && (v & 1))) ? -1 : 1;
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+
+		for (b = 0; b < c->width_in_blocks * c->height_in_blocks; b++){
+			block = c->blocks[b];
+			memcpy(temp, block, sizeof(temp));
+
+			for (k = 0; k < 64; k++){
+				block[ target[k] ] = sign[k] * temp[k];
+			}
+		}
+	}
+
+	// the quantization tables are transposed with the blocks
+	if (changes->transposed){
+		for (i = 0; i < 4; i++){
+			memcpy(temp, frame->quant[i], sizeof(temp));
+			for (n = 0; n < 64; n++){
+				frame->quant[i][(n % 8) * 8 + n / 8] = temp[n];
+			}
+		}
+	}
+}
+
+int crop(JpgFrame *frame, int x, int y, int w, int h)
+{
+	JpgComponent *c = NULL;
+	int **blocks = NULL;
+	int mcu_width = 0, mcu_height = 0;
+	int right = 0, bottom = 0, new_w = 0, new_h = 0;
+	int h_samp = 0, v_samp = 0, first_col = 0, first_row = 0;
+	int i = 0, bx = 0, by = 0;
+
+	if (x < 0 || y < 0 || x >= frame->width || y >= frame->height){
+		return JPG_TRANS_BAD_OPTIONS;
+	}
+
+	mcu_size(frame, &mcu_width, &mcu_height);
+
+	right = (w > frame->width - x) ? frame->width : x + w;
+	bottom = (h > frame->height - y) ? frame->height : y + h;
+	x = x / mcu_width * mcu_width;
+	y = y / mcu_height * mcu_height;
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		scan_sampling(frame, c, &h_samp, &v_samp);
+
+		first_col = x / mcu_width * h_samp;
+		first_row = y / mcu_height * v_samp;
+		new_w = (right - x + mcu_width - 1) / mcu_width * h_samp;
+		new_h = (bottom - y + mcu_height - 1) / mcu_height * v_samp;
+
+		blocks = malloc(sizeof(int *) * new_w * new_h);
+
+		if (blocks == NULL){
+			return JPG_TRANS_FAILED_ALLOCATE_BUFFER;
+		}
+
+		for (by = 0; by < new_h; by++){
+			for (bx = 0; bx < new_w; bx++){
+				blocks[by * new_w + bx] = c->blocks[(first_row + by) * c->width_in_blocks + first_col + bx];
+			}
+		}
+
+		free(c->blocks);
+		c->blocks = blocks;
+		c->width_in_blocks = new_w;
+		c->height_in_blocks = new_h;
+	}
+
+	frame->width = right - x;
+	frame->height = bottom - y;
+
+	return JPG_TRANS_SUCCESS;
+}
+
+int requantize(JpgFrame *frame, int quality)
+{
+	JpgComponent *c = NULL;
+	int tables[4][64];
+	int i = 0, k = 0, n = 0, b = 0, t = 0;
+	int q = 0, value = 0;
+
+	// new tables are built from the standard tables, but never finer than the existing ones
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		build_quant_table((c->huff_table == JPG_HUFF_LUMINANCE) ? quanMatrixLum : quanMatrixChr, quality, tables[c->quant_table]);
+
+		for (n = 0; n < 64; n++){
+			if (tables[c->quant_table][n] < frame->quant[c->quant_table][n]){
+				tables[c->quant_table][n] = frame->quant[c->quant_table][n];
+			}
+		}
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		t = c->quant_table;
+
+		for (b = 0; b < c->width_in_blocks * c->height_in_blocks; b++){
+			for (k = 0; k < 64; k++){
+				n = natural_order[k];
+				q = tables[t][n];
+				value = c->blocks[b][k] * frame->quant[t][n];
+
+				// rounded to the nearest multiple of the new step
+				c->blocks[b][k] = (value >= 0) ? (value + q / 2) / q : -((-value + q / 2) / q);
+			}
+		}
+	}
+
+	// done after every component, several can share a table
+	for (i = 0; i < frame->num_components; i++){
+		t = frame->components[i].quant_table;
+		memcpy(frame->quant[t], tables[t], sizeof(tables[t]));
+	}
+
+	return JPG_TRANS_SUCCESS;
+}
@@ -0,0 +1,1603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "headers/jpg_write.h"
+#include "headers/huffman.h"
+#include "headers/huffman_decode.h"
+#include "headers/tables.h"
+#include "headers/cpu_kernels.h"
+
+// markers
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOF0 0xC0
+#define MARKER_SOF1 0xC1
+#define MARKER_SOF2 0xC2
+#define MARKER_DHT 0xC4
+#define MARKER_SOS 0xDA
+#define MARKER_DQT 0xDB
+#define MARKER_DRI 0xDD
+#define MARKER_RST0 0xD0
+#define MARKER_APP0 0xE0
+
+// the most blocks an MCU may hold (B.2.3 of the spec)
+#define MAX_BLOCKS_IN_MCU 10
+
+// longest run of end of blocks a progressive AC scan can code
+#define MAX_EOB_RUN 0x7FFF
+
+// refinement bits held back while a run of end of blocks grows
+#define MAX_CORRECTION_BITS 1000
+
+// huffman codes of each symbol, derived from bits and huffval
+typedef struct _huffman_codes{
+	Byte bits[17];
+	Byte huffval[256];
+	unsigned int code[256];
+	int size[256]; // 0 if the symbol has no code
+} HuffmanCodes;
+
+typedef struct _bit_writer{
+	JpgBuffer *out;
+	uint32_t buffer; // bits not yet written
+	int num_bits;
+	int error;
+} BitWriter;
+
+// kinds of token, kept in the top bits of ScanToken.info
+#define TOKEN_DC 0x00
+#define TOKEN_AC 0x40
+#define TOKEN_RAW 0x80 // bits without a symbol
+#define TOKEN_RESTART 0xC0 // restart marker, the symbol is its number
+#define TOKEN_KIND 0xC0
+#define TOKEN_TABLE 0x20 // symbol of the chrominance tables
+#define TOKEN_SIZE 0x1F // number of bits after the symbol
+
+/*
+	A symbol and the bits after it, recorded while the symbols of a progressive scan are counted.
+	Once the tables of the scan are built the tokens are written without walking the blocks again.
+*/
+typedef struct _scan_token{
+	unsigned short bits;
+	Byte symbol;
+	Byte info;
+} ScanToken;
+
+// state of a progressive scan while its blocks are tokenized
+typedef struct _scan_state{
+	const JpgFrame *frame;
+	const JpgScan *scan;
+
+	ScanToken *tokens;
+	size_t num_tokens;
+	size_t max_tokens;
+	int error;
+
+	HuffmanData *dc_freq;
+	HuffmanData *ac_freq;
+
+	int dc_pred[JPG_FRAME_COMPONENTS];
+
+	// AC scans: blocks in the current run of end of blocks and the refinement bits of those blocks
+	int ac_table;
+	int eob_run;
+	Byte correction[MAX_CORRECTION_BITS];
+	int num_correction;
+} ScanState;
+
+/* ===================================== Small helper functions ================================== */
+
+// makes room for n more bytes in the buffer
+int reserve_bytes(JpgBuffer *out, size_t n);
+
+// appends a marker and its segment (length is added)
+int append_segment(JpgBuffer *out, int marker, const Byte *segment, int length);
+
+// checks the frame describes an image that can be encoded
+int check_frame(const JpgFrame *frame);
+
+// builds the huffman tables for each table set used by the frame
+void build_huffman_tables(const JpgFrame *frame, HuffmanCodes *dc, HuffmanCodes *ac);
+
+// copies bits and huffval from one of the tables in Annex K
+void load_standard_table(HuffmanCodes *codes, const Byte *bits, const Byte *huffval, int num_values);
+
+// copies bits and huffval from a table built from symbol frequencies
+void load_optimal_table(HuffmanCodes *codes, HuffmanData *huffman_data);
+
+// generates the code of each symbol (C.1 and C.2 of the spec)
+void generate_codes(HuffmanCodes *codes);
+
+// writes the headers of a baseline image: SOI, APP0, DQT, SOF, DRI, DHT and SOS
+int write_headers(const JpgFrame *frame, const HuffmanCodes *dc, const HuffmanCodes *ac, JpgBuffer *out);
+
+// writes SOI, APP0, DQT, SOF and DRI
+int write_frame_headers(const JpgFrame *frame, JpgBuffer *out);
+
+// writes a DHT segment (table_class is 0 for DC, 1 for AC)
+int write_huffman_table(JpgBuffer *out, int table_class, int id, const HuffmanCodes *codes);
+
+// writes the SOS segment of a scan
+int write_scan_header(const JpgFrame *frame, const JpgScan *scan, JpgBuffer *out);
+
+/*
+	Walks the MCUs first_mcu to end_mcu - 1 of the scan in order. With a bit writer the blocks are
+	encoded, otherwise their symbols are counted into dc_freq and ac_freq. first_mcu should start a
+	restart interval.
+*/
+void scan_blocks(const JpgFrame *frame, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac,
+                 HuffmanData *dc_freq, HuffmanData *ac_freq, int first_mcu, int end_mcu);
+
+// codes (or counts the symbols of) the blocks of the MCU at (mx, my), my counts from the first row of the blocks
+void scan_mcu(const JpgFrame *frame, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac,
+              HuffmanData *dc_freq, HuffmanData *ac_freq, int *dc_pred, int mx, int my);
+
+// returns the number of MCUs in the scan of a baseline frame
+int count_mcus(const JpgFrame *frame);
+
+// returns the number of MCUs in a row of the scan of a baseline frame
+int count_mcus_across(const JpgFrame *frame);
+
+// flushes the bits of a restart interval and writes its marker, n is the number of the interval
+void write_restart_marker(BitWriter *bw, int n);
+
+// huffman codes a single block
+void encode_block(BitWriter *bw, const int *zz, int diff, const HuffmanCodes *dc, const HuffmanCodes *ac);
+
+// writes the low size bits of value
+void put_bits(BitWriter *bw, unsigned int value, int size);
+
+// pads the last byte with 1 bits
+void flush_bits(BitWriter *bw);
+
+// encodes the scans of a progressive image
+int write_progressive(const JpgFrame *frame, JpgBuffer *out);
+
+// checks each scan of a script only sends coefficients (or bits of them) that haven't been sent yet
+int check_script(const JpgFrame *frame, const JpgScan *scans, int num_scans);
+
+// walks the blocks of a progressive scan in MCU order, counting and tokenizing each of them
+void walk_scan(ScanState *state);
+
+// writes the tokens of a scan with its huffman tables
+void write_tokens(const ScanState *state, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac);
+
+// the four kinds of progressive scan (G.1.2 of the spec)
+void encode_dc_first(ScanState *state, int i, const int *block);
+void encode_dc_refine(ScanState *state, const int *block);
+void encode_ac_first(ScanState *state, const int *block);
+void encode_ac_refine(ScanState *state, const int *block);
+
+// records a token
+void add_token(ScanState *state, int info, int symbol, unsigned int bits);
+
+// counts a symbol of one of the tables and records it with the bits after it
+void emit_symbol(ScanState *state, int ac, int table, int symbol, unsigned int bits, int size);
+
+// records bits that have no symbol
+void emit_bits(ScanState *state, unsigned int value, int size);
+
+// ends the run of end of blocks, followed by its refinement bits
+void emit_eob_run(ScanState *state);
+
+// writes refinement bits held in a buffer
+void emit_correction_bits(ScanState *state, const Byte *bits, int n);
+
+// point transform of a DC coefficient, an arithmetic shift right
+int shift_right(int value, int bits);
+
+// sets up an interval writer with the given tables, or the standard ones when they are NULL
+IntervalWriter new_interval_writer(const JpgFrame *frame, const JpgHuffmanTable *dc, const JpgHuffmanTable *ac);
+
+// state of an image written a restart interval at a time
+typedef struct _interval_writer{
+	JpgFrame frame;
+	HuffmanCodes dc[2];
+	HuffmanCodes ac[2];
+	int num_mcus;
+	int num_intervals;
+} interval_writer;
+
+// state of an image written to a file a strip at a time
+typedef struct _stream_writer{
+	JpgFrame frame;
+	HuffmanCodes dc[2];
+	HuffmanCodes ac[2];
+	FILE *fp;
+
+	JpgBuffer buffer; // bytes of the current strip
+	BitWriter bw; // bits after the last byte of the buffer are carried to the next strip
+	int dc_pred[JPG_FRAME_COMPONENTS];
+
+	int mcu; // the next MCU to code
+	int num_mcus;
+	int mcus_per_row;
+	long long bytes;
+} stream_writer;
+
+// writes the buffer of a stream writer to its file and empties it
+int flush_stream(StreamWriter writer);
+
+/* ==================================== Function definitions ===================================== */
+
+int write_jpeg(const JpgFrame *frame, JpgBuffer *out)
+{
+	HuffmanCodes dc[2], ac[2];
+	BitWriter bw;
+	const Byte eoi[2] = {0xFF, MARKER_EOI};
+	int error = JPG_WRITE_SUCCESS;
+
+	error = check_frame(frame);
+
+	if (error == JPG_WRITE_SUCCESS && frame->progressive){
+		return write_progressive(frame, out);
+	}
+
+	if (error == JPG_WRITE_SUCCESS){
+		build_huffman_tables(frame, dc, ac);
+		error = write_headers(frame, dc, ac, out);
+	}
+
+	if (error == JPG_WRITE_SUCCESS){
+		bw.out = out;
+		bw.buffer = 0;
+		bw.num_bits = 0;
+		bw.error = JPG_WRITE_SUCCESS;
+
+		// the entropy coded data is usually much smaller than this, it saves growing the buffer
+		reserve_bytes(out, (size_t) frame->width * frame->height / 2 + 1024);
+
+		scan_blocks(frame, &bw, dc, ac, NULL, NULL, 0, count_mcus(frame));
+		flush_bits(&bw);
+
+		error = bw.error;
+	}
+
+	if (error == JPG_WRITE_SUCCESS && !append_bytes(out, eoi, 2)){
+		error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	return error;
+}
+
+void count_frame_symbols(const JpgFrame *frame, long dc_symbols[2], long ac_symbols[2])
+{
+	HuffmanData dc_freq[2], ac_freq[2];
+	int i = 0, k = 0;
+
+	for (i = 0; i < 2; i++){
+		initialize_huffman_data(&dc_freq[i]);
+		initialize_huffman_data(&ac_freq[i]);
+	}
+
+	scan_blocks(frame, NULL, NULL, NULL, dc_freq, ac_freq, 0, count_mcus(frame));
+
+	for (i = 0; i < 2; i++){
+		for (k = 0; k < 256; k++){
+			dc_symbols[i] += dc_freq[i].freq[k];
+			ac_symbols[i] += ac_freq[i].freq[k];
+		}
+	}
+}
+
+int write_jpeg_file(const char *filename, const JpgBuffer *buffer)
+{
+	FILE *fp = NULL;
+	int error = JPG_WRITE_SUCCESS;
+
+	fp = fopen(filename, "wb");
+
+	if (fp != NULL){
+		if (fwrite(buffer->data, sizeof(Byte), buffer->size, fp) != buffer->size){
+			error = JPG_WRITE_FAILED;
+		}
+
+		fclose(fp);
+	}
+
+	else{
+		error = JPG_WRITE_FAILED;
+	}
+
+	return error;
+}
+
+void free_jpeg_buffer(JpgBuffer *buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->capacity = 0;
+}
+
+void free_jpeg_frame(JpgFrame *frame)
+{
+	int i = 0;
+
+	for (i = 0; i < JPG_FRAME_COMPONENTS; i++){
+		free(frame->components[i].blocks);
+		free(frame->components[i].coefficients);
+		frame->components[i].blocks = NULL;
+		frame->components[i].coefficients = NULL;
+	}
+}
+
+int reserve_bytes(JpgBuffer *out, size_t n)
+{
+	Byte *data = NULL;
+	size_t capacity = 0;
+
+	if (out->size + n <= out->capacity){
+		return 1;
+	}
+
+	capacity = (out->capacity) ? out->capacity : 4096;
+	while (capacity < out->size + n){
+		capacity *= 2;
+	}
+
+	data = realloc(out->data, capacity);
+
+	if (data == NULL){
+		return 0;
+	}
+
+	out->data = data;
+	out->capacity = capacity;
+	out->allocations++;
+
+	return 1;
+}
+
+int append_bytes(JpgBuffer *out, const Byte *bytes, size_t n)
+{
+	if (!reserve_bytes(out, n)){
+		return 0;
+	}
+
+	memcpy(out->data + out->size, bytes, n);
+	out->size += n;
+
+	return 1;
+}
+
+int append_segment(JpgBuffer *out, int marker, const Byte *segment, int length)
+{
+	Byte header[4];
+
+	header[0] = 0xFF;
+	header[1] = (Byte) marker;
+	header[2] = (Byte) ((length + 2) >> 8);
+	header[3] = (Byte) ((length + 2) & 0xFF);
+
+	return append_bytes(out, header, 4) && append_bytes(out, segment, length);
+}
+
+int check_frame(const JpgFrame *frame)
+{
+	const JpgComponent *c = NULL;
+	int i = 0, max_h = 1, max_v = 1, blocks_in_mcu = 0;
+
+	if (frame->num_components < 1 || frame->num_components > JPG_FRAME_COMPONENTS
+		|| frame->width < 1 || frame->height < 1 || frame->width > 65535 || frame->height > 65535){
+		return JPG_WRITE_BAD_FRAME;
+	}
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+
+		if (c->h_samp < 1 || c->h_samp > 4 || c->v_samp < 1 || c->v_samp > 4 || c->blocks == NULL
+			|| c->quant_table < 0 || c->quant_table > 3 || c->huff_table < 0 || c->huff_table > 1){
+			return JPG_WRITE_BAD_FRAME;
+		}
+
+		if (c->h_samp > max_h) max_h = c->h_samp;
+		if (c->v_samp > max_v) max_v = c->v_samp;
+		blocks_in_mcu += c->h_samp * c->v_samp;
+	}
+
+	if (frame->num_components > 1 && blocks_in_mcu > MAX_BLOCKS_IN_MCU){
+		return JPG_WRITE_BAD_FRAME;
+	}
+
+	// every MCU of the scan must have its blocks
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+
+		if (frame->num_components == 1){
+			if (c->width_in_blocks < (frame->width + 7) / 8 || c->height_in_blocks < (frame->height + 7) / 8){
+				return JPG_WRITE_BAD_FRAME;
+			}
+		}
+
+		else if (c->width_in_blocks < (frame->width + 8 * max_h - 1) / (8 * max_h) * c->h_samp
+		         || c->height_in_blocks < (frame->height + 8 * max_v - 1) / (8 * max_v) * c->v_samp){
+			return JPG_WRITE_BAD_FRAME;
+		}
+	}
+
+	return JPG_WRITE_SUCCESS;
+}
+
+void build_huffman_tables(const JpgFrame *frame, HuffmanCodes *dc, HuffmanCodes *ac)
+{
+	HuffmanData dc_freq[2], ac_freq[2];
+	int i = 0;
+
+	if (frame->optimize_huffman && frame->symbol_freq != NULL){
+		for (i = 0; i < 2; i++){
+			dc_freq[i] = frame->symbol_freq[2 * i];
+			ac_freq[i] = frame->symbol_freq[2 * i + 1];
+		}
+	}
+
+	else if (frame->optimize_huffman){
+		for (i = 0; i < 2; i++){
+			initialize_huffman_data(&dc_freq[i]);
+			initialize_huffman_data(&ac_freq[i]);
+		}
+
+		// first pass counts the symbols
+		scan_blocks(frame, NULL, NULL, NULL, dc_freq, ac_freq, 0, count_mcus(frame));
+	}
+
+	if (frame->optimize_huffman){
+
+		for (i = 0; i < 2; i++){
+			load_optimal_table(&dc[i], &dc_freq[i]);
+			load_optimal_table(&ac[i], &ac_freq[i]);
+		}
+	}
+
+	else{
+		load_standard_table(&dc[0], DCHuffmanLum_nr, DCHuffmanLumValues, 12);
+		load_standard_table(&ac[0], ACHuffmanLum_nr, ACHuffmanLumValues, 162);
+		load_standard_table(&dc[1], DCHuffmanChr_nr, DCHuffmanChrValues, 12);
+		load_standard_table(&ac[1], ACHuffmanChr_nr, ACHuffmanChrValues, 162);
+	}
+
+	for (i = 0; i < 2; i++){
+		generate_codes(&dc[i]);
+		generate_codes(&ac[i]);
+	}
+}
+
+void load_standard_table(HuffmanCodes *codes, const Byte *bits, const Byte *huffval, int num_values)
+{
+	memcpy(codes->bits, bits, 17);
+	memcpy(codes->huffval, huffval, num_values);
+	codes->bits[0] = 0;
+}
+
+void load_optimal_table(HuffmanCodes *codes, HuffmanData *huffman_data)
+{
+	int i = 0, n = 0;
+
+	construct_huffman_table(huffman_data);
+
+	codes->bits[0] = 0;
+	for (i = 1; i <= 16; i++){
+		codes->bits[i] = (Byte) huffman_data->bits[i];
+		n += huffman_data->bits[i];
+	}
+
+	for (i = 0; i < n; i++){
+		codes->huffval[i] = (Byte) huffman_data->huffval[i];
+	}
+}
+
+void generate_codes(HuffmanCodes *codes)
+{
+	unsigned int code = 0;
+	int l = 0, i = 0, k = 0;
+
+	memset(codes->size, 0, sizeof(codes->size));
+
+	for (l = 1; l <= 16; l++){
+		for (i = 0; i < codes->bits[l]; i++){
+			codes->code[ codes->huffval[k] ] = code++;
+			codes->size[ codes->huffval[k] ] = l;
+			k++;
+		}
+
+		code <<= 1;
+	}
+}
+
+int write_headers(const JpgFrame *frame, const HuffmanCodes *dc, const HuffmanCodes *ac, JpgBuffer *out)
+{
+	JpgScan scan;
+	int used_huff[2] = {0};
+	int i = 0, t = 0, ok = 1;
+
+	// a baseline image has one scan holding every component and coefficient
+	scan.num_components = frame->num_components;
+	scan.ss = 0;
+	scan.se = 63;
+	scan.ah = scan.al = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		scan.component_index[i] = i;
+		used_huff[ frame->components[i].huff_table ] = 1;
+	}
+
+	ok = write_frame_headers(frame, out);
+
+	// DC then AC table of each set
+	for (t = 0; t < 2 && ok; t++){
+		if (used_huff[t]){
+			ok = write_huffman_table(out, 0, t, &dc[t]) && write_huffman_table(out, 1, t, &ac[t]);
+		}
+	}
+
+	ok = ok && write_scan_header(frame, &scan, out);
+
+	return ok ? JPG_WRITE_SUCCESS : JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+}
+
+int write_frame_headers(const JpgFrame *frame, JpgBuffer *out)
+{
+	const Byte soi[2] = {0xFF, MARKER_SOI};
+	const Byte jfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+	Byte segment[2 + 128];
+	const JpgComponent *c = NULL;
+	int used_quant[4] = {0};
+	int i = 0, k = 0, n = 0, t = 0, extended = 0, marker = 0, ok = 1;
+
+	for (i = 0; i < frame->num_components; i++){
+		used_quant[ frame->components[i].quant_table ] = 1;
+	}
+
+	ok = append_bytes(out, soi, 2) && append_segment(out, MARKER_APP0, jfif, 14);
+
+	// quantization tables are stored in zig-zag order, 16 bit entries need an extended frame
+	for (t = 0; t < 4 && ok; t++){
+		if (used_quant[t]){
+			n = 0;
+			segment[n++] = t;
+
+			for (k = 0; k < 64; k++){
+				if (frame->quant[t][k] > 255) segment[0] = 0x10 | t;
+			}
+
+			for (k = 0; k < 64; k++){
+				if (segment[0] & 0x10){
+					segment[n++] = (Byte) (frame->quant[t][ natural_order[k] ] >> 8);
+				}
+
+				segment[n++] = (Byte) frame->quant[t][ natural_order[k] ];
+			}
+
+			extended |= segment[0] >> 4;
+			ok = append_segment(out, MARKER_DQT, segment, n);
+		}
+	}
+
+	if (ok){
+		n = 0;
+		segment[n++] = 8;
+		segment[n++] = (Byte) (frame->height >> 8);
+		segment[n++] = (Byte) frame->height;
+		segment[n++] = (Byte) (frame->width >> 8);
+		segment[n++] = (Byte) frame->width;
+		segment[n++] = (Byte) frame->num_components;
+
+		for (i = 0; i < frame->num_components; i++){
+			c = &frame->components[i];
+			segment[n++] = (Byte) c->id;
+			segment[n++] = (frame->num_components == 1) ? 0x11 : (Byte) ((c->h_samp << 4) | c->v_samp);
+			segment[n++] = (Byte) c->quant_table;
+		}
+
+		marker = (frame->progressive) ? MARKER_SOF2 : (extended) ? MARKER_SOF1 : MARKER_SOF0;
+		ok = append_segment(out, marker, segment, n);
+	}
+
+	if (ok && frame->restart_interval){
+		segment[0] = (Byte) (frame->restart_interval >> 8);
+		segment[1] = (Byte) frame->restart_interval;
+		ok = append_segment(out, MARKER_DRI, segment, 2);
+	}
+
+	return ok;
+}
+
+int write_huffman_table(JpgBuffer *out, int table_class, int id, const HuffmanCodes *codes)
+{
+	Byte segment[1 + 16 + 256];
+	int i = 0, n = 0;
+
+	segment[0] = (Byte) ((table_class << 4) | id);
+	memcpy(segment + 1, codes->bits + 1, 16);
+	for (i = 1; i <= 16; i++) n += codes->bits[i];
+	memcpy(segment + 17, codes->huffval, n);
+
+	return append_segment(out, MARKER_DHT, segment, 17 + n);
+}
+
+int write_scan_header(const JpgFrame *frame, const JpgScan *scan, JpgBuffer *out)
+{
+	Byte segment[2 + 2 * JPG_FRAME_COMPONENTS + 3];
+	const JpgComponent *c = NULL;
+	int i = 0, n = 0;
+
+	segment[n++] = (Byte) scan->num_components;
+
+	for (i = 0; i < scan->num_components; i++){
+		c = &frame->components[ scan->component_index[i] ];
+		segment[n++] = (Byte) c->id;
+		segment[n++] = (Byte) ((c->huff_table << 4) | c->huff_table);
+	}
+
+	// spectral selection and successive approximation
+	segment[n++] = (Byte) scan->ss;
+	segment[n++] = (Byte) scan->se;
+	segment[n++] = (Byte) ((scan->ah << 4) | scan->al);
+
+	return append_segment(out, MARKER_SOS, segment, n);
+}
+
+int count_mcus(const JpgFrame *frame)
+{
+	int max_h = 1, max_v = 1, i = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		if (frame->components[i].h_samp > max_h) max_h = frame->components[i].h_samp;
+		if (frame->components[i].v_samp > max_v) max_v = frame->components[i].v_samp;
+	}
+
+	// a single component scan is not interleaved, each block is an MCU
+	if (frame->num_components == 1){
+		max_h = max_v = 1;
+	}
+
+	return ((frame->width + 8 * max_h - 1) / (8 * max_h)) * ((frame->height + 8 * max_v - 1) / (8 * max_v));
+}
+
+void scan_blocks(const JpgFrame *frame, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac,
+                 HuffmanData *dc_freq, HuffmanData *ac_freq, int first_mcu, int end_mcu)
+{
+	int dc_pred[JPG_FRAME_COMPONENTS] = {0};
+	int mcus_per_row = count_mcus_across(frame);
+	int mcu = 0, i = 0;
+
+	for (mcu = first_mcu; mcu < end_mcu; mcu++){
+		// end the restart interval, the markers count 0 - 7 from the start of the scan
+		if (frame->restart_interval && mcu > first_mcu && mcu % frame->restart_interval == 0){
+			if (bw != NULL){
+				write_restart_marker(bw, mcu / frame->restart_interval - 1);
+			}
+
+			for (i = 0; i < JPG_FRAME_COMPONENTS; i++){
+				dc_pred[i] = 0;
+			}
+		}
+
+		scan_mcu(frame, bw, dc, ac, dc_freq, ac_freq, dc_pred, mcu % mcus_per_row, mcu / mcus_per_row);
+
+		if (bw != NULL && bw->error != JPG_WRITE_SUCCESS){
+			return;
+		}
+	}
+}
+
+void scan_mcu(const JpgFrame *frame, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac,
+              HuffmanData *dc_freq, HuffmanData *ac_freq, int *dc_pred, int mx, int my)
+{
+	const JpgComponent *c = NULL;
+	const int *block = NULL;
+	int h_samp = 1, v_samp = 1;
+	int i = 0, h = 0, v = 0, diff = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		c = &frame->components[i];
+		h_samp = (frame->num_components == 1) ? 1 : c->h_samp;
+		v_samp = (frame->num_components == 1) ? 1 : c->v_samp;
+
+		for (v = 0; v < v_samp; v++){
+			for (h = 0; h < h_samp; h++){
+				block = c->blocks[(my * v_samp + v) * c->width_in_blocks + mx * h_samp + h];
+				diff = block[0] - dc_pred[i];
+				dc_pred[i] = block[0];
+
+				if (bw != NULL){
+					encode_block(bw, block, diff, &dc[c->huff_table], &ac[c->huff_table]);
+				}
+
+				else{
+					dc_freq[c->huff_table].freq[ get_class(diff) ]++;
+					calculate_freq_block_AC(&ac_freq[c->huff_table], (int *) block);
+				}
+			}
+		}
+	}
+}
+
+int count_mcus_across(const JpgFrame *frame)
+{
+	int max_h = 1, i = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		if (frame->components[i].h_samp > max_h) max_h = frame->components[i].h_samp;
+	}
+
+	// a single component scan is not interleaved, each block is an MCU
+	if (frame->num_components == 1){
+		max_h = 1;
+	}
+
+	return (frame->width + 8 * max_h - 1) / (8 * max_h);
+}
+
+void write_restart_marker(BitWriter *bw, int n)
+{
+	Byte rst[2] = {0xFF, MARKER_RST0};
+
+	flush_bits(bw);
+	rst[1] = MARKER_RST0 + (n & 7);
+
+	if (!append_bytes(bw->out, rst, 2)){
+		bw->error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+}
+
+void encode_block(BitWriter *bw, const int *zz, int diff, const HuffmanCodes *dc, const HuffmanCodes *ac)
+{
+	unsigned long long mask = 0;
+	int k = 0, last = 0, run = 0, s = 0, value = 0, symbol = 0;
+
+	s = get_class(diff);
+	if (dc->size[s] == 0){
+		bw->error = JPG_WRITE_BAD_FRAME; // coefficient too large for the tables
+		return;
+	}
+
+	put_bits(bw, dc->code[s], dc->size[s]);
+
+	// negative values are stored as value - 1 in s bits
+	if (s){
+		put_bits(bw, (diff < 0) ? diff - 1 : diff, s);
+	}
+
+	// only the non zero coefficients are visited, the run is the distance from the one before
+	mask = jpg_kernels()->nonzero_mask(zz) & ~1ULL;
+	last = 0;
+
+	while (mask){
+		k = __builtin_ctzll(mask);
+		mask &= mask - 1;
+
+		value = zz[k];
+		run = k - last - 1;
+		last = k;
+
+		// ZRL for each run of 16 zeroes
+		if (run > 15 && ac->size[0xF0] == 0){
+			bw->error = JPG_WRITE_BAD_FRAME;
+			return;
+		}
+
+		while (run > 15){
+			put_bits(bw, ac->code[0xF0], ac->size[0xF0]);
+			run -= 16;
+		}
+
+		s = get_class(value);
+		symbol = (run << 4) | s;
+
+		if (ac->size[symbol] == 0){
+			bw->error = JPG_WRITE_BAD_FRAME;
+			return;
+		}
+
+		put_bits(bw, ac->code[symbol], ac->size[symbol]);
+		put_bits(bw, (value < 0) ? value - 1 : value, s);
+	}
+
+	// EOB when the block ends with zeroes
+	if (last != 63 && ac->size[0x00] == 0){
+		bw->error = JPG_WRITE_BAD_FRAME;
+	}
+
+	else if (last != 63){
+		put_bits(bw, ac->code[0x00], ac->size[0x00]);
+	}
+}
+
+void put_bits(BitWriter *bw, unsigned int value, int size)
+{
+	Byte byte = 0;
+
+	bw->buffer = (bw->buffer << size) | (value & ((1U << size) - 1));
+	bw->num_bits += size;
+
+	while (bw->num_bits >= 8){
+		if (!reserve_bytes(bw->out, 2)){
+			bw->error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+			bw->num_bits = 0;
+			return;
+		}
+
+		bw->num_bits -= 8;
+		byte = (Byte) (bw->buffer >> bw->num_bits);
+		bw->out->data[ bw->out->size++ ] = byte;
+
+		// 0xFF is stuffed with a zero byte so it isn't read as a marker
+		if (byte == 0xFF){
+			bw->out->data[ bw->out->size++ ] = 0x00;
+		}
+	}
+}
+
+void flush_bits(BitWriter *bw)
+{
+	if (bw->num_bits > 0){
+		put_bits(bw, 0x7F, 8 - bw->num_bits);
+	}
+
+	bw->buffer = 0;
+}
+
+int build_scan_script(int num_components, int refine, JpgScan *scans)
+{
+	// component(s), first and last coefficient, ah, al
+	const int colour[10][6] = {
+		{-1, 0, 0, 0, 1}, {0, 1, 5, 0, 2}, {2, 1, 63, 0, 1}, {1, 1, 63, 0, 1}, {0, 6, 63, 0, 2},
+		{0, 1, 63, 2, 1}, {-1, 0, 0, 1, 0}, {2, 1, 63, 1, 0}, {1, 1, 63, 1, 0}, {0, 1, 63, 1, 0}
+	};
+	const int colour_no_refine[5][6] = {
+		{-1, 0, 0, 0, 0}, {0, 1, 5, 0, 0}, {2, 1, 63, 0, 0}, {1, 1, 63, 0, 0}, {0, 6, 63, 0, 0}
+	};
+	const int grey[6][6] = {
+		{-1, 0, 0, 0, 1}, {0, 1, 5, 0, 2}, {0, 6, 63, 0, 2}, {0, 1, 63, 2, 1}, {-1, 0, 0, 1, 0}, {0, 1, 63, 1, 0}
+	};
+	const int grey_no_refine[3][6] = {
+		{-1, 0, 0, 0, 0}, {0, 1, 5, 0, 0}, {0, 6, 63, 0, 0}
+	};
+	const int (*script)[6] = NULL;
+	int num_scans = 0, i = 0, k = 0;
+
+	if (num_components == 3){
+		script = (refine) ? colour : colour_no_refine;
+		num_scans = (refine) ? 10 : 5;
+	}
+
+	else if (num_components == 1){
+		script = (refine) ? grey : grey_no_refine;
+		num_scans = (refine) ? 6 : 3;
+	}
+
+	// any other number of components: the DC coefficients then the AC coefficients of each component
+	else{
+		scans[0].num_components = num_components;
+		for (k = 0; k < num_components; k++){
+			scans[0].component_index[k] = k;
+		}
+
+		scans[0].ss = scans[0].se = scans[0].ah = scans[0].al = 0;
+
+		for (i = 1; i <= num_components; i++){
+			scans[i].num_components = 1;
+			scans[i].component_index[0] = i - 1;
+			scans[i].ss = 1;
+			scans[i].se = 63;
+			scans[i].ah = scans[i].al = 0;
+		}
+
+		return num_components + 1;
+	}
+
+	for (i = 0; i < num_scans; i++){
+		// -1 is a DC scan of every component
+		scans[i].num_components = (script[i][0] < 0) ? num_components : 1;
+		for (k = 0; k < scans[i].num_components; k++){
+			scans[i].component_index[k] = (script[i][0] < 0) ? k : script[i][0];
+		}
+
+		scans[i].ss = script[i][1];
+		scans[i].se = script[i][2];
+		scans[i].ah = script[i][3];
+		scans[i].al = script[i][4];
+	}
+
+	return num_scans;
+}
+
+int write_progressive(const JpgFrame *frame, JpgBuffer *out)
+{
+	JpgScan default_scans[JPG_MAX_SCRIPT_SCANS];
+	const JpgScan *scans = frame->scans;
+	HuffmanCodes dc[2], ac[2];
+	HuffmanData dc_freq[2], ac_freq[2];
+	const Byte eoi[2] = {0xFF, MARKER_EOI};
+	BitWriter bw;
+	ScanState *state = NULL;
+	const JpgScan *scan = NULL;
+	const JpgComponent *c = NULL;
+	int num_scans = frame->num_scans;
+	int used_dc[2], used_ac[2];
+	int error = JPG_WRITE_SUCCESS, ok = 1;
+	int n = 0, i = 0, t = 0;
+
+	if (scans == NULL){
+		num_scans = build_scan_script(frame->num_components, 1, default_scans);
+		scans = default_scans;
+	}
+
+	error = check_script(frame, scans, num_scans);
+	if (error != JPG_WRITE_SUCCESS){
+		return error;
+	}
+
+	state = calloc(1, sizeof(ScanState));
+	if (state == NULL || !write_frame_headers(frame, out)){
+		free(state);
+		return JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	bw.out = out;
+	bw.buffer = 0;
+	bw.num_bits = 0;
+	bw.error = JPG_WRITE_SUCCESS;
+
+	reserve_bytes(out, (size_t) frame->width * frame->height / 2 + 1024);
+
+	state->frame = frame;
+	state->dc_freq = dc_freq;
+	state->ac_freq = ac_freq;
+	state->error = JPG_WRITE_SUCCESS;
+
+	for (n = 0; n < num_scans && ok && state->error == JPG_WRITE_SUCCESS && bw.error == JPG_WRITE_SUCCESS; n++){
+		scan = &scans[n];
+
+		state->scan = scan;
+		state->ac_table = frame->components[ scan->component_index[0] ].huff_table;
+		state->num_tokens = 0;
+
+		used_dc[0] = used_dc[1] = used_ac[0] = used_ac[1] = 0;
+		for (i = 0; i < scan->num_components; i++){
+			c = &frame->components[ scan->component_index[i] ];
+			used_dc[c->huff_table] = (scan->ss == 0 && scan->ah == 0);
+			used_ac[c->huff_table] = (scan->ss > 0);
+		}
+
+		for (t = 0; t < 2; t++){
+			initialize_huffman_data(&dc_freq[t]);
+			initialize_huffman_data(&ac_freq[t]);
+		}
+
+		// one pass over the blocks counts the symbols so the scan gets tables of its own,
+		// DC refinement scans only send raw bits
+		walk_scan(state);
+
+		for (t = 0; t < 2 && ok; t++){
+			if (used_dc[t]){
+				load_optimal_table(&dc[t], &dc_freq[t]);
+				generate_codes(&dc[t]);
+				ok = write_huffman_table(out, 0, t, &dc[t]);
+			}
+
+			if (used_ac[t] && ok){
+				load_optimal_table(&ac[t], &ac_freq[t]);
+				generate_codes(&ac[t]);
+				ok = write_huffman_table(out, 1, t, &ac[t]);
+			}
+		}
+
+		ok = ok && write_scan_header(frame, scan, out);
+
+		if (ok && state->error == JPG_WRITE_SUCCESS){
+			write_tokens(state, &bw, dc, ac);
+			flush_bits(&bw);
+		}
+	}
+
+	error = (!ok) ? JPG_WRITE_FAILED_ALLOCATE_BUFFER : (state->error != JPG_WRITE_SUCCESS) ? state->error : bw.error;
+
+	free(state->tokens);
+	free(state);
+
+	if (error == JPG_WRITE_SUCCESS && !append_bytes(out, eoi, 2)){
+		error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	return error;
+}
+
+int check_script(const JpgFrame *frame, const JpgScan *scans, int num_scans)
+{
+	// bit position sent so far of each coefficient, -1 before its first scan
+	int sent[JPG_FRAME_COMPONENTS][64];
+	const JpgScan *scan = NULL;
+	int n = 0, i = 0, k = 0, c = 0, blocks_in_mcu = 0;
+
+	memset(sent, -1, sizeof(sent));
+
+	if (num_scans < 1){
+		return JPG_WRITE_BAD_FRAME;
+	}
+
+	for (n = 0; n < num_scans; n++){
+		scan = &scans[n];
+
+		if (scan->num_components < 1 || scan->num_components > frame->num_components
+			|| scan->ss < 0 || scan->se > 63 || scan->ss > scan->se || scan->al < 0 || scan->al > 13
+			|| (scan->ss == 0 && scan->se != 0) || (scan->ss > 0 && scan->num_components != 1)
+			|| (scan->ah != 0 && scan->ah != scan->al + 1)){
+			return JPG_WRITE_BAD_FRAME;
+		}
+
+		blocks_in_mcu = 0;
+
+		for (i = 0; i < scan->num_components; i++){
+			c = scan->component_index[i];
+
+			// components are sent in the order of the frame
+			if (c < 0 || c >= frame->num_components || (i > 0 && c <= scan->component_index[i - 1])){
+				return JPG_WRITE_BAD_FRAME;
+			}
+
+			// AC coefficients can only follow the first DC scan
+			if (scan->ss > 0 && sent[c][0] < 0){
+				return JPG_WRITE_BAD_FRAME;
+			}
+
+			for (k = scan->ss; k <= scan->se; k++){
+				if ((scan->ah == 0 && sent[c][k] >= 0) || (scan->ah > 0 && sent[c][k] != scan->ah)){
+					return JPG_WRITE_BAD_FRAME;
+				}
+
+				sent[c][k] = scan->al;
+			}
+
+			blocks_in_mcu += frame->components[c].h_samp * frame->components[c].v_samp;
+		}
+
+		if (scan->num_components > 1 && blocks_in_mcu > MAX_BLOCKS_IN_MCU){
+			return JPG_WRITE_BAD_FRAME;
+		}
+	}
+
+	// every component needs at least its DC coefficients
+	for (c = 0; c < frame->num_components; c++){
+		if (sent[c][0] < 0){
+			return JPG_WRITE_BAD_FRAME;
+		}
+	}
+
+	return JPG_WRITE_SUCCESS;
+}
+
+void walk_scan(ScanState *state)
+{
+	const JpgFrame *frame = state->frame;
+	const JpgScan *scan = state->scan;
+	const JpgComponent *c = NULL;
+	const int *block = NULL;
+	int max_h = 1, max_v = 1, h_samp = 1, v_samp = 1;
+	int mcus_per_row = 0, mcu_rows = 0, num_mcus = 0, mcu = 0;
+	int mx = 0, my = 0, i = 0, h = 0, v = 0, interval = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		if (frame->components[i].h_samp > max_h) max_h = frame->components[i].h_samp;
+		if (frame->components[i].v_samp > max_v) max_v = frame->components[i].v_samp;
+	}
+
+	// a scan of one component isn't interleaved, it only covers the blocks inside the component
+	if (scan->num_components == 1){
+		c = &frame->components[ scan->component_index[0] ];
+		h_samp = (frame->num_components == 1) ? max_h : c->h_samp;
+		v_samp = (frame->num_components == 1) ? max_v : c->v_samp;
+
+		mcus_per_row = ((frame->width * h_samp + max_h - 1) / max_h + 7) / 8;
+		mcu_rows = ((frame->height * v_samp + max_v - 1) / max_v + 7) / 8;
+	}
+
+	else{
+		mcus_per_row = (frame->width + 8 * max_h - 1) / (8 * max_h);
+		mcu_rows = (frame->height + 8 * max_v - 1) / (8 * max_v);
+	}
+
+	num_mcus = mcus_per_row * mcu_rows;
+
+	for (i = 0; i < JPG_FRAME_COMPONENTS; i++){
+		state->dc_pred[i] = 0;
+	}
+
+	state->eob_run = 0;
+	state->num_correction = 0;
+
+	for (mcu = 0; mcu < num_mcus; mcu++){
+		// end the restart interval
+		if (frame->restart_interval && mcu && mcu % frame->restart_interval == 0){
+			emit_eob_run(state);
+			add_token(state, TOKEN_RESTART, interval & 7, 0);
+
+			interval++;
+			for (i = 0; i < JPG_FRAME_COMPONENTS; i++){
+				state->dc_pred[i] = 0;
+			}
+		}
+
+		mx = mcu % mcus_per_row;
+		my = mcu / mcus_per_row;
+
+		for (i = 0; i < scan->num_components; i++){
+			c = &frame->components[ scan->component_index[i] ];
+			h_samp = (scan->num_components == 1) ? 1 : c->h_samp;
+			v_samp = (scan->num_components == 1) ? 1 : c->v_samp;
+
+			for (v = 0; v < v_samp; v++){
+				for (h = 0; h < h_samp; h++){
+					block = c->blocks[(my * v_samp + v) * c->width_in_blocks + mx * h_samp + h];
+
+					if (scan->ss == 0){
+						if (scan->ah == 0) encode_dc_first(state, i, block);
+						else encode_dc_refine(state, block);
+					}
+
+					else{
+						if (scan->ah == 0) encode_ac_first(state, block);
+						else encode_ac_refine(state, block);
+					}
+				}
+			}
+		}
+
+		if (state->error != JPG_WRITE_SUCCESS){
+			return;
+		}
+	}
+
+	emit_eob_run(state);
+}
+
+void write_tokens(const ScanState *state, BitWriter *bw, const HuffmanCodes *dc, const HuffmanCodes *ac)
+{
+	const ScanToken *token = NULL;
+	const HuffmanCodes *codes = NULL;
+	Byte rst[2] = {0xFF, MARKER_RST0};
+	size_t n = 0;
+
+	for (n = 0; n < state->num_tokens && bw->error == JPG_WRITE_SUCCESS; n++){
+		token = &state->tokens[n];
+
+		switch (token->info & TOKEN_KIND){
+			case TOKEN_DC:
+			case TOKEN_AC:
+				codes = ((token->info & TOKEN_KIND) == TOKEN_AC) ? ac : dc;
+				codes += (token->info & TOKEN_TABLE) ? 1 : 0;
+
+				put_bits(bw, codes->code[token->symbol], codes->size[token->symbol]);
+				put_bits(bw, token->bits, token->info & TOKEN_SIZE);
+				break;
+
+			case TOKEN_RAW:
+				put_bits(bw, token->bits, token->info & TOKEN_SIZE);
+				break;
+
+			case TOKEN_RESTART:
+				flush_bits(bw);
+				rst[1] = MARKER_RST0 + token->symbol;
+				if (!append_bytes(bw->out, rst, 2)) bw->error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+				break;
+		}
+	}
+}
+
+void encode_dc_first(ScanState *state, int i, const int *block)
+{
+	int value = 0, diff = 0, s = 0;
+	int table = state->frame->components[ state->scan->component_index[i] ].huff_table;
+
+	value = shift_right(block[0], state->scan->al);
+	diff = value - state->dc_pred[i];
+	state->dc_pred[i] = value;
+
+	s = get_class(diff);
+	emit_symbol(state, 0, table, s, (diff < 0) ? diff - 1 : diff, s);
+}
+
+void encode_dc_refine(ScanState *state, const int *block)
+{
+	emit_bits(state, shift_right(block[0], state->scan->al) & 1, 1);
+}
+
+void encode_ac_first(ScanState *state, const int *block)
+{
+	int k = 0, run = 0, value = 0, t = 0, s = 0, last = 0;
+
+	// the zeroes after the last nonzero coefficient are only counted
+	for (last = state->scan->se; last >= state->scan->ss; last--){
+		value = block[last];
+		if (((value < 0) ? -value : value) >> state->scan->al) break;
+	}
+
+	for (k = state->scan->ss; k <= last; k++){
+		value = block[k];
+
+		// point transform, the magnitude is divided by 2^al
+		t = ((value < 0) ? -value : value) >> state->scan->al;
+
+		if (t == 0){
+			run++;
+			continue;
+		}
+
+		emit_eob_run(state);
+
+		while (run > 15){
+			emit_symbol(state, 1, state->ac_table, 0xF0, 0, 0);
+			run -= 16;
+		}
+
+		s = get_class(t);
+		emit_symbol(state, 1, state->ac_table, (run << 4) | s, (value < 0) ? ~t : t, s);
+		run = 0;
+	}
+
+	// the rest of the band is zero, the block joins the run of end of blocks
+	if (last < state->scan->se){
+		state->eob_run++;
+		if (state->eob_run == MAX_EOB_RUN) emit_eob_run(state);
+	}
+}
+
+void encode_ac_refine(ScanState *state, const int *block)
+{
+	int magnitude[64];
+	Byte *bits = state->correction + state->num_correction;
+	int k = 0, run = 0, t = 0, last_new = 0, last = 0, num_bits = 0;
+
+	// the last coefficient that becomes nonzero in this scan and the last nonzero one
+	last = state->scan->ss - 1;
+	for (k = state->scan->ss; k <= state->scan->se; k++){
+		t = block[k];
+		magnitude[k] = ((t < 0) ? -t : t) >> state->scan->al;
+
+		if (magnitude[k]){
+			last = k;
+			if (magnitude[k] == 1) last_new = k;
+		}
+	}
+
+	for (k = state->scan->ss; k <= last; k++){
+		t = magnitude[k];
+
+		if (t == 0){
+			run++;
+			continue;
+		}
+
+		// a ZRL is only needed when a newly nonzero coefficient follows it
+		while (run > 15 && k <= last_new){
+			emit_eob_run(state);
+			emit_symbol(state, 1, state->ac_table, 0xF0, 0, 0);
+			run -= 16;
+
+			emit_correction_bits(state, bits, num_bits);
+			bits = state->correction;
+			num_bits = 0;
+		}
+
+		// coefficients that were already nonzero send their next bit after the next symbol
+		if (t > 1){
+			bits[num_bits++] = (Byte) (t & 1);
+			continue;
+		}
+
+		emit_eob_run(state);
+		emit_symbol(state, 1, state->ac_table, (run << 4) | 1, (block[k] < 0) ? 0 : 1, 1);
+
+		emit_correction_bits(state, bits, num_bits);
+		bits = state->correction;
+		num_bits = 0;
+		run = 0;
+	}
+
+	// the zeroes after the last nonzero coefficient are only counted
+	run += state->scan->se - last;
+
+	if (run > 0 || num_bits > 0){
+		state->eob_run++;
+		state->num_correction += num_bits;
+
+		// keep room for the bits of another block
+		if (state->eob_run == MAX_EOB_RUN || state->num_correction > MAX_CORRECTION_BITS - 63){
+			emit_eob_run(state);
+		}
+	}
+}
+
+void add_token(ScanState *state, int info, int symbol, unsigned int bits)
+{
+	ScanToken *tokens = NULL;
+	size_t max_tokens = 0;
+
+	if (state->num_tokens == state->max_tokens){
+		max_tokens = (state->max_tokens) ? state->max_tokens * 2 : 65536;
+		tokens = realloc(state->tokens, sizeof(ScanToken) * max_tokens);
+
+		if (tokens == NULL){
+			state->error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+			return;
+		}
+
+		state->tokens = tokens;
+		state->max_tokens = max_tokens;
+	}
+
+	state->tokens[state->num_tokens].bits = (unsigned short) bits;
+	state->tokens[state->num_tokens].symbol = (Byte) symbol;
+	state->tokens[state->num_tokens].info = (Byte) info;
+	state->num_tokens++;
+}
+
+void emit_symbol(ScanState *state, int ac, int table, int symbol, unsigned int bits, int size)
+{
+	if (ac){
+		state->ac_freq[table].freq[symbol]++;
+	}
+
+	else{
+		state->dc_freq[table].freq[symbol]++;
+	}
+
+	add_token(state, ((ac) ? TOKEN_AC : TOKEN_DC) | ((table) ? TOKEN_TABLE : 0) | size, symbol, bits & ((1U << size) - 1));
+}
+
+void emit_bits(ScanState *state, unsigned int value, int size)
+{
+	add_token(state, TOKEN_RAW | size, 0, value & ((1U << size) - 1));
+}
+
+void emit_eob_run(ScanState *state)
+{
+	int n = 0;
+
+	if (state->eob_run > 0){
+		// EOBn: the run is 2^n plus n more bits
+		n = get_class(state->eob_run) - 1;
+		emit_symbol(state, 1, state->ac_table, n << 4, state->eob_run, n);
+
+		state->eob_run = 0;
+
+		emit_correction_bits(state, state->correction, state->num_correction);
+		state->num_correction = 0;
+	}
+}
+
+void emit_correction_bits(ScanState *state, const Byte *bits, int n)
+{
+	unsigned int value = 0;
+	int i = 0, size = 0;
+
+	// up to 16 bits go in each token
+	for (i = 0; i < n; i++){
+		value = (value << 1) | bits[i];
+		size++;
+
+		if (size == 16 || i == n - 1){
+			emit_bits(state, value, size);
+			value = 0;
+			size = 0;
+		}
+	}
+}
+
+int shift_right(int value, int bits)
+{
+	return (value < 0) ? -((-value - 1) >> bits) - 1 : value >> bits;
+}
+
+IntervalWriter create_interval_writer(const JpgFrame *frame)
+{
+	return new_interval_writer(frame, NULL, NULL);
+}
+
+IntervalWriter create_interval_writer_with_tables(const JpgFrame *frame, const JpgHuffmanTable dc[2], const JpgHuffmanTable ac[2])
+{
+	return new_interval_writer(frame, dc, ac);
+}
+
+IntervalWriter new_interval_writer(const JpgFrame *frame, const JpgHuffmanTable *dc, const JpgHuffmanTable *ac)
+{
+	IntervalWriter writer = NULL;
+	int i = 0;
+
+	if (frame->progressive || check_frame(frame) != JPG_WRITE_SUCCESS){
+		return NULL;
+	}
+
+	writer = malloc(sizeof(interval_writer));
+
+	if (writer != NULL){
+		writer->frame = *frame;
+		writer->frame.optimize_huffman = 0;
+		writer->num_mcus = count_mcus(frame);
+		writer->num_intervals = (frame->restart_interval > 0) ? (writer->num_mcus + frame->restart_interval - 1) / frame->restart_interval : 1;
+
+		if (dc == NULL){
+			build_huffman_tables(&writer->frame, writer->dc, writer->ac);
+		}
+
+		else{
+			for (i = 0; i < 2; i++){
+				memcpy(writer->dc[i].bits, dc[i].bits, 17);
+				memcpy(writer->dc[i].huffval, dc[i].huffval, 256);
+				memcpy(writer->ac[i].bits, ac[i].bits, 17);
+				memcpy(writer->ac[i].huffval, ac[i].huffval, 256);
+				writer->dc[i].bits[0] = writer->ac[i].bits[0] = 0;
+
+				generate_codes(&writer->dc[i]);
+				generate_codes(&writer->ac[i]);
+			}
+		}
+	}
+
+	return writer;
+}
+
+int interval_writer_count(IntervalWriter writer)
+{
+	return writer->num_intervals;
+}
+
+int interval_writer_headers(IntervalWriter writer, JpgBuffer *out)
+{
+	return write_headers(&writer->frame, writer->dc, writer->ac, out);
+}
+
+int interval_writer_encode(IntervalWriter writer, int i, JpgBuffer *out)
+{
+	BitWriter bw;
+	Byte rst[2] = {0xFF, MARKER_RST0};
+	int restart = writer->frame.restart_interval;
+	int first = (restart > 0) ? i * restart : 0;
+	int end = (restart > 0 && first + restart < writer->num_mcus) ? first + restart : writer->num_mcus;
+
+	bw.out = out;
+	bw.buffer = 0;
+	bw.num_bits = 0;
+	bw.error = JPG_WRITE_SUCCESS;
+
+	scan_blocks(&writer->frame, &bw, writer->dc, writer->ac, NULL, NULL, first, end);
+	flush_bits(&bw);
+
+	// the marker after interval i is RSTi (mod 8), the same one scan_blocks would write
+	if (bw.error == JPG_WRITE_SUCCESS && i < writer->num_intervals - 1){
+		rst[1] = MARKER_RST0 + (i & 7);
+		if (!append_bytes(out, rst, 2)) bw.error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	return bw.error;
+}
+
+int interval_writer_end(IntervalWriter writer, JpgBuffer *out)
+{
+	const Byte eoi[2] = {0xFF, MARKER_EOI};
+	return append_bytes(out, eoi, 2) ? JPG_WRITE_SUCCESS : JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+}
+
+void destroy_interval_writer(IntervalWriter writer)
+{
+	free(writer);
+}
+
+StreamWriter create_stream_writer(const JpgFrame *frame, FILE *fp)
+{
+	StreamWriter writer = NULL;
+	JpgFrame whole;
+	int i = 0;
+
+	// the blocks only cover a strip, the rest of the frame is checked as if they covered the image
+	whole = *frame;
+	for (i = 0; i < frame->num_components && i < JPG_FRAME_COMPONENTS; i++){
+		whole.components[i].height_in_blocks = 65536;
+	}
+
+	if (frame->progressive || check_frame(&whole) != JPG_WRITE_SUCCESS || (frame->optimize_huffman && frame->symbol_freq == NULL)){
+		return NULL;
+	}
+
+	writer = calloc(1, sizeof(stream_writer));
+
+	if (writer != NULL){
+		writer->frame = *frame;
+		writer->fp = fp;
+		writer->num_mcus = count_mcus(frame);
+		writer->mcus_per_row = count_mcus_across(frame);
+
+		writer->bw.out = &writer->buffer;
+		writer->bw.error = JPG_WRITE_SUCCESS;
+
+		build_huffman_tables(frame, writer->dc, writer->ac);
+
+		if (write_headers(frame, writer->dc, writer->ac, &writer->buffer) != JPG_WRITE_SUCCESS || flush_stream(writer) != JPG_WRITE_SUCCESS){
+			destroy_stream_writer(writer);
+			writer = NULL;
+		}
+	}
+
+	return writer;
+}
+
+int stream_writer_encode(StreamWriter writer, int num_rows)
+{
+	const JpgFrame *frame = &writer->frame;
+	int restart = frame->restart_interval;
+	int end = writer->mcu + num_rows * writer->mcus_per_row;
+	int first = writer->mcu, i = 0, v = 0;
+
+	for (i = 0; i < frame->num_components; i++){
+		v = (frame->num_components == 1) ? 1 : frame->components[i].v_samp;
+
+		if (num_rows * v > frame->components[i].height_in_blocks){
+			return JPG_WRITE_BAD_FRAME;
+		}
+	}
+
+	end = (end > writer->num_mcus) ? writer->num_mcus : end;
+
+	for (; writer->mcu < end && writer->bw.error == JPG_WRITE_SUCCESS; writer->mcu++){
+		// the restart markers and DC predictions carry on from the strip before
+		if (restart && writer->mcu > 0 && writer->mcu % restart == 0){
+			write_restart_marker(&writer->bw, writer->mcu / restart - 1);
+
+			for (i = 0; i < JPG_FRAME_COMPONENTS; i++){
+				writer->dc_pred[i] = 0;
+			}
+		}
+
+		scan_mcu(frame, &writer->bw, writer->dc, writer->ac, NULL, NULL, writer->dc_pred,
+		         writer->mcu % writer->mcus_per_row, (writer->mcu - first) / writer->mcus_per_row);
+	}
+
+	return (writer->bw.error == JPG_WRITE_SUCCESS) ? flush_stream(writer) : writer->bw.error;
+}
+
+int stream_writer_end(StreamWriter writer)
+{
+	const Byte eoi[2] = {0xFF, MARKER_EOI};
+
+	flush_bits(&writer->bw);
+
+	if (writer->bw.error == JPG_WRITE_SUCCESS && !append_bytes(&writer->buffer, eoi, 2)){
+		writer->bw.error = JPG_WRITE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	return (writer->bw.error == JPG_WRITE_SUCCESS) ? flush_stream(writer) : writer->bw.error;
+}
+
+void stream_writer_set_blocks(StreamWriter writer, int **blocks[])
+{
+	int i = 0;
+
+	for (i = 0; i < writer->frame.num_components; i++){
+		writer->frame.components[i].blocks = blocks[i];
+	}
+}
+
+long long stream_writer_bytes(StreamWriter writer)
+{
+	return writer->bytes;
+}
+
+void destroy_stream_writer(StreamWriter writer)
+{
+	free_jpeg_buffer(&writer->buffer);
+	free(writer);
+}
+
+int flush_stream(StreamWriter writer)
+{
+	if (writer->buffer.size > 0 && fwrite(writer->buffer.data, sizeof(Byte), writer->buffer.size, writer->fp) != writer->buffer.size){
+		writer->bw.error = JPG_WRITE_FAILED;
+	}
+
+	writer->bytes += writer->buffer.size;
+	writer->buffer.size = 0;
+
+	return writer->bw.error;
+}
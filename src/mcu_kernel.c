@@ -0,0 +1,412 @@
+// sysconf
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "headers/jpg_encode.h"
+#include "headers/block.h"
+#include "headers/quantise.h"
+#include "headers/zig_zag.h"
+#include "headers/huffman.h"
+#include "headers/mcu_kernel.h"
+#include "headers/fdct.h"
+#include "headers/tables.h"
+#include "headers/thread_pool.h"
+#include "headers/perf_counters.h"
+#include "headers/trace.h"
+
+// layouts of MCU (the first index of mcu_kernels)
+#define MCU_444 0
+#define MCU_422 1
+#define MCU_420 2
+#define MCU_GREY 3
+#define NUM_MCU_LAYOUTS 4
+
+// the three ways a block is transformed: flat (DC only), floating point and fixed point DCT. Each
+// leaves the quantised coefficients of the block in zz (zig-zag order).
+void transform_flat_block(const McuState *state, Block b, const int *quant, int *zz);
+void transform_block_float(const McuState *state, Block b, const int *quant, int *zz);
+void transform_block_integer(const McuState *state, Block b, const int *quant, int *zz);
+
+// counts the DC difference and AC symbols of a block of component c with table t (0 or 1)
+void count_block_symbols(McuState *state, int c, int t, int *zz);
+
+// the rows of MCUs one task of transform_mcus does, with symbol counts of their own
+typedef struct _mcu_band{
+	int first_row;
+	int end_row; // one past the last row
+	McuState state;
+	HuffmanData freq[4];
+	long long counters[JPG_NUM_COUNTERS]; // hardware counters of a band done by a worker thread
+} McuBand;
+
+// what the tasks of transform_mcus share
+typedef struct _mcu_work{
+	JpgData j_data;
+	McuKernel kernel;
+	McuBand *bands;
+	int mcus_across;
+	pthread_t caller; // the thread timing the stage
+} McuWork;
+
+// transforms the MCUs of band i (a ThreadTask)
+void transform_band(void *arg, int i);
+
+/*
+	Adds the symbols counted by each band to symbol_freq. A band predicts its first DC values from
+	0, so unless it starts at a restart marker they are counted again as differences from the last
+	blocks of the band above.
+*/
+void merge_band_symbols(McuWork *work, int num_bands);
+
+// index of the first (or last when last is 1) block of component c in the MCU at (mx, my)
+int mcu_block_index(JpgData j_data, int c, int mx, int my, int last);
+
+/*
+	Defines a kernel for an MCU of H x V luminance blocks followed by one block of each chrominance
+	component (when there are 3 components). TRANSFORM is one of the block transforms above, and
+	COUNT is 1 for the kernels that count huffman symbols.
+*/
+#define DEFINE_MCU_KERNEL(name, H, V, COMPONENTS, TRANSFORM, COUNT)                                        \
+void name(JpgData j_data, McuState *state, int mx, int my)                                                \
+{                                                                                                         \
+	Block *blocks[3] = {j_data->Y, j_data->Cb, j_data->Cr};                                               \
+	Byte *flat[3] = {j_data->flat_Y, j_data->flat_Cb, j_data->flat_Cr};                                   \
+	int **zz[3] = {j_data->zig_zag_Y, j_data->zig_zag_Cb, j_data->zig_zag_Cr};                            \
+	int h = 0, v = 0, c = 0, i = 0;                                                                       \
+                                                                                                          \
+	for (v = 0; v < (V); v++){                                                                            \
+		for (h = 0; h < (H); h++){                                                                        \
+			i = (my * (V) + v) * j_data->width_in_blocks + mx * (H) + h;                                  \
+                                                                                                          \
+			if (IS_FLAT(flat[0], i)) transform_flat_block(state, blocks[0][i], state->quant[0], zz[0][i]);\
+			else TRANSFORM(state, blocks[0][i], state->quant[0], zz[0][i]);                               \
+                                                                                                          \
+			if (COUNT) count_block_symbols(state, 0, 0, zz[0][i]);                                        \
+		}                                                                                                 \
+	}                                                                                                     \
+                                                                                                          \
+	for (c = 1; c < (COMPONENTS); c++){                                                                   \
+		i = my * (j_data->width_in_blocks / (H)) + mx;                                                    \
+                                                                                                          \
+		if (IS_FLAT(flat[c], i)) transform_flat_block(state, blocks[c][i], state->quant[1], zz[c][i]);    \
+		else TRANSFORM(state, blocks[c][i], state->quant[1], zz[c][i]);                                   \
+                                                                                                          \
+		if (COUNT) count_block_symbols(state, c, 1, zz[c][i]);                                            \
+	}                                                                                                     \
+}
+
+DEFINE_MCU_KERNEL(mcu_444_float, 1, 1, 3, transform_block_float, 0)
+DEFINE_MCU_KERNEL(mcu_444_float_count, 1, 1, 3, transform_block_float, 1)
+DEFINE_MCU_KERNEL(mcu_444_integer, 1, 1, 3, transform_block_integer, 0)
+DEFINE_MCU_KERNEL(mcu_444_integer_count, 1, 1, 3, transform_block_integer, 1)
+
+DEFINE_MCU_KERNEL(mcu_422_float, 2, 1, 3, transform_block_float, 0)
+DEFINE_MCU_KERNEL(mcu_422_float_count, 2, 1, 3, transform_block_float, 1)
+DEFINE_MCU_KERNEL(mcu_422_integer, 2, 1, 3, transform_block_integer, 0)
+DEFINE_MCU_KERNEL(mcu_422_integer_count, 2, 1, 3, transform_block_integer, 1)
+
+DEFINE_MCU_KERNEL(mcu_420_float, 2, 2, 3, transform_block_float, 0)
+DEFINE_MCU_KERNEL(mcu_420_float_count, 2, 2, 3, transform_block_float, 1)
+DEFINE_MCU_KERNEL(mcu_420_integer, 2, 2, 3, transform_block_integer, 0)
+DEFINE_MCU_KERNEL(mcu_420_integer_count, 2, 2, 3, transform_block_integer, 1)
+
+DEFINE_MCU_KERNEL(mcu_grey_float, 1, 1, 1, transform_block_float, 0)
+DEFINE_MCU_KERNEL(mcu_grey_float_count, 1, 1, 1, transform_block_float, 1)
+DEFINE_MCU_KERNEL(mcu_grey_integer, 1, 1, 1, transform_block_integer, 0)
+DEFINE_MCU_KERNEL(mcu_grey_integer_count, 1, 1, 1, transform_block_integer, 1)
+
+// [layout][dct method][1 to count symbols]
+static const McuKernel mcu_kernels[NUM_MCU_LAYOUTS][2][2] = {
+	{{mcu_444_float, mcu_444_float_count}, {mcu_444_integer, mcu_444_integer_count}},
+	{{mcu_422_float, mcu_422_float_count}, {mcu_422_integer, mcu_422_integer_count}},
+	{{mcu_420_float, mcu_420_float_count}, {mcu_420_integer, mcu_420_integer_count}},
+	{{mcu_grey_float, mcu_grey_float_count}, {mcu_grey_integer, mcu_grey_integer_count}}
+};
+
+// 1 if the symbols are counted as the blocks are made: optimal tables for a baseline image
+#define COUNTS_SYMBOLS(options) ((options).optimize_huffman && !(options).progressive)
+
+/* ==================================== Function definitions ===================================== */
+
+McuKernel select_mcu_kernel(JpgData j_data)
+{
+	return select_mcu_kernel_for(j_data, COUNTS_SYMBOLS(j_data->options));
+}
+
+McuKernel select_mcu_kernel_for(JpgData j_data, int count)
+{
+	int layout = 0, method = j_data->options.dct_method;
+
+	if (j_data->num_components == 1) layout = MCU_GREY;
+	else if (j_data->h_samp == 1 && j_data->v_samp == 1) layout = MCU_444;
+	else if (j_data->h_samp == 2 && j_data->v_samp == 1) layout = MCU_422;
+	else if (j_data->h_samp == 2 && j_data->v_samp == 2) layout = MCU_420;
+	else return NULL;
+
+	if (method != JPG_DCT_FLOAT && method != JPG_DCT_INTEGER){
+		return NULL;
+	}
+
+	return mcu_kernels[layout][method][count != 0];
+}
+
+void init_mcu_state(JpgData j_data, McuState *state)
+{
+	int i = 0;
+
+	// the fixed point DCT leaves its coefficients FDCT_INTEGER_SHIFT bits too large
+	int shift = (j_data->options.dct_method == JPG_DCT_INTEGER) ? FDCT_INTEGER_SHIFT : 0;
+
+	build_quant_table(quanMatrixLum, j_data->quality, j_data->quant_lum);
+	build_quant_table(quanMatrixChr, j_data->quality, j_data->quant_chr);
+
+	for (i = 0; i < 64; i++){
+		state->quant[0][i] = j_data->quant_lum[i] << shift;
+		state->quant[1][i] = j_data->quant_chr[i] << shift;
+	}
+
+	state->quant_shift = shift;
+	state->kernels = jpg_kernels();
+	state->dc_pred[0] = state->dc_pred[1] = state->dc_pred[2] = 0;
+	state->freq = NULL;
+}
+
+int transform_mcus(JpgData j_data)
+{
+	McuWork work;
+	McuState state;
+	ThreadPool pool = NULL;
+	int h = (j_data->num_components == 1) ? 1 : j_data->h_samp;
+	int v = (j_data->num_components == 1) ? 1 : j_data->v_samp;
+	int mcus_down = j_data->height_in_blocks / v;
+	int num_bands = j_data->options.num_threads;
+	int b = 0, i = 0;
+
+	work.j_data = j_data;
+	work.kernel = select_mcu_kernel(j_data);
+	work.mcus_across = j_data->width_in_blocks / h;
+	work.caller = pthread_self();
+
+	if (work.kernel == NULL){
+		return JPG_ENC_BAD_OPTIONS;
+	}
+
+	// a band of MCU rows for each thread
+	if (num_bands == JPG_THREADS_AUTO){
+		num_bands = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	num_bands = (num_bands > mcus_down) ? mcus_down : num_bands;
+	num_bands = (num_bands < 1) ? 1 : num_bands;
+
+	work.bands = malloc(sizeof(McuBand) * num_bands);
+	if (work.bands == NULL){
+		return JPG_ENC_FAILED_ALLOCATE_BUFFER;
+	}
+
+	allocate_zig_zag(j_data);
+	init_mcu_state(j_data, &state);
+	j_data->symbols_counted = COUNTS_SYMBOLS(j_data->options);
+
+	for (b = 0; b < num_bands; b++){
+		work.bands[b].first_row = mcus_down * b / num_bands;
+		work.bands[b].end_row = mcus_down * (b + 1) / num_bands;
+		work.bands[b].state = state;
+		work.bands[b].state.freq = work.bands[b].freq;
+		memset(work.bands[b].counters, 0, sizeof(work.bands[b].counters));
+
+		for (i = 0; i < 4; i++){
+			initialize_huffman_data(&work.bands[b].freq[i]);
+		}
+	}
+
+	// the bands are independent, without a pool they are done one after another
+	if (num_bands > 1){
+		pool = create_thread_pool(num_bands);
+	}
+
+	if (pool != NULL){
+		thread_pool_run(pool, transform_band, &work, num_bands);
+		destroy_thread_pool(pool);
+	}
+
+	else{
+		for (b = 0; b < num_bands; b++){
+			transform_band(&work, b);
+		}
+	}
+
+	if (j_data->symbols_counted){
+		merge_band_symbols(&work, num_bands);
+	}
+
+	// the counters of the calling thread cover the bands it did, the workers' are added to the stage
+	for (b = 0; j_data->perf != NULL && b < num_bands; b++){
+		for (i = 0; i < JPG_NUM_COUNTERS; i++){
+			j_data->stages[JPG_STAGE_DCT].counters[i] += work.bands[b].counters[i];
+		}
+	}
+
+	free(work.bands);
+
+	return JPG_ENC_SUCCESS;
+}
+
+void transform_band(void *arg, int i)
+{
+	McuWork *work = arg;
+	McuBand *band = &work->bands[i];
+	int restart = work->j_data->options.restart_interval;
+	int mx = 0, my = 0, n = 0;
+	PerfCounters perf = NULL;
+
+	// counters only count the thread that opened them, so a worker opens its own for the band
+	if (work->j_data->perf != NULL && !pthread_equal(pthread_self(), work->caller)){
+		perf = open_perf_counters();
+	}
+
+	if (perf != NULL){
+		start_perf_counters(perf);
+	}
+
+	// a span per band, so the trace shows how evenly the work is split between the threads
+	trace_begin("band", i);
+
+	for (my = band->first_row; my < band->end_row; my++){
+		for (mx = 0; mx < work->mcus_across; mx++){
+			n = my * work->mcus_across + mx;
+
+			// the DC values are predicted from 0 again after each restart marker (and at the start of a band)
+			if ((my == band->first_row && mx == 0) || (restart && n % restart == 0)){
+				band->state.dc_pred[0] = band->state.dc_pred[1] = band->state.dc_pred[2] = 0;
+			}
+
+			work->kernel(work->j_data, &band->state, mx, my);
+		}
+	}
+
+	trace_end();
+
+	if (perf != NULL){
+		add_perf_counters(perf, band->counters);
+		close_perf_counters(perf);
+	}
+}
+
+void merge_band_symbols(McuWork *work, int num_bands)
+{
+	JpgData j_data = work->j_data;
+	HuffmanData *freq = j_data->symbol_freq;
+	int **zz[3] = {j_data->zig_zag_Y, j_data->zig_zag_Cb, j_data->zig_zag_Cr};
+	int restart = j_data->options.restart_interval;
+	int b = 0, i = 0, k = 0, c = 0, row = 0, dc = 0, above = 0;
+
+	for (i = 0; i < 4; i++){
+		initialize_huffman_data(&freq[i]);
+
+		// the reserved code point (freq[256]) is only counted once
+		for (b = 0; b < num_bands; b++){
+			for (k = 0; k < 256; k++){
+				freq[i].freq[k] += work->bands[b].freq[i].freq[k];
+			}
+		}
+	}
+
+	for (b = 1; b < num_bands; b++){
+		row = work->bands[b].first_row;
+
+		if (restart && (row * work->mcus_across) % restart == 0){
+			continue;
+		}
+
+		for (c = 0; c < j_data->num_components; c++){
+			dc = zz[c][ mcu_block_index(j_data, c, 0, row, 0) ][0];
+			above = zz[c][ mcu_block_index(j_data, c, work->mcus_across - 1, row - 1, 1) ][0];
+
+			freq[2 * (c > 0)].freq[ get_class(dc) ]--;
+			freq[2 * (c > 0)].freq[ get_class(dc - above) ]++;
+		}
+	}
+}
+
+int mcu_block_index(JpgData j_data, int c, int mx, int my, int last)
+{
+	int h = (j_data->num_components == 1) ? 1 : j_data->h_samp;
+	int v = (j_data->num_components == 1) ? 1 : j_data->v_samp;
+
+	if (c > 0){
+		return my * (j_data->width_in_blocks / h) + mx;
+	}
+
+	return (my * v + (last ? v - 1 : 0)) * j_data->width_in_blocks + mx * h + (last ? h - 1 : 0);
+}
+
+void transform_block(const McuState *state, Block b, int flat, int t, int *zz)
+{
+	if (flat) transform_flat_block(state, b, state->quant[t], zz);
+	else if (state->quant_shift > 0) transform_block_integer(state, b, state->quant[t], zz);
+	else transform_block_float(state, b, state->quant[t], zz);
+}
+
+void transform_flat_block(const McuState *state, Block b, const int *quant, int *zz)
+{
+	short samples[64];
+	int dc = 0, q = quant[0];
+
+	memset(zz, 0, sizeof(int) * 64);
+
+	// the DC value the full DCT would give, so a block that is exactly flat codes the same either way
+	if (state->quant_shift > 0){
+		fdct_integer_samples(block_values(b), samples);
+		dc = fdct_integer_dc(samples);
+		zz[0] = (dc >= 0) ? (dc + q / 2) / q : -((q / 2 - dc) / q);
+	}
+
+	else{
+		zz[0] = (int) round( fdct_float_dc(block_values(b)) / q );
+	}
+}
+
+void transform_block_float(const McuState *state, Block b, const int *quant, int *zz)
+{
+	double coefficients[64];
+	int k = 0;
+
+	state->kernels->fdct_float(block_values(b), coefficients);
+
+	for (k = 0; k < 64; k++){
+		zz[ scan_order[k / 8][k % 8] ] = (int) round( coefficients[k] / quant[k] );
+	}
+}
+
+void transform_block_integer(const McuState *state, Block b, const int *quant, int *zz)
+{
+	short samples[64];
+	int coefficients[64];
+	int k = 0, value = 0, q = 0;
+
+	fdct_integer_samples(block_values(b), samples);
+	state->kernels->fdct_integer(samples, coefficients);
+
+	// the quantization table is scaled up like the coefficients, the division rounds to the nearest
+	for (k = 0; k < 64; k++){
+		value = coefficients[k];
+		q = quant[k];
+		zz[ scan_order[k / 8][k % 8] ] = (value >= 0) ? (value + q / 2) / q : -((q / 2 - value) / q);
+	}
+}
+
+void count_block_symbols(McuState *state, int c, int t, int *zz)
+{
+	int diff = zz[0] - state->dc_pred[c];
+
+	state->dc_pred[c] = zz[0];
+	state->freq[2 * t].freq[ get_class(diff) ]++;
+	calculate_freq_block_AC(&state->freq[2 * t + 1], zz);
+}
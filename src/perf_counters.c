@@ -0,0 +1,164 @@
+// syscall and ioctl
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "headers/perf_counters.h"
+
+struct _perf_counters{
+	int fd[JPG_NUM_COUNTERS]; // -1 if the counter isn't available
+};
+
+#ifdef __linux__
+
+// opens one counter of the calling thread on any CPU, stopped, returns -1 if it can't be counted
+int open_perf_event(unsigned int type, unsigned long long config);
+
+// reads a counter, scaled up if the kernel had to share the hardware with other counters
+long long read_perf_event(int fd);
+
+#endif
+
+/* ==================================== Function definitions ===================================== */
+
+PerfCounters open_perf_counters(void)
+{
+	PerfCounters counters = malloc(sizeof(struct _perf_counters));
+	int i = 0, available = 0;
+
+	if (counters == NULL){
+		return NULL;
+	}
+
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		counters->fd[i] = -1;
+	}
+
+#ifdef __linux__
+	counters->fd[JPG_COUNTER_CYCLES] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	counters->fd[JPG_COUNTER_INSTRUCTIONS] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	counters->fd[JPG_COUNTER_BRANCH_MISSES] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+	// cache events are the cache, the operation and the result a byte each
+	counters->fd[JPG_COUNTER_L1D_MISSES] = open_perf_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	counters->fd[JPG_COUNTER_LLC_MISSES] = open_perf_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		available += (counters->fd[i] >= 0);
+	}
+
+	if (!available){
+		free(counters);
+		return NULL;
+	}
+
+	return counters;
+}
+
+int perf_counter_available(PerfCounters counters, int counter)
+{
+	return counters != NULL && counters->fd[counter] >= 0;
+}
+
+void start_perf_counters(PerfCounters counters)
+{
+#ifdef __linux__
+	int i = 0;
+
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		if (counters->fd[i] >= 0){
+			ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+void add_perf_counters(PerfCounters counters, long long values[JPG_NUM_COUNTERS])
+{
+#ifdef __linux__
+	int i = 0;
+
+	// stop them all first so reading one isn't counted by the next
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		if (counters->fd[i] >= 0){
+			ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		if (counters->fd[i] >= 0){
+			values[i] += read_perf_event(counters->fd[i]);
+		}
+	}
+#endif
+}
+
+void close_perf_counters(PerfCounters counters)
+{
+	int i = 0;
+
+	if (counters == NULL){
+		return;
+	}
+
+#ifdef __linux__
+	for (i = 0; i < JPG_NUM_COUNTERS; i++){
+		if (counters->fd[i] >= 0){
+			close(counters->fd[i]);
+		}
+	}
+#else
+	(void) i;
+#endif
+
+	free(counters);
+}
+
+#ifdef __linux__
+
+int open_perf_event(unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1; // allowed with perf_event_paranoid up to 2
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long read_perf_event(int fd)
+{
+	// value, time enabled, time running
+	unsigned long long data[3];
+
+	if (read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0){
+		return 0;
+	}
+
+	if (data[2] < data[1]){
+		return (long long) ((double) data[0] * data[1] / data[2]);
+	}
+
+	return (long long) data[0];
+}
+
+#endif
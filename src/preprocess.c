@@ -10,167 +10,375 @@
 
 // helper functions
 
-// determines resolutions of each colour component based on compression settings (e.g sampling, )
-void determine_resolutions(JpgData j_data, int *num_extra_bytes_width, int *num_extra_bytes_height);
-
 // converts the RGB values into YUV values
-void convert_blocks(JpgData j_data, BmpImage bmp, int extra_width, int extra_height);
+void convert_blocks(JpgData j_data, BmpImage bmp);
 
 // levels shifts each block
 void level_shift(JpgData j_data);
 
-// converts block number to starting and ending coordinates (x,y)
-void blockToCoords(int bn, int *x, int *y, unsigned int w);
-
 void preprocess_jpeg(JpgData j_data)
 {
     BmpImage bmp = NULL;
-    int extra_width = 0, extra_height = 0;
     int i = 0;
     char *input_filename = NULL;
 
     input_filename = j_data->input_filename;
 
-    // get the array of pixels
-    bmp = bmp_OpenBitmap(input_filename);
+    // get the array of pixels, from memory if the file has already been read
+    if ( j_data->input_data != NULL ){
+        bmp = bmp_OpenBitmapFromMemory(j_data->input_data, j_data->input_size);
+    }
 
-    if ( bmp != NULL ){
+    else{
+        bmp = bmp_OpenBitmap(input_filename);
+    }
+
+    if ( bmp != NULL && bmp_GetWidth(bmp) > 0 && bmp_GetHeight(bmp) > 0 && bmp_GetRed(bmp) != NULL ){
         j_data->width = bmp_GetWidth(bmp);
         j_data->height = bmp_GetHeight(bmp);
+        j_data->input_bytes = bmp_GetFileSize(bmp);
+
+        // greyscale images only need the luminance channel
+        j_data->num_components = bmp_IsGrayscale(bmp) ? 1 : 3;
 
         // determine resolutions
-        determine_resolutions(j_data, &extra_width, &extra_height);
+        determine_resolutions(j_data);
 
         // allocate memory for blocks (mcus)
-        j_data->num_blocks_Y = (j_data->width / 8) * (j_data->height / 8);
-        j_data->num_blocks_Cb = (j_data->width / 8) * (j_data->height / 8);
-        j_data->num_blocks_Cr = (j_data->width / 8) * (j_data->height / 8);
+        j_data->num_blocks_Y = j_data->width_in_blocks * j_data->height_in_blocks;
+        j_data->num_blocks_Cb = (j_data->num_components == 3) ? j_data->num_blocks_Y : 0;
+        j_data->num_blocks_Cr = j_data->num_blocks_Cb;
 
         // store all the RGB information
         j_data->Y  = malloc(sizeof(Block) * j_data->num_blocks_Y);
         j_data->Cb = malloc(sizeof(Block) * j_data->num_blocks_Cb);
         j_data->Cr = malloc(sizeof(Block) * j_data->num_blocks_Cr);
 
+        j_data->flat_Y  = calloc(j_data->num_blocks_Y, sizeof(Byte));
+        j_data->flat_Cb = calloc(j_data->num_blocks_Cb, sizeof(Byte));
+        j_data->flat_Cr = calloc(j_data->num_blocks_Cr, sizeof(Byte));
+
         // create all the blocks, mcus
         for (i = 0; i < j_data->num_blocks_Y; i++){
             j_data->Y[i]  = new_block();
+        }
+
+        for (i = 0; i < j_data->num_blocks_Cb; i++){
             j_data->Cb[i] = new_block();
             j_data->Cr[i] = new_block();
         }
 
-        convert_blocks(j_data, bmp, extra_width, extra_height);
+        // the lists above and a block each
+        j_data->allocations += 6 + j_data->num_blocks_Y + j_data->num_blocks_Cb + j_data->num_blocks_Cr;
+
+        convert_blocks(j_data, bmp);
         level_shift(j_data);
     }
 
-    else{
+    else if ( bmp != NULL ){
         bmp_GetLastError(bmp);
     }
 
-    bmp_DestroyBitmap(bmp);
+    if ( bmp != NULL ){
+        bmp_DestroyBitmap(bmp);
+    }
 }
 
-void determine_resolutions(JpgData j_data, int *num_extra_bytes_width, int *num_extra_bytes_height)
+int preprocess_yuv(JpgData j_data, const JpgYuvImage *image)
 {
-    int w = 0, h = 0;
-    int sample = 0;
-    int extra_width = 0, extra_height = 0;
+    YuvPlane planes[3];
+    int blocks_across[3], num_blocks[3];
+    Block *blocks[3];
+    Byte *flat[3];
+    int c = 0, i = 0;
+
+    if ( yuv_planes(image, planes, &j_data->h_samp, &j_data->v_samp) != JPG_ENC_SUCCESS ){
+        return JPG_ENC_BAD_OPTIONS;
+    }
+
+    j_data->width = image->width;
+    j_data->height = image->height;
+    j_data->num_components = 3;
+    j_data->sample_ratio = (j_data->v_samp == 2) ? HORIZONTAL_VERTICAL_SUBSAMPLING : HORIZONTAL_SUBSAMPLING;
+
+    // whole MCUs of 2x2 or 2x1 luminance blocks and one block of each chroma channel
+    determine_resolutions(j_data);
+
+    blocks_across[0] = j_data->width_in_blocks;
+    blocks_across[1] = blocks_across[2] = j_data->width_in_blocks / j_data->h_samp;
+
+    j_data->num_blocks_Y = j_data->width_in_blocks * j_data->height_in_blocks;
+    j_data->num_blocks_Cb = blocks_across[1] * (j_data->height_in_blocks / j_data->v_samp);
+    j_data->num_blocks_Cr = j_data->num_blocks_Cb;
+
+    num_blocks[0] = j_data->num_blocks_Y;
+    num_blocks[1] = j_data->num_blocks_Cb;
+    num_blocks[2] = j_data->num_blocks_Cr;
+
+    // a full size luminance plane and two chroma planes of the sampled size
+    j_data->input_bytes = (size_t) image->width * image->height
+                          + 2 * (size_t) ((image->width + j_data->h_samp - 1) / j_data->h_samp) * ((image->height + j_data->v_samp - 1) / j_data->v_samp);
+    j_data->allocations += 6 + num_blocks[0] + num_blocks[1] + num_blocks[2];
+
+    j_data->Y  = malloc(sizeof(Block) * j_data->num_blocks_Y);
+    j_data->Cb = malloc(sizeof(Block) * j_data->num_blocks_Cb);
+    j_data->Cr = malloc(sizeof(Block) * j_data->num_blocks_Cr);
+
+    j_data->flat_Y  = calloc(j_data->num_blocks_Y, sizeof(Byte));
+    j_data->flat_Cb = calloc(j_data->num_blocks_Cb, sizeof(Byte));
+    j_data->flat_Cr = calloc(j_data->num_blocks_Cr, sizeof(Byte));
+
+    blocks[0] = j_data->Y;
+    blocks[1] = j_data->Cb;
+    blocks[2] = j_data->Cr;
+
+    flat[0] = j_data->flat_Y;
+    flat[1] = j_data->flat_Cb;
+    flat[2] = j_data->flat_Cr;
+
+    for ( c = 0; c < 3; c++ ){
+        for ( i = 0; i < num_blocks[c]; i++ ){
+            blocks[c][i] = new_block();
+            flat[c][i] = fill_block(blocks[c][i], &planes[c], i % blocks_across[c], i / blocks_across[c],
+                                    j_data->options.flat_threshold);
+            j_data->num_flat_blocks += flat[c][i];
+        }
+    }
+
+    return JPG_ENC_SUCCESS;
+}
+
+int yuv_planes(const JpgYuvImage *image, YuvPlane planes[3], int *h_samp, int *v_samp)
+{
+    int w = image->width, h = image->height;
+    int c = 0;
+
+    if ( w <= 0 || h <= 0 || image->planes[0] == NULL ){
+        return JPG_ENC_BAD_OPTIONS;
+    }
+
+    for ( c = 0; c < 3; c++ ){
+        planes[c].samples = NULL;
+        planes[c].stride = 0;
+        planes[c].step = 1;
+    }
+
+    // where the samples of each channel are
+    if ( image->format == JPG_YUV_I420 ){
+        for ( c = 0; c < 3; c++ ){
+            planes[c].samples = image->planes[c];
+            planes[c].stride = image->strides[c];
+        }
+
+        *h_samp = *v_samp = 2;
+    }
+
+    else if ( image->format == JPG_YUV_NV12 ){
+        planes[0].samples = image->planes[0];
+        planes[1].samples = image->planes[1];
+        planes[2].samples = (image->planes[1] != NULL) ? image->planes[1] + 1 : NULL;
+        planes[0].stride = image->strides[0];
+        planes[1].stride = planes[2].stride = image->strides[1];
+        planes[1].step = planes[2].step = 2;
+        *h_samp = *v_samp = 2;
+    }
+
+    else if ( image->format == JPG_YUV_YUYV ){
+        planes[0].samples = image->planes[0];
+        planes[1].samples = image->planes[0] + 1;
+        planes[2].samples = image->planes[0] + 3;
+        planes[0].stride = planes[1].stride = planes[2].stride = image->strides[0];
+        planes[0].step = 2;
+        planes[1].step = planes[2].step = 4;
+        *h_samp = 2;
+        *v_samp = 1;
+    }
+
+    else{
+        return JPG_ENC_BAD_OPTIONS;
+    }
+
+    planes[0].width = w;
+    planes[0].height = h;
+    planes[1].width = planes[2].width = (w + 1) / 2;
+    planes[1].height = planes[2].height = (*v_samp == 2) ? (h + 1) / 2 : h;
 
-    w = j_data->width;
-    h = j_data->height;
-    sample = j_data->sample_ratio;
+    for ( c = 0; c < 3; c++ ){
+        if ( planes[c].samples == NULL || planes[c].stride < (planes[c].width - 1) * planes[c].step + 1 ){
+            return JPG_ENC_BAD_OPTIONS;
+        }
+    }
+
+    return JPG_ENC_SUCCESS;
+}
+
+int fill_block(Block b, const YuvPlane *plane, int bx, int by, double threshold)
+{
+    const Byte *row = NULL;
+    int x = 0, y = 0, px = 0, py = 0;
+    int value = 0, min = 255, max = 0;
+
+    for ( y = 0; y < 8; y++ ){
+        py = by * 8 + y;
+        row = plane->samples + (size_t) ((py < plane->height) ? py : plane->height - 1) * plane->stride;
 
-    if ( sample == NO_CHROMA_SUBSAMPLING ){
-        *num_extra_bytes_width = extra_width = w % 8;
-        *num_extra_bytes_height = extra_height = h % 8;
+        for ( x = 0; x < 8; x++ ){
+            px = bx * 8 + x;
+            value = row[ (size_t) ((px < plane->width) ? px : plane->width - 1) * plane->step ];
+
+            if ( value < min ) min = value;
+            if ( value > max ) max = value;
+
+            set_value_block(b, x, y, value - 128);
+        }
     }
 
-    else if ( sample == HORIZONTAL_SUBSAMPLING ){
-        *num_extra_bytes_width = extra_width = w % 16;
-        *num_extra_bytes_height = extra_height = h % 8;
+    return ( max - min <= threshold );
+}
+
+void determine_resolutions(JpgData j_data)
+{
+    int mcu_width = 8, mcu_height = 8;
+    int sample = 0;
+
+    // a single component is never subsampled
+    sample = (j_data->num_components == 1) ? NO_CHROMA_SUBSAMPLING : j_data->sample_ratio;
+
+    if ( sample == HORIZONTAL_SUBSAMPLING ){
+        mcu_width = 16;
     }
 
     else if ( sample == HORIZONTAL_VERTICAL_SUBSAMPLING ){
-        *num_extra_bytes_width = extra_width = w % 16;
-        *num_extra_bytes_height = extra_height = h % 16;
+        mcu_width = 16;
+        mcu_height = 16;
     }
 
-    j_data->width += extra_width;
-    j_data->height += extra_height;
+    // the image is padded to whole MCUs
+    j_data->width_in_blocks = (j_data->width + mcu_width - 1) / mcu_width * (mcu_width / 8);
+    j_data->height_in_blocks = (j_data->height + mcu_height - 1) / mcu_height * (mcu_height / 8);
 }
 
-void convert_blocks(JpgData j_data, BmpImage bmp, int extra_width, int extra_height)
+void convert_blocks(JpgData j_data, BmpImage bmp)
 {
-    int i = 0, j = 0;
-    int original_width = 0;
+    int i = 0;
     Byte *r = NULL, *b = NULL, *g = NULL;
-    Byte *r_new = NULL, *b_new = NULL, *g_new = NULL;
-    int original_num_pixels = 0;
-    int num_pixels_new = 0;
-    int x_coords[2] = {0}, y_coords[2] = {0};
-    int x = 0, y = 0;
-    int offset = 0;
+    int x = 0, y = 0, px = 0, py = 0;
+    size_t offset = 0;
+    int c = 0;
     double y_value = 0.0, cb_value = 0.0, cr_value = 0.0;
+    double value[3], min[3], max[3];
+    Byte *flat[3] = {j_data->flat_Y, j_data->flat_Cb, j_data->flat_Cr};
+    double threshold = j_data->options.flat_threshold;
 
     // get the RGB colour channels
     r = bmp_GetRed(bmp);
     g = bmp_GetGreen(bmp);
     b = bmp_GetBlue(bmp);
 
-    // bmp_GetLastError(bmp);
-
-    // convert RGB => YUV
-    original_width      = j_data->width - extra_width;
-    original_num_pixels = bmp_GetNumPixels(bmp);
-
-    // create new RGB buffers to accomodate for resolution changes
-    num_pixels_new = j_data->width * j_data->height;
-    r_new = malloc(sizeof(Byte) * num_pixels_new);
-    g_new = malloc(sizeof(Byte) * num_pixels_new);
-    b_new = malloc(sizeof(Byte) * num_pixels_new);
-
-    for ( i = 0; i < original_num_pixels; i++ ){
-        r_new[i] = r[i];
-        g_new[i] = g[i];
-        b_new[i] = b[i];
-
-        if ( extra_width ){
-            for ( j = 1; j <= extra_width; j++ ){
-                r_new[i + j] = r_new[i];
-                g_new[i + j] = g_new[i];
-                b_new[i + j] = b_new[i];
+    // fill in the blocks, the padding repeats the last column and row of the image
+    for ( i = 0; i < j_data->num_blocks_Y; i++ ){
+        for ( y = 0; y < 8; y++ ){
+            for ( x = 0; x < 8; x++ ){
+                px = (i % j_data->width_in_blocks) * 8 + x;
+                py = (i / j_data->width_in_blocks) * 8 + y;
+
+                if ( px >= j_data->width ) px = j_data->width - 1;
+                if ( py >= j_data->height ) py = j_data->height - 1;
+
+                offset = (size_t) py * j_data->width + px;
+
+                // grey pixels are their own luminance
+                if ( j_data->num_components == 1 ){
+                    y_value = r[offset];
+                    set_value_block(j_data->Y[i], x, y, y_value);
+                }
+
+                // convert RGB => YUV
+                else{
+                    y_value  = 0.299 * r[offset] + 0.587 * g[offset] + 0.114 * b[offset];
+                    cb_value = 128 - 0.168736 * r[offset] - 0.331264 * g[offset] + 0.5 * b[offset];
+                    cr_value = 128 + 0.5 * r[offset] - 0.418688 * g[offset] - 0.081312 * b[offset];
+
+                    set_value_block(j_data->Y[i], x, y, y_value);
+                    set_value_block(j_data->Cb[i], x, y, cb_value);
+                    set_value_block(j_data->Cr[i], x, y, cr_value);
+                }
+
+                // range of each channel in the block, flat blocks skip the DCT
+                value[0] = y_value;
+                value[1] = cb_value;
+                value[2] = cr_value;
+
+                for ( c = 0; c < j_data->num_components; c++ ){
+                    if ( (x == 0 && y == 0) || value[c] < min[c] ) min[c] = value[c];
+                    if ( (x == 0 && y == 0) || value[c] > max[c] ) max[c] = value[c];
+                }
             }
         }
-    }
 
-    // fill in the remaining pixels
-    if ( extra_height ){
-        for ( i = original_num_pixels; i < num_pixels_new; i++ ){
-            r_new[i] = r_new[i - j_data->width];
-            g_new[i] = g_new[i - j_data->width];
-            b_new[i] = b_new[i - j_data->width];
+        for ( c = 0; c < j_data->num_components; c++ ){
+            flat[c][i] = ( max[c] - min[c] <= threshold );
+            j_data->num_flat_blocks += flat[c][i];
         }
     }
+}
+
+void convert_rgb_rows(JpgData j_data, const Byte *rgb, int first_row, int num_rows, int num_blocks)
+{
+    Block blocks[3];
+    double *values[3];
+    const Byte *p = NULL;
+    Byte *flat[3] = {j_data->flat_Y, j_data->flat_Cb, j_data->flat_Cr};
+    double threshold = j_data->options.flat_threshold;
+    double value[3], min[3], max[3];
+    int i = 0, c = 0, x = 0, y = 0, px = 0, py = 0;
+
+    for ( i = 0; i < num_blocks; i++ ){
+        blocks[0] = j_data->Y[i];
+        blocks[1] = (j_data->num_components == 3) ? j_data->Cb[i] : NULL;
+        blocks[2] = (j_data->num_components == 3) ? j_data->Cr[i] : NULL;
+
+        for ( c = 0; c < j_data->num_components; c++ ){
+            values[c] = block_values(blocks[c]);
+        }
 
-    // fill in the blocks
-    for ( i = 1; i <= j_data->num_blocks_Y; i++ ){
-        blockToCoords(i, x_coords, y_coords, j_data->width);
         for ( y = 0; y < 8; y++ ){
+            // rows past the bottom of the image (or of the pixels given) repeat the last one
+            py = first_row + (i / j_data->width_in_blocks) * 8 + y;
+            if ( py >= j_data->height ) py = j_data->height - 1;
+            if ( py >= first_row + num_rows ) py = first_row + num_rows - 1;
+
             for ( x = 0; x < 8; x++ ){
-                offset   = ((y + y_coords[0]) * original_width) + (x_coords[0] + x);
-                y_value  = 0.299 * r_new[offset] + 0.587 * g_new[offset] + 0.114 * b_new[offset];
-                cb_value = 128 - (0.168736 * r_new[offset] - 0.331264 * g_new[offset] + 0.5 * b_new[offset]);
-                cr_value = 128 + (0.5 * r_new[offset] - 0.418688 * g_new[offset] - 0.081312 * b_new[offset]);
-
-                set_value_block(j_data->Y[i-1], x, y, y_value);
-                set_value_block(j_data->Cb[i-1], x, y, cb_value);
-                set_value_block(j_data->Cr[i-1], x, y, cr_value);
+                px = (i % j_data->width_in_blocks) * 8 + x;
+                if ( px >= j_data->width ) px = j_data->width - 1;
+
+                p = rgb + ((size_t) (py - first_row) * j_data->width + px) * 3;
+
+                // the same sums as convert_blocks, level shifted as they are stored
+                if ( j_data->num_components == 1 ){
+                    value[0] = p[0];
+                }
+
+                else{
+                    value[0] = 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+                    value[1] = 128 - 0.168736 * p[0] - 0.331264 * p[1] + 0.5 * p[2];
+                    value[2] = 128 + 0.5 * p[0] - 0.418688 * p[1] - 0.081312 * p[2];
+                }
+
+                for ( c = 0; c < j_data->num_components; c++ ){
+                    values[c][y * 8 + x] = value[c] - 128;
+
+                    if ( (x == 0 && y == 0) || value[c] < min[c] ) min[c] = value[c];
+                    if ( (x == 0 && y == 0) || value[c] > max[c] ) max[c] = value[c];
+                }
             }
         }
-    }
 
-    free(r_new);
-    free(g_new);
-    free(b_new);
+        for ( c = 0; c < j_data->num_components; c++ ){
+            flat[c][i] = ( max[c] - min[c] <= threshold );
+            j_data->num_flat_blocks += flat[c][i];
+        }
+    }
 }
 
 void level_shift(JpgData j_data)
@@ -184,28 +392,21 @@ void level_shift(JpgData j_data)
         for (y = 0; y < 8; y++){
             for (x = 0; x < 8; x++){
                 new_Y  = get_value_block(j_data->Y[i], x, y) - 128;
+                set_value_block(j_data->Y[i], x, y, new_Y);
+            }
+        }
+    }
+
+    n = j_data->num_blocks_Cb;
+    for (i = 0; i < n; i++){
+        for (y = 0; y < 8; y++){
+            for (x = 0; x < 8; x++){
                 new_Cb = get_value_block(j_data->Cb[i], x, y) - 128;
                 new_Cr = get_value_block(j_data->Cr[i], x, y) - 128;
 
-                set_value_block(j_data->Y[i], x, y, new_Y);
                 set_value_block(j_data->Cb[i], x, y, new_Cb);
                 set_value_block(j_data->Cr[i], x, y, new_Cr);
             }
         }
     }
 }
-
-// converts block number to starting and ending coordinates (x,y)
-void blockToCoords(int bn, int *x, int *y, unsigned int w)
-{
-	unsigned int tw = 8 * (unsigned int) bn;
-
-	// set the starting and ending y values
-	y[0] = (int) (tw / w) * 8;
-	y[1] = y[0] + 8;
-	if (tw % w == 0) { y[0] -= 8; y[1] -= 8; } // reached the last block of a row
-	// set the starting and ending x values
-	x[0] = (tw % w) - 8;
-	// if (x[0] == -8) { x[0] = w - 8; } // in last column, maths doesn't make sense, need to do something weird
-	x[1] = x[0] + 8;
-}
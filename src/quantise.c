@@ -1,86 +1,132 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "headers/quantise.h"
-
-// default jpeg quantization matrix for 50% quality (luminance)
-int q_table_lum[TABLE_SIZE][TABLE_SIZE] = {{16, 11, 10, 16, 24, 40, 51, 61},
-											 {12, 12, 14, 19, 26, 58, 60, 55},
-											 {14, 13, 16, 24, 40, 57, 69, 56},
-											 {14, 17, 22, 29, 51, 87, 80, 62},
-											 {18, 22, 37, 56, 68, 109, 103, 77},
-											 {24, 35, 55, 64, 81, 104, 113, 92},
-											 {49, 64, 78, 87, 103, 121, 120, 101},
-											 {72, 92, 95, 98, 112, 100, 103, 99}};
-
-// matrix for chrominance
-int q_table_chr[TABLE_SIZE][TABLE_SIZE] = {{17, 18, 24, 47, 99, 99, 99, 99},
-											 {18, 21, 26, 66, 99, 99, 99, 99},
-											 {24, 26, 56, 99, 99, 99, 99, 99},
-											 {47, 66, 99, 99, 99, 99, 99, 99},
-											 {99, 99, 99, 99, 99, 99, 99, 99},
-											 {99, 99, 99, 99, 99, 99, 99, 99},
-											 {99, 99, 99, 99, 99, 99, 99, 99},
-									         {99, 99, 99, 99, 99, 99, 99, 99}};
-
-// scales the quantization tables according to the quality setting
-void scale_table(int q_table[TABLE_SIZE][TABLE_SIZE], int quality);
+#include "headers/tables.h"
+#include "headers/zig_zag.h"
 
 void quantise(JpgData j_data)
 {
     int i = 0;
 
-	scale_table(q_table_lum, j_data->quality);
-	scale_table(q_table_chr, j_data->quality);
+    // the tables are scaled for this image only, the defaults in tables.h are left alone
+    build_quant_table(quanMatrixLum, j_data->quality, j_data->quant_lum);
+    build_quant_table(quanMatrixChr, j_data->quality, j_data->quant_chr);
 
-    // quantise the luninance components
+    // quantise the luninance components, flat blocks only have a DC coefficient
     for (i = 0; i < j_data->num_blocks_Y; i++){
-        quantise_lum(j_data->Y[i]);
+        if (IS_FLAT(j_data->flat_Y, i)){
+            set_value_block(j_data->Y[i], 0, 0, round( get_value_block(j_data->Y[i], 0, 0) / j_data->quant_lum[0] ));
+        }
+
+        else{
+            quantise_block(j_data->Y[i], j_data->quant_lum);
+        }
     }
 
     // quantise the chrominance components
     for (i = 0; i < j_data->num_blocks_Cb; i++){
-        quantise_chr(j_data->Cb[i]);
+        if (IS_FLAT(j_data->flat_Cb, i)){
+            set_value_block(j_data->Cb[i], 0, 0, round( get_value_block(j_data->Cb[i], 0, 0) / j_data->quant_chr[0] ));
+        }
+
+        else{
+            quantise_block(j_data->Cb[i], j_data->quant_chr);
+        }
     }
 
     for (i = 0; i < j_data->num_blocks_Cr; i++){
-        quantise_chr(j_data->Cr[i]);
+        if (IS_FLAT(j_data->flat_Cr, i)){
+            set_value_block(j_data->Cr[i], 0, 0, round( get_value_block(j_data->Cr[i], 0, 0) / j_data->quant_chr[0] ));
+        }
+
+        else{
+            quantise_block(j_data->Cr[i], j_data->quant_chr);
+        }
     }
 }
 
-void quantise_lum(Block b)
+void quantise_block(Block b, const int *table)
 {
     int i = 0, j = 0;
 
+    // i is the row (vertical frequency), j the column
     for (i = 0; i < 8; i++){
         for (j = 0; j < 8; j++){
-            set_value_block(b, i, j, round( get_value_block(b, i, j) / q_table_lum[i][j] ));
+            set_value_block(b, j, i, round( get_value_block(b, j, i) / table[i * TABLE_SIZE + j] ));
         }
     }
 }
 
-void quantise_chr(Block b)
+void quantise_coefficients(JpgData j_data)
+{
+    int i = 0;
+
+    build_quant_table(quanMatrixLum, j_data->quality, j_data->quant_lum);
+    build_quant_table(quanMatrixChr, j_data->quality, j_data->quant_chr);
+
+    for (i = 0; i < j_data->num_blocks_Y; i++){
+        if (IS_FLAT(j_data->flat_Y, i)){
+            quantise_flat_zig_zag(j_data->Y[i], j_data->quant_lum, j_data->zig_zag_Y[i]);
+        }
+
+        else{
+            quantise_zig_zag(j_data->Y[i], j_data->quant_lum, j_data->zig_zag_Y[i]);
+        }
+    }
+
+    for (i = 0; i < j_data->num_blocks_Cb; i++){
+        if (IS_FLAT(j_data->flat_Cb, i)){
+            quantise_flat_zig_zag(j_data->Cb[i], j_data->quant_chr, j_data->zig_zag_Cb[i]);
+        }
+
+        else{
+            quantise_zig_zag(j_data->Cb[i], j_data->quant_chr, j_data->zig_zag_Cb[i]);
+        }
+    }
+
+    for (i = 0; i < j_data->num_blocks_Cr; i++){
+        if (IS_FLAT(j_data->flat_Cr, i)){
+            quantise_flat_zig_zag(j_data->Cr[i], j_data->quant_chr, j_data->zig_zag_Cr[i]);
+        }
+
+        else{
+            quantise_zig_zag(j_data->Cr[i], j_data->quant_chr, j_data->zig_zag_Cr[i]);
+        }
+    }
+}
+
+void quantise_zig_zag(Block b, const int *table, int *zz)
 {
     int i = 0, j = 0;
 
     for (i = 0; i < 8; i++){
         for (j = 0; j < 8; j++){
-            set_value_block(b, i, j, round( get_value_block(b, i, j) / q_table_chr[i][j] ));
+            zz[ scan_order[i][j] ] = (int) round( get_value_block(b, j, i) / table[i * TABLE_SIZE + j] );
         }
     }
 }
 
-void scale_table(int q_table[TABLE_SIZE][TABLE_SIZE], int quality)
+void quantise_flat_zig_zag(Block b, const int *table, int *zz)
+{
+    memset(zz, 0, sizeof(int) * 64);
+    zz[0] = (int) round( get_value_block(b, 0, 0) / table[0] );
+}
+
+void build_quant_table(const int base[TABLE_SIZE][TABLE_SIZE], int quality, int *table)
 {
 	int i = 0, j = 0;
 	int s = 0, Ts = 0;
 
+	quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+	s = (quality < 50) ? 5000/quality : 200 - 2*quality;
+
 	for (i = 0; i < TABLE_SIZE; i++){
 		for (j = 0; j < TABLE_SIZE; j++){
-			s = (quality < 50) ? 5000/quality : 200 - 2*quality;
-			Ts = (int) floor( (s * q_table[i][j] + 50) / 100);
-			q_table[i][j] = Ts;
+			Ts = (s * base[i][j] + 50) / 100;
+			table[i * TABLE_SIZE + j] = (Ts < 1) ? 1 : (Ts > 255) ? 255 : Ts;
 		}
 	}
 }
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "headers/spsc_ring.h"
+#include "headers/trace.h"
+
+// bytes of a cache line, the positions are kept on lines of their own so the two threads don't share one
+#define RING_LINE 64
+
+typedef struct _spsc_ring{
+	int *values;
+	unsigned long capacity;
+	const char *name;
+
+	// values pushed so far, the next one goes at tail % capacity (written by the producer)
+	unsigned long tail;
+	char pad_tail[RING_LINE];
+
+	// values popped so far (written by the consumer)
+	unsigned long head;
+	char pad_head[RING_LINE];
+
+	// only taken by a thread that has to wait and by the other one to wake it
+	pthread_mutex_t lock;
+	pthread_cond_t moved;
+	int sleeping; // threads waiting on moved
+} spsc_ring;
+
+// waits until the ring has room (full = 1) or a value (full = 0)
+void wait_on_ring(SpscRing ring, int full);
+
+// 1 if the ring has what a push (full = 1) or pop (full = 0) is waiting for
+int ring_ready(SpscRing ring, int full);
+
+// wakes the other side if it is waiting, after a position has moved
+void wake_ring(SpscRing ring);
+
+/* ==================================== Function definitions ===================================== */
+
+SpscRing create_spsc_ring(int capacity, const char *name)
+{
+	SpscRing ring = NULL;
+
+	if (capacity <= 0){
+		return NULL;
+	}
+
+	ring = calloc(1, sizeof(spsc_ring));
+
+	if (ring != NULL){
+		ring->values = malloc(sizeof(int) * capacity);
+
+		if (ring->values == NULL){
+			free(ring);
+			return NULL;
+		}
+
+		ring->capacity = capacity;
+		ring->name = name;
+		pthread_mutex_init(&ring->lock, NULL);
+		pthread_cond_init(&ring->moved, NULL);
+	}
+
+	return ring;
+}
+
+void spsc_ring_push(SpscRing ring, int value)
+{
+	unsigned long tail = ring->tail; // only this thread writes it
+
+	if (!ring_ready(ring, 1)){
+		wait_on_ring(ring, 1);
+	}
+
+	ring->values[tail % ring->capacity] = value;
+
+	// the value is written before the consumer can see the new tail
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	wake_ring(ring);
+}
+
+int spsc_ring_pop(SpscRing ring)
+{
+	unsigned long head = ring->head; // only this thread writes it
+	int value = 0;
+
+	if (!ring_ready(ring, 0)){
+		wait_on_ring(ring, 0);
+	}
+
+	value = ring->values[head % ring->capacity];
+
+	// the value is read before the producer can reuse its place
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+	wake_ring(ring);
+
+	return value;
+}
+
+void destroy_spsc_ring(SpscRing ring)
+{
+	if (ring != NULL){
+		pthread_mutex_destroy(&ring->lock);
+		pthread_cond_destroy(&ring->moved);
+		free(ring->values);
+		free(ring);
+	}
+}
+
+int ring_ready(SpscRing ring, int full)
+{
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+	unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+
+	return full ? (tail - head < ring->capacity) : (tail != head);
+}
+
+void wait_on_ring(SpscRing ring, int full)
+{
+	trace_begin(ring->name, full);
+	pthread_mutex_lock(&ring->lock);
+
+	// the other side either sees sleeping set after it moves, or it moved before the check below
+	__atomic_add_fetch(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+
+	while (!ring_ready(ring, full)){
+		pthread_cond_wait(&ring->moved, &ring->lock);
+	}
+
+	__atomic_sub_fetch(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ring->lock);
+	trace_end();
+}
+
+void wake_ring(SpscRing ring)
+{
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST) > 0){
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(&ring->moved);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
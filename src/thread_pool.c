@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "headers/thread_pool.h"
+#include "headers/trace.h"
+
+typedef struct _thread_pool{
+    pthread_t *threads;
+    int num_workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+
+    // the tasks being run
+    ThreadTask task;
+    void *arg;
+    int num_tasks;
+    int next_task;
+    int tasks_done;
+
+    int shutdown;
+} thread_pool;
+
+// claims and runs tasks until none are left, called with the lock held
+void run_tasks(ThreadPool pool);
+
+// main loop of each worker thread
+void *worker_main(void *arg);
+
+ThreadPool create_thread_pool(int num_threads)
+{
+    ThreadPool pool = NULL;
+    int i = 0;
+
+    pool = calloc(1, sizeof(thread_pool));
+
+    if (pool != NULL){
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work_ready, NULL);
+        pthread_cond_init(&pool->work_done, NULL);
+
+        if (num_threads > 1){
+            pool->threads = malloc(sizeof(pthread_t) * (num_threads - 1));
+        }
+
+        // the pool still works if some (or all) of the workers can't be started
+        for (i = 0; pool->threads != NULL && i < num_threads - 1; i++){
+            if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0){
+                break;
+            }
+
+            pool->num_workers++;
+        }
+    }
+
+    return pool;
+}
+
+int thread_pool_size(ThreadPool pool)
+{
+    return pool->num_workers + 1;
+}
+
+void thread_pool_run(ThreadPool pool, ThreadTask task, void *arg, int num_tasks)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->task = task;
+    pool->arg = arg;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->tasks_done = 0;
+    pthread_cond_broadcast(&pool->work_ready);
+
+    run_tasks(pool);
+
+    // time the caller spends waiting for the slowest worker
+    trace_begin("wait", -1);
+
+    while (pool->tasks_done < pool->num_tasks){
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+
+    trace_end();
+
+    // nothing left for the workers to pick up
+    pool->num_tasks = pool->next_task = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void run_tasks(ThreadPool pool)
+{
+    int index = 0;
+
+    while (pool->next_task < pool->num_tasks){
+        index = pool->next_task++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, index);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->tasks_done++;
+        if (pool->tasks_done == pool->num_tasks){
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+}
+
+void *worker_main(void *arg)
+{
+    ThreadPool pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (!pool->shutdown){
+        if (pool->next_task < pool->num_tasks){
+            trace_thread_name("worker");
+            run_tasks(pool);
+        }
+
+        else{
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+void destroy_thread_pool(ThreadPool pool)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_workers; i++){
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,286 @@
+// clock_gettime and thread keys
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "headers/trace.h"
+
+// a finished span
+typedef struct _trace_event{
+	const char *name;
+	int index;
+	double start; // microseconds since start_trace
+	double duration;
+} TraceEvent;
+
+// the spans of one thread, only that thread writes to it
+typedef struct _trace_ring{
+	TraceEvent *events;
+	unsigned long written; // spans recorded so far, the next one goes at written % capacity
+	int tid;
+	const char *thread_name;
+	struct _trace_ring *next;
+} TraceRing;
+
+// what a thread keeps between the start and end of its spans
+typedef struct _trace_thread{
+	unsigned int session; // the trace the ring and open spans belong to
+	TraceRing *ring; // NULL until the thread ends its first span
+	int depth;
+	const char *open_name[JPG_TRACE_MAX_DEPTH];
+	int open_index[JPG_TRACE_MAX_DEPTH];
+	double open_start[JPG_TRACE_MAX_DEPTH];
+} TraceThread;
+
+static int trace_active = 0; // read by every span, changed with the lock held
+static unsigned int trace_session = 0;
+static int trace_capacity = 0;
+static int trace_num_threads = 0;
+static double trace_origin = 0.0;
+static TraceRing *trace_rings = NULL;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+// creates the key of the per thread state, freed when the thread exits (its ring is kept)
+void create_trace_key(void);
+
+// returns the state of the calling thread for the current trace, NULL if there's no memory
+TraceThread *trace_thread(void);
+
+// returns the ring of the calling thread, adding it to the trace the first time
+TraceRing *trace_ring(TraceThread *t);
+
+// microseconds of wall clock time since some fixed point
+double trace_now(void);
+
+// writes the spans of every ring as Chrome trace events
+int write_trace(const char *filename);
+
+/* ==================================== Function definitions ===================================== */
+
+int start_trace(int events_per_thread)
+{
+	if (events_per_thread <= 0){
+		return JPG_TRACE_FAILED_ALLOCATE_BUFFER;
+	}
+
+	pthread_once(&trace_key_once, create_trace_key);
+	pthread_mutex_lock(&trace_lock);
+
+	if (!trace_active){
+		__atomic_store_n(&trace_session, trace_session + 1, __ATOMIC_RELEASE);
+		trace_capacity = events_per_thread;
+		trace_num_threads = 0;
+		trace_origin = trace_now();
+		__atomic_store_n(&trace_active, 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return JPG_TRACE_SUCCESS;
+}
+
+int stop_trace(const char *filename)
+{
+	TraceRing *ring = NULL;
+	int error = JPG_TRACE_SUCCESS;
+
+	pthread_mutex_lock(&trace_lock);
+
+	if (!trace_active){
+		pthread_mutex_unlock(&trace_lock);
+		return JPG_TRACE_NOT_STARTED;
+	}
+
+	__atomic_store_n(&trace_active, 0, __ATOMIC_RELEASE);
+	error = write_trace(filename);
+
+	while (trace_rings != NULL){
+		ring = trace_rings;
+		trace_rings = ring->next;
+		free(ring->events);
+		free(ring);
+	}
+
+	pthread_mutex_unlock(&trace_lock);
+
+	return error;
+}
+
+void trace_begin(const char *name, int index)
+{
+	TraceThread *t = NULL;
+
+	if (!__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE) || (t = trace_thread()) == NULL){
+		return;
+	}
+
+	// spans that are too deep are counted so the ends still match up
+	if (t->depth < JPG_TRACE_MAX_DEPTH){
+		t->open_name[t->depth] = name;
+		t->open_index[t->depth] = index;
+		t->open_start[t->depth] = trace_now();
+	}
+
+	t->depth++;
+}
+
+void trace_end(void)
+{
+	TraceThread *t = NULL;
+	TraceRing *ring = NULL;
+	TraceEvent *e = NULL;
+	double now = 0.0;
+
+	if (!__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE) || (t = trace_thread()) == NULL || t->depth == 0){
+		return;
+	}
+
+	now = trace_now();
+	t->depth--;
+
+	if (t->depth >= JPG_TRACE_MAX_DEPTH || (ring = trace_ring(t)) == NULL){
+		return;
+	}
+
+	e = &ring->events[ring->written % trace_capacity];
+	e->name = t->open_name[t->depth];
+	e->index = t->open_index[t->depth];
+	e->start = t->open_start[t->depth] - trace_origin;
+	e->duration = now - t->open_start[t->depth];
+
+	// the span is complete before stop_trace can see it
+	__atomic_store_n(&ring->written, ring->written + 1, __ATOMIC_RELEASE);
+}
+
+void trace_thread_name(const char *name)
+{
+	TraceThread *t = NULL;
+	TraceRing *ring = NULL;
+
+	if (__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE) && (t = trace_thread()) != NULL && (ring = trace_ring(t)) != NULL){
+		ring->thread_name = name;
+	}
+}
+
+void create_trace_key(void)
+{
+	pthread_key_create(&trace_key, free);
+}
+
+TraceThread *trace_thread(void)
+{
+	TraceThread *t = pthread_getspecific(trace_key);
+
+	if (t == NULL){
+		t = calloc(1, sizeof(TraceThread));
+
+		if (t == NULL || pthread_setspecific(trace_key, t) != 0){
+			free(t);
+			return NULL;
+		}
+	}
+
+	// the ring of an earlier trace has been freed
+	if (t->session != __atomic_load_n(&trace_session, __ATOMIC_ACQUIRE)){
+		t->session = __atomic_load_n(&trace_session, __ATOMIC_ACQUIRE);
+		t->ring = NULL;
+		t->depth = 0;
+	}
+
+	return t;
+}
+
+TraceRing *trace_ring(TraceThread *t)
+{
+	TraceRing *ring = NULL;
+
+	if (t->ring != NULL){
+		return t->ring;
+	}
+
+	ring = calloc(1, sizeof(TraceRing));
+
+	if (ring != NULL){
+		ring->events = malloc(sizeof(TraceEvent) * trace_capacity);
+	}
+
+	if (ring == NULL || ring->events == NULL){
+		free(ring);
+		return NULL;
+	}
+
+	// the only lock a thread takes, once per trace
+	pthread_mutex_lock(&trace_lock);
+
+	if (!trace_active || t->session != trace_session){
+		pthread_mutex_unlock(&trace_lock);
+		free(ring->events);
+		free(ring);
+		return NULL;
+	}
+
+	ring->tid = ++trace_num_threads;
+	ring->next = trace_rings;
+	trace_rings = ring;
+
+	pthread_mutex_unlock(&trace_lock);
+
+	t->ring = ring;
+
+	return ring;
+}
+
+double trace_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+int write_trace(const char *filename)
+{
+	FILE *fp = fopen(filename, "w");
+	TraceRing *ring = NULL;
+	TraceEvent *e = NULL;
+	unsigned long written = 0, i = 0;
+	int first = 1;
+
+	if (fp == NULL){
+		return JPG_TRACE_WRITE_FAILED;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	for (ring = trace_rings; ring != NULL; ring = ring->next){
+		fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+		        first ? "" : ",\n", ring->tid, (ring->thread_name != NULL) ? ring->thread_name : "thread", ring->tid);
+		first = 0;
+
+		// oldest first, only the last trace_capacity spans are still there
+		written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+
+		for (i = (written > (unsigned long) trace_capacity) ? written - trace_capacity : 0; i < written; i++){
+			e = &ring->events[i % trace_capacity];
+
+			fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"jpeg\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+			        e->name, ring->tid, e->start, e->duration);
+
+			if (e->index >= 0){
+				fprintf(fp, ", \"args\": {\"index\": %d}", e->index);
+			}
+
+			fprintf(fp, "}");
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	return (fclose(fp) == 0) ? JPG_TRACE_SUCCESS : JPG_TRACE_WRITE_FAILED;
+}
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "headers/upsample.h"
+
+#ifdef JPG_X86_KERNELS
+#include <emmintrin.h>
+#endif
+
+// fixed point arithmetic, the SSE2 kernels need the constants to fit in 16 bits
+#define SCALEBITS 14
+#define ONE_HALF (1 << (SCALEBITS - 1))
+#define FIX(x) ((int) ((x) * (1 << SCALEBITS) + 0.5))
+
+#define C_R FIX(1.402)
+#define C_B FIX(1.772)
+#define C_G_CB (-FIX(0.344136))
+#define C_G_CR (-FIX(0.714136))
+
+// offset of 0 in the clamping table
+#define LIMIT_OFFSET 384
+
+// contribution of a chroma value to each channel
+static int cr_r_tab[256];
+static int cb_b_tab[256];
+static int cr_g_tab[256]; // scaled, added to cb_g_tab before shifting
+static int cb_g_tab[256];
+
+// clamps -384 - 639 to 0 - 255
+static Byte range_limit[1024];
+
+// stores a pixel in the given layout
+static void put_pixel(Byte r, Byte g, Byte b, Byte *out, int format);
+
+// converts a single pixel
+static void convert_pixel(int y, int cb, int cr, Byte *out, int format);
+
+
+void init_upsample(void)
+{
+    int i = 0, x = 0;
+
+    for (i = 0; i < 256; i++){
+        x = i - 128;
+        cr_r_tab[i] = (C_R * x + ONE_HALF) >> SCALEBITS;
+        cb_b_tab[i] = (C_B * x + ONE_HALF) >> SCALEBITS;
+        cr_g_tab[i] = C_G_CR * x;
+        cb_g_tab[i] = C_G_CB * x + ONE_HALF;
+    }
+
+    for (i = 0; i < 1024; i++){
+        x = i - LIMIT_OFFSET;
+        range_limit[i] = (x < 0) ? 0 : (x > 255) ? 255 : x;
+    }
+}
+
+int pixel_size(int format)
+{
+    return (format == JPG_PIXEL_BGRA) ? 4 : 3;
+}
+
+static void put_pixel(Byte r, Byte g, Byte b, Byte *out, int format)
+{
+    if (format == JPG_PIXEL_BGRA){
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        out[3] = 255;
+    }
+
+    else{
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+    }
+}
+
+static void convert_pixel(int y, int cb, int cr, Byte *out, int format)
+{
+    put_pixel(range_limit[ LIMIT_OFFSET + y + cr_r_tab[cr] ],
+              range_limit[ LIMIT_OFFSET + y + ((cb_g_tab[cb] + cr_g_tab[cr]) >> SCALEBITS) ],
+              range_limit[ LIMIT_OFFSET + y + cb_b_tab[cb] ],
+              out, format);
+}
+
+void ycc_to_rgb_row(const Byte *y, const Byte *cb, const Byte *cr, int phase, Byte *out, int width, int h_factor, int format)
+{
+    int x = 0, c = 0, size = 0;
+
+    size = pixel_size(format);
+
+    // finish the chroma sample the row starts part way through
+    while (phase > 0 && phase < h_factor && x < width){
+        convert_pixel(y[x], cb[0], cr[0], out + x * size, format);
+        phase++;
+        x++;
+    }
+
+    if (phase == h_factor){
+        cb++;
+        cr++;
+    }
+
+    if (h_factor == 1){
+        jpg_kernels()->ycc_to_rgb_row_h1(y + x, cb, cr, out + x * size, width - x, format);
+    }
+
+    else if (h_factor == 2){
+        jpg_kernels()->ycc_to_rgb_row_h2(y + x, cb, cr, out + x * size, width - x, format);
+    }
+
+    else{
+        for (c = 0; x < width; x++, c++){
+            convert_pixel(y[x], cb[c / h_factor], cr[c / h_factor], out + x * size, format);
+        }
+    }
+}
+
+void gray_to_rgb_row(const Byte *y, Byte *out, int width, int format)
+{
+    int x = 0;
+
+    if (format == JPG_PIXEL_BGRA){
+        for (x = 0; x < width; x++){
+            out[4*x] = out[4*x + 1] = out[4*x + 2] = y[x];
+            out[4*x + 3] = 255;
+        }
+    }
+
+    else{
+        for (x = 0; x < width; x++){
+            out[3*x] = out[3*x + 1] = out[3*x + 2] = y[x];
+        }
+    }
+}
+
+void ycc_to_rgb_row_h1_scalar(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format)
+{
+    int x = 0, size = 0;
+
+    size = pixel_size(format);
+
+    for (x = 0; x < width; x++){
+        convert_pixel(y[x], cb[x], cr[x], out + x * size, format);
+    }
+}
+
+void ycc_to_rgb_row_h2_scalar(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format)
+{
+    int x = 0, size = 0;
+    int red = 0, green = 0, blue = 0;
+
+    size = pixel_size(format);
+
+    // the chroma terms are looked up once for each pair of pixels
+    for (x = 0; x < width; x++){
+        if (x % 2 == 0){
+            red = cr_r_tab[ cr[x/2] ];
+            green = (cb_g_tab[ cb[x/2] ] + cr_g_tab[ cr[x/2] ]) >> SCALEBITS;
+            blue = cb_b_tab[ cb[x/2] ];
+        }
+
+        put_pixel(range_limit[LIMIT_OFFSET + y[x] + red], range_limit[LIMIT_OFFSET + y[x] + green],
+                  range_limit[LIMIT_OFFSET + y[x] + blue], out + x * size, format);
+    }
+}
+
+
+#ifdef JPG_X86_KERNELS
+
+/*
+    Computes the chroma terms of 8 pixels, cb and cr hold 16 bit samples minus 128.
+    The arithmetic matches the tables: (C * x + ONE_HALF) >> SCALEBITS
+*/
+__attribute__((target("sse2")))
+static void chroma_terms(__m128i cb, __m128i cr, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i k_r = _mm_set_epi16(C_R, 0, C_R, 0, C_R, 0, C_R, 0);
+    const __m128i k_g = _mm_set_epi16(C_G_CR, C_G_CB, C_G_CR, C_G_CB, C_G_CR, C_G_CB, C_G_CR, C_G_CB);
+    const __m128i k_b = _mm_set_epi16(0, C_B, 0, C_B, 0, C_B, 0, C_B);
+    const __m128i half = _mm_set1_epi32(ONE_HALF);
+    __m128i lo = _mm_unpacklo_epi16(cb, cr);
+    __m128i hi = _mm_unpackhi_epi16(cb, cr);
+
+    *r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k_r), half), SCALEBITS),
+                         _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k_r), half), SCALEBITS));
+    *g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k_g), half), SCALEBITS),
+                         _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k_g), half), SCALEBITS));
+    *b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, k_b), half), SCALEBITS),
+                         _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, k_b), half), SCALEBITS));
+}
+
+// writes 16 pixels held as planar R, G and B vectors
+__attribute__((target("sse2")))
+static void store_pixels(__m128i r, __m128i g, __m128i b, Byte *out, int format)
+{
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+    Byte rs[16], gs[16], bs[16];
+    __m128i bg = _mm_setzero_si128(), ra = _mm_setzero_si128();
+    int x = 0;
+
+    if (format == JPG_PIXEL_BGRA){
+        bg = _mm_unpacklo_epi8(b, g);
+        ra = _mm_unpacklo_epi8(r, alpha);
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi16(bg, ra));
+
+        bg = _mm_unpackhi_epi8(b, g);
+        ra = _mm_unpackhi_epi8(r, alpha);
+        _mm_storeu_si128((__m128i *) (out + 32), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i *) (out + 48), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    // SSE2 has no byte shuffle, so 3 byte pixels are interleaved one at a time
+    else{
+        _mm_storeu_si128((__m128i *) rs, r);
+        _mm_storeu_si128((__m128i *) gs, g);
+        _mm_storeu_si128((__m128i *) bs, b);
+
+        for (x = 0; x < 16; x++){
+            out[3*x] = rs[x];
+            out[3*x + 1] = gs[x];
+            out[3*x + 2] = bs[x];
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+void ycc_to_rgb_row_h1_sse2(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+    __m128i yv, cbv, crv, y_lo, y_hi;
+    __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+    int x = 0, size = 0;
+
+    size = pixel_size(format);
+
+    for (x = 0; x + 16 <= width; x += 16){
+        yv = _mm_loadu_si128((const __m128i *) (y + x));
+        cbv = _mm_loadu_si128((const __m128i *) (cb + x));
+        crv = _mm_loadu_si128((const __m128i *) (cr + x));
+
+        chroma_terms(_mm_sub_epi16(_mm_unpacklo_epi8(cbv, zero), c128), _mm_sub_epi16(_mm_unpacklo_epi8(crv, zero), c128), &r_lo, &g_lo, &b_lo);
+        chroma_terms(_mm_sub_epi16(_mm_unpackhi_epi8(cbv, zero), c128), _mm_sub_epi16(_mm_unpackhi_epi8(crv, zero), c128), &r_hi, &g_hi, &b_hi);
+
+        y_lo = _mm_unpacklo_epi8(yv, zero);
+        y_hi = _mm_unpackhi_epi8(yv, zero);
+
+        // saturating pack clamps to 0 - 255
+        store_pixels(_mm_packus_epi16(_mm_add_epi16(y_lo, r_lo), _mm_add_epi16(y_hi, r_hi)),
+                     _mm_packus_epi16(_mm_add_epi16(y_lo, g_lo), _mm_add_epi16(y_hi, g_hi)),
+                     _mm_packus_epi16(_mm_add_epi16(y_lo, b_lo), _mm_add_epi16(y_hi, b_hi)),
+                     out + x * size, format);
+    }
+
+    for (; x < width; x++){
+        convert_pixel(y[x], cb[x], cr[x], out + x * size, format);
+    }
+}
+
+__attribute__((target("sse2")))
+void ycc_to_rgb_row_h2_sse2(const Byte *y, const Byte *cb, const Byte *cr, Byte *out, int width, int format)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+    __m128i yv, y_lo, y_hi, r, g, b;
+    int x = 0, size = 0;
+
+    size = pixel_size(format);
+
+    // 8 chroma samples cover 16 pixels
+    for (x = 0; x + 16 <= width; x += 16){
+        chroma_terms(_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (cb + x/2)), zero), c128),
+                     _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (cr + x/2)), zero), c128),
+                     &r, &g, &b);
+
+        yv = _mm_loadu_si128((const __m128i *) (y + x));
+        y_lo = _mm_unpacklo_epi8(yv, zero);
+        y_hi = _mm_unpackhi_epi8(yv, zero);
+
+        // each chroma term is used by two neighbouring pixels
+        store_pixels(_mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(r, r)), _mm_add_epi16(y_hi, _mm_unpackhi_epi16(r, r))),
+                     _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(g, g)), _mm_add_epi16(y_hi, _mm_unpackhi_epi16(g, g))),
+                     _mm_packus_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(b, b)), _mm_add_epi16(y_hi, _mm_unpackhi_epi16(b, b))),
+                     out + x * size, format);
+    }
+
+    for (; x < width; x++){
+        convert_pixel(y[x], cb[x/2], cr[x/2], out + x * size, format);
+    }
+}
+
+#endif
@@ -18,37 +18,70 @@ void zig_zag(JpgData j_data)
 {
     int i = 0;
 
-    printf("Performing zig zag ordering:\n");
+    log_message(j_data, JPG_LOG_INFO, "Performing zig zag ordering");
 
     // construct the zig zag data structures
+    allocate_zig_zag(j_data);
+
+    // perform zig zag encoding on all blocks, flat blocks only have a DC coefficient (the rest are
+    // left at 0 from allocate_zig_zag)
+    for (i = 0; i < j_data->num_blocks_Y; i++){
+        if (IS_FLAT(j_data->flat_Y, i)){
+            j_data->zig_zag_Y[i][0] = (int) get_value_block(j_data->Y[i], 0, 0);
+        }
+
+        else{
+            zig_zag_block(j_data->Y[i], j_data->zig_zag_Y[i]);
+        }
+    }
+
+    for (i = 0; i < j_data->num_blocks_Cb; i++){
+        if (IS_FLAT(j_data->flat_Cb, i)){
+            j_data->zig_zag_Cb[i][0] = (int) get_value_block(j_data->Cb[i], 0, 0);
+        }
+
+        else{
+            zig_zag_block(j_data->Cb[i], j_data->zig_zag_Cb[i]);
+        }
+    }
+
+    for (i = 0; i < j_data->num_blocks_Cr; i++){
+        if (IS_FLAT(j_data->flat_Cr, i)){
+            j_data->zig_zag_Cr[i][0] = (int) get_value_block(j_data->Cr[i], 0, 0);
+        }
+
+        else{
+            zig_zag_block(j_data->Cr[i], j_data->zig_zag_Cr[i]);
+        }
+    }
+}
+
+void allocate_zig_zag(JpgData j_data)
+{
+    int i = 0;
+
+    if (j_data->zig_zag_Y != NULL){
+        return;
+    }
+
     j_data->zig_zag_Y = malloc(sizeof(int *) * j_data->num_blocks_Y);
     j_data->zig_zag_Cb = malloc(sizeof(int *) * j_data->num_blocks_Cb);
     j_data->zig_zag_Cr = malloc(sizeof(int *) * j_data->num_blocks_Cr);
 
     for (i = 0; i < j_data->num_blocks_Y; i++){
         j_data->zig_zag_Y[i] = calloc(64, sizeof(int));
-        j_data->zig_zag_Cb[i] = calloc(64, sizeof(int));
-        j_data->zig_zag_Cr[i] = calloc(64, sizeof(int));
-    }
-
-    // perform zig zag encoding on all blocks
-    for (i = 0; i < j_data->num_blocks_Y; i++){
-        zig_zag_block(j_data->Y[i], j_data->zig_zag_Y[i]);
     }
 
     for (i = 0; i < j_data->num_blocks_Cb; i++){
-        zig_zag_block(j_data->Cb[i], j_data->zig_zag_Cb[i]);
+        j_data->zig_zag_Cb[i] = calloc(64, sizeof(int));
+        j_data->zig_zag_Cr[i] = calloc(64, sizeof(int));
     }
 
-    for (i = 0; i < j_data->num_blocks_Cr; i++){
-        zig_zag_block(j_data->Cr[i], j_data->zig_zag_Cr[i]);
-    }
+    j_data->allocations += 3 + j_data->num_blocks_Y + j_data->num_blocks_Cb + j_data->num_blocks_Cr;
 }
 
 void zig_zag_block(Block b, int *zz)
 {
-    printf("Zig zag ordering block:\n");
-
     int i = 0, j = 0;
 
     for (i = 0; i < 8; i++){